@@ -0,0 +1,869 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * nc_loadgen - a closed loop, pipelined redis load generator.
+ *
+ * Each of the clients connections sends a batch of pipeline requests,
+ * waits for all of their replies and sends the next batch, until the
+ * requests of the test are issued. The latency of a request is the time
+ * from writing its batch to reading its reply, and goes to a log-linear
+ * histogram like the one of nc_histogram.h. For each test the throughput,
+ * the latency percentiles and the error replies are reported, either as
+ * text or as one csv line per test.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define LG_SUB_BITS         5
+#define LG_SUB_COUNT        (1 << LG_SUB_BITS)
+#define LG_HALF_COUNT       (LG_SUB_COUNT >> 1)
+#define LG_MAX_BITS         30
+#define LG_MAX_VALUE        ((1ULL << LG_MAX_BITS) - 1)
+#define LG_NBUCKET          ((LG_MAX_BITS - LG_SUB_BITS + 2) * LG_HALF_COUNT)
+
+#define LG_KEY_LEN          32
+#define LG_READ_SIZE        (64 * 1024)
+
+struct histo {
+    uint64_t count;
+    uint64_t max;
+    uint64_t bucket[LG_NBUCKET];
+};
+
+struct buf {
+    char   *data;
+    size_t len;
+    size_t size;
+};
+
+struct client {
+    int        fd;
+    struct buf wbuf;
+    size_t     wpos;
+    struct buf rbuf;
+    size_t     rpos;
+    int        outstanding;     /* # replies pending in the batch */
+    int64_t    sent;            /* batch write start in usec */
+};
+
+struct test {
+    const char *name;
+    int        nkey;            /* # keys per request */
+    void       (*build)(struct buf *b, int nkey);
+};
+
+static struct {
+    char          *host;
+    char          *port;
+    int           nclient;
+    int           pipeline;
+    uint64_t      nrequest;
+    int           datasize;
+    uint32_t      keyspace;
+    int           nkey;
+    int           csv;
+    char          *prefix;
+    char          *tests;
+    char          *value;
+    uint32_t      rand;
+    struct client *client;
+    struct histo  histo;
+    uint64_t      nerror;
+} lg;
+
+static struct option long_options[] = {
+    { "help",      no_argument,       NULL, 'h' },
+    { "csv",       no_argument,       NULL, 'C' },
+    { "host",      required_argument, NULL, 's' },
+    { "port",      required_argument, NULL, 'p' },
+    { "clients",   required_argument, NULL, 'c' },
+    { "pipeline",  required_argument, NULL, 'P' },
+    { "requests",  required_argument, NULL, 'n' },
+    { "datasize",  required_argument, NULL, 'd' },
+    { "keyspace",  required_argument, NULL, 'r' },
+    { "keys",      required_argument, NULL, 'k' },
+    { "prefix",    required_argument, NULL, 'x' },
+    { "tests",     required_argument, NULL, 't' },
+    { NULL,        0,                 NULL,  0  }
+};
+
+static char short_options[] = "hCs:p:c:P:n:d:r:k:x:t:";
+
+static void
+lg_show_usage(void)
+{
+    fprintf(stderr,
+        "Usage: nc_loadgen [-hC] [-s host] [-p port] [-c clients] [-P pipeline]" "\n"
+        "                  [-n requests] [-d datasize] [-r keyspace] [-k keys]" "\n"
+        "                  [-x prefix] [-t tests]" "\n"
+        "" "\n"
+        "Options:" "\n"
+        "  -h, --help             : this help" "\n"
+        "  -C, --csv              : one csv line per test" "\n"
+        "  -s, --host=S           : server host (default: 127.0.0.1)" "\n"
+        "  -p, --port=S           : server port (default: 22121)" "\n"
+        "  -c, --clients=N        : # connections (default: 50)" "\n"
+        "  -P, --pipeline=N       : # requests in flight per connection (default: 1)" "\n"
+        "  -n, --requests=N       : # requests per test (default: 100000)" "\n"
+        "  -d, --datasize=N       : value size in bytes (default: 16)" "\n"
+        "  -r, --keyspace=N       : # distinct keys (default: 100000)" "\n"
+        "  -k, --keys=N           : # keys of mget, mset and hmget (default: 10)" "\n"
+        "  -x, --prefix=S         : key prefix (default: key:)" "\n"
+        "  -t, --tests=S          : comma separated tests among ping, set, get," "\n"
+        "                           mset, mget, hset, hget, hmget, incr" "\n"
+        "                           (default: set,get,mset,mget)" "\n"
+        "");
+}
+
+static int64_t
+lg_usec_now(void)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+
+    return (int64_t)now.tv_sec * 1000000LL + (int64_t)now.tv_usec;
+}
+
+static void
+buf_reserve(struct buf *b, size_t n)
+{
+    size_t size;
+
+    if (b->len + n <= b->size) {
+        return;
+    }
+
+    for (size = b->size == 0 ? 4096 : b->size; size < b->len + n; size *= 2) {
+        /* nothing */
+    }
+
+    b->data = realloc(b->data, size);
+    if (b->data == NULL) {
+        fprintf(stderr, "nc_loadgen: out of memory\n");
+        exit(1);
+    }
+    b->size = size;
+}
+
+static void
+buf_append(struct buf *b, const char *data, size_t n)
+{
+    buf_reserve(b, n);
+    memcpy(b->data + b->len, data, n);
+    b->len += n;
+}
+
+static void
+buf_printf(struct buf *b, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
+
+static void
+buf_printf(struct buf *b, const char *fmt, ...)
+{
+    va_list args;
+    int n;
+
+    for (;;) {
+        size_t avail = b->size - b->len;
+
+        va_start(args, fmt);
+        n = vsnprintf(b->data + b->len, avail, fmt, args);
+        va_end(args);
+
+        if (n >= 0 && (size_t)n < avail) {
+            b->len += (size_t)n;
+            return;
+        }
+        buf_reserve(b, (size_t)n + 1);
+    }
+}
+
+/*
+ * Latency histogram, with the bucket layout of nc_histogram.c
+ */
+
+static uint32_t
+histo_index(uint64_t value)
+{
+    uint32_t shift;
+
+    if (value < LG_SUB_COUNT) {
+        return (uint32_t)value;
+    }
+
+    if (value > LG_MAX_VALUE) {
+        value = LG_MAX_VALUE;
+    }
+
+    shift = (uint32_t)(63 - __builtin_clzll(value)) - (LG_SUB_BITS - 1);
+
+    return shift * LG_HALF_COUNT + (uint32_t)(value >> shift);
+}
+
+/* highest value that maps into bucket idx */
+static uint64_t
+histo_bucket_value(uint32_t idx)
+{
+    uint32_t shift;
+    uint64_t low;
+
+    if (idx < LG_SUB_COUNT) {
+        return idx;
+    }
+
+    shift = idx / LG_HALF_COUNT - 1;
+    low = (uint64_t)(idx - shift * LG_HALF_COUNT) << shift;
+
+    return low + (1ULL << shift) - 1;
+}
+
+static void
+histo_record(struct histo *h, uint64_t v)
+{
+    h->bucket[histo_index(v)]++;
+    h->count++;
+    if (v > h->max) {
+        h->max = v;
+    }
+}
+
+static uint64_t
+histo_percentile(const struct histo *h, double q)
+{
+    uint64_t rank, seen = 0;
+    uint32_t i;
+
+    if (h->count == 0) {
+        return 0;
+    }
+
+    rank = (uint64_t)(q * (double)h->count + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    for (i = 0; i < LG_NBUCKET; i++) {
+        seen += h->bucket[i];
+        if (seen >= rank) {
+            uint64_t v = histo_bucket_value(i);
+
+            return v < h->max ? v : h->max;
+        }
+    }
+
+    return h->max;
+}
+
+/*
+ * Requests
+ */
+
+static uint32_t
+lg_random(void)
+{
+    uint32_t x = lg.rand;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    lg.rand = x;
+
+    return x;
+}
+
+static void
+add_key(struct buf *b)
+{
+    char key[LG_KEY_LEN + 64];
+    int n;
+
+    n = snprintf(key, sizeof(key), "%s%010u", lg.prefix,
+                 lg_random() % lg.keyspace);
+    buf_printf(b, "$%d\r\n%s\r\n", n, key);
+}
+
+static void
+add_value(struct buf *b)
+{
+    buf_printf(b, "$%d\r\n", lg.datasize);
+    buf_append(b, lg.value, (size_t)lg.datasize);
+    buf_append(b, "\r\n", 2);
+}
+
+static void
+add_field(struct buf *b, int i)
+{
+    char field[16];
+    int n;
+
+    n = snprintf(field, sizeof(field), "f%d", i);
+    buf_printf(b, "$%d\r\n%s\r\n", n, field);
+}
+
+static void
+build_ping(struct buf *b, int nkey)
+{
+    buf_append(b, "*1\r\n$4\r\nPING\r\n", 14);
+}
+
+static void
+build_set(struct buf *b, int nkey)
+{
+    buf_append(b, "*3\r\n$3\r\nSET\r\n", 13);
+    add_key(b);
+    add_value(b);
+}
+
+static void
+build_get(struct buf *b, int nkey)
+{
+    buf_append(b, "*2\r\n$3\r\nGET\r\n", 13);
+    add_key(b);
+}
+
+static void
+build_incr(struct buf *b, int nkey)
+{
+    char key[LG_KEY_LEN + 64];
+    int n;
+
+    /* counters live apart from the string values */
+    buf_append(b, "*2\r\n$4\r\nINCR\r\n", 14);
+    n = snprintf(key, sizeof(key), "%scounter:%010u", lg.prefix,
+                 lg_random() % lg.keyspace);
+    buf_printf(b, "$%d\r\n%s\r\n", n, key);
+}
+
+static void
+build_mset(struct buf *b, int nkey)
+{
+    int i;
+
+    buf_printf(b, "*%d\r\n$4\r\nMSET\r\n", 1 + 2 * nkey);
+    for (i = 0; i < nkey; i++) {
+        add_key(b);
+        add_value(b);
+    }
+}
+
+static void
+build_mget(struct buf *b, int nkey)
+{
+    int i;
+
+    buf_printf(b, "*%d\r\n$4\r\nMGET\r\n", 1 + nkey);
+    for (i = 0; i < nkey; i++) {
+        add_key(b);
+    }
+}
+
+static void
+add_hash_key(struct buf *b)
+{
+    char key[LG_KEY_LEN + 64];
+    int n;
+
+    n = snprintf(key, sizeof(key), "%shash:%010u", lg.prefix,
+                 lg_random() % lg.keyspace);
+    buf_printf(b, "$%d\r\n%s\r\n", n, key);
+}
+
+static void
+build_hset(struct buf *b, int nkey)
+{
+    buf_append(b, "*4\r\n$4\r\nHSET\r\n", 14);
+    add_hash_key(b);
+    add_field(b, (int)(lg_random() % (uint32_t)nkey));
+    add_value(b);
+}
+
+static void
+build_hget(struct buf *b, int nkey)
+{
+    buf_append(b, "*3\r\n$4\r\nHGET\r\n", 14);
+    add_hash_key(b);
+    add_field(b, (int)(lg_random() % (uint32_t)nkey));
+}
+
+static void
+build_hmget(struct buf *b, int nkey)
+{
+    int i;
+
+    buf_printf(b, "*%d\r\n$5\r\nHMGET\r\n", 2 + nkey);
+    add_hash_key(b);
+    for (i = 0; i < nkey; i++) {
+        add_field(b, i);
+    }
+}
+
+static struct test tests[] = {
+    { "ping",  0, build_ping },
+    { "set",   0, build_set },
+    { "get",   0, build_get },
+    { "incr",  0, build_incr },
+    { "mset",  1, build_mset },
+    { "mget",  1, build_mget },
+    { "hset",  1, build_hset },
+    { "hget",  1, build_hget },
+    { "hmget", 1, build_hmget },
+};
+
+/*
+ * Skip one reply at p; return the # bytes it takes, 0 when it is not
+ * complete and -1 on a protocol error
+ */
+static long
+reply_skip(char *p, char *end, int *error)
+{
+    char *cr, *q;
+    long n, len, i, nskip;
+
+    cr = memchr(p, '\r', (size_t)(end - p));
+    if (cr == NULL || cr + 1 >= end) {
+        return 0;
+    }
+    q = cr + 2;
+
+    switch (*p) {
+    case '-':
+        *error = 1;
+        /* fall through */
+    case '+':
+    case ':':
+        return q - p;
+
+    case '$':
+        len = strtol(p + 1, NULL, 10);
+        if (len < 0) {
+            return q - p;
+        }
+        if (end - q < len + 2) {
+            return 0;
+        }
+        return q + len + 2 - p;
+
+    case '*':
+        n = strtol(p + 1, NULL, 10);
+        for (i = 0; i < n; i++) {
+            int ignore = 0;
+
+            nskip = reply_skip(q, end, &ignore);
+            if (nskip <= 0) {
+                return nskip;
+            }
+            q += nskip;
+            if (q >= end && i + 1 < n) {
+                return 0;
+            }
+        }
+        return q - p;
+
+    default:
+        return -1;
+    }
+}
+
+static int
+client_connect(struct client *c)
+{
+    struct addrinfo hints, *ai;
+    int status, one = 1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    status = getaddrinfo(lg.host, lg.port, &hints, &ai);
+    if (status != 0) {
+        fprintf(stderr, "nc_loadgen: resolve '%s:%s' failed: %s\n", lg.host,
+                lg.port, gai_strerror(status));
+        return -1;
+    }
+
+    c->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (c->fd < 0 || connect(c->fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+        fprintf(stderr, "nc_loadgen: connect to '%s:%s' failed: %s\n",
+                lg.host, lg.port, strerror(errno));
+        freeaddrinfo(ai);
+        return -1;
+    }
+    freeaddrinfo(ai);
+
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+
+    return 0;
+}
+
+/* queue the next batch; return the # requests in it */
+static int
+client_batch(struct client *c, struct test *t, uint64_t *nissued)
+{
+    int n;
+
+    c->wbuf.len = 0;
+    c->wpos = 0;
+
+    for (n = 0; n < lg.pipeline && *nissued < lg.nrequest; n++) {
+        t->build(&c->wbuf, lg.nkey);
+        (*nissued)++;
+    }
+
+    c->outstanding = n;
+    c->sent = lg_usec_now();
+
+    return n;
+}
+
+/* return -1 on failure */
+static int
+client_write(struct client *c)
+{
+    ssize_t n;
+
+    while (c->wpos < c->wbuf.len) {
+        n = write(c->fd, c->wbuf.data + c->wpos, c->wbuf.len - c->wpos);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                return 0;
+            }
+            fprintf(stderr, "nc_loadgen: write failed: %s\n", strerror(errno));
+            return -1;
+        }
+        c->wpos += (size_t)n;
+    }
+
+    return 0;
+}
+
+/* return -1 on failure */
+static int
+client_read(struct client *c)
+{
+    char *p, *end;
+    ssize_t n;
+    long nskip;
+    int64_t now;
+
+    buf_reserve(&c->rbuf, LG_READ_SIZE);
+    n = read(c->fd, c->rbuf.data + c->rbuf.len, c->rbuf.size - c->rbuf.len);
+    if (n == 0) {
+        fprintf(stderr, "nc_loadgen: connection closed by server\n");
+        return -1;
+    }
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EINTR) {
+            return 0;
+        }
+        fprintf(stderr, "nc_loadgen: read failed: %s\n", strerror(errno));
+        return -1;
+    }
+    c->rbuf.len += (size_t)n;
+
+    now = lg_usec_now();
+    p = c->rbuf.data + c->rpos;
+    end = c->rbuf.data + c->rbuf.len;
+
+    while (p < end && c->outstanding > 0) {
+        int error = 0;
+
+        nskip = reply_skip(p, end, &error);
+        if (nskip < 0) {
+            fprintf(stderr, "nc_loadgen: protocol error in reply\n");
+            return -1;
+        }
+        if (nskip == 0) {
+            break;
+        }
+
+        histo_record(&lg.histo, (uint64_t)(now - c->sent));
+        lg.nerror += (uint64_t)error;
+        c->outstanding--;
+        p += nskip;
+    }
+
+    c->rpos = 0;
+    c->rbuf.len = (size_t)(end - p);
+    memmove(c->rbuf.data, p, c->rbuf.len);
+
+    return 0;
+}
+
+static int
+run_test(struct test *t, struct pollfd *pfd)
+{
+    uint64_t nissued = 0;
+    int64_t start, elapsed;
+    int i, nactive = 0;
+    char name[64];
+
+    memset(&lg.histo, 0, sizeof(lg.histo));
+    lg.nerror = 0;
+
+    start = lg_usec_now();
+
+    for (i = 0; i < lg.nclient; i++) {
+        if (client_batch(&lg.client[i], t, &nissued) > 0) {
+            nactive++;
+        }
+    }
+
+    while (nactive > 0) {
+        for (i = 0; i < lg.nclient; i++) {
+            struct client *c = &lg.client[i];
+
+            pfd[i].fd = c->outstanding > 0 ? c->fd : -1;
+            pfd[i].events = POLLIN;
+            if (c->wpos < c->wbuf.len) {
+                pfd[i].events |= POLLOUT;
+            }
+        }
+
+        if (poll(pfd, (nfds_t)lg.nclient, 1000) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "nc_loadgen: poll failed: %s\n", strerror(errno));
+            return -1;
+        }
+
+        for (i = 0; i < lg.nclient; i++) {
+            struct client *c = &lg.client[i];
+
+            if (c->outstanding == 0) {
+                continue;
+            }
+
+            if (client_write(c) < 0) {
+                return -1;
+            }
+            if ((pfd[i].revents & (POLLIN | POLLERR | POLLHUP)) &&
+                client_read(c) < 0) {
+                return -1;
+            }
+
+            if (c->outstanding == 0 && client_batch(c, t, &nissued) == 0) {
+                nactive--;
+            }
+        }
+    }
+
+    elapsed = lg_usec_now() - start;
+    if (elapsed <= 0) {
+        elapsed = 1;
+    }
+
+    if (t->nkey) {
+        snprintf(name, sizeof(name), "%s_%d", t->name, lg.nkey);
+    } else {
+        snprintf(name, sizeof(name), "%s", t->name);
+    }
+
+    if (lg.csv) {
+        printf("%s,%d,%d,%"PRIu64",%"PRIu64",%.3f,%.2f,%"PRIu64",%"PRIu64","
+               "%"PRIu64",%"PRIu64",%"PRIu64"\n", name, lg.nclient,
+               lg.pipeline, lg.histo.count, lg.nerror, (double)elapsed / 1e6,
+               (double)lg.histo.count * 1e6 / (double)elapsed,
+               histo_percentile(&lg.histo, 0.50),
+               histo_percentile(&lg.histo, 0.90),
+               histo_percentile(&lg.histo, 0.99),
+               histo_percentile(&lg.histo, 0.999), lg.histo.max);
+    } else {
+        printf("%-10s %10.2f req/s  p50 %6"PRIu64" us  p90 %6"PRIu64" us  "
+               "p99 %6"PRIu64" us  p99.9 %6"PRIu64" us  max %6"PRIu64" us  "
+               "errors %"PRIu64"\n", name,
+               (double)lg.histo.count * 1e6 / (double)elapsed,
+               histo_percentile(&lg.histo, 0.50),
+               histo_percentile(&lg.histo, 0.90),
+               histo_percentile(&lg.histo, 0.99),
+               histo_percentile(&lg.histo, 0.999), lg.histo.max,
+               lg.nerror);
+    }
+    fflush(stdout);
+
+    return 0;
+}
+
+static struct test *
+find_test(const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        if (strcmp(tests[i].name, name) == 0) {
+            return &tests[i];
+        }
+    }
+
+    return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct pollfd *pfd;
+    char *name, *save;
+    int c, i, status = 0;
+
+    lg.host = "127.0.0.1";
+    lg.port = "22121";
+    lg.nclient = 50;
+    lg.pipeline = 1;
+    lg.nrequest = 100000;
+    lg.datasize = 16;
+    lg.keyspace = 100000;
+    lg.nkey = 10;
+    lg.prefix = "key:";
+    lg.tests = NULL;
+    lg.rand = (uint32_t)lg_usec_now() | 1;
+
+    for (;;) {
+        c = getopt_long(argc, argv, short_options, long_options, NULL);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+        case 'h':
+            lg_show_usage();
+            exit(0);
+
+        case 'C':
+            lg.csv = 1;
+            break;
+
+        case 's':
+            lg.host = optarg;
+            break;
+
+        case 'p':
+            lg.port = optarg;
+            break;
+
+        case 'c':
+            lg.nclient = atoi(optarg);
+            break;
+
+        case 'P':
+            lg.pipeline = atoi(optarg);
+            break;
+
+        case 'n':
+            lg.nrequest = strtoull(optarg, NULL, 10);
+            break;
+
+        case 'd':
+            lg.datasize = atoi(optarg);
+            break;
+
+        case 'r':
+            lg.keyspace = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+
+        case 'k':
+            lg.nkey = atoi(optarg);
+            break;
+
+        case 'x':
+            lg.prefix = optarg;
+            break;
+
+        case 't':
+            lg.tests = strdup(optarg);
+            break;
+
+        default:
+            lg_show_usage();
+            exit(1);
+        }
+    }
+
+    if (lg.nclient <= 0 || lg.pipeline <= 0 || lg.nrequest == 0 ||
+        lg.datasize < 0 || lg.keyspace == 0 || lg.nkey <= 0 ||
+        strlen(lg.prefix) > LG_KEY_LEN) {
+        lg_show_usage();
+        exit(1);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if (lg.tests == NULL) {
+        lg.tests = strdup("set,get,mset,mget");
+    }
+    lg.value = malloc((size_t)lg.datasize + 1);
+    lg.client = calloc((size_t)lg.nclient, sizeof(*lg.client));
+    pfd = calloc((size_t)lg.nclient, sizeof(*pfd));
+    if (lg.tests == NULL || lg.value == NULL || lg.client == NULL ||
+        pfd == NULL) {
+        fprintf(stderr, "nc_loadgen: out of memory\n");
+        exit(1);
+    }
+    memset(lg.value, 'x', (size_t)lg.datasize);
+
+    for (i = 0; i < lg.nclient; i++) {
+        if (client_connect(&lg.client[i]) < 0) {
+            exit(1);
+        }
+    }
+
+    if (lg.csv) {
+        printf("test,clients,pipeline,requests,errors,seconds,rps,"
+               "p50_us,p90_us,p99_us,p999_us,max_us\n");
+    }
+
+    for (name = strtok_r(lg.tests, ",", &save); name != NULL && status == 0;
+         name = strtok_r(NULL, ",", &save)) {
+        struct test *t = find_test(name);
+
+        if (t == NULL) {
+            fprintf(stderr, "nc_loadgen: unknown test '%s'\n", name);
+            status = -1;
+            break;
+        }
+        status = run_test(t, pfd);
+    }
+
+    for (i = 0; i < lg.nclient; i++) {
+        close(lg.client[i].fd);
+        free(lg.client[i].wbuf.data);
+        free(lg.client[i].rbuf.data);
+    }
+    free(lg.client);
+    free(lg.tests);
+    free(lg.value);
+    free(pfd);
+
+    return status == 0 ? 0 : 1;
+}
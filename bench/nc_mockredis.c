@@ -0,0 +1,1517 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * nc_mockredis - a single process stand-in for a redis cluster, used to
+ * benchmark nutcracker without a live cluster.
+ *
+ * It listens on masters * (1 + replicas) consecutive ports; the first
+ * masters ports are the masters and the rest their replicas. All nodes
+ * share one in-memory keyspace of strings and hashes, so a request gives
+ * the same answer whichever node it lands on and no MOVED / ASK is ever
+ * returned. CLUSTER NODES, CLUSTER NODES EXTRA (the format parsed by
+ * lua/redis.lua) and CLUSTER SLOTS describe the emulated topology, with
+ * the 16384 slots split evenly across the masters.
+ *
+ * Every command can be given a fixed service latency; replies on a
+ * connection are still sent in request order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define MOCK_NSLOT          16384
+#define MOCK_MAX_NODE       256
+#define MOCK_MAX_LATENCY    64
+#define MOCK_MAX_ARGC       (1024 * 1024)
+#define MOCK_MAX_BULK       (512 * 1024 * 1024)
+#define MOCK_READ_SIZE      (16 * 1024)
+#define MOCK_ID_LEN         40
+
+#define MOCK_TYPE_STRING    0
+#define MOCK_TYPE_HASH      1
+
+struct buf {
+    char   *data;
+    size_t len;
+    size_t size;
+};
+
+struct entry {
+    struct entry *next;
+    uint32_t     hash;
+    int          type;
+    size_t       klen;
+    size_t       vlen;
+    char         *key;
+    char         *val;              /* string value */
+    struct dict  *fields;           /* hash value */
+};
+
+struct dict {
+    struct entry **bucket;
+    size_t       nbucket;
+    size_t       nentry;
+};
+
+struct delayed {
+    struct delayed *next;
+    int64_t        due;             /* send time in usec */
+    size_t         len;
+    char           data[1];
+};
+
+struct conn {
+    int            fd;
+    int            node;            /* node index of the listener */
+    int            closing;
+    struct buf     rbuf;
+    size_t         rpos;
+    struct buf     wbuf;
+    size_t         wpos;
+    struct delayed *head;           /* replies waiting for their latency */
+    struct delayed *tail;
+};
+
+struct latency {
+    char    name[32];               /* lower case command, or "*" */
+    int64_t usec;
+};
+
+struct arg {
+    char   *data;
+    size_t len;
+};
+
+static struct {
+    char           *addr;
+    int            port;
+    int            nmaster;
+    int            nreplica;
+    int            nnode;
+    char           *zone;
+    int            verbose;
+    struct latency latency[MOCK_MAX_LATENCY];
+    int            nlatency;
+    int            listen_fd[MOCK_MAX_NODE];
+    struct conn    **conn;
+    int            nconn;
+    int            maxconn;
+    struct dict    db;
+    struct arg     *argv;
+    int            maxargc;
+    uint64_t       ncommand;
+} mock;
+
+static volatile sig_atomic_t mock_quit;
+
+static struct option long_options[] = {
+    { "help",     no_argument,       NULL, 'h' },
+    { "verbose",  no_argument,       NULL, 'v' },
+    { "addr",     required_argument, NULL, 'a' },
+    { "port",     required_argument, NULL, 'p' },
+    { "masters",  required_argument, NULL, 'm' },
+    { "replicas", required_argument, NULL, 'r' },
+    { "zone",     required_argument, NULL, 'z' },
+    { "latency",  required_argument, NULL, 'l' },
+    { NULL,       0,                 NULL,  0  }
+};
+
+static char short_options[] = "hva:p:m:r:z:l:";
+
+static void
+mock_show_usage(void)
+{
+    fprintf(stderr,
+        "Usage: nc_mockredis [-hv] [-a addr] [-p port] [-m masters]" "\n"
+        "                    [-r replicas] [-z zone] [-l command=usec]" "\n"
+        "" "\n"
+        "Options:" "\n"
+        "  -h, --help             : this help" "\n"
+        "  -v, --verbose          : log connections" "\n"
+        "  -a, --addr=S           : listening address (default: 127.0.0.1)" "\n"
+        "  -p, --port=N           : first listening port (default: 7000)" "\n"
+        "  -m, --masters=N        : number of masters (default: 3)" "\n"
+        "  -r, --replicas=N       : number of replicas per master (default: 1)" "\n"
+        "  -z, --zone=S           : zone in cluster nodes extra (default: tc)" "\n"
+        "  -l, --latency=S=N      : reply to command S after N usec; S may be" "\n"
+        "                           '*' for every command, repeatable" "\n"
+        "");
+}
+
+static int64_t
+mock_usec_now(void)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+
+    return (int64_t)now.tv_sec * 1000000LL + (int64_t)now.tv_usec;
+}
+
+static void *
+mock_alloc(size_t size)
+{
+    void *p = malloc(size);
+
+    if (p == NULL) {
+        fprintf(stderr, "nc_mockredis: out of memory\n");
+        exit(1);
+    }
+
+    return p;
+}
+
+static void *
+mock_zalloc(size_t size)
+{
+    void *p = mock_alloc(size);
+
+    memset(p, 0, size);
+
+    return p;
+}
+
+static void
+buf_reserve(struct buf *b, size_t n)
+{
+    size_t size;
+
+    if (b->len + n <= b->size) {
+        return;
+    }
+
+    for (size = b->size == 0 ? 4096 : b->size; size < b->len + n; size *= 2) {
+        /* nothing */
+    }
+
+    b->data = realloc(b->data, size);
+    if (b->data == NULL) {
+        fprintf(stderr, "nc_mockredis: out of memory\n");
+        exit(1);
+    }
+    b->size = size;
+}
+
+static void
+buf_append(struct buf *b, const char *data, size_t n)
+{
+    buf_reserve(b, n);
+    memcpy(b->data + b->len, data, n);
+    b->len += n;
+}
+
+static void
+buf_printf(struct buf *b, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
+
+static void
+buf_printf(struct buf *b, const char *fmt, ...)
+{
+    va_list args;
+    int n;
+
+    for (;;) {
+        size_t avail = b->size - b->len;
+
+        va_start(args, fmt);
+        n = vsnprintf(b->data + b->len, avail, fmt, args);
+        va_end(args);
+
+        if (n >= 0 && (size_t)n < avail) {
+            b->len += (size_t)n;
+            return;
+        }
+        buf_reserve(b, (size_t)n + 1);
+    }
+}
+
+/*
+ * Keyspace
+ */
+
+static uint32_t
+dict_hash(const char *key, size_t len)
+{
+    uint32_t hash = 2166136261UL;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= (uint8_t)key[i];
+        hash *= 16777619;
+    }
+
+    return hash;
+}
+
+static void
+dict_init(struct dict *d, size_t nbucket)
+{
+    d->nbucket = nbucket;
+    d->nentry = 0;
+    d->bucket = mock_zalloc(d->nbucket * sizeof(*d->bucket));
+}
+
+static struct dict *
+dict_create(void)
+{
+    struct dict *d = mock_alloc(sizeof(*d));
+
+    dict_init(d, 8);
+
+    return d;
+}
+
+static void
+entry_free(struct entry *e);
+
+static void
+dict_destroy(struct dict *d, int free_self)
+{
+    size_t i;
+
+    for (i = 0; i < d->nbucket; i++) {
+        struct entry *e = d->bucket[i], *next;
+
+        for (; e != NULL; e = next) {
+            next = e->next;
+            entry_free(e);
+        }
+    }
+    free(d->bucket);
+
+    if (free_self) {
+        free(d);
+    }
+}
+
+static void
+entry_free(struct entry *e)
+{
+    if (e->fields != NULL) {
+        dict_destroy(e->fields, 1);
+    }
+    free(e->key);
+    free(e->val);
+    free(e);
+}
+
+static void
+dict_grow(struct dict *d)
+{
+    struct entry **bucket;
+    size_t i, nbucket = d->nbucket * 2;
+
+    bucket = mock_zalloc(nbucket * sizeof(*bucket));
+    for (i = 0; i < d->nbucket; i++) {
+        struct entry *e = d->bucket[i], *next;
+
+        for (; e != NULL; e = next) {
+            next = e->next;
+            e->next = bucket[e->hash & (nbucket - 1)];
+            bucket[e->hash & (nbucket - 1)] = e;
+        }
+    }
+
+    free(d->bucket);
+    d->bucket = bucket;
+    d->nbucket = nbucket;
+}
+
+static struct entry **
+dict_find(struct dict *d, const char *key, size_t len, uint32_t hash)
+{
+    struct entry **e;
+
+    for (e = &d->bucket[hash & (d->nbucket - 1)]; *e != NULL; e = &(*e)->next) {
+        if ((*e)->hash == hash && (*e)->klen == len &&
+            memcmp((*e)->key, key, len) == 0) {
+            break;
+        }
+    }
+
+    return e;
+}
+
+static struct entry *
+dict_get(struct dict *d, struct arg *key)
+{
+    return *dict_find(d, key->data, key->len, dict_hash(key->data, key->len));
+}
+
+/* return the entry of key, adding an empty one of type when missing */
+static struct entry *
+dict_add(struct dict *d, struct arg *key, int type, int *added)
+{
+    uint32_t hash = dict_hash(key->data, key->len);
+    struct entry **pe, *e;
+
+    pe = dict_find(d, key->data, key->len, hash);
+    if (*pe != NULL) {
+        *added = 0;
+        return *pe;
+    }
+
+    e = mock_zalloc(sizeof(*e));
+    e->hash = hash;
+    e->type = type;
+    e->klen = key->len;
+    e->key = mock_alloc(key->len + 1);
+    memcpy(e->key, key->data, key->len);
+    if (type == MOCK_TYPE_HASH) {
+        e->fields = dict_create();
+    }
+    *pe = e;
+    d->nentry++;
+
+    if (d->nentry > d->nbucket) {
+        dict_grow(d);
+    }
+
+    *added = 1;
+    return e;
+}
+
+static int
+dict_del(struct dict *d, struct arg *key)
+{
+    struct entry **pe, *e;
+
+    pe = dict_find(d, key->data, key->len, dict_hash(key->data, key->len));
+    if (*pe == NULL) {
+        return 0;
+    }
+
+    e = *pe;
+    *pe = e->next;
+    d->nentry--;
+    entry_free(e);
+
+    return 1;
+}
+
+static void
+entry_set_val(struct entry *e, struct arg *val)
+{
+    if (e->vlen < val->len || e->val == NULL) {
+        free(e->val);
+        e->val = mock_alloc(val->len + 1);
+    }
+    memcpy(e->val, val->data, val->len);
+    e->vlen = val->len;
+}
+
+/*
+ * Replies
+ */
+
+static void
+reply_status(struct buf *r, const char *status)
+{
+    buf_printf(r, "+%s\r\n", status);
+}
+
+static void
+reply_error(struct buf *r, const char *error)
+{
+    buf_printf(r, "-%s\r\n", error);
+}
+
+static void
+reply_int(struct buf *r, int64_t n)
+{
+    buf_printf(r, ":%lld\r\n", (long long)n);
+}
+
+static void
+reply_bulk(struct buf *r, const char *data, size_t len)
+{
+    buf_printf(r, "$%zu\r\n", len);
+    buf_append(r, data, len);
+    buf_append(r, "\r\n", 2);
+}
+
+static void
+reply_nil(struct buf *r)
+{
+    buf_append(r, "$-1\r\n", 5);
+}
+
+static void
+reply_array(struct buf *r, size_t n)
+{
+    buf_printf(r, "*%zu\r\n", n);
+}
+
+static void
+reply_wrongtype(struct buf *r)
+{
+    reply_error(r, "WRONGTYPE Operation against a key holding the wrong kind "
+                "of value");
+}
+
+static void
+reply_arity(struct buf *r, struct arg *cmd)
+{
+    buf_printf(r, "-ERR wrong number of arguments for '%.*s' command\r\n",
+               (int)cmd->len, cmd->data);
+}
+
+/*
+ * Cluster topology
+ */
+
+static void
+node_id(int node, char *id)
+{
+    snprintf(id, MOCK_ID_LEN + 1, "%040x", node + 1);
+}
+
+static int
+node_master(int node)
+{
+    return node < mock.nmaster ? node : (node - mock.nmaster) / mock.nreplica;
+}
+
+static void
+master_slots(int master, int *first, int *last)
+{
+    *first = master * MOCK_NSLOT / mock.nmaster;
+    *last = (master + 1) * MOCK_NSLOT / mock.nmaster - 1;
+}
+
+/*
+ * Lines of "cluster nodes extra":
+ *   <rw> <region:zone:room> <id> <ip:port> <flags> <master id> <ping> <pong>
+ *   <epoch> <link state> <slots>...
+ * or, without extra, the format of redis "cluster nodes"
+ */
+static void
+cluster_nodes(struct buf *r, int self, int extra)
+{
+    struct buf body = { NULL, 0, 0 };
+    char id[MOCK_ID_LEN + 1], master_id[MOCK_ID_LEN + 1];
+    int node;
+
+    for (node = 0; node < mock.nnode; node++) {
+        int master = node < mock.nmaster;
+        int first, last;
+
+        node_id(node, id);
+        if (master) {
+            strcpy(master_id, "-");
+        } else {
+            node_id(node_master(node), master_id);
+        }
+
+        if (extra) {
+            buf_printf(&body, "%s bj:%s:%s01 %s %s:%d %s%s %s 0 0 %d "
+                       "connected", master ? "rw" : "r", mock.zone,
+                       mock.zone, id, mock.addr, mock.port + node,
+                       node == self ? "myself," : "",
+                       master ? "master" : "slave", master_id,
+                       node_master(node) + 1);
+        } else {
+            buf_printf(&body, "%s %s:%d@%d %s%s %s 0 0 %d connected", id,
+                       mock.addr, mock.port + node, mock.port + node + 10000,
+                       node == self ? "myself," : "",
+                       master ? "master" : "slave", master_id,
+                       node_master(node) + 1);
+        }
+
+        if (master) {
+            master_slots(node, &first, &last);
+            buf_printf(&body, " %d-%d", first, last);
+        }
+        buf_append(&body, "\n", 1);
+    }
+
+    reply_bulk(r, body.data, body.len);
+    free(body.data);
+}
+
+static void
+cluster_slots(struct buf *r)
+{
+    char id[MOCK_ID_LEN + 1];
+    int master, replica;
+
+    reply_array(r, (size_t)mock.nmaster);
+    for (master = 0; master < mock.nmaster; master++) {
+        int first, last;
+
+        master_slots(master, &first, &last);
+        reply_array(r, 2 + 1 + (size_t)mock.nreplica);
+        reply_int(r, first);
+        reply_int(r, last);
+
+        node_id(master, id);
+        reply_array(r, 3);
+        reply_bulk(r, mock.addr, strlen(mock.addr));
+        reply_int(r, mock.port + master);
+        reply_bulk(r, id, MOCK_ID_LEN);
+
+        for (replica = 0; replica < mock.nreplica; replica++) {
+            int node = mock.nmaster + master * mock.nreplica + replica;
+
+            node_id(node, id);
+            reply_array(r, 3);
+            reply_bulk(r, mock.addr, strlen(mock.addr));
+            reply_int(r, mock.port + node);
+            reply_bulk(r, id, MOCK_ID_LEN);
+        }
+    }
+}
+
+/*
+ * Commands
+ */
+
+static int
+arg_is(struct arg *a, const char *name)
+{
+    return a->len == strlen(name) && strncasecmp(a->data, name, a->len) == 0;
+}
+
+static struct entry *
+lookup_type(struct arg *key, int type, struct buf *r)
+{
+    struct entry *e = dict_get(&mock.db, key);
+
+    if (e != NULL && e->type != type) {
+        reply_wrongtype(r);
+        return NULL;
+    }
+
+    return e;
+}
+
+static void
+cmd_get(struct arg *argv, struct buf *r)
+{
+    struct entry *e = dict_get(&mock.db, &argv[1]);
+
+    if (e == NULL) {
+        reply_nil(r);
+    } else if (e->type != MOCK_TYPE_STRING) {
+        reply_wrongtype(r);
+    } else {
+        reply_bulk(r, e->val, e->vlen);
+    }
+}
+
+static void
+cmd_set(struct arg *key, struct arg *val)
+{
+    struct entry *e;
+    int added;
+
+    e = dict_add(&mock.db, key, MOCK_TYPE_STRING, &added);
+    if (e->type != MOCK_TYPE_STRING) {
+        dict_del(&mock.db, key);
+        e = dict_add(&mock.db, key, MOCK_TYPE_STRING, &added);
+    }
+    entry_set_val(e, val);
+}
+
+static void
+cmd_mget(int argc, struct arg *argv, struct buf *r)
+{
+    int i;
+
+    reply_array(r, (size_t)argc - 1);
+    for (i = 1; i < argc; i++) {
+        struct entry *e = dict_get(&mock.db, &argv[i]);
+
+        if (e == NULL || e->type != MOCK_TYPE_STRING) {
+            reply_nil(r);
+        } else {
+            reply_bulk(r, e->val, e->vlen);
+        }
+    }
+}
+
+static void
+cmd_incr(struct arg *argv, struct buf *r)
+{
+    struct entry *e;
+    struct arg val;
+    char num[32], *end;
+    long long n = 0;
+    int added;
+
+    e = lookup_type(&argv[1], MOCK_TYPE_STRING, r);
+    if (e == NULL && dict_get(&mock.db, &argv[1]) != NULL) {
+        return;
+    }
+
+    if (e != NULL) {
+        if (e->vlen == 0 || e->vlen >= sizeof(num)) {
+            reply_error(r, "ERR value is not an integer or out of range");
+            return;
+        }
+        memcpy(num, e->val, e->vlen);
+        num[e->vlen] = '\0';
+        n = strtoll(num, &end, 10);
+        if (*end != '\0') {
+            reply_error(r, "ERR value is not an integer or out of range");
+            return;
+        }
+    }
+
+    n++;
+    val.len = (size_t)snprintf(num, sizeof(num), "%lld", n);
+    val.data = num;
+    e = dict_add(&mock.db, &argv[1], MOCK_TYPE_STRING, &added);
+    entry_set_val(e, &val);
+    reply_int(r, n);
+}
+
+static void
+cmd_hset(int argc, struct arg *argv, struct buf *r, int status)
+{
+    struct entry *e, *f;
+    int i, added, nadded = 0;
+
+    if (lookup_type(&argv[1], MOCK_TYPE_HASH, r) == NULL &&
+        dict_get(&mock.db, &argv[1]) != NULL) {
+        return;
+    }
+
+    e = dict_add(&mock.db, &argv[1], MOCK_TYPE_HASH, &added);
+    for (i = 2; i + 1 < argc; i += 2) {
+        f = dict_add(e->fields, &argv[i], MOCK_TYPE_STRING, &added);
+        entry_set_val(f, &argv[i + 1]);
+        nadded += added;
+    }
+
+    if (status) {
+        reply_status(r, "OK");
+    } else {
+        reply_int(r, nadded);
+    }
+}
+
+static void
+cmd_hget(int argc, struct arg *argv, struct buf *r, int multi)
+{
+    struct entry *e, *f;
+    int i;
+
+    e = lookup_type(&argv[1], MOCK_TYPE_HASH, r);
+    if (e == NULL && dict_get(&mock.db, &argv[1]) != NULL) {
+        return;
+    }
+
+    if (multi) {
+        reply_array(r, (size_t)argc - 2);
+    }
+    for (i = 2; i < argc; i++) {
+        f = e != NULL ? dict_get(e->fields, &argv[i]) : NULL;
+        if (f == NULL) {
+            reply_nil(r);
+        } else {
+            reply_bulk(r, f->val, f->vlen);
+        }
+    }
+}
+
+static void
+cmd_hgetall(struct arg *argv, struct buf *r)
+{
+    struct entry *e, *f;
+    size_t i;
+
+    e = lookup_type(&argv[1], MOCK_TYPE_HASH, r);
+    if (e == NULL) {
+        if (dict_get(&mock.db, &argv[1]) == NULL) {
+            reply_array(r, 0);
+        }
+        return;
+    }
+
+    reply_array(r, 2 * e->fields->nentry);
+    for (i = 0; i < e->fields->nbucket; i++) {
+        for (f = e->fields->bucket[i]; f != NULL; f = f->next) {
+            reply_bulk(r, f->key, f->klen);
+            reply_bulk(r, f->val, f->vlen);
+        }
+    }
+}
+
+static void
+cmd_hdel(int argc, struct arg *argv, struct buf *r)
+{
+    struct entry *e;
+    int i, n = 0;
+
+    e = lookup_type(&argv[1], MOCK_TYPE_HASH, r);
+    if (e == NULL) {
+        if (dict_get(&mock.db, &argv[1]) == NULL) {
+            reply_int(r, 0);
+        }
+        return;
+    }
+
+    for (i = 2; i < argc; i++) {
+        n += dict_del(e->fields, &argv[i]);
+    }
+    if (e->fields->nentry == 0) {
+        dict_del(&mock.db, &argv[1]);
+    }
+
+    reply_int(r, n);
+}
+
+static void
+cmd_info(struct buf *r)
+{
+    struct buf body = { NULL, 0, 0 };
+
+    buf_printf(&body, "# Server\r\nredis_version:3.0.0\r\nredis_mode:cluster\r\n"
+               "# Stats\r\ntotal_commands_processed:%llu\r\n"
+               "# Keyspace\r\ndb0:keys=%zu,expires=0\r\n",
+               (unsigned long long)mock.ncommand, mock.db.nentry);
+    reply_bulk(r, body.data, body.len);
+    free(body.data);
+}
+
+static void
+cmd_cluster(int argc, struct arg *argv, struct buf *r, int self)
+{
+    if (argc >= 2 && arg_is(&argv[1], "nodes")) {
+        cluster_nodes(r, self, argc >= 3 && arg_is(&argv[2], "extra"));
+    } else if (argc == 2 && arg_is(&argv[1], "slots")) {
+        cluster_slots(r);
+    } else if (argc == 2 && arg_is(&argv[1], "info")) {
+        struct buf body = { NULL, 0, 0 };
+
+        buf_printf(&body, "cluster_state:ok\r\ncluster_slots_assigned:%d\r\n"
+                   "cluster_known_nodes:%d\r\ncluster_size:%d\r\n",
+                   MOCK_NSLOT, mock.nnode, mock.nmaster);
+        reply_bulk(r, body.data, body.len);
+        free(body.data);
+    } else {
+        reply_error(r, "ERR unsupported CLUSTER subcommand");
+    }
+}
+
+/* run one command; return -1 when the connection is to be closed */
+static int
+command_run(struct conn *c, int argc, struct arg *argv, struct buf *r)
+{
+    struct arg *cmd = &argv[0];
+    int i, n;
+
+    mock.ncommand++;
+
+    if (arg_is(cmd, "get")) {
+        if (argc != 2) {
+            goto arity;
+        }
+        cmd_get(argv, r);
+    } else if (arg_is(cmd, "set")) {
+        if (argc < 3) {
+            goto arity;
+        }
+        cmd_set(&argv[1], &argv[2]);
+        reply_status(r, "OK");
+    } else if (arg_is(cmd, "mget")) {
+        if (argc < 2) {
+            goto arity;
+        }
+        cmd_mget(argc, argv, r);
+    } else if (arg_is(cmd, "mset")) {
+        if (argc < 3 || argc % 2 == 0) {
+            goto arity;
+        }
+        for (i = 1; i < argc; i += 2) {
+            cmd_set(&argv[i], &argv[i + 1]);
+        }
+        reply_status(r, "OK");
+    } else if (arg_is(cmd, "del") || arg_is(cmd, "exists")) {
+        int del = arg_is(cmd, "del");
+
+        if (argc < 2) {
+            goto arity;
+        }
+        for (n = 0, i = 1; i < argc; i++) {
+            n += del ? dict_del(&mock.db, &argv[i]) :
+                       dict_get(&mock.db, &argv[i]) != NULL;
+        }
+        reply_int(r, n);
+    } else if (arg_is(cmd, "incr")) {
+        if (argc != 2) {
+            goto arity;
+        }
+        cmd_incr(argv, r);
+    } else if (arg_is(cmd, "hset") || arg_is(cmd, "hmset")) {
+        if (argc < 4 || argc % 2 != 0) {
+            goto arity;
+        }
+        cmd_hset(argc, argv, r, arg_is(cmd, "hmset"));
+    } else if (arg_is(cmd, "hget")) {
+        if (argc != 3) {
+            goto arity;
+        }
+        cmd_hget(argc, argv, r, 0);
+    } else if (arg_is(cmd, "hmget")) {
+        if (argc < 3) {
+            goto arity;
+        }
+        cmd_hget(argc, argv, r, 1);
+    } else if (arg_is(cmd, "hgetall")) {
+        if (argc != 2) {
+            goto arity;
+        }
+        cmd_hgetall(argv, r);
+    } else if (arg_is(cmd, "hdel")) {
+        if (argc < 3) {
+            goto arity;
+        }
+        cmd_hdel(argc, argv, r);
+    } else if (arg_is(cmd, "ping")) {
+        if (argc > 1) {
+            reply_bulk(r, argv[1].data, argv[1].len);
+        } else {
+            reply_status(r, "PONG");
+        }
+    } else if (arg_is(cmd, "cluster")) {
+        cmd_cluster(argc, argv, r, c->node);
+    } else if (arg_is(cmd, "info")) {
+        cmd_info(r);
+    } else if (arg_is(cmd, "dbsize")) {
+        reply_int(r, (int64_t)mock.db.nentry);
+    } else if (arg_is(cmd, "flushall") || arg_is(cmd, "flushdb")) {
+        dict_destroy(&mock.db, 0);
+        dict_init(&mock.db, 1024);
+        reply_status(r, "OK");
+    } else if (arg_is(cmd, "command")) {
+        reply_array(r, 0);
+    } else if (arg_is(cmd, "select") || arg_is(cmd, "auth") ||
+               arg_is(cmd, "asking") || arg_is(cmd, "readonly") ||
+               arg_is(cmd, "readwrite")) {
+        reply_status(r, "OK");
+    } else if (arg_is(cmd, "quit")) {
+        reply_status(r, "OK");
+        return -1;
+    } else {
+        buf_printf(r, "-ERR unknown command '%.*s'\r\n", (int)cmd->len,
+                   cmd->data);
+    }
+
+    return 0;
+
+arity:
+    reply_arity(r, cmd);
+    return 0;
+}
+
+static int64_t
+command_latency(struct arg *cmd)
+{
+    int64_t usec = 0;
+    int i;
+
+    for (i = 0; i < mock.nlatency; i++) {
+        struct latency *l = &mock.latency[i];
+
+        if (l->name[0] == '*' && l->name[1] == '\0') {
+            usec = l->usec;
+        } else if (arg_is(cmd, l->name)) {
+            return l->usec;
+        }
+    }
+
+    return usec;
+}
+
+/*
+ * Request parsing; args point into the connection read buffer
+ */
+
+static int
+parse_num(char *p, char *end, long *n, char **line_end)
+{
+    char *cr, *e;
+
+    cr = memchr(p, '\r', (size_t)(end - p));
+    if (cr == NULL || cr + 1 >= end) {
+        return 0;
+    }
+    if (cr[1] != '\n') {
+        return -1;
+    }
+
+    *n = strtol(p, &e, 10);
+    if (e != cr) {
+        return -1;
+    }
+    *line_end = cr + 2;
+
+    return 1;
+}
+
+static void
+args_reserve(int argc)
+{
+    if (argc <= mock.maxargc) {
+        return;
+    }
+
+    free(mock.argv);
+    mock.maxargc = argc;
+    mock.argv = mock_alloc((size_t)argc * sizeof(*mock.argv));
+}
+
+/*
+ * Parse one request at p; return 1 with argc set when complete, 0 when
+ * more data is needed and -1 on a protocol error
+ */
+static int
+parse_request(char *p, char *end, int *argc, char **next)
+{
+    long n, len;
+    int i, status;
+
+    if (p[0] != '*') {
+        /* inline command, handy with telnet */
+        char *nl = memchr(p, '\n', (size_t)(end - p)), *q, *e;
+
+        if (nl == NULL) {
+            return 0;
+        }
+        e = nl > p && nl[-1] == '\r' ? nl - 1 : nl;
+        args_reserve((int)(e - p) / 2 + 1);
+        for (*argc = 0, q = p; q < e;) {
+            while (q < e && *q == ' ') {
+                q++;
+            }
+            if (q == e) {
+                break;
+            }
+            mock.argv[*argc].data = q;
+            while (q < e && *q != ' ') {
+                q++;
+            }
+            mock.argv[*argc].len = (size_t)(q - mock.argv[*argc].data);
+            (*argc)++;
+        }
+        *next = nl + 1;
+        return 1;
+    }
+
+    status = parse_num(p + 1, end, &n, &p);
+    if (status <= 0) {
+        return status;
+    }
+    if (n <= 0 || n > MOCK_MAX_ARGC) {
+        return -1;
+    }
+    args_reserve((int)n);
+
+    for (i = 0; i < n; i++) {
+        if (p >= end) {
+            return 0;
+        }
+        if (*p != '$') {
+            return -1;
+        }
+        status = parse_num(p + 1, end, &len, &p);
+        if (status <= 0) {
+            return status;
+        }
+        if (len < 0 || len > MOCK_MAX_BULK) {
+            return -1;
+        }
+        if (end - p < len + 2) {
+            return 0;
+        }
+        mock.argv[i].data = p;
+        mock.argv[i].len = (size_t)len;
+        p += len + 2;
+    }
+
+    *argc = (int)n;
+    *next = p;
+
+    return 1;
+}
+
+/*
+ * Connections
+ */
+
+static void
+conn_queue(struct conn *c, struct buf *r, int64_t usec, int64_t now)
+{
+    struct delayed *d;
+
+    if (usec == 0 && c->head == NULL) {
+        buf_append(&c->wbuf, r->data, r->len);
+        return;
+    }
+
+    d = mock_alloc(sizeof(*d) + r->len);
+    d->next = NULL;
+    d->due = now + usec;
+    if (c->tail != NULL && c->tail->due > d->due) {
+        /* never overtake an earlier reply */
+        d->due = c->tail->due;
+    }
+    d->len = r->len;
+    memcpy(d->data, r->data, r->len);
+
+    if (c->tail == NULL) {
+        c->head = d;
+    } else {
+        c->tail->next = d;
+    }
+    c->tail = d;
+}
+
+static void
+conn_release(struct conn *c, int64_t now)
+{
+    while (c->head != NULL && c->head->due <= now) {
+        struct delayed *d = c->head;
+
+        buf_append(&c->wbuf, d->data, d->len);
+        c->head = d->next;
+        if (c->head == NULL) {
+            c->tail = NULL;
+        }
+        free(d);
+    }
+}
+
+static void
+conn_close(int idx)
+{
+    struct conn *c = mock.conn[idx];
+
+    if (mock.verbose) {
+        fprintf(stderr, "nc_mockredis: close c %d on port %d\n", c->fd,
+                mock.port + c->node);
+    }
+
+    close(c->fd);
+    while (c->head != NULL) {
+        struct delayed *d = c->head;
+
+        c->head = d->next;
+        free(d);
+    }
+    free(c->rbuf.data);
+    free(c->wbuf.data);
+    free(c);
+
+    mock.conn[idx] = mock.conn[--mock.nconn];
+}
+
+static void
+conn_accept(int node)
+{
+    struct conn *c;
+    int fd, one = 1;
+
+    for (;;) {
+        fd = accept(mock.listen_fd[node], NULL, NULL);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                fprintf(stderr, "nc_mockredis: accept failed: %s\n",
+                        strerror(errno));
+            }
+            return;
+        }
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        if (mock.nconn == mock.maxconn) {
+            mock.maxconn = mock.maxconn == 0 ? 64 : mock.maxconn * 2;
+            mock.conn = realloc(mock.conn, (size_t)mock.maxconn *
+                                sizeof(*mock.conn));
+            if (mock.conn == NULL) {
+                fprintf(stderr, "nc_mockredis: out of memory\n");
+                exit(1);
+            }
+        }
+
+        c = mock_zalloc(sizeof(*c));
+        c->fd = fd;
+        c->node = node;
+        mock.conn[mock.nconn++] = c;
+
+        if (mock.verbose) {
+            fprintf(stderr, "nc_mockredis: accepted c %d on port %d\n", fd,
+                    mock.port + node);
+        }
+    }
+}
+
+/* return -1 when the connection is to be closed */
+static int
+conn_read(struct conn *c, struct buf *r)
+{
+    char *p, *end, *next;
+    ssize_t n;
+    int64_t now;
+    int argc, status;
+
+    buf_reserve(&c->rbuf, MOCK_READ_SIZE);
+    n = read(c->fd, c->rbuf.data + c->rbuf.len, c->rbuf.size - c->rbuf.len);
+    if (n == 0) {
+        return -1;
+    }
+    if (n < 0) {
+        return errno == EAGAIN || errno == EINTR ? 0 : -1;
+    }
+    c->rbuf.len += (size_t)n;
+
+    now = mock.nlatency > 0 ? mock_usec_now() : 0;
+    p = c->rbuf.data + c->rpos;
+    end = c->rbuf.data + c->rbuf.len;
+
+    while (p < end && !c->closing) {
+        status = parse_request(p, end, &argc, &next);
+        if (status < 0) {
+            reply_error(&c->wbuf, "ERR Protocol error");
+            c->closing = 1;
+            break;
+        }
+        if (status == 0) {
+            break;
+        }
+
+        if (argc > 0) {
+            r->len = 0;
+            if (command_run(c, argc, mock.argv, r) < 0) {
+                c->closing = 1;
+            }
+            conn_queue(c, r, command_latency(&mock.argv[0]), now);
+        }
+        p = next;
+    }
+
+    /* keep the partial request at the start of the buffer */
+    c->rpos = 0;
+    c->rbuf.len = (size_t)(end - p);
+    memmove(c->rbuf.data, p, c->rbuf.len);
+
+    return 0;
+}
+
+/* return -1 when the connection is to be closed */
+static int
+conn_write(struct conn *c)
+{
+    ssize_t n;
+
+    while (c->wpos < c->wbuf.len) {
+        n = write(c->fd, c->wbuf.data + c->wpos, c->wbuf.len - c->wpos);
+        if (n < 0) {
+            return errno == EAGAIN || errno == EINTR ? 0 : -1;
+        }
+        c->wpos += (size_t)n;
+    }
+
+    c->wpos = 0;
+    c->wbuf.len = 0;
+
+    return c->closing && c->head == NULL ? -1 : 0;
+}
+
+static int
+mock_listen(int node)
+{
+    struct sockaddr_in sin;
+    int fd, one = 1;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons((uint16_t)(mock.port + node));
+    if (inet_pton(AF_INET, mock.addr, &sin.sin_addr) != 1) {
+        fprintf(stderr, "nc_mockredis: invalid address '%s'\n", mock.addr);
+        return -1;
+    }
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        fprintf(stderr, "nc_mockredis: socket failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+        listen(fd, 512) < 0) {
+        fprintf(stderr, "nc_mockredis: listen on %s:%d failed: %s\n",
+                mock.addr, mock.port + node, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    mock.listen_fd[node] = fd;
+
+    return 0;
+}
+
+static void
+mock_signal(int signo)
+{
+    (void)signo;
+    mock_quit = 1;
+}
+
+static int
+mock_timeout(int64_t now)
+{
+    int64_t due = -1;
+    int i;
+
+    for (i = 0; i < mock.nconn; i++) {
+        struct conn *c = mock.conn[i];
+
+        if (c->head != NULL && (due < 0 || c->head->due < due)) {
+            due = c->head->due;
+        }
+    }
+
+    if (due < 0) {
+        return 1000;
+    }
+
+    return due <= now ? 0 : (int)((due - now + 999) / 1000);
+}
+
+static void
+mock_loop(void)
+{
+    struct pollfd *pfd = NULL;
+    struct buf reply = { NULL, 0, 0 };
+    int npfd = 0, i, n;
+
+    while (!mock_quit) {
+        int64_t now = mock_usec_now();
+
+        if (npfd < mock.nnode + mock.nconn) {
+            npfd = (mock.nnode + mock.nconn) * 2;
+            pfd = realloc(pfd, (size_t)npfd * sizeof(*pfd));
+            if (pfd == NULL) {
+                fprintf(stderr, "nc_mockredis: out of memory\n");
+                exit(1);
+            }
+        }
+
+        for (i = 0; i < mock.nnode; i++) {
+            pfd[i].fd = mock.listen_fd[i];
+            pfd[i].events = POLLIN;
+        }
+        for (i = 0; i < mock.nconn; i++) {
+            struct conn *c = mock.conn[i];
+
+            conn_release(c, now);
+            pfd[mock.nnode + i].fd = c->fd;
+            pfd[mock.nnode + i].events = POLLIN;
+            if (c->wbuf.len > 0) {
+                pfd[mock.nnode + i].events |= POLLOUT;
+            }
+        }
+
+        n = poll(pfd, (nfds_t)(mock.nnode + mock.nconn), mock_timeout(now));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "nc_mockredis: poll failed: %s\n",
+                    strerror(errno));
+            break;
+        }
+
+        /* walk backwards, as closing moves the last connection into idx */
+        for (i = mock.nconn - 1; i >= 0; i--) {
+            struct conn *c = mock.conn[i];
+            short revents = pfd[mock.nnode + i].revents;
+            int status = 0;
+
+            if (revents & (POLLIN | POLLERR | POLLHUP)) {
+                status = conn_read(c, &reply);
+            }
+            if (status == 0 && (c->wbuf.len > 0 || c->closing)) {
+                status = conn_write(c);
+            }
+            if (status < 0) {
+                conn_close(i);
+            }
+        }
+
+        for (i = 0; i < mock.nnode; i++) {
+            if (pfd[i].revents & POLLIN) {
+                conn_accept(i);
+            }
+        }
+    }
+
+    free(pfd);
+    free(reply.data);
+}
+
+static int
+mock_add_latency(char *spec)
+{
+    struct latency *l;
+    char *eq = strchr(spec, '=');
+    size_t i, len;
+
+    if (eq == NULL || eq == spec || mock.nlatency == MOCK_MAX_LATENCY) {
+        return -1;
+    }
+
+    len = (size_t)(eq - spec);
+    l = &mock.latency[mock.nlatency];
+    if (len >= sizeof(l->name)) {
+        return -1;
+    }
+    for (i = 0; i < len; i++) {
+        l->name[i] = (char)tolower((unsigned char)spec[i]);
+    }
+    l->name[len] = '\0';
+    l->usec = atoll(eq + 1);
+    if (l->usec < 0) {
+        return -1;
+    }
+
+    mock.nlatency++;
+
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    int c, node;
+
+    mock.addr = "127.0.0.1";
+    mock.port = 7000;
+    mock.nmaster = 3;
+    mock.nreplica = 1;
+    mock.zone = "tc";
+
+    for (;;) {
+        c = getopt_long(argc, argv, short_options, long_options, NULL);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+        case 'h':
+            mock_show_usage();
+            exit(0);
+
+        case 'v':
+            mock.verbose = 1;
+            break;
+
+        case 'a':
+            mock.addr = optarg;
+            break;
+
+        case 'p':
+            mock.port = atoi(optarg);
+            break;
+
+        case 'm':
+            mock.nmaster = atoi(optarg);
+            break;
+
+        case 'r':
+            mock.nreplica = atoi(optarg);
+            break;
+
+        case 'z':
+            mock.zone = optarg;
+            break;
+
+        case 'l':
+            if (mock_add_latency(optarg) < 0) {
+                fprintf(stderr, "nc_mockredis: invalid latency '%s'\n",
+                        optarg);
+                exit(1);
+            }
+            break;
+
+        default:
+            mock_show_usage();
+            exit(1);
+        }
+    }
+
+    mock.nnode = mock.nmaster * (1 + mock.nreplica);
+    if (mock.nmaster <= 0 || mock.nreplica < 0 ||
+        mock.nnode > MOCK_MAX_NODE || mock.port <= 0 ||
+        mock.port + mock.nnode > 65535) {
+        fprintf(stderr, "nc_mockredis: invalid topology, at most %d nodes\n",
+                MOCK_MAX_NODE);
+        exit(1);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, mock_signal);
+    signal(SIGTERM, mock_signal);
+
+    dict_init(&mock.db, 1024);
+
+    for (node = 0; node < mock.nnode; node++) {
+        if (mock_listen(node) < 0) {
+            exit(1);
+        }
+    }
+
+    fprintf(stderr, "nc_mockredis: %d masters, %d replicas each, on %s:%d-%d\n",
+            mock.nmaster, mock.nreplica, mock.addr, mock.port,
+            mock.port + mock.nnode - 1);
+
+    mock_loop();
+
+    for (node = 0; node < mock.nnode; node++) {
+        close(mock.listen_fd[node]);
+    }
+    while (mock.nconn > 0) {
+        conn_close(mock.nconn - 1);
+    }
+    dict_destroy(&mock.db, 0);
+    free(mock.conn);
+    free(mock.argv);
+
+    return 0;
+}
@@ -0,0 +1,867 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * nc_replay - play back a capture file of nutcracker --capture-file.
+ *
+ * Every captured client connection gets a connection of its own to the
+ * pool it was captured on, and its requests are sent over it in the
+ * captured order. Requests are sent at their captured time, divided by
+ * the speedup (-x), or as fast as the connections take them with -x 0.
+ * Replies are read and discarded; on redis pools they are counted, so
+ * that the replay ends once all of them arrived, and error replies are
+ * reported. Memcache pools end after -w msec without a reply.
+ *
+ * A pool is replayed to the listen address it was captured with, unless
+ * -a sends every pool to one address or -m pool=address sends one pool
+ * elsewhere. -P replays one pool only.
+ *
+ * The file layout is described in src/nc_capture.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+/* as in src/nc_capture.h */
+#define CAPTURE_MAGIC       "NCCAPTUR"
+#define CAPTURE_VERSION     1
+#define CAPTURE_REC_POOL    1
+#define CAPTURE_REC_REQ     2
+
+struct capture_hdr {
+    uint8_t  magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    int64_t  start;
+};
+
+struct capture_rec {
+    uint8_t  type;
+    uint8_t  redis;
+    uint16_t pool;
+    uint32_t len;
+    int64_t  usec;
+    uint64_t conn;
+};
+
+#define RP_NPOOL            65536
+#define RP_READ_SIZE        (64 * 1024)
+#define RP_ADDR_LEN         256
+
+struct buf {
+    char   *data;
+    size_t len;
+    size_t size;
+};
+
+struct pool {
+    char     *name;             /* pool name, NULL if not in capture */
+    char     addr[RP_ADDR_LEN]; /* replay address */
+    unsigned redis:1;           /* redis pool? */
+    unsigned skip:1;            /* not replayed? */
+};
+
+struct rconn {
+    uint64_t    id;             /* captured connection id, 0 if free */
+    struct pool *pool;          /* pool of the connection */
+    int         fd;             /* replay socket, -1 if closed */
+    struct buf  wbuf;           /* requests not written yet */
+    size_t      wpos;           /* written bytes of wbuf */
+    struct buf  rbuf;           /* partial reply */
+    uint64_t    outstanding;    /* # redis replies pending */
+    unsigned    auth:1;         /* reply of our AUTH pending? */
+};
+
+struct mapping {
+    char *name;
+    char *addr;
+};
+
+static struct {
+    uint8_t        *data;       /* capture file */
+    size_t         size;        /* capture file size */
+    double         speed;       /* speedup, 0 for as fast as possible */
+    int            wait;        /* idle wait for replies in msec */
+    char           *addr;       /* replay address of every pool */
+    char           *only;       /* replay this pool only */
+    char           *auth;       /* password of redis pools or NULL */
+    struct mapping *map;        /* per pool replay addresses */
+    int            nmap;        /* # map */
+    int            verbose;
+    struct pool    *pool;       /* pool[RP_NPOOL] */
+    struct rconn   *conn;       /* hash table of connections */
+    size_t         nconn;       /* # conn */
+    size_t         conn_size;   /* # conn slots, power of 2 */
+    uint64_t       nrequest;    /* # requests sent */
+    uint64_t       nrequest_redis; /* # requests sent to redis pools */
+    uint64_t       nreply;      /* # redis replies */
+    uint64_t       nerror;      /* # redis error replies */
+    uint64_t       nauth_error; /* # AUTH refused */
+    uint64_t       sent_bytes;  /* # request bytes */
+    uint64_t       recv_bytes;  /* # reply bytes */
+    int64_t        max_lag;     /* max lag behind schedule in usec */
+} rp;
+
+static struct option long_options[] = {
+    { "help",      no_argument,       NULL, 'h' },
+    { "verbose",   no_argument,       NULL, 'v' },
+    { "addr",      required_argument, NULL, 'a' },
+    { "map",       required_argument, NULL, 'm' },
+    { "pool",      required_argument, NULL, 'P' },
+    { "auth",      required_argument, NULL, 'A' },
+    { "speed",     required_argument, NULL, 'x' },
+    { "wait",      required_argument, NULL, 'w' },
+    { NULL,        0,                 NULL,  0  }
+};
+
+static char short_options[] = "hva:m:P:A:x:w:";
+
+static void
+rp_show_usage(void)
+{
+    fprintf(stderr,
+        "Usage: nc_replay [-hv] [-a addr] [-m pool=addr]... [-P pool]" "\n"
+        "                 [-A password] [-x speedup] [-w msec] capture-file" "\n"
+        "" "\n"
+        "Options:" "\n"
+        "  -h, --help             : this help" "\n"
+        "  -v, --verbose          : print the pools and connections" "\n"
+        "  -a, --addr=S           : replay every pool to host:port or a unix socket" "\n"
+        "                           (default: the captured listen address)" "\n"
+        "  -m, --map=S            : replay pool to addr, as pool=addr" "\n"
+        "  -P, --pool=S           : replay this pool only" "\n"
+        "  -A, --auth=S           : send AUTH with this password first on every" "\n"
+        "                           redis connection, as captures hold no AUTH" "\n"
+        "  -x, --speed=N          : speedup over the captured timing, 0 for as" "\n"
+        "                           fast as possible (default: 1)" "\n"
+        "  -w, --wait=N           : wait for replies for N msec (default: 1000)" "\n"
+        "");
+}
+
+static int64_t
+rp_usec_now(void)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+
+    return (int64_t)now.tv_sec * 1000000LL + (int64_t)now.tv_usec;
+}
+
+static void
+buf_reserve(struct buf *b, size_t n)
+{
+    size_t size;
+
+    if (b->len + n <= b->size) {
+        return;
+    }
+
+    for (size = b->size == 0 ? 4096 : b->size; size < b->len + n; size *= 2) {
+        /* nothing */
+    }
+
+    b->data = realloc(b->data, size);
+    if (b->data == NULL) {
+        fprintf(stderr, "nc_replay: out of memory\n");
+        exit(1);
+    }
+    b->size = size;
+}
+
+static void
+buf_append(struct buf *b, const uint8_t *data, size_t n)
+{
+    buf_reserve(b, n);
+    memcpy(b->data + b->len, data, n);
+    b->len += n;
+}
+
+/*
+ * Skip one redis reply at p; return the # bytes it takes, 0 when it is
+ * not complete and -1 on a protocol error (as in nc_loadgen.c)
+ */
+static long
+reply_skip(char *p, char *end, int *error)
+{
+    char *cr, *q;
+    long n, len, i, nskip;
+
+    cr = memchr(p, '\r', (size_t)(end - p));
+    if (cr == NULL || cr + 1 >= end) {
+        return 0;
+    }
+    q = cr + 2;
+
+    switch (*p) {
+    case '-':
+        *error = 1;
+        /* fall through */
+    case '+':
+    case ':':
+        return q - p;
+
+    case '$':
+        len = strtol(p + 1, NULL, 10);
+        if (len < 0) {
+            return q - p;
+        }
+        if (end - q < len + 2) {
+            return 0;
+        }
+        return q + len + 2 - p;
+
+    case '*':
+        n = strtol(p + 1, NULL, 10);
+        for (i = 0; i < n; i++) {
+            int ignore = 0;
+
+            nskip = reply_skip(q, end, &ignore);
+            if (nskip <= 0) {
+                return nskip;
+            }
+            q += nskip;
+            if (q >= end && i + 1 < n) {
+                return 0;
+            }
+        }
+        return q - p;
+
+    default:
+        return -1;
+    }
+}
+
+/* connect to host:port, or to the unix socket at a path */
+static int
+rp_connect(const char *addr)
+{
+    struct addrinfo hints, *ai;
+    struct sockaddr_un un;
+    char host[RP_ADDR_LEN], *port;
+    int fd, status, one = 1;
+
+    if (addr[0] == '/') {
+        memset(&un, 0, sizeof(un));
+        un.sun_family = AF_UNIX;
+        strncpy(un.sun_path, addr, sizeof(un.sun_path) - 1);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (struct sockaddr *)&un, sizeof(un)) < 0) {
+            fprintf(stderr, "nc_replay: connect to '%s' failed: %s\n", addr,
+                    strerror(errno));
+            return -1;
+        }
+    } else {
+        snprintf(host, sizeof(host), "%s", addr);
+        port = strrchr(host, ':');
+        if (port == NULL) {
+            fprintf(stderr, "nc_replay: address '%s' is not host:port\n",
+                    addr);
+            return -1;
+        }
+        *port++ = '\0';
+        if (strcmp(host, "0.0.0.0") == 0 || host[0] == '\0') {
+            snprintf(host, sizeof(host), "127.0.0.1");
+        }
+
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+
+        status = getaddrinfo(host, port, &hints, &ai);
+        if (status != 0) {
+            fprintf(stderr, "nc_replay: resolve '%s' failed: %s\n", addr,
+                    gai_strerror(status));
+            return -1;
+        }
+
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0 || connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+            fprintf(stderr, "nc_replay: connect to '%s' failed: %s\n", addr,
+                    strerror(errno));
+            freeaddrinfo(ai);
+            return -1;
+        }
+        freeaddrinfo(ai);
+
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    return fd;
+}
+
+static struct rconn *
+conn_lookup(uint64_t id)
+{
+    size_t mask = rp.conn_size - 1, i;
+
+    for (i = (size_t)(id * 0x9e3779b97f4a7c15ULL) & mask;
+         rp.conn[i].id != 0 && rp.conn[i].id != id; i = (i + 1) & mask) {
+        /* linear probing */
+    }
+
+    return &rp.conn[i];
+}
+
+static void
+conn_grow(void)
+{
+    struct rconn *old = rp.conn;
+    size_t i, old_size = rp.conn_size;
+
+    rp.conn_size = old_size == 0 ? 1024 : old_size * 2;
+    rp.conn = calloc(rp.conn_size, sizeof(*rp.conn));
+    if (rp.conn == NULL) {
+        fprintf(stderr, "nc_replay: out of memory\n");
+        exit(1);
+    }
+
+    for (i = 0; i < old_size; i++) {
+        if (old[i].id != 0) {
+            *conn_lookup(old[i].id) = old[i];
+        }
+    }
+    free(old);
+}
+
+/* queue AUTH with the password of -A, ahead of the replayed requests */
+static void
+rp_auth(struct rconn *c)
+{
+    char req[64];
+    size_t len = strlen(rp.auth);
+    int n;
+
+    n = snprintf(req, sizeof(req), "*2\r\n$4\r\nAUTH\r\n$%zu\r\n", len);
+    buf_append(&c->wbuf, (uint8_t *)req, (size_t)n);
+    buf_append(&c->wbuf, (uint8_t *)rp.auth, len);
+    buf_append(&c->wbuf, (uint8_t *)"\r\n", 2);
+    c->auth = 1;
+}
+
+/* the replay connection of captured connection id on pool */
+static struct rconn *
+conn_get(uint64_t id, struct pool *pool)
+{
+    struct rconn *c;
+
+    if (2 * (rp.nconn + 1) > rp.conn_size) {
+        conn_grow();
+    }
+
+    c = conn_lookup(id);
+    if (c->id == 0) {
+        c->id = id;
+        c->pool = pool;
+        c->fd = -1;
+        rp.nconn++;
+    }
+
+    if (c->fd < 0) {
+        c->fd = rp_connect(pool->addr);
+        if (c->fd < 0) {
+            exit(1);
+        }
+        c->wpos = 0;
+        c->wbuf.len = 0;
+        c->rbuf.len = 0;
+        c->outstanding = 0;
+        c->auth = 0;
+        if (rp.auth != NULL && pool->redis) {
+            rp_auth(c);
+        }
+        if (rp.verbose) {
+            fprintf(stderr, "nc_replay: conn %"PRIu64" of pool '%s' to '%s'\n",
+                    id, pool->name, pool->addr);
+        }
+    }
+
+    return c;
+}
+
+static void
+conn_close(struct rconn *c)
+{
+    close(c->fd);
+    c->fd = -1;
+    c->outstanding = 0;
+}
+
+static void
+conn_write(struct rconn *c)
+{
+    ssize_t n;
+
+    while (c->wpos < c->wbuf.len) {
+        n = write(c->fd, c->wbuf.data + c->wpos, c->wbuf.len - c->wpos);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                return;
+            }
+            fprintf(stderr, "nc_replay: write on conn %"PRIu64" failed: %s\n",
+                    c->id, strerror(errno));
+            conn_close(c);
+            return;
+        }
+        c->wpos += (size_t)n;
+    }
+
+    c->wpos = 0;
+    c->wbuf.len = 0;
+}
+
+/* return the # bytes read */
+static ssize_t
+conn_read(struct rconn *c)
+{
+    char *p, *end;
+    ssize_t n;
+    long nskip;
+
+    buf_reserve(&c->rbuf, RP_READ_SIZE);
+    n = read(c->fd, c->rbuf.data + c->rbuf.len, c->rbuf.size - c->rbuf.len);
+    if (n <= 0) {
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+            return 0;
+        }
+        if (c->outstanding > 0 || n < 0) {
+            fprintf(stderr, "nc_replay: conn %"PRIu64" closed by server\n",
+                    c->id);
+        }
+        conn_close(c);
+        return 0;
+    }
+    rp.recv_bytes += (uint64_t)n;
+
+    if (!c->pool->redis) {
+        return n;
+    }
+
+    c->rbuf.len += (size_t)n;
+    p = c->rbuf.data;
+    end = c->rbuf.data + c->rbuf.len;
+
+    while (p < end) {
+        int error = 0;
+
+        nskip = reply_skip(p, end, &error);
+        if (nskip < 0) {
+            fprintf(stderr, "nc_replay: protocol error in reply on conn "
+                    "%"PRIu64"\n", c->id);
+            conn_close(c);
+            return n;
+        }
+        if (nskip == 0) {
+            break;
+        }
+
+        p += nskip;
+
+        if (c->auth) {
+            /* our AUTH is not one of the replayed requests */
+            c->auth = 0;
+            if (error) {
+                rp.nauth_error++;
+                fprintf(stderr, "nc_replay: AUTH refused on conn %"PRIu64"\n",
+                        c->id);
+            }
+            continue;
+        }
+
+        rp.nreply++;
+        rp.nerror += (uint64_t)error;
+        if (c->outstanding > 0) {
+            c->outstanding--;
+        }
+    }
+
+    c->rbuf.len = (size_t)(end - p);
+    memmove(c->rbuf.data, p, c->rbuf.len);
+
+    return n;
+}
+
+static int
+rp_load(const char *filename)
+{
+    struct stat st;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "nc_replay: open '%s' failed: %s\n", filename,
+                strerror(errno));
+        return -1;
+    }
+
+    if ((size_t)st.st_size < sizeof(struct capture_hdr)) {
+        fprintf(stderr, "nc_replay: '%s' is not a capture file\n", filename);
+        close(fd);
+        return -1;
+    }
+
+    rp.size = (size_t)st.st_size;
+    rp.data = mmap(NULL, rp.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (rp.data == MAP_FAILED) {
+        fprintf(stderr, "nc_replay: mmap '%s' failed: %s\n", filename,
+                strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/* register a pool record; data is "<name>\0<listen address>" */
+static void
+rp_pool(struct capture_rec *rec, const uint8_t *data)
+{
+    struct pool *pool = &rp.pool[rec->pool];
+    const char *name = (const char *)data, *nul;
+    int i;
+
+    nul = memchr(name, '\0', rec->len);
+    if (nul == NULL) {
+        nul = name + rec->len;
+    }
+
+    free(pool->name);
+    pool->name = strndup(name, (size_t)(nul - name));
+    if (pool->name == NULL) {
+        fprintf(stderr, "nc_replay: out of memory\n");
+        exit(1);
+    }
+
+    pool->addr[0] = '\0';
+    if (nul < name + rec->len) {
+        snprintf(pool->addr, sizeof(pool->addr), "%.*s",
+                 (int)(name + rec->len - nul - 1), nul + 1);
+    }
+    if (rp.addr != NULL) {
+        snprintf(pool->addr, sizeof(pool->addr), "%s", rp.addr);
+    }
+    for (i = 0; i < rp.nmap; i++) {
+        if (strcmp(rp.map[i].name, pool->name) == 0) {
+            snprintf(pool->addr, sizeof(pool->addr), "%s", rp.map[i].addr);
+        }
+    }
+
+    pool->redis = rec->redis ? 1 : 0;
+    pool->skip = rp.only != NULL && strcmp(rp.only, pool->name) != 0;
+
+    if (rp.verbose) {
+        fprintf(stderr, "nc_replay: pool '%s' (%s) %s '%s'\n", pool->name,
+                pool->redis ? "redis" : "memcache",
+                pool->skip ? "skipped, captured on" : "replayed to",
+                pool->addr);
+    }
+}
+
+/* poll every connection for up to timeout msec; return # bytes read */
+static ssize_t
+rp_poll(struct pollfd *pfd, struct rconn **pconn, int timeout)
+{
+    size_t i, n = 0;
+    ssize_t nread = 0;
+
+    for (i = 0; i < rp.conn_size; i++) {
+        struct rconn *c = &rp.conn[i];
+
+        if (c->id == 0 || c->fd < 0) {
+            continue;
+        }
+        pfd[n].fd = c->fd;
+        pfd[n].events = POLLIN;
+        if (c->wpos < c->wbuf.len) {
+            pfd[n].events |= POLLOUT;
+        }
+        pfd[n].revents = 0;
+        pconn[n] = c;
+        n++;
+    }
+
+    if (poll(pfd, (nfds_t)n, timeout) < 0) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        fprintf(stderr, "nc_replay: poll failed: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    for (i = 0; i < n; i++) {
+        struct rconn *c = pconn[i];
+
+        if (pfd[i].revents & POLLOUT) {
+            conn_write(c);
+        }
+        if (c->fd >= 0 && (pfd[i].revents & (POLLIN | POLLERR | POLLHUP))) {
+            nread += conn_read(c);
+        }
+    }
+
+    return nread;
+}
+
+static bool
+rp_pending(bool replies)
+{
+    size_t i;
+
+    for (i = 0; i < rp.conn_size; i++) {
+        struct rconn *c = &rp.conn[i];
+
+        if (c->id == 0 || c->fd < 0) {
+            continue;
+        }
+        if (c->wpos < c->wbuf.len || (replies && c->outstanding > 0)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static int
+rp_run(void)
+{
+    struct capture_hdr *hdr = (struct capture_hdr *)rp.data;
+    struct capture_rec rec;
+    struct rconn *c;
+    struct pollfd *pfd = NULL;
+    struct rconn **pconn = NULL;
+    size_t off, pfd_size = 0;
+    int64_t start, now, due, idle_since;
+    int timeout;
+    bool memcache = false;
+
+    if (memcmp(hdr->magic, CAPTURE_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != CAPTURE_VERSION) {
+        fprintf(stderr, "nc_replay: not a capture file of version %d\n",
+                CAPTURE_VERSION);
+        return -1;
+    }
+
+    start = rp_usec_now();
+    off = sizeof(*hdr);
+
+    while (off < rp.size || rp_pending(false)) {
+        timeout = 1000;
+
+        while (off + sizeof(rec) <= rp.size) {
+            memcpy(&rec, rp.data + off, sizeof(rec));
+            if (off + sizeof(rec) + rec.len > rp.size) {
+                fprintf(stderr, "nc_replay: capture file truncated\n");
+                off = rp.size;
+                break;
+            }
+
+            if (rec.type == CAPTURE_REC_POOL) {
+                rp_pool(&rec, rp.data + off + sizeof(rec));
+                off += sizeof(rec) + rec.len;
+                continue;
+            }
+
+            if (rec.type != CAPTURE_REC_REQ || rp.pool[rec.pool].name == NULL ||
+                rp.pool[rec.pool].skip) {
+                off += sizeof(rec) + rec.len;
+                continue;
+            }
+
+            now = rp_usec_now() - start;
+            due = rp.speed > 0 ? (int64_t)((double)rec.usec / rp.speed) : now;
+            if (due > now) {
+                timeout = (int)((due - now + 999) / 1000);
+                break;
+            }
+            if (now - due > rp.max_lag) {
+                rp.max_lag = now - due;
+            }
+
+            c = conn_get(rec.conn, &rp.pool[rec.pool]);
+            buf_append(&c->wbuf, rp.data + off + sizeof(rec), rec.len);
+            if (c->pool->redis) {
+                c->outstanding++;
+                rp.nrequest_redis++;
+            } else {
+                memcache = true;
+            }
+            conn_write(c);
+
+            rp.nrequest++;
+            rp.sent_bytes += rec.len;
+            off += sizeof(rec) + rec.len;
+        }
+        if (off + sizeof(rec) > rp.size) {
+            off = rp.size;
+            timeout = 100;
+        }
+
+        if (pfd_size < rp.nconn) {
+            pfd_size = rp.conn_size;
+            pfd = realloc(pfd, pfd_size * sizeof(*pfd));
+            pconn = realloc(pconn, pfd_size * sizeof(*pconn));
+            if (pfd == NULL || pconn == NULL) {
+                fprintf(stderr, "nc_replay: out of memory\n");
+                exit(1);
+            }
+        }
+
+        rp_poll(pfd, pconn, timeout);
+    }
+
+    /* wait for the outstanding replies, and for memcache, for idleness */
+    idle_since = rp_usec_now();
+    while (rp_pending(true) || memcache) {
+        if (rp_poll(pfd, pconn, 100) > 0) {
+            idle_since = rp_usec_now();
+        } else if (rp_usec_now() - idle_since >= (int64_t)rp.wait * 1000) {
+            break;
+        }
+    }
+
+    now = rp_usec_now() - start;
+    if (now <= 0) {
+        now = 1;
+    }
+
+    printf("requests %"PRIu64" in %.3f s, %.2f req/s, %zu connections\n",
+           rp.nrequest, (double)now / 1e6, (double)rp.nrequest * 1e6 /
+           (double)now, rp.nconn);
+    printf("sent %"PRIu64" bytes, received %"PRIu64" bytes, max lag %.3f ms\n",
+           rp.sent_bytes, rp.recv_bytes, (double)rp.max_lag / 1e3);
+    if (rp.nrequest_redis > 0) {
+        printf("redis replies %"PRIu64" of %"PRIu64", errors %"PRIu64"\n",
+               rp.nreply, rp.nrequest_redis, rp.nerror);
+    }
+    if (rp.nauth_error > 0) {
+        printf("AUTH refused on %"PRIu64" connections\n", rp.nauth_error);
+    }
+
+    free(pfd);
+    free(pconn);
+
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    char *eq;
+    int c;
+
+    rp.speed = 1;
+    rp.wait = 1000;
+
+    for (;;) {
+        c = getopt_long(argc, argv, short_options, long_options, NULL);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+        case 'h':
+            rp_show_usage();
+            exit(0);
+
+        case 'v':
+            rp.verbose = 1;
+            break;
+
+        case 'a':
+            rp.addr = optarg;
+            break;
+
+        case 'm':
+            eq = strchr(optarg, '=');
+            if (eq == NULL) {
+                rp_show_usage();
+                exit(1);
+            }
+            *eq = '\0';
+            rp.map = realloc(rp.map, (size_t)(rp.nmap + 1) * sizeof(*rp.map));
+            if (rp.map == NULL) {
+                fprintf(stderr, "nc_replay: out of memory\n");
+                exit(1);
+            }
+            rp.map[rp.nmap].name = optarg;
+            rp.map[rp.nmap].addr = eq + 1;
+            rp.nmap++;
+            break;
+
+        case 'P':
+            rp.only = optarg;
+            break;
+
+        case 'A':
+            rp.auth = optarg;
+            break;
+
+        case 'x':
+            rp.speed = atof(optarg);
+            break;
+
+        case 'w':
+            rp.wait = atoi(optarg);
+            break;
+
+        default:
+            rp_show_usage();
+            exit(1);
+        }
+    }
+
+    if (optind != argc - 1 || rp.speed < 0 || rp.wait < 0) {
+        rp_show_usage();
+        exit(1);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    rp.pool = calloc(RP_NPOOL, sizeof(*rp.pool));
+    if (rp.pool == NULL) {
+        fprintf(stderr, "nc_replay: out of memory\n");
+        exit(1);
+    }
+    conn_grow();
+
+    if (rp_load(argv[optind]) < 0 || rp_run() < 0) {
+        exit(1);
+    }
+
+    return 0;
+}
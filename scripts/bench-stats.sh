@@ -0,0 +1,56 @@
+#!/bin/sh
+
+# Measure the overhead of stats recording. Run two nutcrackers with the same
+# configuration in front of the same redis, one built with stats and one
+# built with --disable-stats, and compare them with redis-benchmark:
+#
+#   ./bench-stats.sh <stats on port> <stats off port>
+#
+# Each test is averaged over all rounds, and the overhead is how much lower
+# the stats on average is than the stats off one.
+
+on=${1:-22121}
+off=${2:-22122}
+host=${HOST:-127.0.0.1}
+requests=${REQUESTS:-1000000}
+clients=${CLIENTS:-50}
+pipeline=${PIPELINE:-16}
+rounds=${ROUNDS:-3}
+tests=${TESTS:-get,set,mget}
+
+out=`mktemp`
+last=`mktemp`
+trap 'rm -f ${out} ${last}' EXIT
+
+bench() {
+    redis-benchmark -h ${host} -p $1 -n ${requests} -c ${clients} \
+        -P ${pipeline} -r 100000 -t ${tests} -q 2>/dev/null | tr '\r' '\n' | \
+        grep "requests per second" > ${last}
+    cat ${last}
+    sed "s/^/$2 /" ${last} >> ${out}
+}
+
+for round in `seq 1 ${rounds}`; do
+    printf "round %d stats on (port %d)\n" ${round} ${on}
+    bench ${on} on
+    printf "round %d stats off (port %d)\n" ${round} ${off}
+    bench ${off} off
+done
+
+# lines look like "on SET: 123456.79 requests per second, p50=..."
+awk '
+{
+    test = $2; sub(/:$/, "", test)
+    if (!(test in seen)) { seen[test] = 1; order[n++] = test }
+    sum[$1, test] += $3; cnt[$1, test]++
+}
+END {
+    printf "\n%-10s %14s %14s %10s\n", "test", "on rps", "off rps", "overhead"
+    for (i = 0; i < n; i++) {
+        t = order[i]
+        if (cnt["on", t] == 0 || cnt["off", t] == 0) continue
+        a = sum["on", t] / cnt["on", t]
+        b = sum["off", t] / cnt["off", t]
+        printf "%-10s %14.2f %14.2f %9.2f%%\n", t, a, b, (b - a) * 100 / b
+    }
+}' ${out}
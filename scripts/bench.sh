@@ -0,0 +1,132 @@
+#!/bin/sh
+
+# End to end benchmark of nutcracker in front of nc_mockredis, a local
+# stand-in for a redis cluster of MASTERS masters with REPLICAS replicas
+# each. Run through "make bench", or by hand from a built tree:
+#
+#   ./scripts/bench.sh
+#
+# Every knob is an environment variable. LATENCY gives the mock a service
+# time per command in usec, e.g. LATENCY="get=100 mget=200". BASELINE=1
+# also runs the tests straight against the mock, to see the proxy overhead.
+# CSV=1 prints one csv line per test, so that runs can be diffed.
+
+top=$(cd "$(dirname "$0")/.." && pwd)
+nutcracker=${NUTCRACKER:-${top}/src/nutcracker}
+luadir=${NC_LUA_DIR:-${top}/src/lua}
+bindir=${BENCH_DIR:-${top}/bench}
+host=127.0.0.1
+listen=${LISTEN:-22190}
+stats=${STATS_PORT:-22290}
+port=${MOCK_PORT:-7100}
+masters=${MASTERS:-3}
+replicas=${REPLICAS:-1}
+latency=${LATENCY:-}
+requests=${REQUESTS:-200000}
+clients=${CLIENTS:-50}
+pipelines=${PIPELINES:-1 16}
+keys=${KEYS:-10}
+datasize=${DATASIZE:-16}
+tests=${TESTS:-set,get,mset,mget}
+baseline=${BASELINE:-0}
+csv=${CSV:-0}
+
+tmp=$(mktemp -d)
+mock_pid=
+nc_pid=
+header=1
+
+cleanup() {
+    [ -n "${nc_pid}" ] && kill ${nc_pid} 2>/dev/null
+    [ -n "${mock_pid}" ] && kill ${mock_pid} 2>/dev/null
+    wait 2>/dev/null
+    rm -rf "${tmp}"
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+for bin in "${nutcracker}" "${bindir}/nc_mockredis" "${bindir}/nc_loadgen"; do
+    if [ ! -x "${bin}" ]; then
+        echo "bench: ${bin} not found, build it first" >&2
+        exit 1
+    fi
+done
+
+# start the mock cluster
+opts=
+for l in ${latency}; do
+    opts="${opts} -l ${l}"
+done
+"${bindir}/nc_mockredis" -a ${host} -p ${port} -m ${masters} \
+    -r ${replicas} ${opts} 2>"${tmp}/mock.log" &
+mock_pid=$!
+
+# nutcracker learns the topology from the seed masters
+cat > "${tmp}/bench.yml" <<EOF
+bench:
+  listen: ${host}:${listen}
+  hash: crc16
+  distribution: random
+  redis: true
+  rediscluster: true
+  zone: tc
+  env: offline
+  timeout: 1000
+  auto_eject_hosts: false
+  preconnect: true
+  servers:
+EOF
+i=0
+while [ ${i} -lt ${masters} ]; do
+    echo "   - ${host}:$((port + i)):1" >> "${tmp}/bench.yml"
+    i=$((i + 1))
+done
+
+"${nutcracker}" -c "${tmp}/bench.yml" -l "${luadir}" -s ${stats} \
+    -o "${tmp}/nutcracker.log" -p "${tmp}/nutcracker.pid" &
+nc_pid=$!
+
+# wait until requests are routed
+ready=0
+for i in `seq 1 50`; do
+    if "${bindir}/nc_loadgen" -C -s ${host} -p ${listen} -c 1 -n 1 -t set \
+        2>/dev/null | awk -F, 'NR == 2 && $4 == 1 && $5 == 0 { ok = 1 }
+                               END { exit !ok }'; then
+        ready=1
+        break
+    fi
+    sleep 0.2
+done
+if [ ${ready} -eq 0 ]; then
+    echo "bench: nutcracker did not get ready, see its log:" >&2
+    tail -n 20 "${tmp}/nutcracker.log" >&2
+    exit 1
+fi
+
+run() {
+    target=$1
+    target_port=$2
+    pipeline=$3
+
+    if [ ${csv} -eq 1 ]; then
+        "${bindir}/nc_loadgen" -C -s ${host} -p ${target_port} -c ${clients} \
+            -P ${pipeline} -n ${requests} -k ${keys} -d ${datasize} \
+            -t ${tests} | awk -v target=${target} -v header=${header} -F, '
+            NR == 1 { if (header) print "target," $0; next }
+            { print target "," $0 }'
+        header=0
+    else
+        printf "== %s, %d clients, pipeline %d\n" ${target} ${clients} \
+            ${pipeline}
+        "${bindir}/nc_loadgen" -s ${host} -p ${target_port} -c ${clients} \
+            -P ${pipeline} -n ${requests} -k ${keys} -d ${datasize} \
+            -t ${tests}
+    fi
+}
+
+for pipeline in ${pipelines}; do
+    if [ ${baseline} -eq 1 ]; then
+        run mock ${port} ${pipeline} || exit 1
+    fi
+    run nutcracker ${listen} ${pipeline} || exit 1
+done
@@ -246,6 +246,8 @@ event_wait(struct event_base *evb, int timeout)
 
         nsd = epoll_wait(ep, event, nevent, timeout);
         if (nsd > 0) {
+            nc_loop_clock_update();
+
             for (i = 0; i < nsd; i++) {
                 struct epoll_event *ev = &evb->event[i];
                 uint32_t events = 0;
@@ -320,7 +322,7 @@ event_loop_stats(event_stats_cb_t cb, void *arg)
     for (;;) {
         int n;
 
-        n = epoll_wait(ep, &ev, 1, st->interval);
+        n = epoll_wait(ep, &ev, 1, st->wait);
         if (n < 0) {
             if (errno == EINTR) {
                 continue;
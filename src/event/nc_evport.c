@@ -290,6 +290,8 @@ event_wait(struct event_base *evb, int timeout)
         }
 
         if (nreturned > 0) {
+            nc_loop_clock_update();
+
             for (i = 0; i < nreturned; i++) {
                 port_event_t *ev = &evb->event[i];
                 uint32_t events = 0;
@@ -369,19 +371,18 @@ event_loop_stats(event_stats_cb_t cb, void *arg)
         goto error;
     }
 
-    /* port_getn should block indefinitely if st->interval < 0 */
-    if (st->interval < 0) {
-        tsp = NULL;
-    } else {
-        tsp = &ts;
-        tsp->tv_sec = st->interval / 1000LL;
-        tsp->tv_nsec = (st->interval % 1000LL) * 1000000LL;
-    }
-
-
     for (;;) {
         unsigned int nreturned = 1;
 
+        /* port_getn should block indefinitely if st->wait < 0 */
+        if (st->wait < 0) {
+            tsp = NULL;
+        } else {
+            tsp = &ts;
+            tsp->tv_sec = st->wait / 1000LL;
+            tsp->tv_nsec = (st->wait % 1000LL) * 1000000LL;
+        }
+
         status = port_getn(evp, &event, 1, &nreturned, tsp);
         if (status != NC_OK) {
             if (errno == EINTR || errno == EAGAIN) {
@@ -274,6 +274,8 @@ event_wait(struct event_base *evb, int timeout)
                                 evb->nevent, tsp);
         evb->nchange = 0;
         if (evb->nreturned > 0) {
+            nc_loop_clock_update();
+
             for (evb->nprocessed = 0; evb->nprocessed < evb->nreturned;
                 evb->nprocessed++) {
                 struct kevent *ev = &evb->event[evb->nprocessed];
@@ -361,18 +363,18 @@ event_loop_stats(event_stats_cb_t cb, void *arg)
 
     EV_SET(&change, st->sd, EVFILT_READ, EV_ADD | EV_CLEAR, 0, 0, NULL);
 
-    /* kevent should block indefinitely if st->interval < 0 */
-    if (st->interval < 0) {
-        tsp = NULL;
-    } else {
-        tsp = &ts;
-        tsp->tv_sec = st->interval / 1000LL;
-        tsp->tv_nsec = (st->interval % 1000LL) * 1000000LL;
-    }
-
     for (;;) {
         int nreturned;
 
+        /* kevent should block indefinitely if st->wait < 0 */
+        if (st->wait < 0) {
+            tsp = NULL;
+        } else {
+            tsp = &ts;
+            tsp->tv_sec = st->wait / 1000LL;
+            tsp->tv_nsec = (st->wait % 1000LL) * 1000000LL;
+        }
+
         nreturned = kevent(kq, &change, 1, &event, 1, tsp);
         if (nreturned < 0) {
             if (errno == EINTR) {
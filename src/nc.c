@@ -68,10 +68,11 @@ static struct option long_options[] = {
     { "pid-file",       required_argument,  NULL,   'p' },
     { "mbuf-size",      required_argument,  NULL,   'm' },
     { "lua-script-path",required_argument,  NULL,   'l' },
+    { "capture-file",   required_argument,  NULL,   'C' },
     { NULL,             0,                  NULL,    0  }
 };
 
-static char short_options[] = "hVtdDv:o:w:c:s:i:a:p:m:l:";
+static char short_options[] = "hVtdDv:o:w:c:s:i:a:p:m:l:C:";
 
 static rstatus_t
 nc_daemonize(int dump_core)
@@ -208,6 +209,7 @@ nc_show_usage(void)
         "Usage: nutcracker [-?hVdDt] [-v verbosity level] [-o output file]" CRLF
         "                  [-c conf file] [-s stats port] [-a stats addr]" CRLF
         "                  [-i stats interval] [-p pid file] [-m mbuf size]" CRLF
+        "                  [-C capture file]" CRLF
         "");
     log_stderr(
         "Options:" CRLF
@@ -226,6 +228,7 @@ nc_show_usage(void)
         "  -p, --pid-file=S       : set pid file (default: %s)" CRLF
         "  -m, --mbuf-size=N      : set size of mbuf chunk in bytes (default: %d bytes)" CRLF
         "  -l, --lua-path=path    : set lua script load path (default: %s)" CRLF
+        "  -C, --capture-file=S   : set capture file of sampled requests (default: off)" CRLF
         "",
         NC_LOG_DEFAULT, NC_LOG_MIN, NC_LOG_MAX,
         NC_LOG_PATH != NULL ? NC_LOG_PATH : "stderr",
@@ -289,6 +292,7 @@ nc_set_default_options(struct instance *nci)
 
     nci->conf_filename = NC_CONF_PATH;
     nci->lua_path = NC_LUA_PATH;
+    nci->capture_filename = NULL;
 
     nci->stats_port = NC_STATS_PORT;
     nci->stats_addr = NC_STATS_ADDR;
@@ -415,11 +419,16 @@ nc_get_options(int argc, char **argv, struct instance *nci)
             nci->lua_path = optarg;
             break;
 
+        case 'C':
+            nci->capture_filename = optarg;
+            break;
+
         case '?':
             switch (optopt) {
             case 'o':
             case 'c':
             case 'p':
+            case 'C':
                 log_stderr("nutcracker: option -%c requires a file name",
                            optopt);
                 break;
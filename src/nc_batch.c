@@ -0,0 +1,486 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <nc_core.h>
+#include <nc_server.h>
+#include <nc_batch.h>
+#include <proto/nc_proto.h>
+
+#define BATCH_STATUS_OK     "+OK\r\n"
+
+static bool
+batch_eligible(struct server_pool *pool, struct msg *msg)
+{
+    struct mbuf *mbuf;
+
+    if (msg->noreply || msg->nobatch || msg->swallow || msg->frag_id != 0) {
+        return false;
+    }
+
+    switch (msg->type) {
+    case MSG_REQ_REDIS_GET:
+        if (!pool->batch_get || msg->narg != 2) {
+            return false;
+        }
+        break;
+
+    case MSG_REQ_REDIS_SET:
+        /* plain "SET key value", without expiry or condition */
+        if (!pool->batch_set || msg->narg != 3) {
+            return false;
+        }
+        break;
+
+    default:
+        return false;
+    }
+
+    /* in one mbuf and not sent in part */
+    mbuf = STAILQ_FIRST(&msg->mhdr);
+    return mbuf != NULL && mbuf == STAILQ_LAST(&msg->mhdr, mbuf, next) &&
+           mbuf_length(mbuf) == msg->mlen && *mbuf->pos == '*';
+}
+
+static bool
+batch_match(struct server_pool *pool, struct msg *first, struct msg *msg)
+{
+    return msg->type == first->type && msg->slot == first->slot &&
+           batch_eligible(pool, msg);
+}
+
+/* append the arguments of msg, after its command, to batch */
+static rstatus_t
+batch_append(struct msg *batch, struct msg *msg)
+{
+    struct mbuf *mbuf;
+    uint8_t *p;
+    uint32_t i;
+
+    mbuf = STAILQ_FIRST(&msg->mhdr);
+    p = mbuf->pos;
+
+    for (i = 0; i < 3; i++) {                /* eat *narg\r\n$3\r\nGET\r\n */
+        p = nc_memchr(p, '\n', mbuf->last - p);
+        if (p == NULL) {
+            return NC_ERROR;
+        }
+        p++;
+    }
+
+    return msg_append(batch, p, (size_t)(mbuf->last - p));
+}
+
+/*
+ * Return the request to send next on server connection conn, in place of
+ * msg: a batch of msg and the requests queued behind it, or msg itself.
+ */
+struct msg *
+batch_next(struct context *ctx, struct conn *conn, struct msg *msg)
+{
+    struct server *server = conn->owner;
+    struct server_pool *pool = server->owner;
+    struct msg *batch, *member, *next, *last;
+    uint32_t i, n;
+    rstatus_t status;
+
+    ASSERT(!conn->client && !conn->proxy);
+    ASSERT(msg->request);
+
+    if (!batch_eligible(pool, msg)) {
+        return msg;
+    }
+
+    next = TAILQ_NEXT(msg, s_tqe);
+    if (next == NULL || !batch_match(pool, msg, next)) {
+        return msg;
+    }
+
+    batch = msg_get(NULL, true, true);
+    if (batch == NULL) {
+        return msg;
+    }
+
+    n = 0;
+    for (member = msg; member != NULL && n < pool->batch_max;
+         member = TAILQ_NEXT(member, s_tqe)) {
+        if (member != msg && !batch_match(pool, msg, member)) {
+            break;
+        }
+
+        status = batch_append(batch, member);
+        if (status != NC_OK) {
+            msg_put(batch);
+            return msg;
+        }
+        n++;
+    }
+
+    batch->narg = 1 + n * (msg->narg - 1);
+    if (msg->type == MSG_REQ_REDIS_GET) {
+        batch->type = MSG_REQ_REDIS_MGET;
+        status = msg_prepend_format(batch, "*%"PRIu32"\r\n$4\r\nmget\r\n",
+                                    batch->narg);
+    } else {
+        batch->type = MSG_REQ_REDIS_MSET;
+        status = msg_prepend_format(batch, "*%"PRIu32"\r\n$4\r\nmset\r\n",
+                                    batch->narg);
+    }
+    if (status != NC_OK) {
+        msg_put(batch);
+        return msg;
+    }
+
+    batch->slot = msg->slot;
+    batch->nbatch = n;
+
+    /* take the place of the members in the server inq */
+    TAILQ_INSERT_BEFORE(msg, batch, s_tqe);
+    stats_server_incr(ctx, server, in_queue);
+    stats_server_incr_by(ctx, server, in_queue_bytes, batch->mlen);
+    msg_tmo_insert(batch, conn);
+
+    last = NULL;
+    for (i = 0, member = msg; i < n; i++, member = next) {
+        next = TAILQ_NEXT(member, s_tqe);
+
+        conn->dequeue_inq(ctx, conn, member);
+        msg_tmo_delete(member);
+
+        if (last == NULL) {
+            batch->batch_first = member;
+        } else {
+            last->batch_link = member;
+        }
+        last = member;
+    }
+
+    if (batch->type == MSG_REQ_REDIS_MGET && pool->batch_get_strict) {
+        batch->batch_strict = 1;
+        conn->batch_reads++;
+    }
+
+    stats_pool_incr(ctx, pool, batches);
+    stats_pool_incr_by(ctx, pool, batched_requests, n);
+
+    log_debug(LOG_VERB, "batch %"PRIu32" req from %"PRIu64" into req "
+              "%"PRIu64" len %"PRIu32" on s %d", n, msg->id, batch->id,
+              batch->mlen, conn->sd);
+
+    return batch;
+}
+
+/*
+ * Should msg, next in the in queue of server connection conn, wait? With
+ * batch_get_strict, a write waits for the reply of the get batches sent
+ * before it, so that the members those send again still read the value
+ * from before the write.
+ */
+bool
+batch_hold(struct conn *conn, struct msg *msg)
+{
+    ASSERT(!conn->client && !conn->proxy);
+    ASSERT(msg->request);
+
+    if (conn->batch_reads == 0) {
+        return false;
+    }
+
+    return msg->type <= MSG_RSP_MC_SERVER_ERROR ||
+           msg->type >= MSG_REQ_REDIS_WRITECMD_START;
+}
+
+/*
+ * Return the request of server connection conn, that nothing of has been
+ * sent yet, to put members back in front of; NULL means the tail.
+ */
+static struct msg *
+batch_requeue_pos(struct conn *conn)
+{
+    struct msg *msg;
+    struct mbuf *mbuf;
+
+    msg = TAILQ_FIRST(&conn->imsg_q);
+    if (msg == NULL) {
+        return NULL;
+    }
+
+    mbuf = STAILQ_FIRST(&msg->mhdr);
+    if (mbuf != NULL && mbuf->pos != mbuf->start) {
+        /* sent in part */
+        return TAILQ_NEXT(msg, s_tqe);
+    }
+
+    return msg;
+}
+
+/*
+ * Put member back, unbatched, into the in queue of server connection conn
+ * in front of pos, where it was before the requests queued after the batch.
+ */
+static void
+batch_requeue(struct context *ctx, struct conn *conn, struct msg *pos,
+              struct msg *member)
+{
+    struct server *server = conn->owner;
+
+    member->nobatch = 1;
+
+    if (pos != NULL) {
+        TAILQ_INSERT_BEFORE(pos, member, s_tqe);
+    } else {
+        TAILQ_INSERT_TAIL(&conn->imsg_q, member, s_tqe);
+    }
+
+    if (!member->noreply) {
+        msg_tmo_insert(member, conn);
+    }
+
+    stats_server_incr(ctx, server, in_queue);
+    stats_server_incr_by(ctx, server, in_queue_bytes, member->mlen);
+
+    log_debug(LOG_VERB, "requeue req %"PRIu64" len %"PRIu32" on s %d",
+              member->id, member->mlen, conn->sd);
+}
+
+/* fail a member that will get no response of the batch */
+static void
+batch_member_fail(struct msg *msg, err_t err)
+{
+    struct conn *c_conn;
+    struct context *ctx;
+    rstatus_t status;
+
+    msg->done = 1;
+    msg->error = 1;
+    msg->err = err;
+
+    limit_release(msg, true);
+
+    /* client went away */
+    if (msg->swallow) {
+        req_put(msg);
+        return;
+    }
+
+    if (msg->sf != NULL) {
+        singleflight_done(msg, NULL, err);
+    }
+
+    c_conn = msg->owner;
+    ctx = conn_to_ctx(c_conn);
+
+    if (req_done(c_conn, TAILQ_FIRST(&c_conn->omsg_q))) {
+        status = event_add_out(ctx->evb, c_conn);
+        if (status != NC_OK) {
+            c_conn->err = errno;
+        }
+    }
+}
+
+static void
+batch_member_done(struct context *ctx, struct conn *conn, struct msg *msg,
+                  struct msg *rsp)
+{
+    if (msg->swallow) {
+        if (msg->sf != NULL) {
+            singleflight_done(msg, rsp, 0);
+        }
+        rsp_put(rsp);
+        req_put(msg);
+        return;
+    }
+
+    rsp_complete(ctx, conn, msg, rsp);
+}
+
+/* send what was put back or held, on server connection conn */
+static void
+batch_resume(struct context *ctx, struct conn *conn)
+{
+    rstatus_t status;
+
+    if (TAILQ_EMPTY(&conn->imsg_q)) {
+        return;
+    }
+
+    status = event_add_out(ctx->evb, conn);
+    if (status != NC_OK) {
+        conn->err = errno;
+    }
+}
+
+/* the bulk mrsp is nil? */
+static bool
+batch_rsp_nil(struct msg *mrsp)
+{
+    struct mbuf *mbuf;
+
+    mbuf = STAILQ_FIRST(&mrsp->mhdr);
+    return mbuf != NULL && mbuf_length(mbuf) >= 3 &&
+           nc_strncmp(mbuf->pos, "$-1", 3) == 0;
+}
+
+/* the reply of batch fits its members? */
+static bool
+batch_rsp_valid(struct msg *batch, struct msg *rsp)
+{
+    struct mbuf *mbuf;
+
+    if (batch->type == MSG_REQ_REDIS_MSET) {
+        return rsp->type == MSG_RSP_REDIS_STATUS;
+    }
+
+    if (rsp->type != MSG_RSP_REDIS_MULTIBULK || rsp->narg != batch->nbatch) {
+        return false;
+    }
+
+    mbuf = STAILQ_FIRST(&rsp->mhdr);
+    return mbuf != NULL && rsp->narg_start == mbuf->pos &&
+           rsp->narg_end != NULL && rsp->narg_end + CRLF_LEN <= mbuf->last;
+}
+
+/*
+ * Split rsp, the reply of batch received on server connection conn, into
+ * the responses of its members.
+ */
+void
+batch_rsp(struct context *ctx, struct conn *conn, struct msg *batch,
+          struct msg *rsp)
+{
+    struct msg *member, *next, *mrsp, *pos;
+    struct mbuf *mbuf;
+    rstatus_t status;
+    bool valid;
+
+    ASSERT(!conn->client && !conn->proxy);
+    ASSERT(batch->request && batch->nbatch != 0);
+    ASSERT(!rsp->request);
+
+    if (batch->batch_strict) {
+        ASSERT(conn->batch_reads > 0);
+        conn->batch_reads--;
+    }
+
+    valid = batch_rsp_valid(batch, rsp);
+
+    member = batch->batch_first;
+    batch->batch_first = NULL;
+    batch->nbatch = 0;
+
+    pos = batch_requeue_pos(conn);
+
+    if (!valid) {
+        log_debug(LOG_INFO, "unbatch req %"PRIu64" on s %d, rsp type %d",
+                  batch->id, conn->sd, rsp->type);
+
+        for (; member != NULL; member = next) {
+            next = member->batch_link;
+            member->batch_link = NULL;
+
+            if (member->swallow) {
+                req_put(member);
+                continue;
+            }
+
+            batch_requeue(ctx, conn, pos, member);
+        }
+
+        rsp_put(rsp);
+        req_put(batch);
+        batch_resume(ctx, conn);
+        return;
+    }
+
+    if (batch->type == MSG_REQ_REDIS_MGET) {
+        /* skip over *narg\r\n */
+        mbuf = STAILQ_FIRST(&rsp->mhdr);
+        rsp->mlen -= (uint32_t)(rsp->narg_end + CRLF_LEN - rsp->narg_start);
+        mbuf->pos = rsp->narg_end + CRLF_LEN;
+    }
+
+    status = NC_OK;
+    for (; member != NULL; member = next) {
+        next = member->batch_link;
+        member->batch_link = NULL;
+
+        mrsp = NULL;
+        if (status == NC_OK) {
+            mrsp = msg_get(conn, false, true);
+            if (mrsp == NULL) {
+                status = NC_ENOMEM;
+            }
+        }
+
+        if (status == NC_OK) {
+            if (batch->type == MSG_REQ_REDIS_MGET) {
+                status = redis_copy_bulk(mrsp, rsp);
+                mrsp->type = MSG_RSP_REDIS_BULK;
+
+                /*
+                 * MGET answers nil for a key that holds no string, where
+                 * GET of it fails with WRONGTYPE; so, with
+                 * batch_get_strict, ask again unbatched
+                 */
+                if (status == NC_OK && batch->batch_strict &&
+                    !member->swallow && batch_rsp_nil(mrsp)) {
+                    rsp_put(mrsp);
+                    batch_requeue(ctx, conn, pos, member);
+                    continue;
+                }
+            } else {
+                status = msg_append(mrsp, (uint8_t *)BATCH_STATUS_OK,
+                                    nc_strlen(BATCH_STATUS_OK));
+                mrsp->type = MSG_RSP_REDIS_STATUS;
+            }
+        }
+
+        if (status != NC_OK) {
+            if (mrsp != NULL) {
+                rsp_put(mrsp);
+            }
+            batch_member_fail(member, ENOMEM);
+            continue;
+        }
+
+        mrsp->phase_start = rsp->phase_start;
+        member->send_ts = batch->send_ts;
+        member->slowlog_stime = batch->slowlog_stime;
+
+        batch_member_done(ctx, conn, member, mrsp);
+    }
+
+    rsp_put(rsp);
+    req_put(batch);
+    batch_resume(ctx, conn);
+}
+
+/* fail the members of batch, that will get no reply */
+void
+batch_fail(struct msg *batch)
+{
+    struct msg *member, *next;
+
+    member = batch->batch_first;
+    batch->batch_first = NULL;
+    batch->nbatch = 0;
+
+    for (; member != NULL; member = next) {
+        next = member->batch_link;
+        member->batch_link = NULL;
+        batch_member_fail(member, batch->err);
+    }
+}
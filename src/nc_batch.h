@@ -0,0 +1,47 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _NC_BATCH_H_
+#define _NC_BATCH_H_
+
+#include <nc_core.h>
+
+/*
+ * Batching of single key requests of a redis pool. When a server
+ * connection turns writable, a run of "GET key" (with batch_get) or
+ * "SET key value" (with batch_set) requests waiting next to each other in
+ * its in queue, all for the same cluster slot, is replaced by one MGET or
+ * MSET of at most batch_max keys. So requests routed to a server in the
+ * same event loop iteration reach it as one command, in the order they
+ * were queued.
+ *
+ * The batch is a request without a client, whose members hang off it
+ * through msg->batch_link. Its reply is split into one response for each
+ * member: a bulk of the MGET array or a copy of the MSET status. Any other
+ * reply, like MOVED, ASK or an error, sends the members again one by one,
+ * so that each gets the reply of its own command. With batch_get_strict,
+ * so does a nil bulk of the MGET, which may stand for a key that GET fails
+ * on with WRONGTYPE; and to keep those reads before the writes queued
+ * after them, writes wait on a connection while a get batch on it is not
+ * answered yet. Without it, the nil bulk is the member's response.
+ */
+struct msg *batch_next(struct context *ctx, struct conn *conn, struct msg *msg);
+bool batch_hold(struct conn *conn, struct msg *msg);
+void batch_rsp(struct context *ctx, struct conn *conn, struct msg *batch, struct msg *rsp);
+void batch_fail(struct msg *batch);
+
+#endif
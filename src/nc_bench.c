@@ -0,0 +1,925 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * nc_bench - microbenchmarks of the hot paths of nutcracker: request and
+ * response parsers, key hashes, ketama, redis cluster routing, and the
+ * fragmentation and coalescing of multi-key requests.
+ *
+ * Every benchmark runs the real functions of the proxy on synthetic
+ * messages and topologies, without sockets. Messages are fed to the
+ * parsers one mbuf at a time, as msg_recv_chain does, so the ones larger
+ * than the mbuf size (-m) are parsed over an mbuf chain. Only the measured
+ * section is timed; building and releasing the messages is not.
+ *
+ * A benchmark is run with a growing number of ops until it lasts at least
+ * the minimum time (-t). Results are printed in the go benchmark format,
+ * one line per benchmark and run:
+ *
+ *   Benchmark<name> <ops> <ns> ns/op <allocs> allocs/op
+ *
+ * so that two commits can be compared with tools like benchstat.
+ * Allocations are the nc_alloc and nc_realloc calls made by the measured
+ * section, counted when built with NC_BENCH.
+ */
+
+#include <stdlib.h>
+#include <getopt.h>
+#include <time.h>
+
+#include <nc_core.h>
+#include <nc_server.h>
+#include <nc_script.h>
+#include <nc_hashkit.h>
+#include <nc_proto.h>
+
+#define BENCH_BATCH         256         /* # messages set up at once */
+#define BENCH_NKEY          1024        /* # distinct keys, power of 2 */
+#define BENCH_KEY_LEN       12          /* length of "key:00000000" */
+#define BENCH_MIN_TIME      500         /* default min time in msec */
+#define BENCH_MAX_OPS       1000000000ULL
+#define BENCH_NMASTER       3
+#define BENCH_NREPLICA      1
+
+struct bench_buf {
+    uint8_t *data;
+    size_t  len;
+    size_t  size;
+};
+
+struct bench;
+
+typedef void (*bench_run_t)(struct bench *, uint64_t);
+typedef void (*bench_build_t)(struct bench *, struct bench_buf *);
+
+struct bench {
+    const char       *name;      /* benchmark name */
+    bench_run_t      run;        /* run n ops */
+    bench_build_t    build;      /* message builder */
+    hash_t           hash;       /* key hash */
+    uint32_t         size;       /* key, value or continuum size */
+    uint32_t         nkey;       /* # keys per message */
+    unsigned         redis:1;    /* redis message? */
+    unsigned         request:1;  /* request message? */
+    msg_type_t       type;       /* request type for routing */
+    struct bench_buf msg;        /* message from build */
+};
+
+static struct {
+    int64_t  start;              /* timer start in nsec */
+    int64_t  elapsed;            /* time measured in nsec */
+    uint64_t nalloc_start;       /* nc_nalloc at timer start */
+    uint64_t nalloc;             /* # allocs measured */
+} timer;
+
+static volatile uint64_t bench_sink; /* results, so they are not optimized out */
+
+static uint8_t bench_keys[BENCH_NKEY][BENCH_KEY_LEN + 1];
+static uint8_t bench_value[MBUF_MAX_SIZE / 256];
+
+static struct context bench_ctx;
+static struct server_pool *bench_pool;
+static struct conn *bench_client;
+
+static struct option long_options[] = {
+    { "help",        no_argument,        NULL,   'h' },
+    { "list",        no_argument,        NULL,   'l' },
+    { "bench",       required_argument,  NULL,   'b' },
+    { "time",        required_argument,  NULL,   't' },
+    { "count",       required_argument,  NULL,   'c' },
+    { "mbuf-size",   required_argument,  NULL,   'm' },
+    { NULL,          0,                  NULL,    0  }
+};
+
+static char short_options[] = "hlb:t:c:m:";
+
+static void
+bench_show_usage(void)
+{
+    log_stderr(
+        "Usage: nc_bench [-hl] [-b name] [-t msec] [-c count] [-m mbuf size]" CRLF
+        "" CRLF
+        "Options:" CRLF
+        "  -h, --help             : this help" CRLF
+        "  -l, --list             : list benchmarks and exit" CRLF
+        "  -b, --bench=S          : run benchmarks whose name contains S" CRLF
+        "  -t, --time=N           : min run time per benchmark in msec (default: %d)" CRLF
+        "  -c, --count=N          : run each benchmark N times (default: 1)" CRLF
+        "  -m, --mbuf-size=N      : set size of mbuf chunk in bytes (default: %d bytes)" CRLF
+        "",
+        BENCH_MIN_TIME, MBUF_SIZE);
+}
+
+static int64_t
+bench_nsec_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int64_t)now.tv_sec * 1000000000LL + (int64_t)now.tv_nsec;
+}
+
+static void
+bench_timer_start(void)
+{
+    timer.nalloc_start = nc_nalloc;
+    timer.start = bench_nsec_now();
+}
+
+static void
+bench_timer_stop(void)
+{
+    timer.elapsed += bench_nsec_now() - timer.start;
+    timer.nalloc += nc_nalloc - timer.nalloc_start;
+}
+
+static void
+bench_fail(struct bench *b, const char *reason)
+{
+    log_stderr("nc_bench: %s failed: %s", b->name, reason);
+    exit(1);
+}
+
+/*
+ * Messages
+ */
+
+static void
+bench_append(struct bench_buf *buf, const void *data, size_t len)
+{
+    if (buf->len + len > buf->size) {
+        size_t size = MAX(buf->size * 2, buf->len + len);
+
+        buf->data = nc_realloc(buf->data, size);
+        if (buf->data == NULL) {
+            log_stderr("nc_bench: out of memory");
+            exit(1);
+        }
+        buf->size = size;
+    }
+
+    nc_memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+}
+
+static void
+bench_printf(struct bench_buf *buf, const char *fmt, ...)
+{
+    char line[128];
+    va_list args;
+    int n;
+
+    va_start(args, fmt);
+    n = nc_vscnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+
+    bench_append(buf, line, (size_t)n);
+}
+
+static void
+bench_bulk(struct bench_buf *buf, const uint8_t *data, uint32_t len)
+{
+    bench_printf(buf, "$%"PRIu32"\r\n", len);
+    bench_append(buf, data, len);
+    bench_append(buf, CRLF, CRLF_LEN);
+}
+
+static void
+build_redis_get(struct bench *b, struct bench_buf *buf)
+{
+    bench_printf(buf, "*2\r\n$3\r\nget\r\n");
+    bench_bulk(buf, bench_keys[0], BENCH_KEY_LEN);
+}
+
+static void
+build_redis_set(struct bench *b, struct bench_buf *buf)
+{
+    bench_printf(buf, "*3\r\n$3\r\nset\r\n");
+    bench_bulk(buf, bench_keys[0], BENCH_KEY_LEN);
+    bench_bulk(buf, bench_value, b->size);
+}
+
+static void
+build_redis_mget(struct bench *b, struct bench_buf *buf)
+{
+    uint32_t i;
+
+    bench_printf(buf, "*%"PRIu32"\r\n$4\r\nmget\r\n", b->nkey + 1);
+    for (i = 0; i < b->nkey; i++) {
+        bench_bulk(buf, bench_keys[i], BENCH_KEY_LEN);
+    }
+}
+
+static void
+build_redis_mset(struct bench *b, struct bench_buf *buf)
+{
+    uint32_t i;
+
+    bench_printf(buf, "*%"PRIu32"\r\n$4\r\nmset\r\n", 2 * b->nkey + 1);
+    for (i = 0; i < b->nkey; i++) {
+        bench_bulk(buf, bench_keys[i], BENCH_KEY_LEN);
+        bench_bulk(buf, bench_value, b->size);
+    }
+}
+
+static void
+build_redis_status(struct bench *b, struct bench_buf *buf)
+{
+    bench_printf(buf, "+OK\r\n");
+}
+
+static void
+build_redis_bulk(struct bench *b, struct bench_buf *buf)
+{
+    bench_bulk(buf, bench_value, b->size);
+}
+
+static void
+build_redis_multibulk(struct bench *b, struct bench_buf *buf)
+{
+    uint32_t i;
+
+    bench_printf(buf, "*%"PRIu32"\r\n", b->nkey);
+    for (i = 0; i < b->nkey; i++) {
+        bench_bulk(buf, bench_value, b->size);
+    }
+}
+
+static void
+build_memcache_get(struct bench *b, struct bench_buf *buf)
+{
+    uint32_t i;
+
+    bench_printf(buf, "get");
+    for (i = 0; i < b->nkey; i++) {
+        bench_printf(buf, " %s", bench_keys[i]);
+    }
+    bench_append(buf, CRLF, CRLF_LEN);
+}
+
+static void
+build_memcache_set(struct bench *b, struct bench_buf *buf)
+{
+    bench_printf(buf, "set %s 0 0 %"PRIu32"\r\n", bench_keys[0], b->size);
+    bench_append(buf, bench_value, b->size);
+    bench_append(buf, CRLF, CRLF_LEN);
+}
+
+static void
+build_memcache_stored(struct bench *b, struct bench_buf *buf)
+{
+    bench_printf(buf, "STORED\r\n");
+}
+
+static void
+build_memcache_value(struct bench *b, struct bench_buf *buf)
+{
+    bench_printf(buf, "VALUE %s 0 %"PRIu32"\r\n", bench_keys[0], b->size);
+    bench_append(buf, bench_value, b->size);
+    bench_printf(buf, "\r\nEND\r\n");
+}
+
+static struct msg *
+bench_msg_get(struct bench *b, struct conn *conn, bool request)
+{
+    struct msg *msg;
+
+    msg = msg_get(conn, request, b->redis);
+    if (msg == NULL) {
+        bench_fail(b, "out of memory");
+    }
+
+    return msg;
+}
+
+static void
+bench_msg_put(struct msg *msg)
+{
+    if (msg->peer != NULL) {
+        msg->peer->peer = NULL;
+        msg_put(msg->peer);
+    }
+    msg_put(msg);
+}
+
+/*
+ * Feed data to the parser of msg one mbuf at a time, the way
+ * msg_recv_chain does, and return the parse result
+ */
+static msg_parse_result_t
+bench_feed(struct msg *msg, uint8_t *data, size_t len)
+{
+    struct mbuf *mbuf, *nbuf;
+    size_t n;
+
+    while (len > 0) {
+        mbuf = STAILQ_LAST(&msg->mhdr, mbuf, next);
+        if (mbuf == NULL || mbuf_full(mbuf)) {
+            mbuf = mbuf_get();
+            if (mbuf == NULL) {
+                return MSG_PARSE_ERROR;
+            }
+            mbuf_insert(&msg->mhdr, mbuf);
+            msg->pos = mbuf->pos;
+        }
+
+        n = MIN(len, mbuf_size(mbuf));
+        mbuf_copy(mbuf, data, n);
+        msg->mlen += (uint32_t)n;
+        data += n;
+        len -= n;
+
+        msg->parser(msg);
+
+        switch (msg->result) {
+        case MSG_PARSE_OK:
+            return len == 0 && msg->pos == mbuf->last ? MSG_PARSE_OK :
+                   MSG_PARSE_ERROR;
+
+        case MSG_PARSE_REPAIR:
+            nbuf = mbuf_split(&msg->mhdr, msg->pos, NULL, NULL);
+            if (nbuf == NULL) {
+                return MSG_PARSE_ERROR;
+            }
+            mbuf_insert(&msg->mhdr, nbuf);
+            msg->pos = nbuf->pos;
+            break;
+
+        case MSG_PARSE_AGAIN:
+            break;
+
+        default:
+            return msg->result;
+        }
+    }
+
+    return MSG_PARSE_AGAIN;
+}
+
+static void
+bench_parse_batch(struct bench *b, struct msg **msg, uint32_t n)
+{
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        msg[i] = bench_msg_get(b, bench_client, b->request);
+        if (bench_feed(msg[i], b->msg.data, b->msg.len) != MSG_PARSE_OK) {
+            bench_fail(b, "message does not parse");
+        }
+    }
+}
+
+/*
+ * Benchmarks
+ */
+
+static void
+bench_hash(struct bench *b, uint64_t n)
+{
+    uint8_t keys[BENCH_NKEY][64];
+    uint64_t i;
+    uint32_t sum = 0;
+
+    for (i = 0; i < BENCH_NKEY; i++) {
+        memset(keys[i], 'k', b->size);
+        nc_memcpy(keys[i], bench_keys[i], MIN(b->size, BENCH_KEY_LEN));
+    }
+
+    bench_timer_start();
+    for (i = 0; i < n; i++) {
+        sum += b->hash((char *)keys[i & (BENCH_NKEY - 1)], b->size);
+    }
+    bench_timer_stop();
+
+    bench_sink += sum;
+}
+
+static void
+bench_ketama(struct bench *b, uint64_t n)
+{
+    struct continuum *continuum;
+    uint32_t ncontinuum, hashes[BENCH_NKEY], sum = 0, i;
+    uint64_t op;
+
+    /* points of each server spread over the ring, in hash order */
+    ncontinuum = b->size * 160;
+    continuum = nc_alloc(ncontinuum * sizeof(*continuum));
+    if (continuum == NULL) {
+        bench_fail(b, "out of memory");
+    }
+    for (i = 0; i < ncontinuum; i++) {
+        continuum[i].index = i % b->size;
+        continuum[i].value = (uint32_t)(((uint64_t)i << 32) / ncontinuum);
+    }
+    for (i = 0; i < BENCH_NKEY; i++) {
+        hashes[i] = hash_fnv1a_64((char *)bench_keys[i], BENCH_KEY_LEN) *
+                    2654435761U;
+    }
+
+    bench_timer_start();
+    for (op = 0; op < n; op++) {
+        sum += ketama_dispatch(continuum, ncontinuum,
+                               hashes[op & (BENCH_NKEY - 1)]);
+    }
+    bench_timer_stop();
+
+    bench_sink += sum;
+    nc_free(continuum);
+}
+
+static void
+bench_parse(struct bench *b, uint64_t n)
+{
+    struct msg *msg[BENCH_BATCH];
+    msg_parse_result_t result = MSG_PARSE_OK;
+    uint32_t i, nbatch;
+
+    for (; n > 0; n -= nbatch) {
+        nbatch = (uint32_t)MIN(n, BENCH_BATCH);
+
+        for (i = 0; i < nbatch; i++) {
+            msg[i] = bench_msg_get(b, NULL, b->request);
+        }
+
+        bench_timer_start();
+        for (i = 0; i < nbatch; i++) {
+            if (bench_feed(msg[i], b->msg.data, b->msg.len) != MSG_PARSE_OK) {
+                result = MSG_PARSE_ERROR;
+            }
+        }
+        bench_timer_stop();
+
+        for (i = 0; i < nbatch; i++) {
+            msg_put(msg[i]);
+        }
+
+        if (result != MSG_PARSE_OK) {
+            bench_fail(b, "message does not parse");
+        }
+    }
+}
+
+static void
+bench_routing(struct bench *b, uint64_t n)
+{
+    struct msg *msg;
+    struct conn *conn;
+    uint64_t i;
+    bool found = true;
+
+    msg = bench_msg_get(b, bench_client, true);
+    msg->type = b->type;
+
+    bench_timer_start();
+    for (i = 0; i < n; i++) {
+        uint8_t *key = bench_keys[i & (BENCH_NKEY - 1)];
+
+        conn = redis_routing(&bench_ctx, bench_pool, msg, key, BENCH_KEY_LEN);
+        if (conn == NULL) {
+            found = false;
+        }
+    }
+    bench_timer_stop();
+
+    msg_put(msg);
+
+    if (!found) {
+        bench_fail(b, "no server for a key");
+    }
+}
+
+static void
+bench_fragment_put(struct msg *msg, struct msg_tqh *frag_msgq)
+{
+    struct msg *sub_msg, *tmsg;
+
+    for (sub_msg = TAILQ_FIRST(frag_msgq); sub_msg != NULL; sub_msg = tmsg) {
+        tmsg = TAILQ_NEXT(sub_msg, m_tqe);
+        TAILQ_REMOVE(frag_msgq, sub_msg, m_tqe);
+        bench_msg_put(sub_msg);
+    }
+    bench_msg_put(msg);
+}
+
+static void
+bench_fragment(struct bench *b, uint64_t n)
+{
+    struct msg *msg[BENCH_BATCH];
+    struct msg_tqh frag_msgq[BENCH_BATCH];
+    rstatus_t status = NC_OK;
+    uint32_t i, nbatch;
+
+    for (; n > 0; n -= nbatch) {
+        nbatch = (uint32_t)MIN(n, BENCH_BATCH);
+
+        bench_parse_batch(b, msg, nbatch);
+        for (i = 0; i < nbatch; i++) {
+            TAILQ_INIT(&frag_msgq[i]);
+        }
+
+        bench_timer_start();
+        for (i = 0; i < nbatch; i++) {
+            if (redis_fragment(msg[i], REDIS_CLUSTER_SLOTS,
+                               &frag_msgq[i]) != NC_OK) {
+                status = NC_ERROR;
+            }
+        }
+        bench_timer_stop();
+
+        for (i = 0; i < nbatch; i++) {
+            if (msg[i]->nfrag == 0) {
+                status = NC_ERROR;
+            }
+            bench_fragment_put(msg[i], &frag_msgq[i]);
+        }
+
+        if (status != NC_OK) {
+            bench_fail(b, "fragment");
+        }
+    }
+}
+
+/*
+ * Give every fragment of msg the response a server would send, through
+ * the response parser and pre-coalesce as rsp_forward does, and attach
+ * the client response that post-coalesce fills in
+ */
+static void
+bench_coalesce_setup(struct bench *b, struct msg *msg,
+                     struct msg_tqh *frag_msgq)
+{
+    struct bench_buf buf = { NULL, 0, 0 };
+    struct msg *sub_msg, *rsp;
+    uint32_t i;
+
+    TAILQ_FOREACH(sub_msg, frag_msgq, m_tqe) {
+        rsp = bench_msg_get(b, NULL, false);
+
+        buf.len = 0;
+        if (msg->type == MSG_REQ_REDIS_MGET) {
+            bench_printf(&buf, "*%"PRIu32"\r\n", array_n(sub_msg->keys));
+            for (i = 0; i < array_n(sub_msg->keys); i++) {
+                bench_bulk(&buf, bench_value, b->size);
+            }
+        } else {
+            bench_printf(&buf, "+OK\r\n");
+        }
+        if (bench_feed(rsp, buf.data, buf.len) != MSG_PARSE_OK) {
+            bench_fail(b, "fragment response does not parse");
+        }
+
+        sub_msg->peer = rsp;
+        rsp->peer = sub_msg;
+        redis_pre_coalesce(rsp);
+    }
+
+    rsp = bench_msg_get(b, bench_client, false);
+    msg->peer = rsp;
+    rsp->peer = msg;
+
+    if (buf.data != NULL) {
+        nc_free(buf.data);
+    }
+}
+
+static void
+bench_coalesce(struct bench *b, uint64_t n)
+{
+    struct msg *msg[BENCH_BATCH];
+    struct msg_tqh frag_msgq[BENCH_BATCH];
+    uint32_t i, nbatch;
+    bool error = false;
+
+    for (; n > 0; n -= nbatch) {
+        nbatch = (uint32_t)MIN(n, BENCH_BATCH);
+
+        bench_parse_batch(b, msg, nbatch);
+        for (i = 0; i < nbatch; i++) {
+            TAILQ_INIT(&frag_msgq[i]);
+            if (redis_fragment(msg[i], REDIS_CLUSTER_SLOTS,
+                               &frag_msgq[i]) != NC_OK) {
+                bench_fail(b, "fragment");
+            }
+            bench_coalesce_setup(b, msg[i], &frag_msgq[i]);
+        }
+
+        bench_timer_start();
+        for (i = 0; i < nbatch; i++) {
+            redis_post_coalesce(msg[i]);
+        }
+        bench_timer_stop();
+
+        for (i = 0; i < nbatch; i++) {
+            if (msg[i]->peer->mlen == 0 || bench_client->err != 0) {
+                error = true;
+            }
+            bench_fragment_put(msg[i], &frag_msgq[i]);
+        }
+
+        if (error) {
+            bench_fail(b, "coalesce");
+        }
+    }
+}
+
+#define BENCH_HASH(_name, _hash, _len)                                      \
+    { _name, bench_hash, NULL, _hash, _len, 0, 0, 0, MSG_UNKNOWN, { NULL, 0, 0 } }
+
+#define BENCH_KETAMA(_name, _nserver)                                       \
+    { _name, bench_ketama, NULL, NULL, _nserver, 0, 0, 0, MSG_UNKNOWN, { NULL, 0, 0 } }
+
+#define BENCH_PARSE(_name, _build, _size, _nkey, _redis, _request)          \
+    { _name, bench_parse, _build, NULL, _size, _nkey, _redis, _request,     \
+      MSG_UNKNOWN, { NULL, 0, 0 } }
+
+#define BENCH_ROUTING(_name, _type)                                         \
+    { _name, bench_routing, NULL, NULL, 0, 0, 1, 1, _type, { NULL, 0, 0 } }
+
+#define BENCH_FRAGMENT(_name, _run, _build, _size, _nkey)                   \
+    { _name, _run, _build, NULL, _size, _nkey, 1, 1, MSG_UNKNOWN, { NULL, 0, 0 } }
+
+static struct bench benchmarks[] = {
+    BENCH_HASH("hash_crc16/16", hash_crc16, 16),
+    BENCH_HASH("hash_crc16/64", hash_crc16, 64),
+    BENCH_HASH("hash_fnv1a_64/16", hash_fnv1a_64, 16),
+    BENCH_HASH("hash_fnv1a_64/64", hash_fnv1a_64, 64),
+    BENCH_HASH("hash_murmur/16", hash_murmur, 16),
+    BENCH_HASH("hash_murmur/64", hash_murmur, 64),
+
+    BENCH_KETAMA("ketama_dispatch/10", 10),
+    BENCH_KETAMA("ketama_dispatch/100", 100),
+
+    BENCH_PARSE("redis_parse_req/get", build_redis_get, 0, 1, 1, 1),
+    BENCH_PARSE("redis_parse_req/set_16", build_redis_set, 16, 1, 1, 1),
+    BENCH_PARSE("redis_parse_req/set_64k", build_redis_set, 65536, 1, 1, 1),
+    BENCH_PARSE("redis_parse_req/mget_10", build_redis_mget, 0, 10, 1, 1),
+    BENCH_PARSE("redis_parse_req/mget_100", build_redis_mget, 0, 100, 1, 1),
+    BENCH_PARSE("redis_parse_req/mset_10", build_redis_mset, 16, 10, 1, 1),
+    BENCH_PARSE("redis_parse_rsp/status", build_redis_status, 0, 0, 1, 0),
+    BENCH_PARSE("redis_parse_rsp/bulk_16", build_redis_bulk, 16, 0, 1, 0),
+    BENCH_PARSE("redis_parse_rsp/bulk_64k", build_redis_bulk, 65536, 0, 1, 0),
+    BENCH_PARSE("redis_parse_rsp/multibulk_10", build_redis_multibulk, 16, 10, 1, 0),
+    BENCH_PARSE("redis_parse_rsp/multibulk_100", build_redis_multibulk, 16, 100, 1, 0),
+
+    BENCH_PARSE("memcache_parse_req/get", build_memcache_get, 0, 1, 0, 1),
+    BENCH_PARSE("memcache_parse_req/get_10", build_memcache_get, 0, 10, 0, 1),
+    BENCH_PARSE("memcache_parse_req/set_16", build_memcache_set, 16, 0, 0, 1),
+    BENCH_PARSE("memcache_parse_req/set_64k", build_memcache_set, 65536, 0, 0, 1),
+    BENCH_PARSE("memcache_parse_rsp/stored", build_memcache_stored, 0, 0, 0, 0),
+    BENCH_PARSE("memcache_parse_rsp/value_16", build_memcache_value, 16, 0, 0, 0),
+    BENCH_PARSE("memcache_parse_rsp/value_64k", build_memcache_value, 65536, 0, 0, 0),
+
+    BENCH_ROUTING("redis_routing/read", MSG_REQ_REDIS_GET),
+    BENCH_ROUTING("redis_routing/write", MSG_REQ_REDIS_SET),
+
+    BENCH_FRAGMENT("redis_fragment/mget_10", bench_fragment, build_redis_mget, 16, 10),
+    BENCH_FRAGMENT("redis_fragment/mget_100", bench_fragment, build_redis_mget, 16, 100),
+    BENCH_FRAGMENT("redis_fragment/mset_10", bench_fragment, build_redis_mset, 16, 10),
+    BENCH_FRAGMENT("redis_post_coalesce/mget_10", bench_coalesce, build_redis_mget, 16, 10),
+    BENCH_FRAGMENT("redis_post_coalesce/mget_100", bench_coalesce, build_redis_mget, 16, 100),
+    BENCH_FRAGMENT("redis_post_coalesce/mset_10", bench_coalesce, build_redis_mset, 16, 10),
+};
+
+/*
+ * A redis cluster pool of BENCH_NMASTER masters with BENCH_NREPLICA
+ * readable replicas each, the slots split evenly, and one established
+ * connection per server, so that routing never connects
+ */
+static rstatus_t
+bench_pool_init(void)
+{
+    struct server_pool *pool;
+    struct replicaset *rs;
+    struct server *server, **ps;
+    char name[NC_ADDR_DESC_LEN];
+    struct conn *conn;
+    uint32_t i, j, slot;
+
+    pool = nc_zalloc(sizeof(*pool));
+    if (pool == NULL) {
+        return NC_ENOMEM;
+    }
+
+    string_set_text(&pool->name, "bench");
+    string_init(&pool->hash_tag);
+    string_init(&pool->redis_auth);
+    TAILQ_INIT(&pool->c_conn_q);
+    pool->key_hash_type = HASH_CRC16;
+    pool->key_hash = hash_crc16;
+    pool->redis = 1;
+    pool->rediscluster = 1;
+    pool->server_connections = 1;
+
+    if (array_init(&pool->server, BENCH_NMASTER * (1 + BENCH_NREPLICA),
+                   sizeof(struct server *)) != NC_OK) {
+        return NC_ENOMEM;
+    }
+
+    for (i = 0; i < BENCH_NMASTER; i++) {
+        rs = ffi_replicaset_new();
+        if (rs == NULL) {
+            return NC_ENOMEM;
+        }
+
+        for (j = 0; j <= BENCH_NREPLICA; j++) {
+            nc_snprintf(name, sizeof(name), "127.0.0.1:%d",
+                        7000 + i + j * BENCH_NMASTER);
+            server = ffi_server_new(pool, name, name, "127.0.0.1",
+                                    (int)(7000 + i + j * BENCH_NMASTER));
+            if (server == NULL) {
+                return NC_ERROR;
+            }
+
+            conn = conn_get(server, false, true);
+            if (conn == NULL) {
+                return NC_ENOMEM;
+            }
+            conn->sd = INT_MAX;     /* connected, never used for io */
+
+            ps = array_push(&pool->server);
+            *ps = server;
+
+            if (j == 0) {
+                ffi_replicaset_set_master(rs, server);
+            } else {
+                ffi_replicaset_add_tagged_server(rs, 0, server);
+            }
+        }
+
+        for (slot = i * REDIS_CLUSTER_SLOTS / BENCH_NMASTER;
+             slot < (i + 1) * REDIS_CLUSTER_SLOTS / BENCH_NMASTER; slot++) {
+            pool->slots[slot] = rs;
+        }
+    }
+
+    bench_client = conn_get(pool, true, true);
+    if (bench_client == NULL) {
+        return NC_ENOMEM;
+    }
+
+    bench_pool = pool;
+
+    return NC_OK;
+}
+
+static bool
+bench_match(struct bench *b, const char *filter)
+{
+    return filter == NULL || strstr(b->name, filter) != NULL;
+}
+
+static void
+bench_one(struct bench *b, int64_t min_time)
+{
+    uint64_t n = 1, next;
+
+    if (b->build != NULL && b->msg.data == NULL) {
+        b->build(b, &b->msg);
+    }
+
+    for (;;) {
+        timer.elapsed = 0;
+        timer.nalloc = 0;
+
+        b->run(b, n);
+
+        if (timer.elapsed >= min_time || n >= BENCH_MAX_OPS) {
+            break;
+        }
+
+        /* aim 20% over min time, growing at most 100x per round */
+        next = timer.elapsed > 0 ?
+               (uint64_t)((double)n * 1.2 * (double)min_time /
+                          (double)timer.elapsed) : n * 100;
+        next = MIN(next, n * 100);
+        n = MIN(MAX(next, n + 1), BENCH_MAX_OPS);
+    }
+
+    printf("Benchmark%s\t%10"PRIu64"\t%12.2f ns/op\t%8.2f allocs/op\n",
+           b->name, n, (double)timer.elapsed / (double)n,
+           (double)timer.nalloc / (double)n);
+    fflush(stdout);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct instance nci;
+    char *filter = NULL;
+    int64_t min_time = BENCH_MIN_TIME;
+    long count = 1, i;
+    bool list = false;
+    uint32_t k;
+    size_t j;
+    int c;
+
+    memset(&nci, 0, sizeof(nci));
+    nci.log_level = LOG_NOTICE;
+    nci.mbuf_chunk_size = MBUF_SIZE;
+
+    for (;;) {
+        c = getopt_long(argc, argv, short_options, long_options, NULL);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+        case 'h':
+            bench_show_usage();
+            exit(0);
+
+        case 'l':
+            list = true;
+            break;
+
+        case 'b':
+            filter = optarg;
+            break;
+
+        case 't':
+            min_time = nc_atoi(optarg, strlen(optarg));
+            if (min_time <= 0) {
+                log_stderr("nc_bench: option -t requires a positive number");
+                exit(1);
+            }
+            break;
+
+        case 'c':
+            count = nc_atoi(optarg, strlen(optarg));
+            if (count <= 0) {
+                log_stderr("nc_bench: option -c requires a positive number");
+                exit(1);
+            }
+            break;
+
+        case 'm':
+            c = nc_atoi(optarg, strlen(optarg));
+            if (c < MBUF_MIN_SIZE || c > MBUF_MAX_SIZE) {
+                log_stderr("nc_bench: mbuf chunk size must be between %d and"
+                           " %d bytes", MBUF_MIN_SIZE, MBUF_MAX_SIZE);
+                exit(1);
+            }
+            nci.mbuf_chunk_size = (size_t)c;
+            break;
+
+        default:
+            bench_show_usage();
+            exit(1);
+        }
+    }
+
+    if (list) {
+        for (j = 0; j < NELEMS(benchmarks); j++) {
+            printf("%s\n", benchmarks[j].name);
+        }
+        exit(0);
+    }
+
+    if (log_init(&nci) < 0) {
+        exit(1);
+    }
+
+    mbuf_init(&nci);
+    msg_init();
+    conn_init();
+
+    for (k = 0; k < BENCH_NKEY; k++) {
+        nc_snprintf(bench_keys[k], sizeof(bench_keys[k]), "key:%08"PRIu32"",
+                    k);
+    }
+    memset(bench_value, 'v', sizeof(bench_value));
+
+    if (bench_pool_init() != NC_OK) {
+        log_stderr("nc_bench: failed to set up the redis cluster pool");
+        exit(1);
+    }
+
+    printf("# mbuf_size: %zu, min_time: %"PRId64" msec\n", nci.mbuf_chunk_size,
+           min_time);
+
+    for (j = 0; j < NELEMS(benchmarks); j++) {
+        if (!bench_match(&benchmarks[j], filter)) {
+            continue;
+        }
+        for (i = 0; i < count; i++) {
+            bench_one(&benchmarks[j], min_time * 1000000LL);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,355 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <signal.h>
+#include <fcntl.h>
+
+#include <nc_core.h>
+#include <nc_capture.h>
+
+struct capture_buf {
+    uint8_t  *data;                        /* CAPTURE_BUF_SIZE bytes */
+    size_t   len;                          /* # bytes used */
+    unsigned reopen:1;                     /* reopen the file before writing? */
+};
+
+/*
+ * buf[0] is filled by the event loop and buf[1] is written out by the
+ * writer thread; the event loop swaps them under mutex once buf[1] has
+ * been emptied
+ */
+static struct {
+    char               *filename;          /* capture file, NULL if disabled */
+    int                fd;                 /* capture file descriptor */
+    int64_t            start;              /* capture start in usec */
+    struct capture_buf buf[2];             /* active and written out buffer */
+    pthread_mutex_t    mutex;              /* guards swapping buf[] */
+    pthread_cond_t     cond;               /* buf[1] filled or done */
+    pthread_t          tid;                /* writer thread */
+    unsigned           done:1;             /* writer thread to exit? */
+    uint64_t           nrecord;            /* # requests captured */
+    uint64_t           ndrop;              /* # requests dropped */
+    uint64_t           ndrop_logged;       /* # requests dropped, last logged */
+} capture;
+
+static volatile sig_atomic_t capture_reopen_tag;
+
+static void
+capture_write(int fd, uint8_t *data, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_error("write to capture file '%s' failed: %s",
+                      capture.filename, strerror(errno));
+            return;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+}
+
+static void *
+capture_loop(void *arg)
+{
+    struct capture_buf *b = &capture.buf[1];
+    int fd;
+
+    for (;;) {
+        pthread_mutex_lock(&capture.mutex);
+        while (b->len == 0 && !capture.done) {
+            pthread_cond_wait(&capture.cond, &capture.mutex);
+        }
+        if (b->len == 0) {
+            pthread_mutex_unlock(&capture.mutex);
+            break;
+        }
+        pthread_mutex_unlock(&capture.mutex);
+
+        if (b->reopen) {
+            fd = open(capture.filename, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+            if (fd < 0) {
+                log_error("reopening capture file '%s' failed, ignored: %s",
+                          capture.filename, strerror(errno));
+            } else {
+                close(capture.fd);
+                capture.fd = fd;
+            }
+        }
+
+        capture_write(capture.fd, b->data, b->len);
+
+        pthread_mutex_lock(&capture.mutex);
+        b->len = 0;
+        b->reopen = 0;
+        pthread_mutex_unlock(&capture.mutex);
+    }
+
+    return NULL;
+}
+
+/*
+ * Hand buf[0] to the writer thread if it is done with buf[1]. Never
+ * blocks the event loop; returns false when the buffers cannot be swapped
+ */
+static bool
+capture_swap(void)
+{
+    struct capture_buf tmp;
+    bool swapped = false;
+
+    if (pthread_mutex_trylock(&capture.mutex) != 0) {
+        return false;
+    }
+
+    if (capture.buf[1].len == 0 && capture.buf[0].len > 0) {
+        tmp = capture.buf[0];
+        capture.buf[0] = capture.buf[1];
+        capture.buf[1] = tmp;
+        pthread_cond_signal(&capture.cond);
+        swapped = true;
+    }
+
+    pthread_mutex_unlock(&capture.mutex);
+
+    return swapped;
+}
+
+static void
+capture_copy(const void *data, size_t len)
+{
+    struct capture_buf *b = &capture.buf[0];
+
+    ASSERT(b->len + len <= CAPTURE_BUF_SIZE);
+
+    nc_memcpy(b->data + b->len, data, len);
+    b->len += len;
+}
+
+/* start a new capture in buf[0]: the header and one record per pool */
+static void
+capture_start(struct context *ctx)
+{
+    struct capture_hdr hdr;
+    struct capture_rec rec;
+    uint32_t i, npool;
+
+    capture.start = nc_usec_now();
+
+    nc_memcpy(hdr.magic, CAPTURE_MAGIC, sizeof(hdr.magic));
+    hdr.version = CAPTURE_VERSION;
+    hdr.reserved = 0;
+    hdr.start = capture.start;
+    capture_copy(&hdr, sizeof(hdr));
+
+    for (i = 0, npool = array_n(&ctx->pool); i < npool; i++) {
+        struct server_pool *pool = array_get(&ctx->pool, i);
+
+        rec.type = CAPTURE_REC_POOL;
+        rec.redis = pool->redis ? 1 : 0;
+        rec.pool = (uint16_t)pool->idx;
+        rec.len = pool->name.len + 1 + pool->addrstr.len;
+        rec.usec = 0;
+        rec.conn = 0;
+        capture_copy(&rec, sizeof(rec));
+        capture_copy(pool->name.data, pool->name.len);
+        capture_copy("", 1);
+        capture_copy(pool->addrstr.data, pool->addrstr.len);
+    }
+}
+
+rstatus_t
+capture_init(struct context *ctx, char *filename)
+{
+    uint32_t i, npool;
+    int status;
+
+    capture.filename = NULL;
+    capture.fd = -1;
+
+    if (filename == NULL) {
+        for (i = 0, npool = array_n(&ctx->pool); i < npool; i++) {
+            struct server_pool *pool = array_get(&ctx->pool, i);
+
+            if (pool->capture_sample_rate != 0) {
+                log_warn("capture_sample_rate of pool '%.*s' ignored, no "
+                         "capture file given", pool->name.len,
+                         pool->name.data);
+                pool->capture_sample_rate = 0;
+            }
+        }
+        return NC_OK;
+    }
+
+    capture.fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (capture.fd < 0) {
+        log_error("opening capture file '%s' failed: %s", filename,
+                  strerror(errno));
+        return NC_ERROR;
+    }
+
+    for (i = 0; i < NELEMS(capture.buf); i++) {
+        capture.buf[i].data = nc_alloc(CAPTURE_BUF_SIZE);
+        if (capture.buf[i].data == NULL) {
+            close(capture.fd);
+            capture.fd = -1;
+            return NC_ENOMEM;
+        }
+        capture.buf[i].len = 0;
+        capture.buf[i].reopen = 0;
+    }
+
+    pthread_mutex_init(&capture.mutex, NULL);
+    pthread_cond_init(&capture.cond, NULL);
+    capture.done = 0;
+    capture.nrecord = 0;
+    capture.ndrop = 0;
+    capture.ndrop_logged = 0;
+    capture.filename = filename;
+
+    capture_start(ctx);
+
+    status = pthread_create(&capture.tid, NULL, capture_loop, NULL);
+    if (status != 0) {
+        log_error("capture writer create failed: %s", strerror(status));
+        capture.filename = NULL;
+        close(capture.fd);
+        capture.fd = -1;
+        return NC_ERROR;
+    }
+
+    loga("capturing requests to '%s'", filename);
+
+    return NC_OK;
+}
+
+void
+capture_deinit(void)
+{
+    uint32_t i;
+
+    if (capture.filename == NULL) {
+        return;
+    }
+
+    /* flush what the event loop captured, then stop the writer */
+    while (capture.buf[0].len > 0) {
+        if (!capture_swap()) {
+            usleep(1000);
+        }
+    }
+
+    pthread_mutex_lock(&capture.mutex);
+    capture.done = 1;
+    pthread_cond_signal(&capture.cond);
+    pthread_mutex_unlock(&capture.mutex);
+
+    pthread_join(capture.tid, NULL);
+
+    close(capture.fd);
+    capture.fd = -1;
+
+    for (i = 0; i < NELEMS(capture.buf); i++) {
+        nc_free(capture.buf[i].data);
+    }
+
+    loga("captured %"PRIu64" requests to '%s', dropped %"PRIu64"",
+         capture.nrecord, capture.filename, capture.ndrop);
+
+    capture.filename = NULL;
+}
+
+/*
+ * Append the request msg received on client conn of pool to the capture,
+ * stamped with the event loop clock. The request is dropped when it does
+ * not fit in buf[0] and the writer thread is still busy with buf[1]. AUTH
+ * is never captured, so no password lands on disk; nc_replay sends its own.
+ */
+void
+capture_request(struct server_pool *pool, struct conn *conn, struct msg *msg)
+{
+    struct capture_rec rec;
+    struct mbuf *mbuf;
+    size_t size;
+
+    if (capture.filename == NULL || msg->type == MSG_REQ_REDIS_AUTH) {
+        return;
+    }
+
+    size = sizeof(rec) + msg->mlen;
+    if (capture.buf[0].len + size > CAPTURE_BUF_SIZE &&
+        (size > CAPTURE_BUF_SIZE || !capture_swap())) {
+        capture.ndrop++;
+        return;
+    }
+
+    rec.type = CAPTURE_REC_REQ;
+    rec.redis = pool->redis ? 1 : 0;
+    rec.pool = (uint16_t)pool->idx;
+    rec.len = msg->mlen;
+    rec.usec = MAX(nc_loop_usec() - capture.start, 0);
+    rec.conn = conn->id;
+    capture_copy(&rec, sizeof(rec));
+
+    STAILQ_FOREACH(mbuf, &msg->mhdr, next) {
+        capture_copy(mbuf->pos, mbuf_length(mbuf));
+    }
+
+    capture.nrecord++;
+}
+
+/* called every tick on the event loop */
+void
+capture_cron(struct context *ctx)
+{
+    if (capture.filename == NULL) {
+        return;
+    }
+
+    if (capture_reopen_tag) {
+        /* the old file gets everything captured so far */
+        if (capture.buf[0].len > 0 && !capture_swap()) {
+            return;
+        }
+        capture_reopen_tag = 0;
+
+        capture.buf[0].reopen = 1;
+        capture_start(ctx);
+        loga("reopening capture file '%s'", capture.filename);
+    } else {
+        capture_swap();
+    }
+
+    if (capture.ndrop != capture.ndrop_logged) {
+        log_warn("capture dropped %"PRIu64" requests, writing to '%s' falls "
+                 "behind", capture.ndrop - capture.ndrop_logged,
+                 capture.filename);
+        capture.ndrop_logged = capture.ndrop;
+    }
+}
+
+/* signal handler: reopen the capture file on the next tick */
+void
+capture_reopen(void)
+{
+    capture_reopen_tag = 1;
+}
@@ -0,0 +1,71 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _NC_CAPTURE_H_
+#define _NC_CAPTURE_H_
+
+#include <nc_core.h>
+
+/*
+ * Traffic capture. One in every capture_sample_rate requests of a pool is
+ * copied, as received from the client, into the capture file given with
+ * --capture-file, for bench/nc_replay to play back.
+ *
+ * The event loop appends records to the active one of two buffers; a
+ * writer thread writes the other one out. Recording is a memcpy into
+ * the active buffer, never a syscall or an allocation. When both buffers
+ * are full, records are dropped and counted instead of stalling the loop.
+ *
+ * The file starts with a struct capture_hdr and is followed by records,
+ * each a struct capture_rec and then len bytes of data. Integers are in
+ * host byte order. The header is followed by one pool record per pool,
+ * data "<name>\0<listen address>", and then by request records carrying
+ * the request bytes. SIGHUP reopens the file, which then starts over with
+ * a header and the pool records.
+ */
+#define CAPTURE_MAGIC       "NCCAPTUR"
+#define CAPTURE_VERSION     1
+#define CAPTURE_BUF_SIZE    (4 * 1024 * 1024)
+
+typedef enum capture_rec_type {
+    CAPTURE_REC_POOL = 1,                  /* pool index to name and address */
+    CAPTURE_REC_REQ  = 2,                  /* client request */
+} capture_rec_type_t;
+
+struct capture_hdr {
+    uint8_t  magic[8];                     /* CAPTURE_MAGIC */
+    uint32_t version;                      /* CAPTURE_VERSION */
+    uint32_t reserved;                     /* zero */
+    int64_t  start;                        /* capture start in usec since epoch */
+};
+
+struct capture_rec {
+    uint8_t  type;                         /* capture_rec_type_t */
+    uint8_t  redis;                        /* redis (1) or memcache (0) pool? */
+    uint16_t pool;                         /* pool index */
+    uint32_t len;                          /* # data bytes that follow */
+    int64_t  usec;                         /* usec since capture start */
+    uint64_t conn;                         /* client connection id */
+};
+
+rstatus_t capture_init(struct context *ctx, char *filename);
+void capture_deinit(void);
+void capture_request(struct server_pool *pool, struct conn *conn, struct msg *msg);
+void capture_cron(struct context *ctx);
+void capture_reopen(void);
+
+#endif
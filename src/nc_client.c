@@ -129,6 +129,8 @@ client_close(struct context *ctx, struct conn *conn)
 
     client_close_stats(ctx, conn->owner, conn->err, conn->eof);
 
+    ratelimit_detach(ctx, conn);
+
     if (conn->sd < 0) {
         conn->unref(conn);
         conn_put(conn);
@@ -167,6 +169,11 @@ client_close(struct context *ctx, struct conn *conn)
         } else {
             msg->swallow = 1;
 
+            /* the owner goes now, its pending near cache entry with it */
+            if (msg->nearcache) {
+                nearcache_abort(conn->owner, msg);
+            }
+
             ASSERT(msg->request);
             ASSERT(msg->peer == NULL);
 
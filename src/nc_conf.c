@@ -158,6 +158,142 @@ static struct command conf_commands[] = {
       conf_set_num,
       offsetof(struct conf_pool, slowlog_slower_than) },
 
+    { string("slowlog_max_len"),
+      conf_set_num,
+      offsetof(struct conf_pool, slowlog_max_len) },
+
+    { string("slowlog_log"),
+      conf_set_bool,
+      offsetof(struct conf_pool, slowlog_log) },
+
+    { string("trace_sample_rate"),
+      conf_set_num,
+      offsetof(struct conf_pool, trace_sample_rate) },
+
+    { string("capture_sample_rate"),
+      conf_set_num,
+      offsetof(struct conf_pool, capture_sample_rate) },
+
+    { string("hotkey_max_len"),
+      conf_set_num,
+      offsetof(struct conf_pool, hotkey_max_len) },
+
+    { string("hotkey_sample_rate"),
+      conf_set_num,
+      offsetof(struct conf_pool, hotkey_sample_rate) },
+
+    { string("slot_stats"),
+      conf_set_bool,
+      offsetof(struct conf_pool, slot_stats) },
+
+    { string("bigkey_threshold"),
+      conf_set_num,
+      offsetof(struct conf_pool, bigkey_threshold) },
+
+    { string("bigkey_max_len"),
+      conf_set_num,
+      offsetof(struct conf_pool, bigkey_max_len) },
+
+    { string("nearcache_max_memory"),
+      conf_set_num,
+      offsetof(struct conf_pool, nearcache_max_memory) },
+
+    { string("nearcache_ttl"),
+      conf_set_num,
+      offsetof(struct conf_pool, nearcache_ttl) },
+
+    { string("nearcache_tracking"),
+      conf_set_bool,
+      offsetof(struct conf_pool, nearcache_tracking) },
+
+    { string("nearcache_commands"),
+      conf_set_string,
+      offsetof(struct conf_pool, nearcache_commands) },
+
+    { string("singleflight_commands"),
+      conf_set_string,
+      offsetof(struct conf_pool, singleflight_commands) },
+
+    { string("batch_get"),
+      conf_set_bool,
+      offsetof(struct conf_pool, batch_get) },
+
+    { string("batch_get_strict"),
+      conf_set_bool,
+      offsetof(struct conf_pool, batch_get_strict) },
+
+    { string("batch_set"),
+      conf_set_bool,
+      offsetof(struct conf_pool, batch_set) },
+
+    { string("batch_max"),
+      conf_set_num,
+      offsetof(struct conf_pool, batch_max) },
+
+    { string("hedge_after_ms"),
+      conf_set_num,
+      offsetof(struct conf_pool, hedge_after_ms) },
+
+    { string("hedge_budget"),
+      conf_set_num,
+      offsetof(struct conf_pool, hedge_budget) },
+
+    { string("retry_reads"),
+      conf_set_bool,
+      offsetof(struct conf_pool, retry_reads) },
+
+    { string("health_check_interval"),
+      conf_set_num,
+      offsetof(struct conf_pool, health_check_interval) },
+
+    { string("health_check_failures"),
+      conf_set_num,
+      offsetof(struct conf_pool, health_check_failures) },
+
+    { string("health_latency_factor"),
+      conf_set_num,
+      offsetof(struct conf_pool, health_latency_factor) },
+
+    { string("concurrency_limit"),
+      conf_set_num,
+      offsetof(struct conf_pool, concurrency_limit) },
+
+    { string("concurrency_latency"),
+      conf_set_num,
+      offsetof(struct conf_pool, concurrency_latency) },
+
+    { string("concurrency_queue"),
+      conf_set_num,
+      offsetof(struct conf_pool, concurrency_queue) },
+
+    { string("rate_limit_requests"),
+      conf_set_num,
+      offsetof(struct conf_pool, rate_limit_requests) },
+
+    { string("rate_limit_bytes"),
+      conf_set_num,
+      offsetof(struct conf_pool, rate_limit_bytes) },
+
+    { string("rate_limit_prefix"),
+      conf_set_num,
+      offsetof(struct conf_pool, rate_limit_prefix) },
+
+    { string("rate_limit_reject"),
+      conf_set_bool,
+      offsetof(struct conf_pool, rate_limit_reject) },
+
+    { string("slow_lane_commands"),
+      conf_set_string,
+      offsetof(struct conf_pool, slow_lane_commands) },
+
+    { string("slow_lane_connections"),
+      conf_set_num,
+      offsetof(struct conf_pool, slow_lane_connections) },
+
+    { string("slow_lane_limit"),
+      conf_set_num,
+      offsetof(struct conf_pool, slow_lane_limit) },
+
     null_command
 };
 
@@ -223,6 +359,16 @@ conf_server_each_transform(void *elem, void *data)
     s->auto_ban_flag = false;
     s->lift_ban_time = 0LL;
 
+    s->tracker = NULL;
+
+    s->health_ts = 0LL;
+    s->health_id = 0;
+    s->health_rtt = 0LL;
+    s->health_failures = 0;
+    s->health_demoted = 0;
+
+    server_lane_init(s, NULL);
+
     log_debug(LOG_VERB, "transform to server %"PRIu32" '%.*s'",
               s->idx, s->pname.len, s->pname.data);
 
@@ -271,6 +417,40 @@ conf_pool_init(struct conf_pool *cp, struct string *name)
     cp->whitelist_interval = CONF_UNSET_NUM;
     cp->slowlog = CONF_UNSET_NUM;
     cp->slowlog_slower_than = CONF_UNSET_NUM;
+    cp->slowlog_max_len = CONF_UNSET_NUM;
+    cp->slowlog_log = CONF_UNSET_NUM;
+    cp->trace_sample_rate = CONF_UNSET_NUM;
+    cp->capture_sample_rate = CONF_UNSET_NUM;
+    cp->hotkey_max_len = CONF_UNSET_NUM;
+    cp->hotkey_sample_rate = CONF_UNSET_NUM;
+    cp->slot_stats = CONF_UNSET_NUM;
+    cp->bigkey_threshold = CONF_UNSET_NUM;
+    cp->bigkey_max_len = CONF_UNSET_NUM;
+    cp->nearcache_max_memory = CONF_UNSET_NUM;
+    cp->nearcache_ttl = CONF_UNSET_NUM;
+    cp->nearcache_tracking = CONF_UNSET_NUM;
+    string_init(&cp->nearcache_commands);
+    string_init(&cp->singleflight_commands);
+    cp->batch_get = CONF_UNSET_NUM;
+    cp->batch_get_strict = CONF_UNSET_NUM;
+    cp->batch_set = CONF_UNSET_NUM;
+    cp->batch_max = CONF_UNSET_NUM;
+    cp->hedge_after_ms = CONF_UNSET_NUM;
+    cp->hedge_budget = CONF_UNSET_NUM;
+    cp->retry_reads = CONF_UNSET_NUM;
+    cp->health_check_interval = CONF_UNSET_NUM;
+    cp->health_check_failures = CONF_UNSET_NUM;
+    cp->health_latency_factor = CONF_UNSET_NUM;
+    cp->concurrency_limit = CONF_UNSET_NUM;
+    cp->concurrency_latency = CONF_UNSET_NUM;
+    cp->concurrency_queue = CONF_UNSET_NUM;
+    cp->rate_limit_requests = CONF_UNSET_NUM;
+    cp->rate_limit_bytes = CONF_UNSET_NUM;
+    cp->rate_limit_prefix = CONF_UNSET_NUM;
+    cp->rate_limit_reject = CONF_UNSET_NUM;
+    string_init(&cp->slow_lane_commands);
+    cp->slow_lane_connections = CONF_UNSET_NUM;
+    cp->slow_lane_limit = CONF_UNSET_NUM;
 
     array_null(&cp->server);
 
@@ -304,6 +484,9 @@ conf_pool_deinit(struct conf_pool *cp)
     string_deinit(&cp->zone);
     string_deinit(&cp->env);
     string_deinit(&cp->whitelist);
+    string_deinit(&cp->nearcache_commands);
+    string_deinit(&cp->singleflight_commands);
+    string_deinit(&cp->slow_lane_commands);
 
     if (cp->redis_auth.len > 0) {
         string_deinit(&cp->redis_auth);
@@ -374,6 +557,53 @@ conf_pool_each_transform(void *elem, void *data)
     sp->backlog = cp->backlog;
     sp->slowlog = cp->slowlog? 1 : 0;
     sp->slowlog_slower_than = cp->slowlog_slower_than;
+    sp->slowlog_max_len = (uint32_t)cp->slowlog_max_len;
+    sp->slowlog_log = cp->slowlog_log ? 1 : 0;
+    memset(&sp->slowlog_ring, 0, sizeof(sp->slowlog_ring));
+    sp->trace_sample_rate = (uint32_t)cp->trace_sample_rate;
+    sp->trace_countdown = sp->trace_sample_rate;
+    sp->capture_sample_rate = (uint32_t)cp->capture_sample_rate;
+    sp->capture_countdown = sp->capture_sample_rate;
+    sp->hotkey_max_len = (uint32_t)cp->hotkey_max_len;
+    sp->hotkey_sample_rate = (uint32_t)cp->hotkey_sample_rate;
+    sp->hotkey = NULL;
+    sp->slot_stats = cp->slot_stats ? 1 : 0;
+    sp->slot_stat = NULL;
+    sp->slot_stat_since = 0;
+    sp->bigkey_threshold = (uint32_t)cp->bigkey_threshold;
+    sp->bigkey_max_len = (uint32_t)cp->bigkey_max_len;
+    sp->nearcache_max_memory = (uint32_t)cp->nearcache_max_memory;
+    sp->nearcache_ttl = (int64_t)cp->nearcache_ttl * 1000LL;
+    sp->nearcache_tracking = cp->nearcache_tracking ? 1 : 0;
+    sp->nearcache_commands = cp->nearcache_commands;
+    sp->nearcache = NULL;
+    sp->singleflight_commands = cp->singleflight_commands;
+    sp->singleflight = NULL;
+    sp->batch_get = cp->batch_get ? 1 : 0;
+    sp->batch_get_strict = cp->batch_get_strict ? 1 : 0;
+    sp->batch_set = cp->batch_set ? 1 : 0;
+    sp->batch_max = (uint32_t)cp->batch_max;
+    sp->hedge_after = (uint32_t)cp->hedge_after_ms;
+    sp->hedge_budget = (uint32_t)cp->hedge_budget;
+    sp->hedge_credit = 0;
+    sp->retry_reads = cp->retry_reads ? 1 : 0;
+    sp->health_interval = (int64_t)cp->health_check_interval * 1000LL;
+    sp->health_failures = (uint32_t)cp->health_check_failures;
+    sp->health_latency_factor = (uint32_t)cp->health_latency_factor;
+    sp->health_next = 0LL;
+    sp->limit_max = (uint32_t)cp->concurrency_limit;
+    sp->limit_latency = (int64_t)cp->concurrency_latency * 1000LL;
+    sp->limit_queue = (uint32_t)cp->concurrency_queue;
+    sp->rate_requests = (uint32_t)cp->rate_limit_requests;
+    sp->rate_bytes = (uint32_t)cp->rate_limit_bytes;
+    sp->rate_prefix = (uint32_t)cp->rate_limit_prefix;
+    sp->rate_reject = cp->rate_limit_reject ? 1 : 0;
+    sp->ratelimit = NULL;
+    sp->slow_lane_commands = cp->slow_lane_commands;
+    sp->slow_lane_connections = (uint32_t)cp->slow_lane_connections;
+    sp->slow_lane_limit = (uint32_t)cp->slow_lane_limit;
+    sp->slow_lane = 0;
+    memset(sp->slow_cmd, 0, sizeof(sp->slow_cmd));
 
     sp->client_connections = (uint32_t)cp->client_connections;
 
@@ -449,6 +679,49 @@ conf_dump(struct conf *cf)
         nserver = array_n(&cp->server);
         log_debug(LOG_VVERB, "  slowlog: %d", cp->slowlog);
         log_debug(LOG_VVERB, "  slowlog_slower_than: %d", cp->slowlog_slower_than);
+        log_debug(LOG_VVERB, "  slowlog_max_len: %d", cp->slowlog_max_len);
+        log_debug(LOG_VVERB, "  slowlog_log: %d", cp->slowlog_log);
+        log_debug(LOG_VVERB, "  trace_sample_rate: %d", cp->trace_sample_rate);
+        log_debug(LOG_VVERB, "  capture_sample_rate: %d", cp->capture_sample_rate);
+        log_debug(LOG_VVERB, "  hotkey_max_len: %d", cp->hotkey_max_len);
+        log_debug(LOG_VVERB, "  hotkey_sample_rate: %d", cp->hotkey_sample_rate);
+        log_debug(LOG_VVERB, "  slot_stats: %d", cp->slot_stats);
+        log_debug(LOG_VVERB, "  bigkey_threshold: %d", cp->bigkey_threshold);
+        log_debug(LOG_VVERB, "  bigkey_max_len: %d", cp->bigkey_max_len);
+        log_debug(LOG_VVERB, "  nearcache_max_memory: %d", cp->nearcache_max_memory);
+        log_debug(LOG_VVERB, "  nearcache_ttl: %d", cp->nearcache_ttl);
+        log_debug(LOG_VVERB, "  nearcache_tracking: %d", cp->nearcache_tracking);
+        log_debug(LOG_VVERB, "  nearcache_commands: %.*s", cp->nearcache_commands.len,
+                  cp->nearcache_commands.data);
+        log_debug(LOG_VVERB, "  singleflight_commands: %.*s",
+                  cp->singleflight_commands.len, cp->singleflight_commands.data);
+        log_debug(LOG_VVERB, "  batch_get: %d", cp->batch_get);
+        log_debug(LOG_VVERB, "  batch_get_strict: %d", cp->batch_get_strict);
+        log_debug(LOG_VVERB, "  batch_set: %d", cp->batch_set);
+        log_debug(LOG_VVERB, "  batch_max: %d", cp->batch_max);
+        log_debug(LOG_VVERB, "  hedge_after_ms: %d", cp->hedge_after_ms);
+        log_debug(LOG_VVERB, "  hedge_budget: %d", cp->hedge_budget);
+        log_debug(LOG_VVERB, "  retry_reads: %d", cp->retry_reads);
+        log_debug(LOG_VVERB, "  health_check_interval: %d",
+                  cp->health_check_interval);
+        log_debug(LOG_VVERB, "  health_check_failures: %d",
+                  cp->health_check_failures);
+        log_debug(LOG_VVERB, "  health_latency_factor: %d",
+                  cp->health_latency_factor);
+        log_debug(LOG_VVERB, "  concurrency_limit: %d", cp->concurrency_limit);
+        log_debug(LOG_VVERB, "  concurrency_latency: %d",
+                  cp->concurrency_latency);
+        log_debug(LOG_VVERB, "  concurrency_queue: %d", cp->concurrency_queue);
+        log_debug(LOG_VVERB, "  rate_limit_requests: %d",
+                  cp->rate_limit_requests);
+        log_debug(LOG_VVERB, "  rate_limit_bytes: %d", cp->rate_limit_bytes);
+        log_debug(LOG_VVERB, "  rate_limit_prefix: %d", cp->rate_limit_prefix);
+        log_debug(LOG_VVERB, "  rate_limit_reject: %d", cp->rate_limit_reject);
+        log_debug(LOG_VVERB, "  slow_lane_commands: %.*s",
+                  cp->slow_lane_commands.len, cp->slow_lane_commands.data);
+        log_debug(LOG_VVERB, "  slow_lane_connections: %d",
+                  cp->slow_lane_connections);
+        log_debug(LOG_VVERB, "  slow_lane_limit: %d", cp->slow_lane_limit);
         log_debug(LOG_VVERB, "  servers: %"PRIu32"", nserver);
 
         for (j = 0; j < nserver; j++) {
@@ -1393,6 +1666,168 @@ conf_validate_pool(struct conf *cf, struct conf_pool *cp)
         cp->slowlog_slower_than = CONF_DEFAULT_SLOWLOG_SLOWER_THAN;
     }
 
+    if (cp->slowlog_max_len == CONF_UNSET_NUM) {
+        cp->slowlog_max_len = CONF_DEFAULT_SLOWLOG_MAX_LEN;
+    } else if (cp->slowlog_max_len == 0) {
+        log_error("conf: directive \"slowlog_max_len:\" cannot be 0");
+        return NC_ERROR;
+    }
+
+    if (cp->slowlog_log == CONF_UNSET_NUM) {
+        cp->slowlog_log = CONF_DEFAULT_SLOWLOG_LOG;
+    }
+
+    if (cp->trace_sample_rate == CONF_UNSET_NUM) {
+        cp->trace_sample_rate = CONF_DEFAULT_TRACE_SAMPLE_RATE;
+    }
+
+    if (cp->capture_sample_rate == CONF_UNSET_NUM) {
+        cp->capture_sample_rate = CONF_DEFAULT_CAPTURE_SAMPLE_RATE;
+    }
+
+    if (cp->hotkey_max_len == CONF_UNSET_NUM) {
+        cp->hotkey_max_len = CONF_DEFAULT_HOTKEY_MAX_LEN;
+    }
+
+    if (cp->hotkey_sample_rate == CONF_UNSET_NUM) {
+        cp->hotkey_sample_rate = CONF_DEFAULT_HOTKEY_SAMPLE_RATE;
+    } else if (cp->hotkey_sample_rate == 0) {
+        log_error("conf: directive \"hotkey_sample_rate:\" cannot be 0");
+        return NC_ERROR;
+    }
+
+    if (cp->slot_stats == CONF_UNSET_NUM) {
+        cp->slot_stats = CONF_DEFAULT_SLOT_STATS;
+    }
+
+    if (cp->bigkey_threshold == CONF_UNSET_NUM) {
+        cp->bigkey_threshold = CONF_DEFAULT_BIGKEY_THRESHOLD;
+    }
+
+    if (cp->bigkey_max_len == CONF_UNSET_NUM) {
+        cp->bigkey_max_len = CONF_DEFAULT_BIGKEY_MAX_LEN;
+    } else if (cp->bigkey_max_len == 0) {
+        log_error("conf: directive \"bigkey_max_len:\" cannot be 0");
+        return NC_ERROR;
+    }
+
+    if (cp->nearcache_max_memory == CONF_UNSET_NUM) {
+        cp->nearcache_max_memory = CONF_DEFAULT_NEARCACHE_MAX_MEMORY;
+    }
+
+    if (cp->nearcache_ttl == CONF_UNSET_NUM) {
+        cp->nearcache_ttl = CONF_DEFAULT_NEARCACHE_TTL;
+    } else if (cp->nearcache_ttl == 0) {
+        log_error("conf: directive \"nearcache_ttl:\" cannot be 0");
+        return NC_ERROR;
+    }
+
+    if (cp->nearcache_tracking == CONF_UNSET_NUM) {
+        cp->nearcache_tracking = CONF_DEFAULT_NEARCACHE_TRACKING;
+    }
+
+    if (cp->batch_get == CONF_UNSET_NUM) {
+        cp->batch_get = CONF_DEFAULT_BATCH_GET;
+    }
+
+    if (cp->batch_get_strict == CONF_UNSET_NUM) {
+        cp->batch_get_strict = CONF_DEFAULT_BATCH_GET_STRICT;
+    }
+
+    if (cp->batch_set == CONF_UNSET_NUM) {
+        cp->batch_set = CONF_DEFAULT_BATCH_SET;
+    }
+
+    if (cp->batch_max == CONF_UNSET_NUM) {
+        cp->batch_max = CONF_DEFAULT_BATCH_MAX;
+    } else if (cp->batch_max < 2) {
+        log_error("conf: directive \"batch_max:\" must be at least 2");
+        return NC_ERROR;
+    }
+
+    if (cp->hedge_after_ms == CONF_UNSET_NUM) {
+        cp->hedge_after_ms = CONF_DEFAULT_HEDGE_AFTER_MS;
+    }
+
+    if (cp->hedge_budget == CONF_UNSET_NUM) {
+        cp->hedge_budget = CONF_DEFAULT_HEDGE_BUDGET;
+    } else if (cp->hedge_budget < 1 || cp->hedge_budget > 100) {
+        log_error("conf: directive \"hedge_budget:\" must be a percentage "
+                  "between 1 and 100");
+        return NC_ERROR;
+    }
+
+    if (cp->retry_reads == CONF_UNSET_NUM) {
+        cp->retry_reads = CONF_DEFAULT_RETRY_READS;
+    }
+
+    if (cp->health_check_interval == CONF_UNSET_NUM) {
+        cp->health_check_interval = CONF_DEFAULT_HEALTH_CHECK_INTERVAL;
+    }
+
+    if (cp->health_check_failures == CONF_UNSET_NUM) {
+        cp->health_check_failures = CONF_DEFAULT_HEALTH_CHECK_FAILURES;
+    } else if (cp->health_check_failures < 1) {
+        log_error("conf: directive \"health_check_failures:\" must be at "
+                  "least 1");
+        return NC_ERROR;
+    }
+
+    if (cp->health_latency_factor == CONF_UNSET_NUM) {
+        cp->health_latency_factor = CONF_DEFAULT_HEALTH_LATENCY_FACTOR;
+    } else if (cp->health_latency_factor < 2) {
+        log_error("conf: directive \"health_latency_factor:\" must be at "
+                  "least 2");
+        return NC_ERROR;
+    }
+
+    if (cp->concurrency_limit == CONF_UNSET_NUM) {
+        cp->concurrency_limit = CONF_DEFAULT_CONCURRENCY_LIMIT;
+    }
+
+    if (cp->concurrency_latency == CONF_UNSET_NUM) {
+        cp->concurrency_latency = CONF_DEFAULT_CONCURRENCY_LATENCY;
+    } else if (cp->concurrency_latency < 1) {
+        log_error("conf: directive \"concurrency_latency:\" must be at "
+                  "least 1");
+        return NC_ERROR;
+    }
+
+    if (cp->concurrency_queue == CONF_UNSET_NUM) {
+        cp->concurrency_queue = CONF_DEFAULT_CONCURRENCY_QUEUE;
+    }
+
+    if (cp->rate_limit_requests == CONF_UNSET_NUM) {
+        cp->rate_limit_requests = CONF_DEFAULT_RATE_LIMIT_REQUESTS;
+    }
+
+    if (cp->rate_limit_bytes == CONF_UNSET_NUM) {
+        cp->rate_limit_bytes = CONF_DEFAULT_RATE_LIMIT_BYTES;
+    }
+
+    if (cp->rate_limit_prefix == CONF_UNSET_NUM) {
+        cp->rate_limit_prefix = CONF_DEFAULT_RATE_LIMIT_PREFIX;
+    } else if (cp->rate_limit_prefix > 32) {
+        log_error("conf: directive \"rate_limit_prefix:\" must be at most 32");
+        return NC_ERROR;
+    }
+
+    if (cp->rate_limit_reject == CONF_UNSET_NUM) {
+        cp->rate_limit_reject = CONF_DEFAULT_RATE_LIMIT_REJECT;
+    }
+
+    if (cp->slow_lane_connections == CONF_UNSET_NUM) {
+        cp->slow_lane_connections = CONF_DEFAULT_SLOW_LANE_CONNECTIONS;
+    } else if (cp->slow_lane_connections < 1) {
+        log_error("conf: directive \"slow_lane_connections:\" must be at "
+                  "least 1");
+        return NC_ERROR;
+    }
+
+    if (cp->slow_lane_limit == CONF_UNSET_NUM) {
+        cp->slow_lane_limit = CONF_DEFAULT_SLOW_LANE_LIMIT;
+    }
+
     if (string_empty(&cp->whitelist)) {
         string_set_text(&cp->whitelist, "conf/authip");
     }
@@ -58,6 +58,37 @@
 #define CONF_DEFAULT_WHITELIST_INTERVAL      10
 #define CONF_DEFAULT_SLOWLOG                 false
 #define CONF_DEFAULT_SLOWLOG_SLOWER_THAN     50
+#define CONF_DEFAULT_SLOWLOG_MAX_LEN         128
+#define CONF_DEFAULT_SLOWLOG_LOG             true
+#define CONF_DEFAULT_TRACE_SAMPLE_RATE       0
+#define CONF_DEFAULT_CAPTURE_SAMPLE_RATE     0
+#define CONF_DEFAULT_HOTKEY_MAX_LEN          0
+#define CONF_DEFAULT_HOTKEY_SAMPLE_RATE      100
+#define CONF_DEFAULT_SLOT_STATS              false
+#define CONF_DEFAULT_BIGKEY_THRESHOLD        0
+#define CONF_DEFAULT_BIGKEY_MAX_LEN          16
+#define CONF_DEFAULT_NEARCACHE_MAX_MEMORY    0
+#define CONF_DEFAULT_NEARCACHE_TTL           60 * 1000      /* in msec */
+#define CONF_DEFAULT_NEARCACHE_TRACKING      true
+#define CONF_DEFAULT_BATCH_GET               false
+#define CONF_DEFAULT_BATCH_GET_STRICT        true
+#define CONF_DEFAULT_BATCH_SET               false
+#define CONF_DEFAULT_BATCH_MAX               64
+#define CONF_DEFAULT_HEDGE_AFTER_MS          0              /* in msec, 0 disables */
+#define CONF_DEFAULT_HEDGE_BUDGET            5              /* in % of reads */
+#define CONF_DEFAULT_RETRY_READS             false
+#define CONF_DEFAULT_HEALTH_CHECK_INTERVAL   0              /* in msec, 0 disables */
+#define CONF_DEFAULT_HEALTH_CHECK_FAILURES   3
+#define CONF_DEFAULT_HEALTH_LATENCY_FACTOR   5
+#define CONF_DEFAULT_CONCURRENCY_LIMIT       0              /* 0 disables */
+#define CONF_DEFAULT_CONCURRENCY_LATENCY     20             /* in msec */
+#define CONF_DEFAULT_CONCURRENCY_QUEUE       0
+#define CONF_DEFAULT_RATE_LIMIT_REQUESTS     0              /* 0 disables */
+#define CONF_DEFAULT_RATE_LIMIT_BYTES        0              /* 0 disables */
+#define CONF_DEFAULT_RATE_LIMIT_PREFIX       32             /* per ipv4 address */
+#define CONF_DEFAULT_RATE_LIMIT_REJECT       false
+#define CONF_DEFAULT_SLOW_LANE_CONNECTIONS   1
+#define CONF_DEFAULT_SLOW_LANE_LIMIT         0              /* 0 disables */
 #define CONF_DEFAULT_TCPKEEPALIVE            true
 #define CONF_DEFAULT_TCPKEEPIDLE             60
 #define CONF_DEFAULT_TCPKEEPINTVAL           10
@@ -114,6 +145,40 @@ struct conf_pool {
     unsigned           valid:1;               /* valid? */
     int                slowlog;               /* slowlog? */
     int                slowlog_slower_than;   /* slowlog overtime setting */
+    int                slowlog_max_len;       /* slowlog_max_len: # ring entries */
+    int                slowlog_log;           /* slowlog_log: drain ring to log? */
+    int                trace_sample_rate;     /* trace_sample_rate: trace 1 in N requests */
+    int                capture_sample_rate;   /* capture_sample_rate: capture 1 in N requests */
+    int                hotkey_max_len;        /* hotkey_max_len: # hot keys reported */
+    int                hotkey_sample_rate;    /* hotkey_sample_rate: sample 1 in N keys */
+    int                slot_stats;            /* slot_stats: per slot counters? */
+    int                bigkey_threshold;      /* bigkey_threshold: big response in bytes */
+    int                bigkey_max_len;        /* bigkey_max_len: # big keys reported */
+    int                nearcache_max_memory;  /* nearcache_max_memory: in bytes */
+    int                nearcache_ttl;         /* nearcache_ttl: in msec */
+    int                nearcache_tracking;    /* nearcache_tracking: client tracking? */
+    struct string      nearcache_commands;    /* nearcache_commands: cached commands */
+    struct string      singleflight_commands; /* singleflight_commands: shared commands */
+    int                batch_get;             /* batch_get: gets sent as mget? */
+    int                batch_get_strict;      /* batch_get_strict: resend nil gets? */
+    int                batch_set;             /* batch_set: sets sent as mset? */
+    int                batch_max;             /* batch_max: max # requests per batch */
+    int                hedge_after_ms;        /* hedge_after_ms: in msec */
+    int                hedge_budget;          /* hedge_budget: % of reads hedged */
+    int                retry_reads;           /* retry_reads: retry failed reads? */
+    int                health_check_interval; /* health_check_interval: in msec */
+    int                health_check_failures; /* health_check_failures: # to demote */
+    int                health_latency_factor; /* health_latency_factor: rtt / median */
+    int                concurrency_limit;     /* concurrency_limit: max in flight */
+    int                concurrency_latency;   /* concurrency_latency: in msec */
+    int                concurrency_queue;     /* concurrency_queue: max waiting */
+    int                rate_limit_requests;   /* rate_limit_requests: per sec */
+    int                rate_limit_bytes;      /* rate_limit_bytes: per sec */
+    int                rate_limit_prefix;     /* rate_limit_prefix: ipv4 bits */
+    int                rate_limit_reject;     /* rate_limit_reject: reject, not pause? */
+    struct string      slow_lane_commands;    /* slow_lane_commands: slow lane commands */
+    int                slow_lane_connections; /* slow_lane_connections: per server */
+    int                slow_lane_limit;       /* slow_lane_limit: max in flight */
 };
 
 struct conf {
@@ -127,6 +127,7 @@ _conn_get(void)
 
     conn->sd = -1;
     /* {family, addrlen, addr} are initialized in enqueue handler */
+    conn->peer[0] = '\0';
 
     TAILQ_INIT(&conn->imsg_q);
     TAILQ_INIT(&conn->omsg_q);
@@ -144,6 +145,11 @@ _conn_get(void)
 
     conn->events = 0;
     conn->err = 0;
+    conn->deadline = 0;
+    conn->batch_reads = 0;
+    conn->rate = NULL;
+    conn->rate_paused = 0;
+    conn->lane = SERVER_LANE_FAST;
     conn->recv_active = 0;
     conn->recv_ready = 0;
     conn->send_active = 0;
@@ -161,6 +167,8 @@ _conn_get(void)
     ntotal_conn++;
     ncurr_conn++;
 
+    conn->id = ntotal_conn;
+
     return conn;
 }
 
@@ -301,6 +309,50 @@ conn_get_proxy(void *owner)
     return conn;
 }
 
+struct conn *
+conn_get_tracker(void *owner)
+{
+    struct conn *conn;
+
+    conn = _conn_get();
+    if (conn == NULL) {
+        return NULL;
+    }
+
+    /*
+     * tracking connection of a near cache sends a handshake and then only
+     * receives invalidation pushes from the server that owns it
+     */
+    conn->redis = 1;
+
+    conn->recv = nearcache_recv;
+    conn->recv_next = NULL;
+    conn->recv_done = NULL;
+
+    conn->send = nearcache_send;
+    conn->send_next = NULL;
+    conn->send_done = NULL;
+
+    conn->close = nearcache_close;
+    conn->active = nearcache_active;
+
+    conn->ref = nearcache_ref;
+    conn->unref = nearcache_unref;
+
+    conn->enqueue_inq = NULL;
+    conn->dequeue_inq = NULL;
+    conn->enqueue_outq = NULL;
+    conn->dequeue_outq = NULL;
+    conn->post_connect = NULL;
+    conn->swallow_msg = NULL;
+
+    conn->ref(conn, owner);
+
+    log_debug(LOG_VVERB, "get conn %p tracker", conn);
+
+    return conn;
+}
+
 static void
 conn_free(struct conn *conn)
 {
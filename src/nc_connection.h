@@ -41,11 +41,13 @@ typedef void (*conn_swallow_msg_t)(struct conn *, struct msg *, struct msg *);
 struct conn {
     TAILQ_ENTRY(conn)   conn_tqe;      /* link in server_pool / server / free q */
     void                *owner;        /* connection owner - server_pool / server */
+    uint64_t            id;            /* connection id, unique from start */
 
     int                 sd;            /* socket descriptor */
     int                 family;        /* socket address family */
     socklen_t           addrlen;       /* socket length */
     struct sockaddr     *addr;         /* socket address (ref in server or server_pool) */
+    char                peer[NC_ADDR_DESC_LEN]; /* client address, cached at accept for slowlog */
 
     struct msg_tqh      imsg_q;        /* incoming request Q */
     struct msg_tqh      omsg_q;        /* outstanding request Q */
@@ -76,6 +78,10 @@ struct conn {
 
     uint32_t            events;        /* connection io events */
     err_t               err;           /* connection errno */
+    uint32_t            deadline;      /* client set request deadline in msec or 0 */
+    uint32_t            batch_reads;   /* # get batches not answered yet */
+    struct ratelimit_bucket *rate;     /* rate limit bucket of client source or NULL */
+    TAILQ_ENTRY(conn)   rate_tqe;      /* link in ratelimit paused q */
     unsigned            recv_active:1; /* recv active? */
     unsigned            recv_ready:1;  /* recv ready? */
     unsigned            send_active:1; /* send active? */
@@ -89,6 +95,8 @@ struct conn {
     unsigned            done:1;        /* done? aka close? */
     unsigned            redis:1;       /* redis? */
     unsigned            need_auth:1;   /* need_auth? */
+    unsigned            rate_paused:1; /* reads paused over the rate limit? */
+    unsigned            lane:1;        /* server lane, SERVER_LANE_* */
 };
 
 TAILQ_HEAD(conn_tqh, conn);
@@ -96,6 +104,7 @@ TAILQ_HEAD(conn_tqh, conn);
 struct context *conn_to_ctx(struct conn *conn);
 struct conn *conn_get(void *owner, bool client, bool redis);
 struct conn *conn_get_proxy(void *owner);
+struct conn *conn_get_tracker(void *owner);
 void conn_put(struct conn *conn);
 ssize_t conn_recv(struct conn *conn, void *buf, size_t size);
 ssize_t conn_sendv(struct conn *conn, struct array *sendv, size_t nsend);
@@ -150,6 +150,18 @@ core_ctx_create(struct instance *nci)
         return NULL;
     }
 
+    status = capture_init(ctx, nci->capture_filename);
+    if (status != NC_OK) {
+        proxy_deinit(ctx);
+        server_pool_disconnect(ctx);
+        event_base_destroy(ctx->evb);
+        stats_destroy(ctx->stats);
+        server_pool_deinit(&ctx->pool);
+        conf_destroy(ctx->cf);
+        nc_free(ctx);
+        return NULL;
+    }
+
     log_debug(LOG_VVERB, "created ctx %p id %"PRIu32"", ctx, ctx->id);
 
     /* initialize whitelist thread */
@@ -169,6 +181,7 @@ static void
 core_ctx_destroy(struct context *ctx)
 {
     log_debug(LOG_VVERB, "destroy ctx %p id %"PRIu32"", ctx, ctx->id);
+    capture_deinit();
     proxy_deinit(ctx);
     server_pool_disconnect(ctx);
     event_base_destroy(ctx->evb);
@@ -185,6 +198,7 @@ core_start(struct instance *nci)
 
     mbuf_init(nci);
     msg_init();
+    hedge_init();
     conn_init();
 
     ctx = core_ctx_create(nci);
@@ -259,6 +273,9 @@ core_close(struct context *ctx, struct conn *conn)
               conn->eof, conn->done, conn->recv_bytes, conn->send_bytes,
               conn->err ? ':' : ' ', conn->err ? strerror(conn->err) : "");
 
+    NC_PROBE6(conn__close, conn->id, conn->sd, conn->client, conn->err,
+              conn->recv_bytes, conn->send_bytes);
+
     status = event_del_conn(ctx->evb, conn);
     if (status < 0) {
         log_warn("event del conn %c %d failed, ignored: %s",
@@ -379,7 +396,7 @@ core_tick(struct context *ctx)
     }
 
     server_pool_tick(ctx);
-    log_cron();
+    capture_cron(ctx);
 }
 
 rstatus_t
@@ -406,8 +423,7 @@ core_loop(struct context *ctx)
     }
 
     core_timeout(ctx);
-
-    stats_swap(ctx->stats);
+    hedge_timeout(ctx);
 
     return NC_OK;
 }
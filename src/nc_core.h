@@ -58,6 +58,10 @@
 # define NC_HAVE_BACKTRACE 1
 #endif
 
+#ifdef HAVE_USDT
+# define NC_HAVE_USDT 1
+#endif
+
 #define NC_OK        0
 #define NC_ERROR    -1
 #define NC_EAGAIN   -2
@@ -113,11 +117,23 @@ struct event_base;
 #include <nc_util.h>
 #include <nc_assoc.h>
 #include <event/nc_event.h>
+#include <nc_histogram.h>
+#include <nc_hotkey.h>
 #include <nc_stats.h>
 #include <nc_mbuf.h>
 #include <nc_message.h>
 #include <nc_connection.h>
+#include <nc_slowlog.h>
 #include <nc_server.h>
+#include <nc_nearcache.h>
+#include <nc_singleflight.h>
+#include <nc_batch.h>
+#include <nc_hedge.h>
+#include <nc_health.h>
+#include <nc_limit.h>
+#include <nc_ratelimit.h>
+#include <nc_capture.h>
+#include <nc_probe.h>
 
 #define NC_TICK_INTERVAL (1 * 100) /* in msecs */
 
@@ -153,6 +169,7 @@ struct instance {
     char            *pid_filename;               /* pid filename */
     unsigned        pidfile:1;                   /* pid file created? */
     char            *lua_path;                   /* lua script path */
+    char            *capture_filename;           /* capture filename */
 };
 
 struct context *core_start(struct instance *nci);
@@ -0,0 +1,218 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include <nc_core.h>
+#include <nc_server.h>
+#include <nc_health.h>
+
+#define HEALTH_PING     "*1\r\n$4\r\nping\r\n"
+
+/* an idle connection of server, to check it without waiting */
+static struct conn *
+health_conn(struct server *server)
+{
+    struct conn *conn;
+
+    TAILQ_FOREACH(conn, &server->s_conn_q, conn_tqe) {
+        if (conn->connected && !conn->need_auth && conn->err == 0 &&
+            conn->rmsg == NULL && conn->smsg == NULL &&
+            TAILQ_EMPTY(&conn->imsg_q) && TAILQ_EMPTY(&conn->omsg_q)) {
+            return conn;
+        }
+    }
+
+    return NULL;
+}
+
+static void
+health_check(struct context *ctx, struct server *server, int64_t now)
+{
+    struct conn *conn;
+    struct msg *msg;
+    rstatus_t status;
+
+    conn = health_conn(server);
+    if (conn == NULL) {
+        return;
+    }
+
+    msg = msg_get(NULL, true, conn->redis);
+    if (msg == NULL) {
+        return;
+    }
+
+    status = msg_append(msg, (uint8_t *)HEALTH_PING, nc_strlen(HEALTH_PING));
+    if (status != NC_OK) {
+        msg_put(msg);
+        return;
+    }
+
+    msg->type = MSG_REQ_REDIS_PING;
+    msg->swallow = 1;
+    msg->nobatch = 1;
+
+    status = event_add_out(ctx->evb, conn);
+    if (status != NC_OK) {
+        conn->err = errno;
+        msg_put(msg);
+        return;
+    }
+
+    conn->enqueue_inq(ctx, conn, msg);
+
+    server->health_ts = now;
+    server->health_id = msg->id;
+
+    log_debug(LOG_VERB, "health check req %"PRIu64" on s %d to '%.*s'",
+              msg->id, conn->sd, server->pname.len, server->pname.data);
+}
+
+static int
+health_cmp(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* demote the servers that failed or are much slower than the pool median */
+static void
+health_rank(struct context *ctx, struct server_pool *pool)
+{
+    struct server *server;
+    int64_t *rtt, limit;
+    uint32_t i, n, nserver;
+    bool demote;
+
+    nserver = array_n(&pool->server);
+    if (nserver == 0) {
+        return;
+    }
+
+    rtt = nc_alloc(nserver * sizeof(*rtt));
+    if (rtt == NULL) {
+        return;
+    }
+
+    for (i = 0, n = 0; i < nserver; i++) {
+        server = *(struct server **)array_get(&pool->server, i);
+        if (server->health_rtt > 0) {
+            rtt[n++] = server->health_rtt;
+        }
+    }
+
+    limit = 0;
+    if (n != 0) {
+        qsort(rtt, n, sizeof(*rtt), health_cmp);
+        limit = MAX(rtt[n / 2] * pool->health_latency_factor, HEALTH_RTT_MIN);
+    }
+
+    nc_free(rtt);
+
+    for (i = 0; i < nserver; i++) {
+        server = *(struct server **)array_get(&pool->server, i);
+
+        demote = server->health_failures >= pool->health_failures ||
+                 (limit != 0 && server->health_rtt > limit);
+
+        if (demote && !server->health_demoted) {
+            log_warn("'%.*s' demoted from reads: %"PRIu32" failed health "
+                     "checks, rtt %"PRId64" usec over %"PRId64"",
+                     server->pname.len, server->pname.data,
+                     server->health_failures, server->health_rtt, limit);
+        } else if (!demote && server->health_demoted) {
+            log_warn("'%.*s' healthy again, rtt %"PRId64" usec",
+                     server->pname.len, server->pname.data,
+                     server->health_rtt);
+        }
+        server->health_demoted = demote ? 1 : 0;
+
+        stats_server_set(ctx, server, health_rtt, server->health_rtt);
+        stats_server_set(ctx, server, health_failures, server->health_failures);
+        stats_server_set(ctx, server, health_demoted, server->health_demoted);
+    }
+}
+
+/* run a round of health checks of pool, if due */
+void
+health_tick(struct server_pool *pool)
+{
+    struct context *ctx = pool->ctx;
+    struct server *server;
+    uint32_t i;
+    int64_t now;
+
+    if (pool->health_interval == 0 || !pool->redis) {
+        return;
+    }
+
+    now = nc_usec_now();
+    if (now < 0 || now < pool->health_next) {
+        return;
+    }
+    pool->health_next = now + pool->health_interval;
+
+    /* checks of the last round with no reply yet failed */
+    for (i = 0; i < array_n(&pool->server); i++) {
+        server = *(struct server **)array_get(&pool->server, i);
+        if (server->health_ts != 0) {
+            server->health_failures++;
+            server->health_ts = 0;
+            server->health_id = 0;
+        }
+    }
+
+    health_rank(ctx, pool);
+
+    for (i = 0; i < array_n(&pool->server); i++) {
+        server = *(struct server **)array_get(&pool->server, i);
+        health_check(ctx, server, now);
+    }
+}
+
+/* take the reply rsp of pmsg, swallowed on server connection conn */
+void
+health_rsp(struct conn *conn, struct msg *pmsg, struct msg *rsp)
+{
+    struct server *server = conn->owner;
+    int64_t now, rtt;
+
+    if (server->health_id != pmsg->id || pmsg->id == 0) {
+        return;
+    }
+
+    now = nc_usec_now();
+    rtt = now - server->health_ts;
+
+    server->health_ts = 0;
+    server->health_id = 0;
+
+    if (now < 0 || rsp->type == MSG_RSP_REDIS_ERROR) {
+        server->health_failures++;
+        return;
+    }
+
+    server->health_rtt = server->health_rtt == 0 ? rtt :
+                         (3 * server->health_rtt + rtt) / 4;
+    server->health_failures = 0;
+
+    log_debug(LOG_VERB, "health check req %"PRIu64" on s %d rtt %"PRId64" "
+              "usec, smoothed %"PRId64"", pmsg->id, conn->sd, rtt,
+              server->health_rtt);
+}
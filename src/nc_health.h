@@ -0,0 +1,41 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _NC_HEALTH_H_
+#define _NC_HEALTH_H_
+
+#include <nc_core.h>
+
+/*
+ * Active health checks of the servers of a redis pool. Every
+ * health_check_interval, each server with an idle connection is sent a
+ * PING on it. The round trip time of the reply is smoothed per server; a
+ * check that is not answered by the next round, or answered with an error,
+ * is a failure.
+ *
+ * After each round, a server with health_check_failures failures in a row,
+ * or with a round trip time above health_latency_factor times the median of
+ * the pool (and above HEALTH_RTT_MIN), is demoted: read routing of a redis
+ * cluster pool skips it, like a banned replica, until a later round finds
+ * it healthy again.
+ */
+#define HEALTH_RTT_MIN  1000                /* min rtt that demotes, in usec */
+
+void health_tick(struct server_pool *pool);
+void health_rsp(struct conn *conn, struct msg *pmsg, struct msg *rsp);
+
+#endif
@@ -0,0 +1,312 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <nc_core.h>
+#include <nc_server.h>
+#include <nc_hedge.h>
+#include <proto/nc_proto.h>
+
+static struct rbtree hedge_rbt;     /* hedge rbtree */
+static struct rbnode hedge_rbs;     /* hedge rbtree sentinel */
+
+void
+hedge_init(void)
+{
+    rbtree_init(&hedge_rbt, &hedge_rbs);
+}
+
+static struct msg *
+hedge_from_rbe(struct rbnode *node)
+{
+    struct msg *msg;
+    int offset;
+
+    offset = offsetof(struct msg, hedge_rbe);
+    msg = (struct msg *)((char *)node - offset);
+
+    return msg;
+}
+
+static void
+hedge_disarm(struct msg *msg)
+{
+    struct rbnode *node;
+
+    node = &msg->hedge_rbe;
+
+    /* not armed */
+
+    if (node->data == NULL) {
+        return;
+    }
+
+    rbtree_delete(&hedge_rbt, node);
+}
+
+static bool
+hedge_read(struct msg *msg)
+{
+    return msg->type > MSG_RSP_MC_SERVER_ERROR &&
+           msg->type < MSG_REQ_REDIS_WRITECMD_START;
+}
+
+/* start the hedge clock of read msg, just sent on server connection s_conn */
+void
+hedge_arm(struct conn *s_conn, struct msg *msg)
+{
+    struct server *server = s_conn->owner;
+    struct server_pool *pool = server->owner;
+    struct replicaset *slot;
+    struct rbnode *node;
+    int64_t now;
+
+    ASSERT(!s_conn->client && !s_conn->proxy);
+    ASSERT(msg->request);
+
+    if (pool->hedge_after == 0 || !pool->rediscluster) {
+        return;
+    }
+
+    /* single key reads of a client, routed by slot */
+    if (msg->owner == NULL || msg->swallow || msg->frag_id != 0 ||
+        msg->slot == 0 || msg->hedge != NULL || !hedge_read(msg)) {
+        return;
+    }
+
+    /* only reads routed to a replica, not those the master serves */
+    slot = pool->slots[msg->slot - 1];
+    if (slot == NULL || slot->master == server) {
+        return;
+    }
+
+    now = nc_msec_now();
+    if (now < 0) {
+        return;
+    }
+
+    pool->hedge_credit = MIN(pool->hedge_credit + pool->hedge_budget,
+                             HEDGE_BURST * 100);
+
+    hedge_disarm(msg);
+
+    node = &msg->hedge_rbe;
+    node->key = now + pool->hedge_after;
+    node->data = s_conn;
+
+    rbtree_insert(&hedge_rbt, node);
+}
+
+/* send a copy of read msg, slow on server connection s_conn, to a replica */
+static void
+hedge_send(struct context *ctx, struct conn *s_conn, struct msg *msg)
+{
+    struct server *server = s_conn->owner;
+    struct server_pool *pool = server->owner;
+    struct conn *c_conn, *h_conn;
+    struct msg *hmsg;
+    struct mbuf *mbuf;
+    rstatus_t status;
+
+    if (msg->done || msg->swallow || msg->peer != NULL) {
+        return;
+    }
+
+    if (pool->hedge_credit < 100) {
+        log_debug(LOG_VERB, "no hedge for req %"PRIu64" on s %d, over budget",
+                  msg->id, s_conn->sd);
+        return;
+    }
+
+    h_conn = redis_replica_routing(ctx, pool, msg, server);
+    if (h_conn == NULL) {
+        return;
+    }
+
+    hmsg = msg_get(NULL, true, msg->redis);
+    if (hmsg == NULL) {
+        return;
+    }
+
+    /* sent requests are read again from the start of their mbufs */
+    STAILQ_FOREACH(mbuf, &msg->mhdr, next) {
+        status = msg_append(hmsg, mbuf->start, (size_t)(mbuf->last - mbuf->start));
+        if (status != NC_OK) {
+            msg_put(hmsg);
+            return;
+        }
+    }
+
+    hmsg->type = msg->type;
+    hmsg->slot = msg->slot;
+    hmsg->lane = msg->lane;
+    hmsg->nobatch = 1;
+
+    c_conn = msg->owner;
+
+    if (TAILQ_EMPTY(&h_conn->imsg_q)) {
+        status = event_add_out(ctx->evb, h_conn);
+        if (status != NC_OK) {
+            h_conn->err = errno;
+            msg_put(hmsg);
+            return;
+        }
+    }
+
+    if (h_conn->need_auth) {
+        status = hmsg->add_auth(ctx, c_conn, h_conn);
+        if (status != NC_OK) {
+            h_conn->err = errno;
+            msg_put(hmsg);
+            return;
+        }
+    }
+
+    h_conn->enqueue_inq(ctx, h_conn, hmsg);
+
+    msg->hedge = hmsg;
+    msg->hedge_conn = s_conn;
+    hmsg->hedge = msg;
+
+    pool->hedge_credit -= 100;
+    stats_pool_incr(ctx, pool, hedged_requests);
+
+    log_debug(LOG_VERB, "hedge req %"PRIu64" on s %d with req %"PRIu64" on "
+              "s %d", msg->id, s_conn->sd, hmsg->id, h_conn->sd);
+}
+
+/* hedge the reads whose clock ran out */
+void
+hedge_timeout(struct context *ctx)
+{
+    struct rbnode *node;
+    struct msg *msg;
+    struct conn *s_conn;
+    int64_t now;
+
+    now = nc_msec_now();
+
+    for (;;) {
+        node = rbtree_min(&hedge_rbt);
+        if (node == NULL) {
+            return;
+        }
+
+        if (now < node->key) {
+            int delta = (int)(node->key - now);
+            ctx->timeout = MIN(delta, ctx->timeout);
+            return;
+        }
+
+        msg = hedge_from_rbe(node);
+        s_conn = node->data;
+
+        rbtree_delete(&hedge_rbt, node);
+
+        hedge_send(ctx, s_conn, msg);
+    }
+}
+
+/*
+ * Handle rsp, the reply of pmsg just dequeued from server connection
+ * s_conn. Returns true if the reply was consumed: it came for a hedge and
+ * either answered the read in place of the read's own reply, or lost.
+ */
+bool
+hedge_rsp(struct context *ctx, struct conn *s_conn, struct msg *pmsg,
+          struct msg *rsp)
+{
+    struct server *server = s_conn->owner;
+    struct msg *msg, *hmsg;
+    struct conn *conn;
+
+    hedge_disarm(pmsg);
+
+    if (pmsg->hedge == NULL) {
+        return false;
+    }
+
+    if (pmsg->owner != NULL) {
+        /* the read was first, its hedge gets swallowed */
+        hmsg = pmsg->hedge;
+        hmsg->hedge = NULL;
+        hmsg->swallow = 1;
+        pmsg->hedge = NULL;
+        pmsg->hedge_conn = NULL;
+        return false;
+    }
+
+    hmsg = pmsg;
+    msg = hmsg->hedge;
+    conn = msg->hedge_conn;
+
+    hmsg->hedge = NULL;
+    msg->hedge = NULL;
+    msg->hedge_conn = NULL;
+
+    if (msg->done || msg->swallow || rsp->type == MSG_RSP_REDIS_ERROR ||
+        rsp->type == MSG_RSP_REDIS_ASK || rsp->type == MSG_RSP_REDIS_MOVED) {
+        rsp_put(rsp);
+        req_put(hmsg);
+        return true;
+    }
+
+    ASSERT(msg->peer == NULL);
+
+    /* the hedge takes the place of the read on its server, to swallow the reply */
+    TAILQ_INSERT_BEFORE(msg, hmsg, s_tqe);
+    TAILQ_REMOVE(&conn->omsg_q, msg, s_tqe);
+    msg_tmo_delete(msg);
+    msg_tmo_insert(hmsg, conn);
+    hmsg->swallow = 1;
+
+    msg->send_ts = hmsg->send_ts;
+    msg->slowlog_stime = hmsg->slowlog_stime;
+
+    stats_pool_incr(ctx, server->owner, hedge_wins);
+
+    log_debug(LOG_VERB, "hedge req %"PRIu64" on s %d answers req %"PRIu64"",
+              hmsg->id, s_conn->sd, msg->id);
+
+    rsp_complete(ctx, s_conn, msg, rsp);
+
+    return true;
+}
+
+/* unlink msg, about to be put, from its hedge */
+void
+hedge_put(struct msg *msg)
+{
+    struct msg *other;
+
+    hedge_disarm(msg);
+
+    other = msg->hedge;
+    if (other == NULL) {
+        return;
+    }
+
+    msg->hedge = NULL;
+    msg->hedge_conn = NULL;
+    other->hedge = NULL;
+
+    if (msg->owner != NULL) {
+        /* the hedge of a read that goes away is not needed */
+        other->swallow = 1;
+    } else {
+        other->hedge_conn = NULL;
+    }
+}
@@ -0,0 +1,42 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _NC_HEDGE_H_
+#define _NC_HEDGE_H_
+
+#include <nc_core.h>
+
+/*
+ * Hedged reads of a redis cluster pool. A read still waiting for its reply
+ * hedge_after msec after it was sent to a replica is sent again, as a copy
+ * without a client, to another replica of its slot in the same or a
+ * following tag tier. The client gets whichever reply comes first and the
+ * other one is swallowed. An error reply of the copy never wins.
+ *
+ * Each hedgeable read earns hedge_budget hundredths of a hedge, and each
+ * hedge costs one, so that at most hedge_budget percent of the reads are
+ * sent twice even when every replica turns slow.
+ */
+#define HEDGE_BURST 10                      /* max # hedges sent back to back */
+
+void hedge_init(void);
+void hedge_arm(struct conn *s_conn, struct msg *msg);
+void hedge_timeout(struct context *ctx);
+bool hedge_rsp(struct context *ctx, struct conn *s_conn, struct msg *pmsg, struct msg *rsp);
+void hedge_put(struct msg *msg);
+
+#endif
@@ -0,0 +1,99 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <nc_core.h>
+
+void
+histo_reset(struct histo *h)
+{
+    if (h->count == 0) {
+        return;
+    }
+
+    memset(h, 0, sizeof(*h));
+}
+
+void
+histo_merge(struct histo *dst, const struct histo *src)
+{
+    uint32_t i;
+
+    if (src->count == 0) {
+        return;
+    }
+
+    for (i = 0; i < HISTO_NBUCKET; i++) {
+        dst->bucket[i] += src->bucket[i];
+    }
+
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
+
+/*
+ * Return the highest value that maps into bucket idx
+ */
+uint64_t
+histo_bucket_value(uint32_t idx)
+{
+    uint32_t shift;
+    uint64_t low;
+
+    ASSERT(idx < HISTO_NBUCKET);
+
+    if (idx < HISTO_SUB_COUNT) {
+        return idx;
+    }
+
+    shift = idx / HISTO_HALF_COUNT - 1;
+    low = (uint64_t)(idx - shift * HISTO_HALF_COUNT) << shift;
+
+    return low + (1ULL << shift) - 1;
+}
+
+/*
+ * Return the value at quantile q (0 < q <= 1), reported as the upper
+ * bound of the bucket holding it but never more than the exact max
+ */
+uint64_t
+histo_percentile(const struct histo *h, double q)
+{
+    uint64_t rank, seen;
+    uint32_t i;
+
+    if (h->count == 0) {
+        return 0;
+    }
+
+    rank = (uint64_t)(q * (double)h->count + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    seen = 0;
+    for (i = 0; i < HISTO_NBUCKET; i++) {
+        seen += h->bucket[i];
+        if (seen >= rank) {
+            return MIN(histo_bucket_value(i), h->max);
+        }
+    }
+
+    return h->max;
+}
@@ -0,0 +1,83 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _NC_HISTOGRAM_H_
+#define _NC_HISTOGRAM_H_
+
+#include <nc_core.h>
+
+/*
+ * Log-linear (HDR style) histogram of non-negative integer samples, used
+ * to record latencies in usec.
+ *
+ * Values below HISTO_SUB_COUNT get a bucket each. Above that, every power
+ * of two is split into HISTO_SUB_COUNT / 2 linear sub-buckets, so that any
+ * reported percentile is within 1 / (HISTO_SUB_COUNT / 2) = 6.25% of the
+ * true value. Samples above HISTO_MAX_VALUE (~17.9 minutes in usec) are
+ * clamped into the last bucket; max is tracked exactly.
+ */
+#define HISTO_SUB_BITS      5
+#define HISTO_SUB_COUNT     (1 << HISTO_SUB_BITS)
+#define HISTO_HALF_COUNT    (HISTO_SUB_COUNT >> 1)
+#define HISTO_MAX_BITS      30
+#define HISTO_MAX_VALUE     ((1ULL << HISTO_MAX_BITS) - 1)
+#define HISTO_NBUCKET       ((HISTO_MAX_BITS - HISTO_SUB_BITS + 2) * HISTO_HALF_COUNT)
+
+struct histo {
+    uint64_t count;                 /* # samples */
+    uint64_t sum;                   /* sum of samples */
+    uint64_t max;                   /* max sample */
+    uint64_t bucket[HISTO_NBUCKET]; /* # samples per bucket */
+};
+
+static inline uint32_t
+histo_index(uint64_t value)
+{
+    uint32_t shift;
+
+    if (value < HISTO_SUB_COUNT) {
+        return (uint32_t)value;
+    }
+
+    if (value > HISTO_MAX_VALUE) {
+        value = HISTO_MAX_VALUE;
+    }
+
+    shift = (uint32_t)(63 - __builtin_clzll(value)) - (HISTO_SUB_BITS - 1);
+
+    return shift * HISTO_HALF_COUNT + (uint32_t)(value >> shift);
+}
+
+static inline void
+histo_record(struct histo *h, int64_t value)
+{
+    uint64_t v = value < 0 ? 0 : (uint64_t)value;
+
+    h->bucket[histo_index(v)]++;
+    h->count++;
+    h->sum += v;
+    if (v > h->max) {
+        h->max = v;
+    }
+}
+
+void histo_reset(struct histo *h);
+void histo_merge(struct histo *dst, const struct histo *src);
+uint64_t histo_bucket_value(uint32_t idx);
+uint64_t histo_percentile(const struct histo *h, double q);
+
+#endif
@@ -0,0 +1,314 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <nc_core.h>
+#include <nc_server.h>
+#include <nc_hashkit.h>
+#include <nc_hotkey.h>
+
+struct hotkey *
+hotkey_create(uint32_t max_top, uint32_t sample_rate)
+{
+    struct hotkey *hk;
+    uint32_t nslot;
+
+    ASSERT(max_top > 0 && sample_rate > 0);
+
+    hk = nc_zalloc(sizeof(*hk));
+    if (hk == NULL) {
+        return NULL;
+    }
+
+    hk->max_top = max_top;
+    hk->max_counter = max_top * HOTKEY_NCOUNTER;
+    hk->sample_rate = sample_rate;
+    hk->countdown = 1;
+    hk->rand = (uint32_t)nc_usec_now() | 1;
+
+    /* keep the table at most half full, so probes stay short */
+    for (nslot = 1; nslot < 2 * hk->max_counter; nslot <<= 1) {
+        /* nothing */
+    }
+    hk->table_mask = nslot - 1;
+
+    hk->counter = nc_zalloc(hk->max_counter * sizeof(*hk->counter));
+    hk->heap = nc_zalloc(hk->max_counter * sizeof(*hk->heap));
+    hk->table = nc_zalloc(nslot * sizeof(*hk->table));
+    hk->top = nc_zalloc(max_top * sizeof(*hk->top));
+    if (hk->counter == NULL || hk->heap == NULL || hk->table == NULL ||
+        hk->top == NULL) {
+        hotkey_destroy(hk);
+        return NULL;
+    }
+
+    return hk;
+}
+
+void
+hotkey_destroy(struct hotkey *hk)
+{
+    if (hk->counter != NULL) {
+        nc_free(hk->counter);
+    }
+    if (hk->heap != NULL) {
+        nc_free(hk->heap);
+    }
+    if (hk->table != NULL) {
+        nc_free(hk->table);
+    }
+    if (hk->top != NULL) {
+        nc_free(hk->top);
+    }
+    nc_free(hk);
+}
+
+/*
+ * Schedule the next sample in 1 to 2 * sample_rate - 1 keys, which is
+ * sample_rate on average but does not alias with periodic key patterns
+ */
+static void
+hotkey_schedule(struct hotkey *hk)
+{
+    uint32_t x;
+
+    if (hk->sample_rate == 1) {
+        hk->countdown = 1;
+        return;
+    }
+
+    x = hk->rand;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    hk->rand = x;
+
+    hk->countdown = 1 + x % (2 * hk->sample_rate - 1);
+}
+
+static void
+hotkey_heap_swap(struct hotkey *hk, uint32_t i, uint32_t j)
+{
+    uint32_t ci = hk->heap[i], cj = hk->heap[j];
+
+    hk->heap[i] = cj;
+    hk->counter[cj].heap_idx = i;
+    hk->heap[j] = ci;
+    hk->counter[ci].heap_idx = j;
+}
+
+static uint64_t
+hotkey_heap_count(struct hotkey *hk, uint32_t i)
+{
+    return hk->counter[hk->heap[i]].count;
+}
+
+static void
+hotkey_heap_up(struct hotkey *hk, uint32_t i)
+{
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+
+        if (hotkey_heap_count(hk, parent) <= hotkey_heap_count(hk, i)) {
+            break;
+        }
+        hotkey_heap_swap(hk, i, parent);
+        i = parent;
+    }
+}
+
+static void
+hotkey_heap_down(struct hotkey *hk, uint32_t i)
+{
+    for (;;) {
+        uint32_t l = 2 * i + 1, r = l + 1, min = i;
+
+        if (l < hk->ncounter &&
+            hotkey_heap_count(hk, l) < hotkey_heap_count(hk, min)) {
+            min = l;
+        }
+        if (r < hk->ncounter &&
+            hotkey_heap_count(hk, r) < hotkey_heap_count(hk, min)) {
+            min = r;
+        }
+        if (min == i) {
+            break;
+        }
+        hotkey_heap_swap(hk, i, min);
+        i = min;
+    }
+}
+
+/*
+ * Return the table slot holding the key, or the empty slot where it would
+ * be inserted. Keys match on hash, full length and the stored prefix.
+ */
+static uint32_t *
+hotkey_lookup(struct hotkey *hk, uint32_t hash, uint8_t *key, uint32_t keylen)
+{
+    uint32_t i;
+
+    for (i = hash & hk->table_mask;; i = (i + 1) & hk->table_mask) {
+        struct hotkey_counter *c;
+
+        if (hk->table[i] == 0) {
+            return &hk->table[i];
+        }
+
+        c = &hk->counter[hk->table[i] - 1];
+        if (c->hash == hash && c->key_len == keylen &&
+            memcmp(c->key, key, MIN(keylen, HOTKEY_KEY_LEN)) == 0) {
+            return &hk->table[i];
+        }
+    }
+}
+
+/* linear probing delete with backward shift, so no tombstones pile up */
+static void
+hotkey_unlink(struct hotkey *hk, uint32_t idx)
+{
+    uint32_t i, j, home, mask = hk->table_mask;
+
+    for (i = hk->counter[idx].hash & mask; hk->table[i] != idx + 1;
+         i = (i + 1) & mask) {
+        /* nothing */
+    }
+
+    for (j = (i + 1) & mask; hk->table[j] != 0; j = (j + 1) & mask) {
+        home = hk->counter[hk->table[j] - 1].hash & mask;
+
+        /* entry at j stays if its home slot lies cyclically in (i, j] */
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j)) {
+            continue;
+        }
+
+        hk->table[i] = hk->table[j];
+        i = j;
+    }
+
+    hk->table[i] = 0;
+}
+
+static void
+hotkey_set_key(struct hotkey_counter *c, uint32_t hash, uint8_t *key,
+               uint32_t keylen)
+{
+    c->hash = hash;
+    c->key_len = keylen;
+    nc_memcpy(c->key, key, MIN(keylen, HOTKEY_KEY_LEN));
+}
+
+void
+hotkey_sample(struct hotkey *hk, uint8_t *key, uint32_t keylen)
+{
+    struct hotkey_counter *c;
+    uint32_t hash, idx, *slot;
+    uint64_t min;
+
+    hotkey_schedule(hk);
+
+    hash = hash_fnv1a_32((char *)key, keylen);
+    slot = hotkey_lookup(hk, hash, key, keylen);
+
+    if (*slot != 0) {
+        c = &hk->counter[*slot - 1];
+        c->count += hk->sample_rate;
+        hotkey_heap_down(hk, c->heap_idx);
+        return;
+    }
+
+    if (hk->ncounter < hk->max_counter) {
+        idx = hk->ncounter++;
+        c = &hk->counter[idx];
+        hotkey_set_key(c, hash, key, keylen);
+        c->count = hk->sample_rate;
+        c->error = 0;
+        c->heap_idx = idx;
+        hk->heap[idx] = idx;
+        *slot = idx + 1;
+        hotkey_heap_up(hk, idx);
+        return;
+    }
+
+    /* all counters taken; the key replaces the least counted one */
+    idx = hk->heap[0];
+    c = &hk->counter[idx];
+    min = c->count;
+
+    hotkey_unlink(hk, idx);
+    hotkey_set_key(c, hash, key, keylen);
+    c->count = min + hk->sample_rate;
+    c->error = min;
+
+    slot = hotkey_lookup(hk, hash, key, keylen);
+    *slot = idx + 1;
+    hotkey_heap_down(hk, 0);
+}
+
+/*
+ * Close the window when it is due: drain the heap in ascending order so
+ * the largest max_top counters land in top[] sorted by count, publish them
+ * and start counting again
+ */
+void
+hotkey_tick(struct context *ctx, struct server_pool *pool)
+{
+    struct hotkey *hk = pool->hotkey;
+    int64_t now, elapsed;
+    uint32_t n;
+
+    if (hk == NULL) {
+        return;
+    }
+
+    now = nc_usec_now();
+    if (hk->window_start == 0) {
+        hk->window_start = now;
+        return;
+    }
+
+    elapsed = now - hk->window_start;
+    if (elapsed < HOTKEY_WINDOW * 1000000LL) {
+        return;
+    }
+
+    hk->ntop = MIN(hk->ncounter, hk->max_top);
+
+    while (hk->ncounter > 0) {
+        struct hotkey_counter *c = &hk->counter[hk->heap[0]];
+
+        n = --hk->ncounter;
+        if (n < hk->ntop) {
+            struct hotkey_stat *hs = &hk->top[n];
+
+            hs->count = c->count;
+            hs->error = c->error;
+            hs->rate = c->count * 1000000ULL / (uint64_t)elapsed;
+            hs->key_len = c->key_len;
+            nc_memcpy(hs->key, c->key, MIN(c->key_len, HOTKEY_KEY_LEN));
+        }
+
+        if (n > 0) {
+            hotkey_heap_swap(hk, 0, n);
+            hotkey_heap_down(hk, 0);
+        }
+    }
+
+    memset(hk->table, 0, (hk->table_mask + 1) * sizeof(*hk->table));
+    hk->window_start = now;
+
+    stats_pool_hotkey(ctx, pool, hk->top, hk->ntop);
+}
@@ -0,0 +1,92 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _NC_HOTKEY_H_
+#define _NC_HOTKEY_H_
+
+#include <nc_core.h>
+
+/*
+ * Streaming heavy hitters of the keys forwarded by a pool, using the
+ * Space-Saving algorithm over a fixed number of counters. A key is sampled
+ * with probability ~1 / sample_rate and counts for sample_rate requests.
+ * A sampled key either bumps its counter or, when all counters are taken,
+ * replaces the smallest one and inherits its count as error, so that
+ * count - error is a lower bound of the key's true (sampled) count.
+ *
+ * Counters live in a min-heap on count and are found through an open
+ * addressing table keyed by the key hash. Every HOTKEY_WINDOW seconds the
+ * top keys are published, with their rate over the window, and counting
+ * starts over. Memory is bounded by the number of counters; only a prefix
+ * of each key is kept.
+ */
+#define HOTKEY_KEY_LEN      64
+#define HOTKEY_NCOUNTER     4       /* # counters per reported key */
+#define HOTKEY_WINDOW       10      /* report window in sec */
+
+struct hotkey_counter {
+    uint64_t count;                 /* estimated # requests */
+    uint64_t error;                 /* overestimation bound of count */
+    uint32_t hash;                  /* key hash */
+    uint32_t heap_idx;              /* position in heap */
+    uint32_t key_len;               /* full key length */
+    uint8_t  key[HOTKEY_KEY_LEN];   /* key prefix */
+};
+
+struct hotkey_stat {
+    uint64_t count;                 /* estimated # requests in window */
+    uint64_t error;                 /* overestimation bound of count */
+    uint64_t rate;                  /* estimated requests per second */
+    uint32_t key_len;               /* full key length */
+    uint8_t  key[HOTKEY_KEY_LEN];   /* key prefix */
+};
+
+struct hotkey {
+    uint32_t              ncounter;     /* # counters in use */
+    uint32_t              max_counter;  /* # counters */
+    struct hotkey_counter *counter;     /* counter[] */
+    uint32_t              *heap;        /* min-heap of counter index on count */
+    uint32_t              *table;       /* counter index + 1, 0 when empty */
+    uint32_t              table_mask;   /* # table slots - 1 */
+
+    uint32_t              sample_rate;  /* sample 1 in sample_rate keys */
+    uint32_t              countdown;    /* # keys until the next sample */
+    uint32_t              rand;         /* xorshift state */
+
+    int64_t               window_start; /* window start in usec */
+    uint32_t              ntop;         /* # top keys of the last window */
+    uint32_t              max_top;      /* # top keys reported */
+    struct hotkey_stat    *top;         /* top[] of the last window, by count */
+};
+
+void hotkey_sample(struct hotkey *hk, uint8_t *key, uint32_t keylen);
+
+static inline void
+hotkey_update(struct hotkey *hk, uint8_t *key, uint32_t keylen)
+{
+    if (--hk->countdown != 0) {
+        return;
+    }
+
+    hotkey_sample(hk, key, keylen);
+}
+
+struct hotkey *hotkey_create(uint32_t max_top, uint32_t sample_rate);
+void hotkey_destroy(struct hotkey *hk);
+void hotkey_tick(struct context *ctx, struct server_pool *pool);
+
+#endif
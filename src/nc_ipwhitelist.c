@@ -10,16 +10,43 @@
 #include <nc_core.h>
 #include <sys/stat.h>
 
+/*
+ * The whitelist is a binary radix (longest-prefix-match) trie keyed on the
+ * raw network-order address bytes: one bit per level, nodes packed in one
+ * array and linked by index. IPv4 and IPv6 have separate roots; IPv4-mapped
+ * IPv6 addresses (::ffff:a.b.c.d) are looked up in the IPv4 trie. A node
+ * that terminates a prefix has both children set to WL_MATCH, and nothing
+ * is ever inserted below it, so a lookup stops at the first (shortest)
+ * covering prefix.
+ *
+ * The table is immutable once published. The reload thread swaps the global
+ * pointer and then waits for whitelist_nreader to drain to zero before the
+ * old table is freed, so readers never touch reclaimed memory.
+ */
+
+#define WL_ROOT_V4      0
+#define WL_ROOT_V6      1
+#define WL_NODE_INIT    64
+#define WL_MATCH        UINT32_MAX
+
 static const char *whitelist_file = NULL;
 static int check_interval;
 
+struct wl_node {
+    uint32_t child[2];      /* 0 - none, WL_MATCH - prefix ends here */
+};
+
 typedef struct _whitelist_t {
-    struct hash_table *ht;
+    struct wl_node *node;   /* node[0] - ipv4 root, node[1] - ipv6 root */
+    uint32_t nnode;         /* # used nodes */
+    uint32_t nalloc;        /* # allocated nodes */
+    uint32_t nentry;        /* # prefixes loaded */
     long mtime;
 } whitelist_t;
 pthread_t whitelist_thread;
 
-whitelist_t *whitelist = NULL;
+whitelist_t *volatile whitelist = NULL;
+static volatile int whitelist_nreader = 0;
 
 static long get_mtime(const char* filename)
 {
@@ -30,12 +57,143 @@ static long get_mtime(const char* filename)
     return (long)buf.st_mtime;
 }
 
+static whitelist_t *whitelist_create(void) {
+    whitelist_t *w = (whitelist_t*) nc_alloc(sizeof(whitelist_t));
+    if (w == NULL) {
+        return NULL;
+    }
+    w->node = nc_zalloc(sizeof(struct wl_node) * WL_NODE_INIT);
+    if (w->node == NULL) {
+        nc_free(w);
+        return NULL;
+    }
+    w->nnode = 2;
+    w->nalloc = WL_NODE_INIT;
+    w->nentry = 0;
+    w->mtime = 0;
+    return w;
+}
+
+static uint32_t wl_node_new(whitelist_t *w) {
+    struct wl_node *node;
+    uint32_t nalloc;
+
+    if (w->nnode == w->nalloc) {
+        nalloc = w->nalloc * 2;
+        node = nc_realloc(w->node, sizeof(struct wl_node) * nalloc);
+        if (node == NULL) {
+            return 0;
+        }
+        w->node = node;
+        w->nalloc = nalloc;
+    }
+    w->node[w->nnode].child[0] = 0;
+    w->node[w->nnode].child[1] = 0;
+    return w->nnode++;
+}
+
+static int wl_insert(whitelist_t *w, uint32_t root, const uint8_t *key, int plen) {
+    uint32_t n = root, next;
+    int i, bit;
+
+    for (i = 0; i < plen; i++) {
+        if (w->node[n].child[0] == WL_MATCH) {
+            /* already covered by a shorter prefix */
+            return NC_OK;
+        }
+        bit = (key[i >> 3] >> (7 - (i & 7))) & 1;
+        next = w->node[n].child[bit];
+        if (next == 0) {
+            next = wl_node_new(w);
+            if (next == 0) {
+                return NC_ENOMEM;
+            }
+            w->node[n].child[bit] = next;
+        }
+        n = next;
+    }
+
+    /* any longer prefixes below this node are subsumed by it */
+    w->node[n].child[0] = WL_MATCH;
+    w->node[n].child[1] = WL_MATCH;
+    w->nentry++;
+    return NC_OK;
+}
+
+static int wl_match(const whitelist_t *w, uint32_t root, const uint8_t *key, int nbits) {
+    uint32_t n = root;
+    int i, bit;
+
+    for (i = 0; ; i++) {
+        if (w->node[n].child[0] == WL_MATCH) {
+            return 1;
+        }
+        if (i == nbits) {
+            return 0;
+        }
+        bit = (key[i >> 3] >> (7 - (i & 7))) & 1;
+        n = w->node[n].child[bit];
+        if (n == 0) {
+            return 0;
+        }
+    }
+}
+
+/*
+ * Parse "addr" or "addr/prefixlen" (ipv4 or ipv6) and insert it. Returns
+ * NC_ERROR for a malformed entry, which the caller skips.
+ */
+static int wl_add(whitelist_t *w, char *line) {
+    uint8_t key[16];
+    char *slash;
+    int plen, maxlen, status;
+    uint32_t root;
+
+    slash = strchr(line, '/');
+    if (slash != NULL) {
+        *slash = '\0';
+    }
+
+    if (inet_pton(AF_INET, line, key) == 1) {
+        root = WL_ROOT_V4;
+        maxlen = 32;
+    } else if (inet_pton(AF_INET6, line, key) == 1) {
+        root = WL_ROOT_V6;
+        maxlen = 128;
+    } else {
+        return NC_ERROR;
+    }
+
+    plen = maxlen;
+    if (slash != NULL) {
+        plen = nc_atoi(slash + 1, strlen(slash + 1));
+        if (plen < 0 || plen > maxlen) {
+            return NC_ERROR;
+        }
+    }
+
+    /* fold ::ffff:a.b.c.d/96+ into the ipv4 trie */
+    if (root == WL_ROOT_V6 && plen >= 96 && IN6_IS_ADDR_V4MAPPED((struct in6_addr *)key)) {
+        memmove(key, key + 12, 4);
+        root = WL_ROOT_V4;
+        plen -= 96;
+    }
+
+    status = wl_insert(w, root, key, plen);
+    if (status != NC_OK) {
+        return status;
+    }
+    log_debug(LOG_DEBUG, "whitelist added for %s/%d", line, plen);
+    return NC_OK;
+}
+
 whitelist_t* load_whitelist(void) {
     FILE *f;
     char buf[128];
     char *line;
     char *end;
     long mtime;
+    int status;
     mtime = get_mtime(whitelist_file);
     if (mtime < 0) {
         return NULL;
@@ -46,17 +204,12 @@ whitelist_t* load_whitelist(void) {
         return NULL;
     }
 
-    whitelist_t *w = (whitelist_t*) nc_alloc(sizeof(whitelist_t));
+    whitelist_t *w = whitelist_create();
     if (w == NULL) {
+        fclose(f);
         log_warn("malloc failed");
         return NULL;
     }
-    w->ht = assoc_create_table_default();
-    if (w->ht == NULL) {
-        nc_free(w);
-        log_warn("hashset create failed");
-        return NULL;
-    }
     w->mtime = mtime;
 
     while(fgets(buf, sizeof(buf), f) != NULL) {
@@ -66,20 +219,23 @@ whitelist_t* load_whitelist(void) {
         //skip empty line or comments
         if (line[0] == '#' || line[0] == '\r' || line[0] == '\n' || line[0] == 0) continue;
         end = line;
-        //trim trailing characters
-        while ((*end >= '0' && *end <= '9') || *end == '.') end++;
+        //trim trailing whitespace and comments
+        while (*end != 0 && *end != ' ' && *end != '\t' && *end != '\r' &&
+               *end != '\n' && *end != '#') end++;
         *end = 0;
 
-        if (strlen(line) == 0) continue;
-
-        //add to ht
-        if (assoc_set(w->ht, line, strlen(line), (void *)1) != NC_OK) {
+        status = wl_add(w, line);
+        if (status == NC_ENOMEM) {
+            fclose(f);
             free_whitelist(w);
             return NULL;
         }
-        log_debug(LOG_DEBUG, "whitelist added for %s", line);
+        if (status != NC_OK) {
+            log_warn("whitelist ignore invalid entry '%s'", line);
+        }
     }
     fclose(f);
+    log_warn("whitelist loaded %u entries, %u nodes", w->nentry, w->nnode);
     return w;
 }
 
@@ -115,20 +271,37 @@ int is_whitelist_changed(void) {
 
 void free_whitelist(whitelist_t *w) {
     if (!w) return;
-    assoc_destroy_table(w->ht);
+    nc_free(w->node);
     nc_free(w);
 }
 
-int in_whitelist_u(char *ip) {
-    if (whitelist == NULL) return 1;
-    if (assoc_find(whitelist->ht, ip, nc_strlen(ip)) != NULL) {
-        return 1;
+int in_whitelist(const struct sockaddr *addr) {
+    const whitelist_t *w;
+    const uint8_t *key;
+    int allow;
+
+    __sync_fetch_and_add(&whitelist_nreader, 1);
+    w = whitelist;
+
+    if (w == NULL) {
+        allow = 1;
+    } else if (addr->sa_family == AF_INET) {
+        key = (const uint8_t *)&((const struct sockaddr_in *)addr)->sin_addr;
+        allow = wl_match(w, WL_ROOT_V4, key, 32);
+    } else if (addr->sa_family == AF_INET6) {
+        key = (const uint8_t *)&((const struct sockaddr_in6 *)addr)->sin6_addr;
+        if (IN6_IS_ADDR_V4MAPPED((const struct in6_addr *)key)) {
+            allow = wl_match(w, WL_ROOT_V4, key + 12, 32);
+        } else {
+            allow = wl_match(w, WL_ROOT_V6, key, 128);
+        }
+    } else {
+        /* unix domain sockets are local */
+        allow = 1;
     }
-    return 0;
-}
 
-int in_whitelist(struct in_addr in) {
-    return in_whitelist_u(inet_ntoa(in));
+    __sync_fetch_and_sub(&whitelist_nreader, 1);
+    return allow;
 }
 
 void *whitelist_loop() {
@@ -141,9 +314,12 @@ void *whitelist_loop() {
             whitelist_t *w = load_whitelist();
             whitelist_t *tmp = whitelist;
             whitelist = w;
+            __sync_synchronize();
 
-            /* if whitelist changed, sleep double time */
-            sleep((unsigned)check_interval);
+            /* wait for readers that may still hold the old table */
+            while (whitelist_nreader != 0) {
+                usleep(1000);
+            }
             free_whitelist(tmp);
         }
     }
@@ -14,11 +14,10 @@ typedef struct _whitelist_t whitelist_t;
 whitelist_t* load_whitelist(void);
 int is_whitelist_changed(void);
 void free_whitelist(whitelist_t *w);
-int in_whitelist_u(char *ip);
-int in_whitelist(struct in_addr addr);
+int in_whitelist(const struct sockaddr *addr);
 int whitelist_init(const char *filename, int interval);
 
-extern whitelist_t *whitelist;
+extern whitelist_t *volatile whitelist;
 #endif  //_NC_IPWHITELIST_H_
 
 /* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
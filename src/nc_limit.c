@@ -0,0 +1,314 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <nc_core.h>
+#include <nc_server.h>
+#include <nc_limit.h>
+
+/* max in-flight requests in lane of pool, or 0 for no limit */
+static uint32_t
+limit_max(struct server_pool *pool, uint32_t lane)
+{
+    return lane == SERVER_LANE_SLOW ? pool->slow_lane_limit : pool->limit_max;
+}
+
+static void
+limit_take(struct context *ctx, struct server *server, struct msg *msg)
+{
+    ASSERT(msg->limit_server == NULL);
+
+    msg->limit_server = server;
+    msg->limit_ts = nc_loop_usec();
+    server->lane[msg->lane].limit_inflight++;
+
+    stats_server_incr(ctx, server, concurrency_inflight);
+}
+
+/*
+ * Additive increase on a fast reply, multiplicative decrease on a slow one,
+ * in the fast lane; the limit of the slow lane, made of slow replies, is
+ * fixed.
+ */
+static void
+limit_adjust(struct server *server, uint32_t lane, int64_t now, bool slow)
+{
+    struct server_pool *pool = server->owner;
+    struct server_lane *l = &server->lane[lane];
+    uint32_t cut;
+
+    if (lane != SERVER_LANE_FAST) {
+        return;
+    }
+
+    if (!slow) {
+        if (l->limit >= pool->limit_max) {
+            return;
+        }
+
+        if (++l->limit_acc >= l->limit) {
+            l->limit++;
+            l->limit_acc = 0;
+        }
+        return;
+    }
+
+    /* replies in flight still reflect the limit before the last cut */
+    if (l->limit <= LIMIT_MIN || now - l->limit_cut < pool->limit_latency) {
+        return;
+    }
+
+    cut = MAX(l->limit / 10, 1);
+    l->limit = MAX(l->limit - cut, LIMIT_MIN);
+    l->limit_acc = 0;
+    l->limit_cut = now;
+
+    log_debug(LOG_INFO, "limit of '%.*s' cut to %"PRIu32", %"PRIu32" in flight",
+              server->pname.len, server->pname.data, l->limit,
+              l->limit_inflight);
+}
+
+/* fail a waiting request, that was never sent */
+static void
+limit_fail(struct context *ctx, struct msg *msg, err_t err)
+{
+    struct conn *c_conn;
+    rstatus_t status;
+
+    /* client went away */
+    if (msg->swallow) {
+        req_put(msg);
+        return;
+    }
+
+    msg->done = 1;
+    msg->error = 1;
+    msg->err = err;
+
+    if (msg->sf != NULL) {
+        singleflight_done(msg, NULL, err);
+    }
+
+    if (msg->frag_owner != NULL) {
+        msg->frag_owner->nfrag_done++;
+    }
+
+    /* noreply request don't expect any response */
+    if (msg->noreply) {
+        req_put(msg);
+        return;
+    }
+
+    c_conn = msg->owner;
+
+    if (req_done(c_conn, TAILQ_FIRST(&c_conn->omsg_q))) {
+        status = event_add_out(ctx->evb, c_conn);
+        if (status != NC_OK) {
+            c_conn->err = errno;
+        }
+    }
+}
+
+/* send the requests waiting in lane of server, as long as it has free slots */
+static void
+limit_dispatch(struct context *ctx, struct server *server, uint32_t lane)
+{
+    struct server_lane *l = &server->lane[lane];
+    struct msg *msg;
+    struct conn *conn;
+    rstatus_t status;
+
+    while (l->limit_nwait != 0 && l->limit_inflight < l->limit) {
+        msg = TAILQ_FIRST(&l->limit_wait);
+
+        conn = NULL;
+        if (!msg->swallow) {
+            conn = server_lane_conn(server, lane);
+            if (conn == NULL) {
+                return;
+            }
+
+            status = server_connect(ctx, server, conn);
+            if (status != NC_OK) {
+                server_close(ctx, conn);
+                return;
+            }
+        }
+
+        TAILQ_REMOVE(&l->limit_wait, msg, s_tqe);
+        l->limit_nwait--;
+        stats_server_decr(ctx, server, concurrency_waiting);
+
+        /* client went away */
+        if (msg->swallow) {
+            req_put(msg);
+            continue;
+        }
+
+        limit_take(ctx, server, msg);
+
+        log_debug(LOG_VERB, "send waiting req %"PRIu64" on s %d, %"PRIu32
+                  " in flight", msg->id, conn->sd, l->limit_inflight);
+
+        (void)req_enqueue(ctx, conn, msg->owner, msg);
+    }
+}
+
+/*
+ * Admit request msg to its lane of the server of server connection s_conn.
+ * Return
+ * NC_OK when msg may be enqueued now, NC_EAGAIN when it waits for a slot
+ * and NC_ERROR, with errno set, when it is shed.
+ */
+rstatus_t
+limit_admit(struct context *ctx, struct conn *s_conn, struct msg *msg)
+{
+    struct server *server = s_conn->owner;
+    struct server_pool *pool = server->owner;
+    struct server_lane *l = &server->lane[msg->lane];
+
+    ASSERT(!s_conn->client && !s_conn->proxy);
+    ASSERT(msg->request);
+
+    if (limit_max(pool, msg->lane) == 0 || msg->limit_server == server) {
+        return NC_OK;
+    }
+
+    /* a redirected or retried request takes its slot along */
+    if (msg->limit_server != NULL) {
+        limit_release(msg, false);
+        limit_take(ctx, server, msg);
+        return NC_OK;
+    }
+
+    if (l->limit_nwait != 0) {
+        limit_dispatch(ctx, server, msg->lane);
+    }
+
+    if (l->limit_nwait == 0 && l->limit_inflight < l->limit) {
+        limit_take(ctx, server, msg);
+        return NC_OK;
+    }
+
+    if (l->limit_nwait < pool->limit_queue) {
+        TAILQ_INSERT_TAIL(&l->limit_wait, msg, s_tqe);
+        l->limit_nwait++;
+        stats_server_incr(ctx, server, concurrency_waiting);
+
+        log_debug(LOG_VERB, "req %"PRIu64" waits on '%.*s', %"PRIu32" in "
+                  "flight", msg->id, server->pname.len, server->pname.data,
+                  l->limit_inflight);
+
+        return NC_EAGAIN;
+    }
+
+    stats_server_incr(ctx, server, shed_requests);
+
+    log_debug(LOG_INFO, "shed req %"PRIu64" to '%.*s', %"PRIu32" in flight "
+              "and %"PRIu32" waiting", msg->id, server->pname.len,
+              server->pname.data, l->limit_inflight, l->limit_nwait);
+
+    errno = EBUSY;
+    return NC_ERROR;
+}
+
+/* request msg got its response */
+void
+limit_done(struct context *ctx, struct msg *msg)
+{
+    struct server *server = msg->limit_server;
+    int64_t now;
+
+    if (server == NULL) {
+        return;
+    }
+
+    now = nc_loop_usec();
+    limit_adjust(server, msg->lane, now,
+                 now - msg->limit_ts > server->owner->limit_latency);
+    limit_release(msg, false);
+
+    limit_dispatch(ctx, server, msg->lane);
+}
+
+/* give back the slot of request msg, that failed if failed */
+void
+limit_release(struct msg *msg, bool failed)
+{
+    struct server *server = msg->limit_server;
+
+    if (server == NULL) {
+        return;
+    }
+
+    if (failed) {
+        limit_adjust(server, msg->lane, nc_loop_usec(), true);
+    }
+
+    ASSERT(server->lane[msg->lane].limit_inflight > 0);
+    server->lane[msg->lane].limit_inflight--;
+    msg->limit_server = NULL;
+
+    stats_server_decr(server->owner->ctx, server, concurrency_inflight);
+}
+
+/* fail the requests waiting on server, that goes away */
+void
+limit_drain(struct context *ctx, struct server *server)
+{
+    struct server_lane *l;
+    struct msg *msg;
+    uint32_t i;
+
+    for (i = 0; i < SERVER_NLANE; i++) {
+        l = &server->lane[i];
+
+        while (!TAILQ_EMPTY(&l->limit_wait)) {
+            msg = TAILQ_FIRST(&l->limit_wait);
+            TAILQ_REMOVE(&l->limit_wait, msg, s_tqe);
+            l->limit_nwait--;
+            stats_server_decr(ctx, server, concurrency_waiting);
+
+            limit_fail(ctx, msg, EBUSY);
+        }
+    }
+}
+
+/* send waiting requests of servers whose slots freed up by failures */
+void
+limit_tick(struct server_pool *pool)
+{
+    struct context *ctx = pool->ctx;
+    struct server *server;
+    uint32_t i, lane;
+
+    if (pool->limit_max == 0 && pool->slow_lane_limit == 0) {
+        return;
+    }
+
+    for (i = 0; i < array_n(&pool->server); i++) {
+        server = *(struct server **)array_get(&pool->server, i);
+
+        stats_server_set(ctx, server, concurrency_limit,
+                         server->lane[SERVER_LANE_FAST].limit);
+
+        for (lane = 0; lane < SERVER_NLANE; lane++) {
+            if (server->lane[lane].limit_nwait != 0) {
+                limit_dispatch(ctx, server, lane);
+            }
+        }
+    }
+}
@@ -0,0 +1,50 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _NC_LIMIT_H_
+#define _NC_LIMIT_H_
+
+#include <nc_core.h>
+
+/*
+ * Adaptive limit of the requests in flight to each server of a pool with
+ * concurrency_limit set. A request takes a slot of its server when it is
+ * enqueued on one of the server connections, and gives it back when its
+ * response is received, when it fails or, at the latest, when it is put.
+ *
+ * The limit of each server starts at concurrency_limit and moves AIMD
+ * style: it grows by one after as many replies faster than
+ * concurrency_latency as the limit itself, and shrinks by a tenth (by one
+ * at least, down to LIMIT_MIN) on a slower reply or a failed request, at
+ * most once per concurrency_latency. A request over the limit waits in
+ * the server's queue of at most concurrency_queue requests, or fails with
+ * EBUSY when that is full. Waiting requests are sent, in order, as slots
+ * free up.
+ *
+ * The slow lane of a server keeps its own slots, waiting queue and a fixed
+ * limit of slow_lane_limit, so slow commands never take the slots of the
+ * fast lane.
+ */
+#define LIMIT_MIN   1
+
+rstatus_t limit_admit(struct context *ctx, struct conn *s_conn, struct msg *msg);
+void limit_done(struct context *ctx, struct msg *msg);
+void limit_release(struct msg *msg, bool failed);
+void limit_drain(struct context *ctx, struct server *server);
+void limit_tick(struct server_pool *pool);
+
+#endif
@@ -17,9 +17,12 @@
 
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <ctype.h>
 #include <time.h>
+#include <poll.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <nc_core.h>
 #include <nc_log.h>
@@ -28,8 +31,93 @@
 #define LOG_EX_MAX_INTERCAL 20
 #define LOG_EX_MIN_INTERCAL 1
 
+#define LOG_OUT_SIZE        (256 * 1024)   /* log thread output buffer size */
+#define LOG_IOV_MAX         64             /* max # iovecs in one writev */
+
+typedef enum log_rec_type {
+    LOG_REC_PAD = 1,                       /* skip to the start of the ring */
+    LOG_REC_FMT = 2,                       /* format and its arguments */
+    LOG_REC_RAW = 3,                       /* preformatted text */
+} log_rec_type_t;
+
+/*
+ * A ring record is a struct log_rec followed by dlen bytes of data, padded
+ * to 8 bytes. For LOG_REC_FMT the data are the arguments of the format in
+ * order of use, each in an 8 byte slot: integers as int64_t or uint64_t,
+ * doubles and pointers as is, and a string as its length followed by its
+ * bytes. A record never wraps around the end of the ring; the space left
+ * at the end is skipped with a LOG_REC_PAD record of which only the first
+ * 8 bytes are written.
+ */
+struct log_rec {
+    uint32_t   len;                        /* record size, header included */
+    uint8_t    type;                       /* log_rec_type_t */
+    uint8_t    level;                      /* log level */
+    uint16_t   unused;                     /* zero */
+    uint32_t   line;                       /* source line */
+    uint32_t   dlen;                       /* # data bytes that follow */
+    int64_t    usec;                       /* time of the log call */
+    const char *file;                      /* source file */
+    const char *fmt;                       /* format, for LOG_REC_FMT */
+};
+
+typedef enum log_arg_type {
+    LOG_ARG_NONE,                          /* %% or unknown conversion */
+    LOG_ARG_INT,                           /* d, i, c */
+    LOG_ARG_UINT,                          /* o, u, x, X */
+    LOG_ARG_DOUBLE,                        /* e, f, g, a */
+    LOG_ARG_STR,                           /* s */
+    LOG_ARG_PTR,                           /* p */
+    LOG_ARG_SKIP,                          /* n, pointer not stored */
+} log_arg_type_t;
+
+typedef enum log_lmod {
+    LOG_LMOD_NONE,
+    LOG_LMOD_HH,
+    LOG_LMOD_H,
+    LOG_LMOD_L,
+    LOG_LMOD_LL,
+    LOG_LMOD_Z,
+    LOG_LMOD_J,
+    LOG_LMOD_T,
+    LOG_LMOD_LD,
+} log_lmod_t;
+
+/* a printf conversion: %[flags][width][.precision][length]conversion */
+struct log_spec {
+    const char *start;                     /* '%' */
+    const char *prec;                      /* '.' or length modifier */
+    const char *lmod;                      /* length modifier or conversion */
+    const char *end;                       /* one past the conversion */
+    log_lmod_t lm;                         /* length modifier */
+    char       conv;                       /* conversion */
+    unsigned   wstar:1;                    /* width is '*'? */
+    unsigned   pstar:1;                    /* precision is '*'? */
+    int        precision;                  /* literal precision, -1 if none */
+};
+
+/* arguments of a record, as stored by a producer or read by the log thread */
+struct log_args {
+    uint8_t    *pos;                       /* next slot */
+    uint8_t    *end;                       /* end of the arguments */
+};
+
+/* text and raw records of one destination, gathered for a writev */
+struct log_out {
+    char         *buf;                     /* LOG_OUT_SIZE bytes of text */
+    size_t       len;                      /* # bytes of text */
+    struct iovec iov[LOG_IOV_MAX];         /* text and raw records */
+    int          niov;                     /* # iov used */
+};
+
+/* cached time prefix, "%Y-%m-%d %H:%M:%S." of sec */
+struct log_clock {
+    time_t     sec;
+    int        len;
+    char       str[32];
+};
+
 static struct logger logger;
-static int status;
 static int log_up_tag;
 static int log_down_tag;
 static int log_reopen_tag;
@@ -37,6 +125,15 @@ static int logbuf_exintercal = 10;
 static int logbuf_intercal_up;
 static int logbuf_intercal_down;
 
+static __thread struct log_ring *log_ring_self; /* ring of this thread */
+static __thread int log_ring_none;              /* no ring for this thread? */
+
+static void log_ring_release(void *arg);
+
+static struct log_out log_out[2];               /* LOG_ACCESS and LOG_WF */
+static struct log_clock log_clock;              /* log thread clock */
+static uint64_t log_nnoring_logged;             /* # nnoring, last logged */
+
 /*
  *  init and deinit
  */
@@ -44,11 +141,16 @@ int
 log_init(struct instance *nci)
 {
     struct logger *l = &logger;
+    int i, status;
+
     l->level = MAX(LOG_EMERG, MIN(nci->log_level, LOG_PVERB));
     l->name = nci->log_filename;
     l->nerror = 0;
-    l->exchange_failed = 0;
-    l->discard_log_count=0;
+    l->nring = 0;
+    l->nrecord = 0;
+    l->nnoring = 0;
+    l->running = 0;
+    l->done = 0;
     log_up_tag = 0;
     log_down_tag = 0;
     log_reopen_tag = 0;
@@ -68,7 +170,7 @@ log_init(struct instance *nci)
     } else {
         size_t len = strlen(l->name);
         l->wf_name = malloc(len + 4);
-        if (l->wf_name == NULL) 
+        if (l->wf_name == NULL)
             return -1;
         memcpy(l->wf_name, l->name, (size_t)(len));
         *(l->wf_name + len) = '.';
@@ -87,26 +189,17 @@ log_init(struct instance *nci)
         }
     }
 
-    l->accesslog_buf[0] = _log_buf_get("accesslog_buf_0");
-    if (l->accesslog_buf[0] == NULL) {
-        log_stderr("accesslog_buf_0 malloc failed!");
-        return -1;
-    } 
-    l->accesslog_buf[1] = _log_buf_get("accesslog_buf_1");
-    if (l->accesslog_buf[1] == NULL) {
-        log_stderr("accesslog_buf_1 malloc failed!");
-        return -1;
-    }
-    l->wflog_buf[0] = _log_buf_get("wf_buf_0");
-    if (l->wflog_buf[0] == NULL) {
-        log_stderr("wflog_buf_0 malloc failed!");
-        return -1;
-    }
-    l->wflog_buf[1] = _log_buf_get("wf_buf_1");
-    if (l->wflog_buf[1] == NULL) {
-        log_stderr("wflog_buf_1 malloc failed!");
-        return -1;
+    for (i = 0; i < (int)NELEMS(log_out); i++) {
+        log_out[i].buf = malloc(LOG_OUT_SIZE);
+        if (log_out[i].buf == NULL) {
+            log_stderr("log output buffer malloc failed!");
+            return -1;
+        }
+        log_out[i].len = 0;
+        log_out[i].niov = 0;
     }
+    log_clock.sec = -1;
+    log_nnoring_logged = 0;
 
     status = pipe(l->notify_fd);
     if (status != 0) {
@@ -120,11 +213,20 @@ log_init(struct instance *nci)
         return -1;
     }
 
-    pthread_mutex_t temp_mutex = PTHREAD_MUTEX_INITIALIZER;
-    memcpy(&l->log_mutex, &temp_mutex, sizeof(temp_mutex));
+    pthread_mutex_init(&l->ring_mutex, NULL);
+
+    status = pthread_key_create(&l->ring_key, log_ring_release);
+    if (status != 0) {
+        log_stderr("create log ring key failed");
+        return -1;
+    }
+
+    /* from now on, threads log into their rings */
+    l->running = 1;
 
     status = pthread_create(&l->log_thread, NULL, log_thread_loop, NULL);
     if (status) {
+        l->running = 0;
         log_stderr("create log thread failed");
         return -1;
     }
@@ -132,31 +234,21 @@ log_init(struct instance *nci)
     return 0;
 }
 
-struct log_buf *
-_log_buf_get(char* name) 
-{
-    struct log_buf *log_buffer;
-    void *buf;
-
-    buf = malloc(LOG_BUF_CHUN_SIZE);
-    if (buf == NULL) 
-        return NULL;
-
-    log_buffer = (struct log_buf *)((size_t)buf + LOG_BUF_OFFSET);
-    memcpy(log_buffer->name, name, (size_t)strlen(name));
-    *(log_buffer->name + (size_t)strlen(name)) = '\0';
-    log_buffer->start = (size_t)buf;
-    log_buffer->pos = (size_t)buf;
-    log_buffer->end = (size_t)buf + LOG_BUF_OFFSET - 1;
-
-    return log_buffer;
-}
-
 void
 log_deinit(void)
 {
     struct logger *l = &logger;
 
+    if (l->running) {
+        /* log directly from now on and let the log thread drain the rings */
+        __atomic_store_n(&l->running, 0, __ATOMIC_RELEASE);
+        __atomic_store_n(&l->done, 1, __ATOMIC_RELEASE);
+        if (write(l->notify_fd[1], "1", 1) != 1) {
+            log_stderr("notify log thread failed");
+        }
+        pthread_join(l->log_thread, NULL);
+    }
+
     fsync(l->fd);
     fsync(l->wfd);
 
@@ -271,7 +363,7 @@ _logbuf_exchange_period_up(void)
     logbuf_intercal_up = 0;
     logbuf_exintercal++;
     logbuf_exintercal = logbuf_exintercal > LOG_EX_MAX_INTERCAL ? LOG_EX_MAX_INTERCAL : logbuf_exintercal;
-    log_safe("up log_buf exchange period to %d * 100 ms", logbuf_exintercal);
+    log_safe("up log drain period to %d * 100 ms", logbuf_exintercal);
 }
 
 void
@@ -287,7 +379,7 @@ _logbuf_exchange_period_down(void)
     logbuf_intercal_down = 0;
     logbuf_exintercal--;
     logbuf_exintercal = logbuf_exintercal <= LOG_EX_MIN_INTERCAL ? LOG_EX_MIN_INTERCAL : logbuf_exintercal;
-    log_safe("down log_buf exchange period to %d * 100 ms", logbuf_exintercal);
+    log_safe("down log drain period to %d * 100 ms", logbuf_exintercal);
 }
 
 void
@@ -329,230 +421,1059 @@ log_stacktrace(void)
 }
 
 /*
- * log thread loop
+ * format walking, shared by the producers storing the arguments and by the
+ * log thread formatting them
  */
-static char log_buf_log[LOG_MAX_LEN];
-void*
-log_thread_loop(void* loop)
+
+/*
+ * Find the next conversion in fmt and describe it in sp. Returns a pointer
+ * past the conversion or NULL when fmt has no more complete conversions;
+ * sp->start is then the end of the literal text that remains.
+ */
+static const char *
+log_spec_next(const char *fmt, struct log_spec *sp)
 {
-    struct logger *l = &logger;
-    size_t size;
-    ssize_t writen;
-    int len=0;
-    char msg[1];
+    const char *p;
 
+    p = strchr(fmt, '%');
+    if (p == NULL) {
+        sp->start = fmt + strlen(fmt);
+        return NULL;
+    }
 
-    for(;;){
-        log_singal_handler();
-        if (read(l->notify_fd[0], msg, 1) != 1) {
-            continue;
+    sp->start = p++;
+    sp->wstar = 0;
+    sp->pstar = 0;
+    sp->precision = -1;
+    sp->lm = LOG_LMOD_NONE;
+
+    while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0' ||
+           *p == '\'') {
+        p++;
+    }
+
+    if (*p == '*') {
+        sp->wstar = 1;
+        p++;
+    } else {
+        while (isdigit((unsigned char)*p)) {
+            p++;
         }
-        if (l->accesslog_buf[1]->start < l->accesslog_buf[1]->pos) {
-            if (l->accesslog_buf[1]->pos == l->accesslog_buf[1]->end) {
-                len = nc_scnprintf(log_buf_log, LOG_MAX_LEN, "[LOG_LOG] %s is full , begin flush!\n", l->accesslog_buf[1]->name);
-                writen = write(l->wfd, log_buf_log, (size_t)len);
+    }
+
+    sp->prec = p;
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            sp->pstar = 1;
+            p++;
+        } else {
+            sp->precision = 0;
+            while (isdigit((unsigned char)*p)) {
+                sp->precision = sp->precision * 10 + (*p - '0');
+                p++;
             }
-            size = l->accesslog_buf[1]->pos - l->accesslog_buf[1]->start;
-            writen = write(l->fd, (void *)l->accesslog_buf[1]->start, size);
-            if (writen <= 0) {
-                    continue;
+        }
+    }
+
+    sp->lmod = p;
+    switch (*p) {
+    case 'h':
+        p++;
+        sp->lm = LOG_LMOD_H;
+        if (*p == 'h') {
+            p++;
+            sp->lm = LOG_LMOD_HH;
+        }
+        break;
+
+    case 'l':
+        p++;
+        sp->lm = LOG_LMOD_L;
+        if (*p == 'l') {
+            p++;
+            sp->lm = LOG_LMOD_LL;
+        }
+        break;
+
+    case 'q':
+        p++;
+        sp->lm = LOG_LMOD_LL;
+        break;
+
+    case 'z':
+        p++;
+        sp->lm = LOG_LMOD_Z;
+        break;
+
+    case 'j':
+        p++;
+        sp->lm = LOG_LMOD_J;
+        break;
+
+    case 't':
+        p++;
+        sp->lm = LOG_LMOD_T;
+        break;
+
+    case 'L':
+        p++;
+        sp->lm = LOG_LMOD_LD;
+        break;
+
+    default:
+        break;
+    }
+
+    if (*p == '\0') {
+        /* incomplete conversion, left as literal text */
+        sp->start = p;
+        return NULL;
+    }
+
+    sp->conv = *p++;
+    sp->end = p;
+
+    return p;
+}
+
+static log_arg_type_t
+log_spec_arg(const struct log_spec *sp)
+{
+    switch (sp->conv) {
+    case 'd':
+    case 'i':
+    case 'c':
+        return LOG_ARG_INT;
+
+    case 'o':
+    case 'u':
+    case 'x':
+    case 'X':
+        return LOG_ARG_UINT;
+
+    case 'e':
+    case 'E':
+    case 'f':
+    case 'F':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        return LOG_ARG_DOUBLE;
+
+    case 's':
+        return LOG_ARG_STR;
+
+    case 'p':
+        return LOG_ARG_PTR;
+
+    case 'n':
+        return LOG_ARG_SKIP;
+
+    default:
+        return LOG_ARG_NONE;
+    }
+}
+
+static bool
+log_args_put(struct log_args *a, const void *slot)
+{
+    if (a->pos + sizeof(uint64_t) > a->end) {
+        return false;
+    }
+    nc_memcpy(a->pos, slot, sizeof(uint64_t));
+    a->pos += sizeof(uint64_t);
+    return true;
+}
+
+static bool
+log_args_get(struct log_args *a, void *slot)
+{
+    if (a->pos + sizeof(uint64_t) > a->end) {
+        return false;
+    }
+    nc_memcpy(slot, a->pos, sizeof(uint64_t));
+    a->pos += sizeof(uint64_t);
+    return true;
+}
+
+static bool
+log_args_put_int(struct log_args *a, int64_t v)
+{
+    return log_args_put(a, &v);
+}
+
+static bool
+log_args_put_str(struct log_args *a, const char *s, int precision)
+{
+    size_t max, n;
+    uint64_t slot;
+
+    if (s == NULL) {
+        s = "(null)";
+    }
+
+    max = LOG_MAX_LEN;
+    if (precision >= 0 && (size_t)precision < max) {
+        max = (size_t)precision;
+    }
+    n = strnlen(s, max);
+
+    if (a->pos + sizeof(slot) > a->end) {
+        return false;
+    }
+    n = MIN(n, (size_t)(a->end - a->pos) - sizeof(slot));
+    slot = n;
+    log_args_put(a, &slot);
+
+    nc_memcpy(a->pos, s, n);
+    a->pos += NC_ALIGN(n, sizeof(uint64_t));
+    if (a->pos > a->end) {
+        a->pos = a->end;
+    }
+
+    return true;
+}
+
+/*
+ * Store the arguments of fmt into a, as the types fmt says they are.
+ * Stops at the first argument that does not fit; the log thread then
+ * formats the line up to that argument.
+ */
+static void
+log_args_store(struct log_args *a, const char *fmt, va_list args)
+{
+    struct log_spec sp;
+    const char *p;
+    int precision;
+    bool ok;
+
+    for (p = fmt; (p = log_spec_next(p, &sp)) != NULL; ) {
+        precision = sp.precision;
+
+        if (sp.wstar && !log_args_put_int(a, va_arg(args, int))) {
+            return;
+        }
+        if (sp.pstar) {
+            precision = va_arg(args, int);
+            if (!log_args_put_int(a, precision)) {
+                return;
             }
-            l->accesslog_buf[1]->pos = l->accesslog_buf[1]->start;
         }
-        if (l->wflog_buf[1]->start < l->wflog_buf[1]->pos) {
-            if (l->discard_log_count) {
-                len = nc_scnprintf(log_buf_log, LOG_MAX_LEN, "[LOG_LOG] discard %d log items for log_buf is full\n", l->discard_log_count);
-                writen = write(l->wfd, log_buf_log, (size_t)len);
-                l->discard_log_count = 0;
+
+        switch (log_spec_arg(&sp)) {
+        case LOG_ARG_INT:
+            switch (sp.lm) {
+            case LOG_LMOD_HH:
+                ok = log_args_put_int(a, (signed char)va_arg(args, int));
+                break;
+            case LOG_LMOD_H:
+                ok = log_args_put_int(a, (short)va_arg(args, int));
+                break;
+            case LOG_LMOD_L:
+                ok = log_args_put_int(a, va_arg(args, long));
+                break;
+            case LOG_LMOD_LL:
+                ok = log_args_put_int(a, va_arg(args, long long));
+                break;
+            case LOG_LMOD_Z:
+                ok = log_args_put_int(a, va_arg(args, ssize_t));
+                break;
+            case LOG_LMOD_J:
+                ok = log_args_put_int(a, va_arg(args, intmax_t));
+                break;
+            case LOG_LMOD_T:
+                ok = log_args_put_int(a, va_arg(args, ptrdiff_t));
+                break;
+            default:
+                ok = log_args_put_int(a, va_arg(args, int));
+                break;
             }
-            if (l->wflog_buf[1]->pos == l->wflog_buf[1]->end) {
-                len = nc_scnprintf(log_buf_log, LOG_MAX_LEN, "[LOG_LOG] %s is full , begin flush!\n", l->wflog_buf[1]->name);
-                writen = write(l->wfd, log_buf_log, (size_t)len);
+            break;
+
+        case LOG_ARG_UINT: {
+            uint64_t v;
+
+            switch (sp.lm) {
+            case LOG_LMOD_HH:
+                v = (unsigned char)va_arg(args, unsigned int);
+                break;
+            case LOG_LMOD_H:
+                v = (unsigned short)va_arg(args, unsigned int);
+                break;
+            case LOG_LMOD_L:
+                v = va_arg(args, unsigned long);
+                break;
+            case LOG_LMOD_LL:
+                v = va_arg(args, unsigned long long);
+                break;
+            case LOG_LMOD_Z:
+                v = va_arg(args, size_t);
+                break;
+            case LOG_LMOD_J:
+                v = va_arg(args, uintmax_t);
+                break;
+            case LOG_LMOD_T:
+                v = (uint64_t)va_arg(args, ptrdiff_t);
+                break;
+            default:
+                v = va_arg(args, unsigned int);
+                break;
             }
+            ok = log_args_put(a, &v);
+            break;
+        }
+
+        case LOG_ARG_DOUBLE: {
+            double v;
 
-            size = l->wflog_buf[1]->pos - l->wflog_buf[1]->start;
-            writen = write(l->wfd, (void *)l->wflog_buf[1]->start, size);
-            if (writen <= 0) {
-                    continue;
+            if (sp.lm == LOG_LMOD_LD) {
+                v = (double)va_arg(args, long double);
+            } else {
+                v = va_arg(args, double);
             }
-            l->wflog_buf[1]->pos = l->wflog_buf[1]->start;
+            ok = log_args_put(a, &v);
+            break;
+        }
+
+        case LOG_ARG_STR:
+            ok = log_args_put_str(a, va_arg(args, const char *), precision);
+            break;
+
+        case LOG_ARG_PTR: {
+            uint64_t v = (uint64_t)(uintptr_t)va_arg(args, void *);
+
+            ok = log_args_put(a, &v);
+            break;
+        }
+
+        case LOG_ARG_SKIP:
+            (void)va_arg(args, void *);
+            ok = true;
+            break;
+
+        default:
+            ok = true;
+            break;
+        }
+
+        if (!ok) {
+            return;
         }
     }
 }
 
+/* append [LEVEL][%Y-%m-%d %H:%M:%S.mmm] file:line to buf */
+static int
+log_prefix(struct log_clock *clock, char *buf, int size, int level,
+           const char *file, int line, int64_t usec)
+{
+    time_t sec = (time_t)(usec / 1000000);
+    struct tm tm;
+    int len;
+
+    if (clock->sec != sec) {
+        localtime_r(&sec, &tm);
+        clock->len = (int)nc_strftime(clock->str, sizeof(clock->str),
+                                      "%Y-%m-%d %H:%M:%S.", &tm);
+        clock->sec = sec;
+    }
+
+    len = 0;
+    _log_level(level, buf, &len);
+    buf[len++] = '[';
+    nc_memcpy(buf + len, clock->str, (size_t)clock->len);
+    len += clock->len;
+    len += nc_scnprintf(buf + len, size - len, "%03d",
+                        (int)(usec % 1000000 / 1000));
+    len += nc_scnprintf(buf + len, size - len, "] %s:%d ", file, line);
+
+    return len;
+}
+
 /*
- * log tick task in main thread
- * could exec in  main, stats, whiteiplist thread when log_buf is full
+ * Format one conversion of a record with its stored arguments into buf.
+ * Returns the # bytes written or -1 when the record has no arguments left.
  */
-int 
-log_tick_task(void)
+static int
+log_format_spec(const struct log_spec *sp, struct log_args *a, char *buf,
+                int size)
 {
-    return _swap_log_buf();
+    char spec[64];
+    log_arg_type_t type;
+    size_t n;
+    int w, p, len;
+    int64_t star;
+    uint64_t slot;
+
+    w = 0;
+    p = 0;
+    if (sp->wstar) {
+        if (!log_args_get(a, &star)) {
+            return -1;
+        }
+        w = (int)star;
+    }
+    if (sp->pstar) {
+        if (!log_args_get(a, &star)) {
+            return -1;
+        }
+        p = (int)star;
+    }
+
+    type = log_spec_arg(sp);
+    if (type == LOG_ARG_NONE || type == LOG_ARG_SKIP) {
+        if (sp->conv == '%') {
+            return nc_scnprintf(buf, size, "%%");
+        }
+        return nc_scnprintf(buf, size, "%.*s", (int)(sp->end - sp->start),
+                            sp->start);
+    }
+
+    if (!log_args_get(a, &slot)) {
+        return -1;
+    }
+
+    /* flags, width and precision as given, followed by our own length */
+    n = (size_t)((type == LOG_ARG_STR ? sp->prec : sp->lmod) - sp->start);
+    if (n > sizeof(spec) - 8) {
+        return nc_scnprintf(buf, size, "%.*s", (int)(sp->end - sp->start),
+                            sp->start);
+    }
+    nc_memcpy(spec, sp->start, n);
+
+#define LOG_PRINT(_v) do {                                                   \
+    if (sp->wstar && sp->pstar) {                                           \
+        len = nc_scnprintf(buf, size, spec, w, p, _v);                      \
+    } else if (sp->wstar) {                                                 \
+        len = nc_scnprintf(buf, size, spec, w, _v);                         \
+    } else if (sp->pstar) {                                                 \
+        len = nc_scnprintf(buf, size, spec, p, _v);                         \
+    } else {                                                                \
+        len = nc_scnprintf(buf, size, spec, _v);                            \
+    }                                                                       \
+} while (0)
+
+    switch (type) {
+    case LOG_ARG_INT:
+        if (sp->conv == 'c') {
+            spec[n++] = 'c';
+            spec[n] = '\0';
+            LOG_PRINT((int)(int64_t)slot);
+        } else {
+            spec[n++] = 'l';
+            spec[n++] = 'l';
+            spec[n++] = sp->conv;
+            spec[n] = '\0';
+            LOG_PRINT((long long)(int64_t)slot);
+        }
+        break;
+
+    case LOG_ARG_UINT:
+        spec[n++] = 'l';
+        spec[n++] = 'l';
+        spec[n++] = sp->conv;
+        spec[n] = '\0';
+        LOG_PRINT((unsigned long long)slot);
+        break;
+
+    case LOG_ARG_DOUBLE: {
+        double d;
+
+        nc_memcpy(&d, &slot, sizeof(d));
+        spec[n++] = sp->conv;
+        spec[n] = '\0';
+        LOG_PRINT(d);
+        break;
+    }
+
+    case LOG_ARG_PTR:
+        spec[n++] = 'p';
+        spec[n] = '\0';
+        LOG_PRINT((void *)(uintptr_t)slot);
+        break;
+
+    case LOG_ARG_STR: {
+        /* the stored length is the precision */
+        const char *s = (const char *)a->pos;
+
+        a->pos += NC_ALIGN(slot, sizeof(uint64_t));
+        if (a->pos > a->end) {
+            return -1;
+        }
+        spec[n++] = '.';
+        spec[n++] = '*';
+        spec[n++] = 's';
+        spec[n] = '\0';
+        if (sp->wstar) {
+            len = nc_scnprintf(buf, size, spec, w, (int)slot, s);
+        } else {
+            len = nc_scnprintf(buf, size, spec, (int)slot, s);
+        }
+        break;
+    }
+
+    default:
+        NOT_REACHED();
+        len = 0;
+    }
+
+#undef LOG_PRINT
+
+    return len;
 }
 
-/* 
- * 100ms per ticked
- */
-void
-log_cron(void) 
+/* format a LOG_REC_FMT record into buf, a line of at most LOG_MAX_LEN bytes */
+static int
+log_format(struct log_rec *rec, char *buf)
 {
-    static int count = 0;
-    count++;
-    if (count == logbuf_exintercal) {
-        log_tick_task();
-        count = 0;
+    struct log_args a;
+    struct log_spec sp;
+    const char *p, *q;
+    int len, size, n;
+
+    size = LOG_MAX_LEN - 1;
+    len = log_prefix(&log_clock, buf, size, rec->level, rec->file,
+                     (int)rec->line, rec->usec);
+
+    a.pos = (uint8_t *)(rec + 1);
+    a.end = a.pos + rec->dlen;
+
+    for (p = rec->fmt; ; p = q) {
+        q = log_spec_next(p, &sp);
+
+        n = MIN((int)(sp.start - p), size - len);
+        nc_memcpy(buf + len, p, (size_t)n);
+        len += n;
+
+        if (q == NULL) {
+            break;
+        }
+
+        n = log_format_spec(&sp, &a, buf + len, size - len);
+        if (n < 0) {
+            break;
+        }
+        len += n;
     }
+
+    buf[len++] = '\n';
+
+    return len;
 }
+
 /*
- * call this function among two conditions:
- *  a.tick task per 1s
- *  b.log_buf is full
- * @return is used for condition b
+ * log thread
  */
-int
-_swap_log_buf(void)
+
+static void
+log_out_add(struct log_out *o, char *data, size_t len)
 {
-    struct logger *l = &logger;
-    struct log_buf *temp;
-    int result = 1;
+    struct iovec *last = o->niov > 0 ? &o->iov[o->niov - 1] : NULL;
 
-    if (pthread_mutex_trylock(&(l->log_mutex))){
-        l->exchange_failed++;
-        return result;
+    if (last != NULL && (char *)last->iov_base + last->iov_len == data) {
+        last->iov_len += len;
+        return;
     }
 
-    if ((l->accesslog_buf[0]->start != l->accesslog_buf[0]->pos) &&
-        (l->accesslog_buf[1]->start == l->accesslog_buf[1]->pos)) {
-        temp = l->accesslog_buf[0];
-        l->accesslog_buf[0] = l->accesslog_buf[1];
-        l->accesslog_buf[1] = temp;
-        result = 0;
-    } 
-    
-    if ((l->wflog_buf[0]->start != l->wflog_buf[0]->pos) &&
-        (l->wflog_buf[1]->start == l->wflog_buf[1]->pos)) {
-        temp = l->wflog_buf[0];
-        l->wflog_buf[0] = l->wflog_buf[1];
-        l->wflog_buf[1] = temp;
-        result = 0;
-    } 
-    
-    pthread_mutex_unlock(&(l->log_mutex));
+    ASSERT(o->niov < LOG_IOV_MAX);
+    o->iov[o->niov].iov_base = data;
+    o->iov[o->niov].iov_len = len;
+    o->niov++;
+}
+
+static void
+log_out_text(struct log_out *o, const char *fmt, ...)
+{
+    va_list args;
+    int len;
+
+    va_start(args, fmt);
+    len = nc_vscnprintf(o->buf + o->len, LOG_OUT_SIZE - o->len, fmt, args);
+    va_end(args);
+
+    log_out_add(o, o->buf + o->len, (size_t)len);
+    o->len += (size_t)len;
+}
+
+/* room for one more record in o? */
+static bool
+log_out_room(struct log_out *o)
+{
+    return o->niov < LOG_IOV_MAX - 1 && o->len + LOG_MAX_LEN <= LOG_OUT_SIZE;
+}
+
+static void
+log_out_flush(struct log_out *o, int fd)
+{
+    struct iovec *iov = o->iov;
+    int niov = o->niov;
+    ssize_t n;
+
+    while (niov > 0) {
+        n = writev(fd, iov, niov);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            logger.nerror++;
+            break;
+        }
 
-    if (write(l->notify_fd[1], "1", 1) != 1) {
-        log_stderr("notify log thread failed");
+        while (niov > 0 && (size_t)n >= iov->iov_len) {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            niov--;
+        }
+        if (niov > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
     }
 
-    return result;
+    o->len = 0;
+    o->niov = 0;
 }
 
-int
-log_loggable(int level)
+static void
+log_flush(void)
 {
     struct logger *l = &logger;
 
-    if (level > l->level) {
+    log_out_flush(&log_out[LOG_ACCESS], l->fd);
+    log_out_flush(&log_out[LOG_WF], l->wfd);
+}
+
+/*
+ * Format and write out the records of ring r. Raw records are written
+ * from the ring in place, so the tail only moves on after a flush.
+ */
+static uint64_t
+log_drain_ring(struct log_ring *r)
+{
+    struct log_rec *rec;
+    struct log_out *o;
+    uint64_t head, pos, nrecord;
+
+    head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    pos = r->tail;
+    if (pos == head) {
         return 0;
     }
 
-    return 1;
+    __atomic_store_n(&r->notified, 0, __ATOMIC_RELAXED);
+
+    for (nrecord = 0; pos != head; pos += rec->len) {
+        rec = (struct log_rec *)(r->data + (pos & (LOG_RING_SIZE - 1)));
+        if (rec->type == LOG_REC_PAD) {
+            continue;
+        }
+
+        o = &log_out[_log_switch(rec->level)];
+        if (!log_out_room(o)) {
+            log_flush();
+            __atomic_store_n(&r->tail, pos, __ATOMIC_RELEASE);
+        }
+
+        if (rec->type == LOG_REC_RAW) {
+            log_out_add(o, (char *)(rec + 1), rec->dlen);
+        } else {
+            int len = log_format(rec, o->buf + o->len);
+
+            log_out_add(o, o->buf + o->len, (size_t)len);
+            o->len += (size_t)len;
+        }
+        nrecord++;
+    }
+
+    log_flush();
+    __atomic_store_n(&r->tail, pos, __ATOMIC_RELEASE);
+
+    return nrecord;
 }
 
-int
-_log_switch(int level)
+static void
+log_drain(void)
 {
-    if (level <= LOG_WARN)
-        return LOG_WF;
-    else
-        return LOG_ACCESS;
+    struct logger *l = &logger;
+    struct log_ring *r;
+    uint32_t i, nring;
+    uint64_t nrecord, ndrop;
+
+    nring = __atomic_load_n(&l->nring, __ATOMIC_ACQUIRE);
+    for (i = 0, nrecord = 0; i < nring; i++) {
+        nrecord += log_drain_ring(l->ring[i]);
+    }
+    if (nrecord != 0) {
+        __atomic_store_n(&l->nrecord, l->nrecord + nrecord, __ATOMIC_RELAXED);
+    }
+
+    for (i = 0; i < nring; i++) {
+        r = l->ring[i];
+        ndrop = __atomic_load_n(&r->ndrop, __ATOMIC_RELAXED);
+        if (ndrop != r->ndrop_logged) {
+            log_out_text(&log_out[LOG_WF], "[LOG_LOG] discard %"PRIu64" log "
+                         "items for log ring %"PRIu32" is full\n",
+                         ndrop - r->ndrop_logged, i);
+            r->ndrop_logged = ndrop;
+        }
+    }
+
+    ndrop = __atomic_load_n(&l->nnoring, __ATOMIC_RELAXED);
+    if (ndrop != log_nnoring_logged) {
+        log_out_text(&log_out[LOG_WF], "[LOG_LOG] discard %"PRIu64" log items "
+                     "for more than %d threads log\n",
+                     ndrop - log_nnoring_logged, LOG_MAX_RING);
+        log_nnoring_logged = ndrop;
+    }
+
+    log_flush();
 }
 
 /*
- * all threads write to logbuffer 
+ * log thread loop: drains the rings every logbuf_exintercal * 100 msec,
+ * or sooner when a producer finds its ring half full
  */
-void
-_log_write_buf(int level, char *buf, size_t len)
+void *
+log_thread_loop(void *arg)
 {
-    if (len <= 0 && len >= LOG_MAX_LEN) {
-        return;
-    }
     struct logger *l = &logger;
-    size_t length;
-    size_t max_len;
-
-    pthread_mutex_lock(&(l->log_mutex));
-    struct log_buf *log_buffer;
-    while(len) {
-        if (_log_switch(level)) {
-            log_buffer = l->wflog_buf[0];
-        } else {
-            log_buffer = l->accesslog_buf[0];
+    struct pollfd pfd;
+    char msg[64];
+
+    pfd.fd = l->notify_fd[0];
+    pfd.events = POLLIN;
+
+    for (;;) {
+        log_singal_handler();
+        log_drain();
+
+        if (__atomic_load_n(&l->done, __ATOMIC_ACQUIRE)) {
+            log_drain();
+            break;
         }
 
-        if (log_buffer->pos == log_buffer->end) {
-            if (!_swap_log_buf()) {
+        pfd.revents = 0;
+        if (poll(&pfd, 1, logbuf_exintercal * 100) > 0) {
+            if (read(l->notify_fd[0], msg, sizeof(msg)) <= 0) {
                 continue;
-            } else {
-                l->discard_log_count++;
-                break;
             }
         }
+    }
 
-        max_len = log_buffer->end - log_buffer->pos;
-        if (max_len < len) {
-            length = max_len;
-        } else {
-            length = len;
+    return NULL;
+}
+
+/*
+ * producers
+ */
+
+/*
+ * Hand the ring of a thread that exits, or is cancelled, back for another
+ * thread to take over; what it logged is still drained
+ */
+static void
+log_ring_release(void *arg)
+{
+    struct logger *l = &logger;
+    struct log_ring *r = arg;
+
+    pthread_mutex_lock(&l->ring_mutex);
+    r->owned = 0;
+    pthread_mutex_unlock(&l->ring_mutex);
+
+    log_ring_self = NULL;
+    log_ring_none = 1;
+}
+
+/*
+ * A ring handed back by a thread gone, preferably one drained already; the
+ * new owner goes on producing where the last one stopped
+ */
+static struct log_ring *
+log_ring_reuse(void)
+{
+    struct logger *l = &logger;
+    struct log_ring *r, *found;
+    uint32_t i;
+
+    found = NULL;
+    for (i = 0; i < l->nring; i++) {
+        r = l->ring[i];
+        if (r->owned) {
+            continue;
+        }
+
+        found = r;
+        if (__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == r->head) {
+            break;
         }
-        memcpy((void *)log_buffer->pos, buf, length);
-        len = len - length;
-        buf = buf + length;
-        log_buffer->pos = log_buffer->pos + length;
-        if (log_buffer->pos > log_buffer->end) {
-            log_buffer->pos = log_buffer->end;
-        }  
     }
-    pthread_mutex_unlock(&(l->log_mutex));    
+
+    return found;
+}
+
+/* the ring of the calling thread, taken on first use */
+static struct log_ring *
+log_ring_get(void)
+{
+    struct logger *l = &logger;
+    struct log_ring *r;
+
+    if (log_ring_self != NULL || log_ring_none) {
+        return log_ring_self;
+    }
+
+    pthread_mutex_lock(&l->ring_mutex);
+
+    r = log_ring_reuse();
+    if (r == NULL && l->nring < LOG_MAX_RING) {
+        /* malloc, not nc_alloc, which logs on failure */
+        r = malloc(sizeof(*r));
+        if (r != NULL) {
+            r->data = malloc(LOG_RING_SIZE);
+            if (r->data == NULL) {
+                free(r);
+                r = NULL;
+            }
+        }
+
+        if (r != NULL) {
+            /* fault the ring in now rather than on the hot path */
+            memset(r->data, 0, LOG_RING_SIZE);
+            r->head = 0;
+            r->tail = 0;
+            r->ndrop = 0;
+            r->ndrop_logged = 0;
+            r->notified = 0;
+            l->ring[l->nring] = r;
+            __atomic_store_n(&l->nring, l->nring + 1, __ATOMIC_RELEASE);
+        }
+    }
+
+    if (r != NULL) {
+        r->owned = 1;
+        log_ring_self = r;
+    } else {
+        log_ring_none = 1;
+    }
+
+    pthread_mutex_unlock(&l->ring_mutex);
+
+    if (r != NULL) {
+        (void)pthread_setspecific(l->ring_key, r);
+    }
+
+    return r;
 }
 
 /*
- * log format function
+ * Append a record to the ring of the calling thread: hdr followed by dlen
+ * bytes of data. Drops the record when the ring is too full for it.
+ */
+static void
+log_ring_put(struct log_rec *hdr, const void *data, uint32_t dlen)
+{
+    struct logger *l = &logger;
+    struct log_ring *r;
+    struct log_rec *pad;
+    uint64_t head, tail, off, contig, need;
+    uint32_t size;
+
+    r = log_ring_get();
+    if (r == NULL) {
+        __sync_fetch_and_add(&l->nnoring, 1);
+        return;
+    }
+
+    size = (uint32_t)NC_ALIGN(sizeof(*hdr) + dlen, sizeof(uint64_t));
+    head = r->head;
+    tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    off = head & (LOG_RING_SIZE - 1);
+    contig = LOG_RING_SIZE - off;
+    need = contig < size ? contig + size : size;
+
+    if (head - tail + need > LOG_RING_SIZE) {
+        __atomic_store_n(&r->ndrop, r->ndrop + 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    if (contig < size) {
+        pad = (struct log_rec *)(r->data + off);
+        pad->len = (uint32_t)contig;
+        pad->type = LOG_REC_PAD;
+        head += contig;
+        off = 0;
+    }
+
+    hdr->len = size;
+    hdr->dlen = dlen;
+    nc_memcpy(r->data + off, hdr, sizeof(*hdr));
+    nc_memcpy(r->data + off + sizeof(*hdr), data, dlen);
+    head += size;
+
+    __atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+
+    /* wake the log thread early, once per drain, when half full */
+    if (head - tail > LOG_RING_SIZE / 2 &&
+        !__atomic_load_n(&r->notified, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&r->notified, 1, __ATOMIC_RELAXED);
+        if (write(l->notify_fd[1], "1", 1) != 1) {
+            /* pipe full, the log thread is awake anyway */
+        }
+    }
+}
+
+static void
+log_rec_init(struct log_rec *rec, uint8_t type, int level, const char *file,
+             int line, const char *fmt)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    rec->type = type;
+    rec->level = (uint8_t)level;
+    rec->unused = 0;
+    rec->line = (uint32_t)line;
+    rec->usec = (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+    rec->file = file;
+    rec->fmt = fmt;
+}
+
+/*
+ * Format and write a line right away, for logging before the log thread
+ * runs or after it is stopped and for panics
+ */
+static void
+log_write_now(int level, const char *file, int line, const char *fmt,
+              va_list args)
+{
+    struct logger *l = &logger;
+    struct log_clock clock;
+    struct timeval tv;
+    char buf[LOG_MAX_LEN];
+    int fd, len, size;
+    ssize_t n;
+
+    if (!__atomic_load_n(&l->running, __ATOMIC_ACQUIRE)) {
+        fd = STDERR_FILENO;
+    } else {
+        fd = _log_switch(level) == LOG_WF ? l->wfd : l->fd;
+    }
+
+    gettimeofday(&tv, NULL);
+    clock.sec = -1;
+    size = LOG_MAX_LEN - 1;
+    len = log_prefix(&clock, buf, size, level, file, line,
+                     (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec);
+    len += nc_vscnprintf(buf + len, size - len, fmt, args);
+    buf[len++] = '\n';
+
+    n = nc_write(fd, buf, (size_t)len);
+    if (n < 0) {
+        l->nerror++;
+    }
+}
+
+/* append the len bytes of preformatted text in buf as a raw record */
+static void
+log_raw(int level, char *buf, size_t len)
+{
+    struct logger *l = &logger;
+    struct log_rec rec;
+    ssize_t n;
+
+    if (!__atomic_load_n(&l->running, __ATOMIC_ACQUIRE)) {
+        n = nc_write(STDERR_FILENO, buf, len);
+        if (n < 0) {
+            l->nerror++;
+        }
+        return;
+    }
+
+    log_rec_init(&rec, LOG_REC_RAW, level, NULL, 0, NULL);
+    log_ring_put(&rec, buf, (uint32_t)len);
+}
+
+void
+log_counters(uint64_t *nrecord, uint64_t *ndrop, uint64_t *backlog)
+{
+    struct logger *l = &logger;
+    struct log_ring *r;
+    uint32_t i, nring;
+
+    *nrecord = __atomic_load_n(&l->nrecord, __ATOMIC_RELAXED);
+    *ndrop = __atomic_load_n(&l->nnoring, __ATOMIC_RELAXED);
+    *backlog = 0;
+
+    nring = __atomic_load_n(&l->nring, __ATOMIC_ACQUIRE);
+    for (i = 0; i < nring; i++) {
+        r = l->ring[i];
+        *ndrop += __atomic_load_n(&r->ndrop, __ATOMIC_RELAXED);
+        *backlog += __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) -
+                    __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    }
+}
+
+int
+log_loggable(int level)
+{
+    struct logger *l = &logger;
+
+    if (level > l->level) {
+        return 0;
+    }
+
+    return 1;
+}
+
+int
+_log_switch(int level)
+{
+    if (level <= LOG_WARN)
+        return LOG_WF;
+    else
+        return LOG_ACCESS;
+}
+
+/*
+ * log entry of all threads: stores the arguments, the log thread formats
  */
 void
 _log(int level, const char *file, int line, int panic, const char *fmt, ...)
 {
-    char tem_buf[8 * LOG_MAX_LEN];
+    uint64_t data[LOG_REC_MAX / sizeof(uint64_t)];
     struct logger *l = &logger;
-    int len, size;
-    char *buf = tem_buf;
+    struct log_rec rec;
+    struct log_args a;
     va_list args;
-    struct timeval tv;
 
     if (l->fd < 0) {
         return;
     }
 
-    len = 0;            /* length of output buffer */
-    size = LOG_MAX_LEN; /* size of output buffer */
+    if (panic || !__atomic_load_n(&l->running, __ATOMIC_ACQUIRE)) {
+        va_start(args, fmt);
+        log_write_now(level, file, line, fmt, args);
+        va_end(args);
 
-    _log_level(level, buf, &len);
-    gettimeofday(&tv, NULL);
-    buf[len++] = '[';
-    len += nc_strftime(buf + len, size - len, "%Y-%m-%d %H:%M:%S.", localtime(&tv.tv_sec));
-    len += nc_scnprintf(buf + len, size - len, "%03ld", tv.tv_usec/1000);
-    len += nc_scnprintf(buf + len, size - len, "] %s:%d ", file, line);
+        if (panic) {
+            abort();
+        }
+        return;
+    }
+
+    a.pos = (uint8_t *)data;
+    a.end = a.pos + sizeof(data) - sizeof(rec);
 
     va_start(args, fmt);
-    len += nc_vscnprintf(buf + len, size - len, fmt, args);
+    log_args_store(&a, fmt, args);
     va_end(args);
 
-    buf[len++] = '\n';
-
-    _log_write_buf(level, buf, (size_t)len);
-
-    if (panic) {
-        abort();
-    }
+    log_rec_init(&rec, LOG_REC_FMT, level, file, line, fmt);
+    log_ring_put(&rec, data, (uint32_t)(a.pos - (uint8_t *)data));
 }
 
 void
@@ -641,10 +1562,11 @@ _log_hexdump(int level, const char *file, int line, char *data, int datalen,
         off += 16;
     }
 
-    _log_write_buf(level, buf, (size_t)len);
     if (len >= size - 1) {
-        _log_write_buf(level, "\n", 1);
+        buf[len++] = '\n';
     }
+
+    log_raw(level, buf, (size_t)len);
 }
 
 void
@@ -672,7 +1594,7 @@ _log_safe(int level, const char *fmt, ...)
 
     buf[len++] = '\n';
 
-	_log_write_buf(level, buf, (size_t)len);
+    log_raw(level, buf, (size_t)len);
 
     errno = errno_save;
 }
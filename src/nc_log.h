@@ -20,27 +20,47 @@
 #define _NC_LOG_H_
 
 
-struct log_buf{
-    size_t      start;      /* start of log_buf (const) */
-    size_t      end;        /* end of log_buf (const) */
-    size_t      pos;        /* operate marker */
-    char        name[64];   /* log_buf name, used when buf is full for trace */
+#define LOG_RING_SIZE           (8 * 1024 * 1024)  /* per thread ring size, power of 2 */
+#define LOG_MAX_RING            128                /* max # threads that log */
+
+/*
+ * Every thread that logs owns a single producer, single consumer ring of
+ * binary records, registered with the logger on its first log line. A
+ * record holds the format, file, line, time and the arguments of the call;
+ * the log thread does the formatting and writes the lines out with
+ * writev. Logging costs the producer a walk over the format and a memcpy
+ * into its ring, never a lock or a syscall; a record that does not fit is
+ * dropped and counted. A thread that exits, or is cancelled, hands its
+ * ring back, and the next thread to log takes it over, so LOG_MAX_RING
+ * bounds the threads logging at once rather than ever.
+ */
+struct log_ring {
+    uint8_t             *data;              /* LOG_RING_SIZE bytes */
+    uint64_t            head;               /* bytes produced, by the owner thread */
+    uint64_t            tail;               /* bytes consumed, by the log thread */
+    uint64_t            ndrop;              /* # records dropped, by the owner thread */
+    uint64_t            ndrop_logged;       /* # records dropped, last logged */
+    int                 notified;           /* log thread woken since last drain? */
+    int                 owned;              /* ring taken by a live thread? */
 };
 
 struct logger {
     char                *name;              /* log file name */
     char                *wf_name;           /* wf log file name */
     int                 level;              /* log level */
-    int                 nerror;             /* # flush buf error */
-    int                 exchange_failed;    /* # flush buf error */
+    int                 nerror;             /* # write errors */
     int                 fd;                 /* log file descriptor */
-    int                 wfd;                /* log file descriptor */
-    int                 discard_log_count;  /* discard log num */
+    int                 wfd;                /* wf log file descriptor */
     int                 notify_fd[2];       /* pipe fd to notify log thread */
-    struct log_buf      *accesslog_buf[2];  /* access log buf array */
-    struct log_buf      *wflog_buf[2];      /* wf log buf array */
-    pthread_mutex_t     log_mutex;          /* pthread_mutex_lock use */
+    pthread_mutex_t     ring_mutex;         /* guards registering rings */
+    pthread_key_t       ring_key;           /* hands the ring back at thread exit */
+    struct log_ring     *ring[LOG_MAX_RING];/* per thread rings */
+    uint32_t            nring;              /* # registered rings */
+    uint64_t            nrecord;            /* # records written out */
+    uint64_t            nnoring;            /* # records dropped, out of rings */
     pthread_t           log_thread;         /* log loop thread */
+    int                 running;            /* log thread draining the rings? */
+    int                 done;               /* log thread to exit? */
 };
 
 #define LOG_SLOW    0   /* slow log don‘t conflict other log level */
@@ -62,8 +82,7 @@ struct logger {
 #define LOG_WF      1
 
 #define LOG_MAX_LEN             (8 * 256)          /* max length of log message */
-#define LOG_BUF_OFFSET          (64 * 1024 * 1024) /* max log buf size*/
-#define LOG_BUF_CHUN_SIZE       (64 * 1024 * 1024) + sizeof(struct log_buf) /* logbuf chun size */ 
+#define LOG_REC_MAX             (4 * LOG_MAX_LEN)  /* max size of a formatted record */
 
 /*
  * log_stderr   - log to stderr
@@ -161,18 +180,14 @@ void _log_stderr(int level, const char *fmt, ...);
 void _log_safe(int level, const char *fmt, ...);                                       
 void _log_stderr_safe(int level, const char *fmt, ...);                                
 void _log_hexdump(int level, const char *file, int line, char *data, int datalen, const char *fmt, ...);
-void log_singal_handler(void);  
-void log_cron(void);
+void log_singal_handler(void);
+void log_counters(uint64_t *nrecord, uint64_t *ndrop, uint64_t *backlog);
 void _log_reopen(void);
 void _log_level_up(void);
 void _log_level_down(void);
 void _logbuf_exchange_period_up(void);
 void _logbuf_exchange_period_down(void);
-struct log_buf *_log_buf_get(char* name);
-int log_tick_task(void);
-int _swap_log_buf(void);
 void _log_level(int level, char *buf , int *pos);
 int _log_switch(int level);
-void _log_write_buf(int level, char *buf , size_t len);
 
 #endif
@@ -248,12 +248,38 @@ done:
     msg->slowlog_stime = 0;
     msg->slowlog_etime = 0;
 
+    msg->recv_ts = 0;
+    msg->send_ts = 0;
+
+    msg->phase_start = 0;
+    msg->phase_mask = 0;
+
+    msg->slot = 0;
+
     msg->frag_owner = NULL;
     msg->frag_seq = NULL;
     msg->nfrag = 0;
     msg->nfrag_done = 0;
     msg->frag_id = 0;
 
+    msg->sf = NULL;
+    msg->sf_next = NULL;
+    msg->sf_waiter = NULL;
+    msg->sf_hash = 0;
+
+    msg->batch_first = NULL;
+    msg->batch_link = NULL;
+    msg->nbatch = 0;
+
+    rbtree_node_init(&msg->hedge_rbe);
+    msg->hedge = NULL;
+    msg->hedge_conn = NULL;
+
+    msg->limit_server = NULL;
+    msg->limit_ts = 0LL;
+
+    msg->deadline = 0LL;
+
     msg->narg_start = NULL;
     msg->narg_end = NULL;
     msg->narg = 0;
@@ -272,6 +298,12 @@ done:
     msg->fdone = 0;
     msg->swallow = 0;
     msg->redis = 0;
+    msg->nearcache = 0;
+    msg->nobatch = 0;
+    msg->batch_strict = 0;
+    msg->retried = 0;
+    msg->sf_stale = 0;
+    msg->lane = SERVER_LANE_FAST;
 
     return msg;
 }
@@ -291,6 +323,11 @@ msg_get(struct conn *conn, bool request, bool redis)
     msg->request = request ? 1 : 0;
     msg->redis = redis ? 1 : 0;
 
+    /* responses from a server start their phase clock at the first byte */
+    if (!request && conn != NULL && !conn->client && !conn->proxy) {
+        msg->phase_start = nc_loop_usec();
+    }
+
     // if (conn && conn->client && !conn->proxy) {
     //     sp = conn->owner;
     //     if (sp && sp->slowlog) {
@@ -350,6 +387,16 @@ msg_get_error(bool redis, err_t err)
     char *errstr = err ? strerror(err) : "unknown";
     char *protstr = redis ? "-ERR" : "SERVER_ERROR";
 
+    /* shed by the concurrency limit of the server */
+    if (err == EBUSY) {
+        errstr = "server busy";
+    }
+
+    /* rejected by the rate limit of the client source */
+    if (err == EDQUOT) {
+        errstr = "rate limit exceeded";
+    }
+
     msg = _msg_get();
     if (msg == NULL) {
         return NULL;
@@ -466,6 +513,35 @@ msg_type_string(msg_type_t type)
     return &msg_type_strings[type];
 }
 
+/* look up a redis command name, as in "hget", among the request types */
+msg_type_t
+msg_type_redis(uint8_t *name, uint32_t len)
+{
+    static const char prefix[] = "REQ_REDIS_";
+    msg_type_t type;
+    struct string *str;
+    uint32_t i, plen = sizeof(prefix) - 1;
+
+    for (type = MSG_UNKNOWN + 1; type < MSG_SENTINEL; type++) {
+        str = msg_type_string(type);
+        if (str->len != plen + len ||
+            nc_strncmp(str->data, prefix, plen) != 0) {
+            continue;
+        }
+
+        for (i = 0; i < len; i++) {
+            if (toupper(name[i]) != str->data[plen + i]) {
+                break;
+            }
+        }
+        if (i == len) {
+            return type;
+        }
+    }
+
+    return MSG_UNKNOWN;
+}
+
 bool
 msg_empty(struct msg *msg)
 {
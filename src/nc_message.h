@@ -180,6 +180,10 @@ typedef enum msg_parse_result {
     ACTION( REQ_REDIS_NODE )                                                                        \
     ACTION( REQ_REDIS_SLOTS )                                                                       \
     ACTION( REQ_REDIS_SLOT )                                                                        \
+    ACTION( REQ_REDIS_SLOWLOG )                                                                     \
+    ACTION( REQ_REDIS_HOTKEYS )                                                                     \
+    ACTION( REQ_REDIS_SLOTSTATS )                                                                   \
+    ACTION( REQ_REDIS_DEADLINE )                                                                    \
     ACTION( SENTINEL )                                                                              \
 
 
@@ -194,6 +198,33 @@ struct keypos {
     uint8_t             *end;             /* key end pos */
 };
 
+/*
+ * Points in the life of a forwarded request, stamped with the event loop
+ * clock as usec offsets from the time the request was fully received
+ */
+typedef enum msg_phase {
+    MSG_PHASE_ROUTED,                     /* server connection picked */
+    MSG_PHASE_ENQUEUED,                   /* enqueued in server inq */
+    MSG_PHASE_SENT,                       /* written to server */
+    MSG_PHASE_RSP_FIRST,                  /* first response byte read */
+    MSG_PHASE_RSP_DONE,                   /* response parsed */
+    MSG_PHASE_REPLIED,                    /* response written to client */
+    MSG_PHASE_SENTINEL
+} msg_phase_t;
+
+#define MSG_PHASE_ALL   ((1U << MSG_PHASE_SENTINEL) - 1)
+
+#define msg_phase_set(_msg, _phase, _ts) do {                           \
+    if ((_msg)->phase_start != 0) {                                     \
+        (_msg)->phase[_phase] = (_ts) > (_msg)->phase_start ?           \
+            (uint32_t)((_ts) - (_msg)->phase_start) : 0;                \
+        (_msg)->phase_mask |= (1U << (_phase));                         \
+    }                                                                   \
+} while (0)
+
+#define msg_phase_mark(_msg, _phase)                                    \
+    msg_phase_set(_msg, _phase, nc_loop_usec())
+
 struct msg {
     TAILQ_ENTRY(msg)     c_tqe;           /* link in client q */
     TAILQ_ENTRY(msg)     s_tqe;           /* link in server q */
@@ -240,6 +271,15 @@ struct msg {
     int64_t              slowlog_stime;   /* if slowlog, start time */
     int64_t              slowlog_etime;   /* if slowlog, end time */
 
+    int64_t              recv_ts;         /* request received timestamp in usec */
+    int64_t              send_ts;         /* request sent timestamp in usec */
+
+    int64_t              phase_start;     /* loop clock at request received or response first byte */
+    uint32_t             phase[MSG_PHASE_SENTINEL]; /* phase offsets from phase_start in usec */
+    uint32_t             phase_mask;      /* bitmap of phases stamped */
+
+    uint32_t             slot;            /* cluster slot + 1, 0 if none */
+
     uint8_t              *narg_start;     /* narg start (redis) */
     uint8_t              *narg_end;       /* narg end (redis) */
     uint32_t             narg;            /* # arguments (redis) */
@@ -253,6 +293,24 @@ struct msg {
     uint64_t             frag_id;         /* id of fragmented message */
     struct msg           **frag_seq;      /* sequence of fragment message, map from keys to fragments*/
 
+    struct singleflight  *sf;             /* single flight table led in or NULL */
+    struct msg           *sf_next;        /* next leader in bucket or next waiter */
+    struct msg           *sf_waiter;      /* first request waiting on this one */
+    uint32_t             sf_hash;         /* single flight hash of a leader */
+
+    struct msg           *batch_first;    /* first request of a batch */
+    struct msg           *batch_link;     /* next request of the same batch */
+    uint32_t             nbatch;          /* # requests of a batch */
+
+    struct rbnode        hedge_rbe;       /* entry in hedge rbtree */
+    struct msg           *hedge;          /* other copy of a hedged read or NULL */
+    struct conn          *hedge_conn;     /* server conn of a hedged read */
+
+    struct server        *limit_server;   /* server whose in-flight slot is held */
+    int64_t              limit_ts;        /* slot taken in usec */
+
+    int64_t              deadline;        /* not sent after, in usec or 0 */
+
     err_t                err;             /* errno on error? */
     unsigned             error:1;         /* error? */
     unsigned             ferror:1;        /* one or more fragments are in error? */
@@ -264,6 +322,12 @@ struct msg {
     unsigned             fdone:1;         /* all fragments are done? */
     unsigned             swallow:1;       /* swallow response? */
     unsigned             redis:1;         /* redis? */
+    unsigned             nearcache:1;     /* near cache entry pending on response? */
+    unsigned             nobatch:1;       /* never batch? */
+    unsigned             batch_strict:1;  /* get batch that resends nil members? */
+    unsigned             retried:1;       /* sent again after a server failure? */
+    unsigned             sf_stale:1;      /* single flight leader a write overtook? */
+    unsigned             lane:1;          /* server lane, SERVER_LANE_* */
 };
 
 TAILQ_HEAD(msg_tqh, msg);
@@ -275,6 +339,7 @@ void msg_tmo_delete(struct msg *msg);
 void msg_init(void);
 void msg_deinit(void);
 struct string *msg_type_string(msg_type_t type);
+msg_type_t msg_type_redis(uint8_t *name, uint32_t len);
 struct msg *msg_get(struct conn *conn, bool request, bool redis);
 void msg_put(struct msg *msg);
 struct msg *msg_get_error(bool redis, err_t err);
@@ -310,6 +375,7 @@ struct msg *rsp_get(struct conn *conn);
 void rsp_put(struct msg *msg);
 struct msg *rsp_recv_next(struct context *ctx, struct conn *conn, bool alloc);
 void rsp_recv_done(struct context *ctx, struct conn *conn, struct msg *msg, struct msg *nmsg);
+void rsp_complete(struct context *ctx, struct conn *s_conn, struct msg *pmsg, struct msg *msg);
 struct msg *rsp_send_next(struct context *ctx, struct conn *conn);
 void rsp_send_done(struct context *ctx, struct conn *conn, struct msg *msg);
 
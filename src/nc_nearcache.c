@@ -0,0 +1,1311 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ctype.h>
+
+#include <nc_core.h>
+#include <nc_server.h>
+#include <nc_hashkit.h>
+#include <nc_nearcache.h>
+
+#define NEARCACHE_SKETCH_MAX     15             /* 4 bit counters */
+#define NEARCACHE_RESP_DEPTH     8              /* max RESP3 nesting */
+
+/* read commands of a single key whose response depends only on the request */
+static bool
+nearcache_cacheable(msg_type_t type)
+{
+    switch (type) {
+    case MSG_REQ_REDIS_TYPE:
+    case MSG_REQ_REDIS_BITCOUNT:
+    case MSG_REQ_REDIS_GET:
+    case MSG_REQ_REDIS_GETBIT:
+    case MSG_REQ_REDIS_GETRANGE:
+    case MSG_REQ_REDIS_STRLEN:
+    case MSG_REQ_REDIS_HEXISTS:
+    case MSG_REQ_REDIS_HGET:
+    case MSG_REQ_REDIS_HGETALL:
+    case MSG_REQ_REDIS_HKEYS:
+    case MSG_REQ_REDIS_HLEN:
+    case MSG_REQ_REDIS_HMGET:
+    case MSG_REQ_REDIS_HVALS:
+    case MSG_REQ_REDIS_LINDEX:
+    case MSG_REQ_REDIS_LLEN:
+    case MSG_REQ_REDIS_LRANGE:
+    case MSG_REQ_REDIS_SCARD:
+    case MSG_REQ_REDIS_SISMEMBER:
+    case MSG_REQ_REDIS_SMEMBERS:
+    case MSG_REQ_REDIS_ZCARD:
+    case MSG_REQ_REDIS_ZCOUNT:
+    case MSG_REQ_REDIS_ZLEXCOUNT:
+    case MSG_REQ_REDIS_ZRANGE:
+    case MSG_REQ_REDIS_ZRANGEBYLEX:
+    case MSG_REQ_REDIS_ZRANGEBYSCORE:
+    case MSG_REQ_REDIS_ZRANK:
+    case MSG_REQ_REDIS_ZREVRANGE:
+    case MSG_REQ_REDIS_ZREVRANGEBYSCORE:
+    case MSG_REQ_REDIS_ZREVRANK:
+    case MSG_REQ_REDIS_ZSCORE:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+/* look up a command name, as in "hget", among the cacheable request types */
+static msg_type_t
+nearcache_command(uint8_t *name, uint32_t len)
+{
+    msg_type_t type;
+
+    type = msg_type_redis(name, len);
+    if (type == MSG_UNKNOWN || !nearcache_cacheable(type)) {
+        return MSG_UNKNOWN;
+    }
+
+    return type;
+}
+
+/*
+ * Parse a list of command names separated by spaces or commas, as in
+ * nearcache_commands and singleflight_commands, into the cmd flags indexed
+ * by request type, and return the # commands in ncmd. Only read commands
+ * whose response depends on nothing but the request are accepted.
+ */
+rstatus_t
+nearcache_commands(struct server_pool *pool, struct string *names,
+                   uint8_t *cmd, uint32_t *ncmd)
+{
+    uint8_t *p, *end, *name;
+    msg_type_t type;
+
+    *ncmd = 0;
+
+    p = names->data;
+    end = names->data + names->len;
+
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == ',')) {
+            p++;
+        }
+
+        for (name = p; p < end && *p != ' ' && *p != ','; p++) {
+            /* nothing */
+        }
+        if (p == name) {
+            break;
+        }
+
+        type = nearcache_command(name, (uint32_t)(p - name));
+        if (type == MSG_UNKNOWN) {
+            log_error("pool '%.*s' can not cache or share the response of "
+                      "'%.*s'", pool->name.len, pool->name.data,
+                      (int)(p - name), name);
+            return NC_ERROR;
+        }
+
+        cmd[type] = 1;
+        (*ncmd)++;
+    }
+
+    return NC_OK;
+}
+
+struct nearcache *
+nearcache_create(struct server_pool *pool)
+{
+    struct nearcache *nc;
+    uint32_t nslot, ncmd;
+    rstatus_t status;
+
+    ASSERT(pool->nearcache_max_memory > 0);
+
+    nc = nc_zalloc(sizeof(*nc));
+    if (nc == NULL) {
+        return NULL;
+    }
+
+    nc->owner = pool;
+    nc->max_memory = pool->nearcache_max_memory;
+    nc->max_protected = nc->max_memory * NEARCACHE_PROTECTED_PCT / 100;
+    nc->max_item = (uint32_t)(nc->max_memory / NEARCACHE_ITEM_SHARE);
+    nc->ttl = pool->nearcache_ttl;
+    nc->tracking = pool->nearcache_tracking;
+    TAILQ_INIT(&nc->pending);
+    TAILQ_INIT(&nc->probation);
+    TAILQ_INIT(&nc->protect);
+
+    status = nearcache_commands(pool, &pool->nearcache_commands, nc->cmd,
+                                &ncmd);
+    if (status != NC_OK) {
+        nearcache_destroy(nc);
+        return NULL;
+    }
+    if (ncmd == 0) {
+        nc->cmd[MSG_REQ_REDIS_GET] = 1;
+    }
+
+    /* a bucket and a sketch column per 256 bytes of cache */
+    for (nslot = 1024; nslot < nc->max_memory / 256 && nslot < (1U << 24);
+         nslot <<= 1) {
+        /* nothing */
+    }
+    nc->mask = nslot - 1;
+
+    nc->table = nc_zalloc(nslot * sizeof(*nc->table));
+    nc->ktable = nc_zalloc(nslot * sizeof(*nc->ktable));
+    nc->sketch = nc_zalloc(NEARCACHE_SKETCH_DEPTH * nslot);
+    if (nc->table == NULL || nc->ktable == NULL || nc->sketch == NULL) {
+        nearcache_destroy(nc);
+        return NULL;
+    }
+
+    return nc;
+}
+
+static void
+nearcache_free_q(struct nearcache_tqh *q)
+{
+    struct nearcache_entry *e;
+
+    while (!TAILQ_EMPTY(q)) {
+        e = TAILQ_FIRST(q);
+        TAILQ_REMOVE(q, e, tqe);
+        nc_free(e);
+    }
+}
+
+void
+nearcache_destroy(struct nearcache *nc)
+{
+    nearcache_free_q(&nc->pending);
+    nearcache_free_q(&nc->probation);
+    nearcache_free_q(&nc->protect);
+
+    if (nc->table != NULL) {
+        nc_free(nc->table);
+    }
+    if (nc->ktable != NULL) {
+        nc_free(nc->ktable);
+    }
+    if (nc->sketch != NULL) {
+        nc_free(nc->sketch);
+    }
+    nc_free(nc);
+}
+
+static uint32_t
+nearcache_hash(msg_type_t type, uint8_t *key, uint32_t klen)
+{
+    return hash_fnv1a_32((char *)key, klen) ^ ((uint32_t)type * 0x9e3779b1U);
+}
+
+/* second hash of the sketch rows, odd so that rows never coincide */
+static uint32_t
+nearcache_rehash(uint32_t hash)
+{
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bU;
+    hash ^= hash >> 13;
+
+    return hash | 1;
+}
+
+static void
+nearcache_sketch_add(struct nearcache *nc, uint32_t hash)
+{
+    uint32_t i, width, h2;
+    uint8_t *c;
+
+    width = nc->mask + 1;
+    h2 = nearcache_rehash(hash);
+
+    for (i = 0; i < NEARCACHE_SKETCH_DEPTH; i++) {
+        c = &nc->sketch[i * width + ((hash + i * h2) & nc->mask)];
+        if (*c < NEARCACHE_SKETCH_MAX) {
+            (*c)++;
+        }
+    }
+
+    /* age the counts, so that keys that went cold give way */
+    if (++nc->nsketch >= 10 * width) {
+        for (i = 0; i < NEARCACHE_SKETCH_DEPTH * width; i++) {
+            nc->sketch[i] >>= 1;
+        }
+        nc->nsketch /= 2;
+    }
+}
+
+static uint8_t
+nearcache_sketch_freq(struct nearcache *nc, uint32_t hash)
+{
+    uint32_t i, width, h2;
+    uint8_t c, freq = NEARCACHE_SKETCH_MAX;
+
+    width = nc->mask + 1;
+    h2 = nearcache_rehash(hash);
+
+    for (i = 0; i < NEARCACHE_SKETCH_DEPTH; i++) {
+        c = nc->sketch[i * width + ((hash + i * h2) & nc->mask)];
+        freq = MIN(freq, c);
+    }
+
+    return freq;
+}
+
+/*
+ * Point key at the request bytes from its only key to its end, which is
+ * the lookup key; the request must sit in a single mbuf
+ */
+static rstatus_t
+nearcache_key(struct msg *msg, uint8_t **key, uint32_t *klen, uint32_t *rklen)
+{
+    struct mbuf *mbuf;
+    struct keypos *kpos;
+
+    if (msg->keys == NULL || array_n(msg->keys) != 1) {
+        return NC_ERROR;
+    }
+
+    mbuf = STAILQ_FIRST(&msg->mhdr);
+    if (mbuf == NULL || mbuf != STAILQ_LAST(&msg->mhdr, mbuf, next)) {
+        return NC_ERROR;
+    }
+
+    kpos = array_get(msg->keys, 0);
+    if (kpos->start < mbuf->start || kpos->end > mbuf->last ||
+        kpos->start > kpos->end) {
+        return NC_ERROR;
+    }
+
+    *key = kpos->start;
+    *klen = (uint32_t)(mbuf->last - kpos->start);
+    *rklen = (uint32_t)(kpos->end - kpos->start);
+
+    return NC_OK;
+}
+
+static size_t
+nearcache_size(struct nearcache_entry *e)
+{
+    return sizeof(*e) + e->klen + e->vlen;
+}
+
+static struct nearcache_entry *
+nearcache_lookup(struct nearcache *nc, uint32_t hash, msg_type_t type,
+                 uint8_t *key, uint32_t klen)
+{
+    struct nearcache_entry *e;
+
+    for (e = nc->table[hash & nc->mask]; e != NULL; e = e->next) {
+        if (e->hash == hash && e->type == type && e->klen == klen &&
+            memcmp(e->data, key, klen) == 0) {
+            return e;
+        }
+    }
+
+    return NULL;
+}
+
+static void
+nearcache_link(struct nearcache *nc, struct nearcache_entry *e)
+{
+    struct nearcache_entry **bucket;
+    size_t size = nearcache_size(e);
+
+    bucket = &nc->table[e->hash & nc->mask];
+    e->next = *bucket;
+    *bucket = e;
+
+    bucket = &nc->ktable[e->khash & nc->mask];
+    e->knext = *bucket;
+    *bucket = e;
+
+    if (e->seg == NEARCACHE_PENDING) {
+        TAILQ_INSERT_TAIL(&nc->pending, e, tqe);
+    } else {
+        ASSERT(e->seg == NEARCACHE_PROBATION);
+        TAILQ_INSERT_HEAD(&nc->probation, e, tqe);
+    }
+
+    nc->memory += size;
+    nc->nentry++;
+
+    stats_pool_incr_by(nc->owner->ctx, nc->owner, nearcache_bytes, (int64_t)size);
+    stats_pool_incr(nc->owner->ctx, nc->owner, nearcache_entries);
+}
+
+static void
+nearcache_remove(struct nearcache *nc, struct nearcache_entry *e)
+{
+    struct nearcache_entry **pe;
+    size_t size = nearcache_size(e);
+
+    for (pe = &nc->table[e->hash & nc->mask]; *pe != e; pe = &(*pe)->next) {
+        ASSERT(*pe != NULL);
+    }
+    *pe = e->next;
+
+    for (pe = &nc->ktable[e->khash & nc->mask]; *pe != e; pe = &(*pe)->knext) {
+        ASSERT(*pe != NULL);
+    }
+    *pe = e->knext;
+
+    switch (e->seg) {
+    case NEARCACHE_PENDING:
+        TAILQ_REMOVE(&nc->pending, e, tqe);
+        break;
+
+    case NEARCACHE_PROBATION:
+        TAILQ_REMOVE(&nc->probation, e, tqe);
+        break;
+
+    case NEARCACHE_PROTECTED:
+        TAILQ_REMOVE(&nc->protect, e, tqe);
+        nc->protected -= size;
+        break;
+
+    default:
+        NOT_REACHED();
+    }
+
+    nc->memory -= size;
+    nc->nentry--;
+
+    stats_pool_decr_by(nc->owner->ctx, nc->owner, nearcache_bytes, (int64_t)size);
+    stats_pool_decr(nc->owner->ctx, nc->owner, nearcache_entries);
+
+    nc_free(e);
+}
+
+/*
+ * Make room for size bytes, evicting from the lru end of probation, then
+ * of protected, then the oldest pending entries. A live victim that the
+ * sketch saw at least as often as the candidate stays, and the candidate
+ * is turned away.
+ */
+static bool
+nearcache_admit(struct nearcache *nc, uint32_t hash, size_t size, int64_t now)
+{
+    struct nearcache_entry *victim;
+    uint8_t freq;
+
+    if (nc->memory + size <= nc->max_memory) {
+        return true;
+    }
+
+    freq = nearcache_sketch_freq(nc, hash);
+
+    while (nc->memory + size > nc->max_memory) {
+        victim = TAILQ_LAST(&nc->probation, nearcache_tqh);
+        if (victim == NULL) {
+            victim = TAILQ_LAST(&nc->protect, nearcache_tqh);
+        }
+        if (victim == NULL) {
+            victim = TAILQ_FIRST(&nc->pending);
+        }
+        if (victim == NULL) {
+            return false;
+        }
+
+        if (victim->seg != NEARCACHE_PENDING && victim->expire > now &&
+            nearcache_sketch_freq(nc, victim->hash) >= freq) {
+            stats_pool_incr(nc->owner->ctx, nc->owner, nearcache_rejects);
+            return false;
+        }
+
+        nearcache_remove(nc, victim);
+        stats_pool_incr(nc->owner->ctx, nc->owner, nearcache_evictions);
+    }
+
+    return true;
+}
+
+/* move a hit entry to the mru end of protected, demoting its lru end */
+static void
+nearcache_touch(struct nearcache *nc, struct nearcache_entry *e)
+{
+    struct nearcache_entry *lru;
+
+    if (e->seg == NEARCACHE_PROTECTED) {
+        TAILQ_REMOVE(&nc->protect, e, tqe);
+        TAILQ_INSERT_HEAD(&nc->protect, e, tqe);
+        return;
+    }
+
+    ASSERT(e->seg == NEARCACHE_PROBATION);
+
+    TAILQ_REMOVE(&nc->probation, e, tqe);
+    e->seg = NEARCACHE_PROTECTED;
+    TAILQ_INSERT_HEAD(&nc->protect, e, tqe);
+    nc->protected += nearcache_size(e);
+
+    while (nc->protected > nc->max_protected) {
+        lru = TAILQ_LAST(&nc->protect, nearcache_tqh);
+        ASSERT(lru != e);
+
+        TAILQ_REMOVE(&nc->protect, lru, tqe);
+        nc->protected -= nearcache_size(lru);
+        lru->seg = NEARCACHE_PROBATION;
+        TAILQ_INSERT_HEAD(&nc->probation, lru, tqe);
+    }
+}
+
+/* hold the place of a missed request until its response comes */
+static void
+nearcache_pend(struct nearcache *nc, struct msg *msg, uint32_t hash,
+               uint8_t *key, uint32_t klen, uint32_t rklen, int64_t now)
+{
+    struct nearcache_entry *e;
+    size_t size;
+
+    size = sizeof(*e) + klen;
+    if (size > nc->max_item || !nearcache_admit(nc, hash, size, now)) {
+        return;
+    }
+
+    e = nc_alloc(size);
+    if (e == NULL) {
+        return;
+    }
+
+    e->server = NULL;
+    e->req_id = msg->id;
+    e->since = now;
+    e->expire = now + nc->ttl;
+    e->hash = hash;
+    e->khash = hash_fnv1a_32((char *)key, rklen);
+    e->klen = klen;
+    e->rklen = rklen;
+    e->vlen = 0;
+    e->type = (uint16_t)msg->type;
+    e->rtype = MSG_UNKNOWN;
+    e->seg = NEARCACHE_PENDING;
+    nc_memcpy(e->data, key, klen);
+
+    nearcache_link(nc, e);
+
+    msg->nearcache = 1;
+}
+
+/*
+ * Return the live entry for a request, or NULL when the request has to go
+ * to a server. Every cacheable request counts towards the sketch.
+ */
+struct nearcache_entry *
+nearcache_get(struct nearcache *nc, struct msg *msg)
+{
+    struct nearcache_entry *e;
+    uint8_t *key;
+    uint32_t klen, rklen, hash;
+    int64_t now;
+
+    if (!nc->cmd[msg->type]) {
+        return NULL;
+    }
+
+    if (nearcache_key(msg, &key, &klen, &rklen) != NC_OK) {
+        return NULL;
+    }
+
+    hash = nearcache_hash(msg->type, key, klen);
+    nearcache_sketch_add(nc, hash);
+
+    now = nc_loop_usec();
+
+    e = nearcache_lookup(nc, hash, msg->type, key, klen);
+    if (e != NULL && e->expire <= now) {
+        nearcache_remove(nc, e);
+        e = NULL;
+    }
+
+    if (e == NULL || e->seg == NEARCACHE_PENDING) {
+        stats_pool_incr(nc->owner->ctx, nc->owner, nearcache_misses);
+        if (e == NULL) {
+            nearcache_pend(nc, msg, hash, key, klen, rklen, now);
+        }
+        return NULL;
+    }
+
+    nearcache_touch(nc, e);
+    stats_pool_incr(nc->owner->ctx, nc->owner, nearcache_hits);
+
+    return e;
+}
+
+rstatus_t
+nearcache_reply(struct nearcache_entry *e, struct msg *rsp)
+{
+    rstatus_t status;
+    uint8_t *p;
+    uint32_t left;
+    size_t n;
+
+    ASSERT(e->seg != NEARCACHE_PENDING);
+
+    p = e->data + e->klen;
+    for (left = e->vlen; left > 0; left -= (uint32_t)n) {
+        n = MIN(left, mbuf_data_size());
+        status = msg_append(rsp, p, n);
+        if (status != NC_OK) {
+            return status;
+        }
+        p += n;
+    }
+
+    rsp->type = e->rtype;
+
+    return NC_OK;
+}
+
+/*
+ * Drop the pending entry of request msg, that goes away without its
+ * response, so that the next miss of its key can take its place
+ */
+void
+nearcache_abort(struct server_pool *pool, struct msg *msg)
+{
+    struct nearcache *nc = pool->nearcache;
+    struct nearcache_entry *e;
+    uint8_t *key;
+    uint32_t klen, rklen, hash;
+
+    ASSERT(msg->nearcache);
+
+    msg->nearcache = 0;
+
+    if (nc == NULL || nearcache_key(msg, &key, &klen, &rklen) != NC_OK) {
+        return;
+    }
+
+    hash = nearcache_hash(msg->type, key, klen);
+    e = nearcache_lookup(nc, hash, msg->type, key, klen);
+    if (e == NULL || e->seg != NEARCACHE_PENDING || e->req_id != msg->id) {
+        return;
+    }
+
+    log_debug(LOG_VERB, "near cache drop pending req %"PRIu64" key '%.*s'",
+              msg->id, rklen, key);
+
+    nearcache_remove(nc, e);
+}
+
+/*
+ * Cache the response of a request that left a pending entry, unless the
+ * entry was invalidated meanwhile or the key could have changed on the
+ * server unnoticed
+ */
+void
+nearcache_fill(struct nearcache *nc, struct conn *s_conn, struct msg *req,
+               struct msg *rsp)
+{
+    struct server *server = s_conn->owner;
+    struct nearcache_tracker *t;
+    struct nearcache_entry *e;
+    struct mbuf *mbuf;
+    uint8_t *key, *p, *end;
+    uint32_t klen, rklen, hash, khash, n;
+    size_t size;
+    int64_t now;
+
+    ASSERT(req->nearcache);
+
+    req->nearcache = 0;
+
+    if (nearcache_key(req, &key, &klen, &rklen) != NC_OK) {
+        return;
+    }
+
+    hash = nearcache_hash(req->type, key, klen);
+    e = nearcache_lookup(nc, hash, req->type, key, klen);
+    if (e == NULL || e->seg != NEARCACHE_PENDING || e->req_id != req->id) {
+        /* invalidated, evicted or expired in flight */
+        return;
+    }
+    khash = e->khash;
+
+    switch (rsp->type) {
+    case MSG_RSP_REDIS_INTEGER:
+    case MSG_RSP_REDIS_BULK:
+    case MSG_RSP_REDIS_MULTIBULK:
+        break;
+
+    default:
+        nearcache_remove(nc, e);
+        return;
+    }
+
+    if (nc->tracking) {
+        t = server->tracker;
+        if (t == NULL || t->ready_at == 0 || t->ready_at >= e->since) {
+            nearcache_remove(nc, e);
+            return;
+        }
+    }
+
+    nearcache_remove(nc, e);
+
+    size = sizeof(*e) + klen + rsp->mlen;
+    if (size > nc->max_item) {
+        return;
+    }
+
+    now = nc_loop_usec();
+    if (!nearcache_admit(nc, hash, size, now)) {
+        return;
+    }
+
+    e = nc_alloc(size);
+    if (e == NULL) {
+        return;
+    }
+
+    p = e->data + klen;
+    end = p + rsp->mlen;
+    STAILQ_FOREACH(mbuf, &rsp->mhdr, next) {
+        n = mbuf_length(mbuf);
+        if (n > (uint32_t)(end - p)) {
+            break;
+        }
+        nc_memcpy(p, mbuf->pos, n);
+        p += n;
+    }
+    if (p != end || mbuf != NULL) {
+        nc_free(e);
+        return;
+    }
+
+    e->server = server;
+    e->req_id = 0;
+    e->since = 0;
+    e->expire = now + nc->ttl;
+    e->hash = hash;
+    e->khash = khash;
+    e->klen = klen;
+    e->rklen = rklen;
+    e->vlen = rsp->mlen;
+    e->type = (uint16_t)req->type;
+    e->rtype = (uint16_t)rsp->type;
+    e->seg = NEARCACHE_PROBATION;
+    nc_memcpy(e->data, key, klen);
+
+    nearcache_link(nc, e);
+
+    log_debug(LOG_VERB, "near cache req %"PRIu64" type %d key '%.*s' %"PRIu32
+              " bytes", req->id, req->type, rklen, key, rsp->mlen);
+}
+
+static void
+nearcache_invalidate(struct nearcache *nc, uint8_t *key, uint32_t keylen)
+{
+    struct nearcache_entry *e, *next;
+    uint32_t khash, n = 0;
+
+    khash = hash_fnv1a_32((char *)key, keylen);
+
+    for (e = nc->ktable[khash & nc->mask]; e != NULL; e = next) {
+        next = e->knext;
+        if (e->khash == khash && e->rklen == keylen &&
+            memcmp(e->data, key, keylen) == 0) {
+            nearcache_remove(nc, e);
+            n++;
+        }
+    }
+
+    if (n != 0) {
+        stats_pool_incr_by(nc->owner->ctx, nc->owner, nearcache_invalidations,
+                           n);
+    }
+}
+
+/*
+ * Write msg, routed to a server, may change its keys: drop their entries,
+ * pending ones included, rather than wait for the tracking push or ttl
+ */
+void
+nearcache_write(struct nearcache *nc, struct msg *msg)
+{
+    struct keypos *kpos;
+    uint32_t i;
+
+    ASSERT(msg->request);
+
+    if (nc->nentry == 0 || msg->type <= MSG_REQ_REDIS_WRITECMD_START) {
+        return;
+    }
+
+    for (i = 0; i < array_n(msg->keys); i++) {
+        kpos = array_get(msg->keys, i);
+        nearcache_invalidate(nc, kpos->start,
+                             (uint32_t)(kpos->end - kpos->start));
+    }
+}
+
+static void
+nearcache_flush_q(struct nearcache *nc, struct nearcache_tqh *q,
+                  struct server *server)
+{
+    struct nearcache_entry *e, *next;
+
+    for (e = TAILQ_FIRST(q); e != NULL; e = next) {
+        next = TAILQ_NEXT(e, tqe);
+        if (server == NULL || e->server == server) {
+            nearcache_remove(nc, e);
+        }
+    }
+}
+
+/* drop the entries of a server, or all entries when server is NULL */
+static void
+nearcache_flush(struct nearcache *nc, struct server *server)
+{
+    uint32_t nentry = nc->nentry;
+
+    if (server == NULL) {
+        nearcache_flush_q(nc, &nc->pending, NULL);
+    }
+    nearcache_flush_q(nc, &nc->probation, server);
+    nearcache_flush_q(nc, &nc->protect, server);
+
+    stats_pool_incr_by(nc->owner->ctx, nc->owner, nearcache_invalidations,
+                       nentry - nc->nentry);
+}
+
+/*
+ * Parse the line of the RESP3 element at p, a type byte and text up to
+ * CRLF. Return one past the CRLF, NULL when the line is incomplete or p
+ * when it is malformed; *val is the text as an integer, or INT64_MIN when
+ * it is not one.
+ */
+static uint8_t *
+nearcache_resp_line(uint8_t *p, uint8_t *end, int64_t *val)
+{
+    uint8_t *q, *s;
+    int64_t v = 0;
+    bool neg;
+
+    q = memchr(p, '\n', (size_t)(end - p));
+    if (q == NULL) {
+        return NULL;
+    }
+    if (q == p || q[-1] != '\r') {
+        return p;
+    }
+
+    s = p + 1;
+    neg = (s < q - 1 && *s == '-');
+    if (neg) {
+        s++;
+    }
+
+    *val = INT64_MIN;
+    if (s == q - 1 || q - 1 - s > 18) {
+        return q + 1;
+    }
+    for (; s < q - 1; s++) {
+        if (!isdigit(*s)) {
+            return q + 1;
+        }
+        v = v * 10 + (*s - '0');
+    }
+    *val = neg ? -v : v;
+
+    return q + 1;
+}
+
+/*
+ * Return one past the RESP3 element at p, NULL when it is incomplete or p
+ * when it is malformed
+ */
+static uint8_t *
+nearcache_resp_skip(uint8_t *p, uint8_t *end, int depth)
+{
+    uint8_t *q, *r;
+    int64_t n, i;
+
+    if (p >= end) {
+        return NULL;
+    }
+
+    q = nearcache_resp_line(p, end, &n);
+    if (q == NULL || q == p) {
+        return q;
+    }
+
+    switch (*p) {
+    case '+':
+    case '-':
+    case ':':
+    case ',':
+    case '_':
+    case '#':
+    case '(':
+        return q;
+
+    case '$':
+    case '!':
+    case '=':
+        if (n == -1) {
+            return q;
+        }
+        if (n < 0) {
+            return p;
+        }
+        if (end - q < n + 2) {
+            return NULL;
+        }
+        if (q[n] != '\r' || q[n + 1] != '\n') {
+            return p;
+        }
+        return q + n + 2;
+
+    case '*':
+    case '~':
+    case '>':
+    case '%':
+    case '|':
+        if (n == -1) {
+            return q;
+        }
+        if (n < 0 || depth >= NEARCACHE_RESP_DEPTH) {
+            return p;
+        }
+        if (*p == '%' || *p == '|') {
+            n *= 2;
+        }
+        /* an attribute map comes before the element it annotates */
+        if (*p == '|') {
+            n++;
+        }
+        for (i = 0; i < n; i++) {
+            r = nearcache_resp_skip(q, end, depth + 1);
+            if (r == NULL || r == q) {
+                return r == NULL ? NULL : p;
+            }
+            q = r;
+        }
+        return q;
+
+    default:
+        return p;
+    }
+}
+
+/* apply a complete push, "invalidate" followed by the keys or null */
+static void
+nearcache_push(struct nearcache *nc, uint8_t *p, uint8_t *end)
+{
+    uint8_t *q;
+    int64_t n, len, i;
+
+    q = nearcache_resp_line(p, end, &n);
+    if (n < 2 || *q != '$') {
+        return;
+    }
+
+    q = nearcache_resp_line(q, end, &len);
+    if (len != 10 || nc_strncmp(q, "invalidate", 10) != 0) {
+        return;
+    }
+    q += len + 2;
+
+    if (*q == '_') {
+        nearcache_flush(nc, NULL);
+        return;
+    }
+    if (*q != '*') {
+        return;
+    }
+
+    q = nearcache_resp_line(q, end, &n);
+    if (n == -1) {
+        nearcache_flush(nc, NULL);
+        return;
+    }
+
+    for (i = 0; i < n && *q == '$'; i++) {
+        q = nearcache_resp_line(q, end, &len);
+        if (len < 0) {
+            return;
+        }
+        nearcache_invalidate(nc, q, (uint32_t)len);
+        q += len + 2;
+    }
+}
+
+/* handle the complete frames in the read buffer of a tracking connection */
+static rstatus_t
+nearcache_tracker_parse(struct nearcache *nc, struct nearcache_tracker *t)
+{
+    struct server *server = t->server;
+    uint8_t *p, *q, *end;
+
+    p = t->rbuf;
+    end = t->rbuf + t->rlen;
+
+    while (p < end) {
+        q = nearcache_resp_skip(p, end, 0);
+        if (q == NULL) {
+            break;
+        }
+        if (q == p) {
+            log_warn("malformed tracking frame from server '%.*s'",
+                     server->pname.len, server->pname.data);
+            return NC_ERROR;
+        }
+
+        if (*p == '>') {
+            nearcache_push(nc, p, q);
+        } else if (t->nreply > 0) {
+            if (*p == '-' || *p == '!') {
+                log_warn("client tracking on server '%.*s' refused: %.*s",
+                         server->pname.len, server->pname.data,
+                         (int)(q - p - 3), p + 1);
+                return NC_ERROR;
+            }
+            if (--t->nreply == 0) {
+                t->ready_at = nc_usec_now();
+                log_debug(LOG_NOTICE, "client tracking on server '%.*s'",
+                          server->pname.len, server->pname.data);
+            }
+        }
+
+        p = q;
+    }
+
+    t->rlen = (uint32_t)(end - p);
+    if (t->rlen != 0 && p != t->rbuf) {
+        memmove(t->rbuf, p, t->rlen);
+    }
+
+    return NC_OK;
+}
+
+rstatus_t
+nearcache_recv(struct context *ctx, struct conn *conn)
+{
+    struct server *server = conn->owner;
+    struct nearcache_tracker *t = server->tracker;
+    struct nearcache *nc = server->owner->nearcache;
+    uint8_t *rbuf;
+    ssize_t n;
+
+    ASSERT(!conn->client && !conn->proxy);
+
+    conn->recv_ready = 1;
+    do {
+        if (t->rlen == t->rsize) {
+            if (t->rsize >= NEARCACHE_RBUF_MAX) {
+                log_warn("tracking frame from server '%.*s' exceeds %d bytes",
+                         server->pname.len, server->pname.data,
+                         NEARCACHE_RBUF_MAX);
+                conn->err = EMSGSIZE;
+                return NC_ERROR;
+            }
+            rbuf = nc_realloc(t->rbuf, 2 * t->rsize);
+            if (rbuf == NULL) {
+                conn->err = ENOMEM;
+                return NC_ENOMEM;
+            }
+            t->rbuf = rbuf;
+            t->rsize *= 2;
+        }
+
+        n = conn_recv(conn, t->rbuf + t->rlen, t->rsize - t->rlen);
+        if (n < 0) {
+            return n == NC_EAGAIN ? NC_OK : NC_ERROR;
+        }
+        if (n == 0) {
+            conn->done = 1;
+            return NC_OK;
+        }
+        t->rlen += (uint32_t)n;
+
+        if (nearcache_tracker_parse(nc, t) != NC_OK) {
+            conn->err = EPROTO;
+            return NC_ERROR;
+        }
+    } while (conn->recv_ready);
+
+    return NC_OK;
+}
+
+/* send the handshake once the connection is up */
+rstatus_t
+nearcache_send(struct context *ctx, struct conn *conn)
+{
+    struct server *server = conn->owner;
+    struct nearcache_tracker *t = server->tracker;
+    ssize_t n;
+
+    ASSERT(!conn->client && !conn->proxy);
+
+    if (conn->connecting) {
+        conn->connecting = 0;
+        conn->connected = 1;
+    }
+
+    while (t->wpos < t->wlen) {
+        n = nc_write(conn->sd, t->wbuf + t->wpos, t->wlen - t->wpos);
+        if (n > 0) {
+            t->wpos += (uint32_t)n;
+            conn->send_bytes += (size_t)n;
+            continue;
+        }
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return NC_OK;
+        }
+
+        conn->err = errno;
+        return NC_ERROR;
+    }
+
+    return NC_OK;
+}
+
+void
+nearcache_close(struct context *ctx, struct conn *conn)
+{
+    struct server *server = conn->owner;
+    struct server_pool *pool = server->owner;
+    struct nearcache_tracker *t = server->tracker;
+    int status;
+
+    ASSERT(!conn->client && !conn->proxy);
+
+    if (conn->sd >= 0) {
+        status = close(conn->sd);
+        if (status < 0) {
+            log_error("close s %d failed, ignored: %s", conn->sd,
+                      strerror(errno));
+        }
+        conn->sd = -1;
+    }
+
+    conn->unref(conn);
+    conn_put(conn);
+
+    if (t->ready_at != 0) {
+        log_warn("client tracking on server '%.*s' lost, dropping its near "
+                 "cache entries", server->pname.len, server->pname.data);
+        nearcache_flush(pool->nearcache, server);
+    }
+
+    t->ready_at = 0;
+    t->nreply = 0;
+    t->rlen = 0;
+    t->wpos = 0;
+    t->next_retry = nc_usec_now() + pool->server_retry_timeout;
+}
+
+bool
+nearcache_active(struct conn *conn)
+{
+    return false;
+}
+
+void
+nearcache_ref(struct conn *conn, void *owner)
+{
+    struct server *server = owner;
+
+    ASSERT(!conn->client && !conn->proxy);
+    ASSERT(conn->owner == NULL && server->tracker->conn == NULL);
+
+    conn->family = server->family;
+    conn->addrlen = server->addrlen;
+    conn->addr = server->addr;
+
+    conn->owner = owner;
+    server->tracker->conn = conn;
+
+    log_debug(LOG_VVERB, "ref conn %p tracker of '%.*s'", conn,
+              server->pname.len, server->pname.data);
+}
+
+void
+nearcache_unref(struct conn *conn)
+{
+    struct server *server = conn->owner;
+
+    ASSERT(!conn->client && !conn->proxy);
+    ASSERT(server->tracker->conn == conn);
+
+    conn->owner = NULL;
+    server->tracker->conn = NULL;
+
+    log_debug(LOG_VVERB, "unref conn %p tracker of '%.*s'", conn,
+              server->pname.len, server->pname.data);
+}
+
+/* HELLO 3 [AUTH default password] and CLIENT TRACKING on BCAST */
+static rstatus_t
+nearcache_handshake(struct nearcache_tracker *t, struct string *auth)
+{
+    size_t size = sizeof(t->wbuf);
+    int n;
+
+    if (auth->len + 128 > size) {
+        log_error("redis_auth too long for near cache tracking");
+        return NC_ERROR;
+    }
+
+    if (auth->len > 0) {
+        n = nc_scnprintf(t->wbuf, size, "*5\r\n$5\r\nHELLO\r\n$1\r\n3\r\n"
+                         "$4\r\nAUTH\r\n$7\r\ndefault\r\n$%"PRIu32"\r\n"
+                         "%.*s\r\n", auth->len, auth->len, auth->data);
+    } else {
+        n = nc_scnprintf(t->wbuf, size, "*2\r\n$5\r\nHELLO\r\n$1\r\n3\r\n");
+    }
+    n += nc_scnprintf(t->wbuf + n, size - (size_t)n, "*4\r\n$6\r\nCLIENT\r\n"
+                      "$8\r\nTRACKING\r\n$2\r\non\r\n$5\r\nBCAST\r\n");
+
+    t->wlen = (uint32_t)n;
+    t->wpos = 0;
+    t->nreply = 2;
+
+    return NC_OK;
+}
+
+static void
+nearcache_tracker_connect(struct context *ctx, struct nearcache *nc,
+                          struct nearcache_tracker *t, int64_t now)
+{
+    struct server_pool *pool = nc->owner;
+    struct conn *conn;
+    rstatus_t status;
+
+    t->next_retry = now + pool->server_retry_timeout;
+
+    if (t->rbuf == NULL) {
+        t->rbuf = nc_alloc(NEARCACHE_RBUF_SIZE);
+        if (t->rbuf == NULL) {
+            return;
+        }
+        t->rsize = NEARCACHE_RBUF_SIZE;
+    }
+    t->rlen = 0;
+
+    status = nearcache_handshake(t, &pool->redis_auth);
+    if (status != NC_OK) {
+        return;
+    }
+
+    conn = conn_get_tracker(t->server);
+    if (conn == NULL) {
+        return;
+    }
+
+    status = server_connect(ctx, t->server, conn);
+    if (status != NC_OK) {
+        nearcache_close(ctx, conn);
+    }
+}
+
+/*
+ * Expire pending entries and (re)connect the tracking connections of the
+ * servers of the pool
+ */
+void
+nearcache_tick(struct server_pool *pool)
+{
+    struct nearcache *nc = pool->nearcache;
+    struct nearcache_entry *e;
+    struct nearcache_tracker *t;
+    struct server *server;
+    uint32_t i, nserver;
+    int64_t now;
+
+    if (nc == NULL) {
+        return;
+    }
+
+    now = nc_usec_now();
+
+    while ((e = TAILQ_FIRST(&nc->pending)) != NULL && e->expire <= now) {
+        nearcache_remove(nc, e);
+    }
+
+    if (!nc->tracking) {
+        return;
+    }
+
+    for (i = 0, nserver = array_n(&pool->server); i < nserver; i++) {
+        server = *(struct server **)array_get(&pool->server, i);
+
+        t = server->tracker;
+        if (t == NULL) {
+            t = nc_zalloc(sizeof(*t));
+            if (t == NULL) {
+                continue;
+            }
+            t->server = server;
+            server->tracker = t;
+        }
+
+        if (t->conn == NULL && now >= t->next_retry) {
+            nearcache_tracker_connect(pool->ctx, nc, t, now);
+        }
+    }
+}
+
+/* close and free the tracking connections of the servers of the pool */
+void
+nearcache_disconnect(struct server_pool *pool)
+{
+    struct nearcache_tracker *t;
+    struct server *server;
+    uint32_t i, nserver;
+
+    for (i = 0, nserver = array_n(&pool->server); i < nserver; i++) {
+        server = *(struct server **)array_get(&pool->server, i);
+
+        t = server->tracker;
+        if (t == NULL) {
+            continue;
+        }
+
+        if (t->conn != NULL) {
+            t->conn->close(pool->ctx, t->conn);
+        }
+        if (t->rbuf != NULL) {
+            nc_free(t->rbuf);
+        }
+        nc_free(t);
+        server->tracker = NULL;
+    }
+}
+
+/*
+ * The servers of the pool are about to be replaced; their tracking
+ * connections go and with them everything cached
+ */
+void
+nearcache_servers_update(struct server_pool *pool)
+{
+    if (pool->nearcache == NULL) {
+        return;
+    }
+
+    nearcache_disconnect(pool);
+    nearcache_flush(pool->nearcache, NULL);
+}
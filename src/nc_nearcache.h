@@ -0,0 +1,142 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _NC_NEARCACHE_H_
+#define _NC_NEARCACHE_H_
+
+#include <nc_core.h>
+
+/*
+ * Near cache of read responses of a redis pool. Responses to the commands
+ * in nearcache_commands are kept in the proxy and replayed to clients that
+ * send the same request, without a round trip to a server.
+ *
+ * An entry is keyed on the request type and the request bytes from its
+ * first key to its end, so "GET k" and "HGET k f" differ, and indexed a
+ * second time on the redis key for invalidation. When a cacheable request
+ * misses, a pending entry tagged with the request id is put in place; the
+ * response fills it only if nothing invalidated the key meanwhile.
+ *
+ * Memory is bounded by nearcache_max_memory. Entries enter a probation
+ * segment and move to a protected segment, at most 80% of the memory, on
+ * their first hit; both are LRU. A count-min sketch of 4 bit counters,
+ * halved every 10 * width updates, estimates how often each request was
+ * seen; a new entry only displaces an LRU victim that was seen less often
+ * (TinyLFU admission), so one off reads do not flush the hot keys.
+ *
+ * Entries live at most nearcache_ttl msec. With nearcache_tracking, the
+ * default, every server of the pool also gets a connection that speaks
+ * RESP3 and turns on CLIENT TRACKING in BCAST mode, so the server pushes
+ * the keys written on it and the proxy drops them. A response is cached
+ * only when the tracking connection of its server was up when the request
+ * came in, and the entries of a server are dropped when its tracking
+ * connection goes down. Without tracking, entries are only bounded by ttl.
+ * Either way, a write routed through the proxy drops the entries of its
+ * keys right away, so its client never reads its own write stale.
+ */
+#define NEARCACHE_PROTECTED_PCT  80             /* protected share of memory */
+#define NEARCACHE_ITEM_SHARE     64             /* largest entry is memory / share */
+#define NEARCACHE_SKETCH_DEPTH   4              /* # count-min rows */
+#define NEARCACHE_RBUF_SIZE      (16 * 1024)    /* initial tracking read buffer */
+#define NEARCACHE_RBUF_MAX       (4 * 1024 * 1024) /* largest tracking frame */
+#define NEARCACHE_WBUF_SIZE      1024           /* tracking handshake buffer */
+
+typedef enum nearcache_seg {
+    NEARCACHE_PENDING,                   /* waiting for the response of req_id */
+    NEARCACHE_PROBATION,                 /* not hit since cached */
+    NEARCACHE_PROTECTED,                 /* hit at least once */
+} nearcache_seg_t;
+
+struct nearcache_entry {
+    struct nearcache_entry       *next;  /* chain in key table */
+    struct nearcache_entry       *knext; /* chain in redis key table */
+    TAILQ_ENTRY(nearcache_entry) tqe;    /* link in segment q */
+    struct server                *server;/* server of the value, never dereferenced */
+    uint64_t                     req_id; /* pending: request to fill the entry */
+    int64_t                      since;  /* pending: creation in usec */
+    int64_t                      expire; /* expiry in usec */
+    uint32_t                     hash;   /* hash of type and key */
+    uint32_t                     khash;  /* hash of the redis key */
+    uint32_t                     klen;   /* key length */
+    uint32_t                     rklen;  /* redis key length, a prefix of key */
+    uint32_t                     vlen;   /* response length */
+    uint16_t                     type;   /* request type (msg_type_t) */
+    uint16_t                     rtype;  /* response type (msg_type_t) */
+    uint8_t                      seg;    /* segment (nearcache_seg_t) */
+    uint8_t                      data[]; /* key, then response */
+};
+
+TAILQ_HEAD(nearcache_tqh, nearcache_entry);
+
+/* tracking connection of a server, owned by that server */
+struct nearcache_tracker {
+    struct server  *server;              /* tracked server */
+    struct conn    *conn;                /* tracking connection or NULL */
+    int64_t        next_retry;           /* next connect in usec */
+    int64_t        ready_at;             /* tracking since in usec, 0 if not */
+    uint32_t       nreply;               /* # handshake replies outstanding */
+    uint32_t       wlen;                 /* # handshake bytes */
+    uint32_t       wpos;                 /* # handshake bytes sent */
+    uint32_t       rlen;                 /* # bytes in rbuf */
+    uint32_t       rsize;                /* rbuf size */
+    uint8_t        *rbuf;                /* unparsed input */
+    uint8_t        wbuf[NEARCACHE_WBUF_SIZE]; /* handshake */
+};
+
+struct nearcache {
+    struct server_pool     *owner;       /* owner pool */
+    uint64_t               max_memory;   /* memory limit in bytes */
+    uint64_t               memory;       /* memory of entries in bytes */
+    uint64_t               max_protected;/* protected segment limit in bytes */
+    uint64_t               protected;    /* protected segment memory in bytes */
+    uint32_t               max_item;     /* largest entry in bytes */
+    int64_t                ttl;          /* entry lifetime in usec */
+    unsigned               tracking:1;   /* invalidate with client tracking? */
+    uint8_t                cmd[MSG_SENTINEL]; /* cacheable request types */
+
+    uint32_t               nentry;       /* # entries, pending included */
+    uint32_t               mask;         /* # table buckets - 1 */
+    struct nearcache_entry **table;      /* entries by key */
+    struct nearcache_entry **ktable;     /* entries by redis key */
+    struct nearcache_tqh   pending;      /* pending entries, oldest first */
+    struct nearcache_tqh   probation;    /* probation entries, lru last */
+    struct nearcache_tqh   protect;      /* protected entries, lru last */
+
+    uint8_t                *sketch;      /* count-min rows of (mask + 1) counters */
+    uint32_t               nsketch;      /* # sketch updates since last aging */
+};
+
+rstatus_t nearcache_commands(struct server_pool *pool, struct string *names, uint8_t *cmd, uint32_t *ncmd);
+struct nearcache *nearcache_create(struct server_pool *pool);
+void nearcache_destroy(struct nearcache *nc);
+struct nearcache_entry *nearcache_get(struct nearcache *nc, struct msg *msg);
+rstatus_t nearcache_reply(struct nearcache_entry *e, struct msg *rsp);
+void nearcache_fill(struct nearcache *nc, struct conn *s_conn, struct msg *req, struct msg *rsp);
+void nearcache_abort(struct server_pool *pool, struct msg *msg);
+void nearcache_write(struct nearcache *nc, struct msg *msg);
+void nearcache_tick(struct server_pool *pool);
+void nearcache_servers_update(struct server_pool *pool);
+void nearcache_disconnect(struct server_pool *pool);
+
+rstatus_t nearcache_recv(struct context *ctx, struct conn *conn);
+rstatus_t nearcache_send(struct context *ctx, struct conn *conn);
+void nearcache_close(struct context *ctx, struct conn *conn);
+bool nearcache_active(struct conn *conn);
+void nearcache_ref(struct conn *conn, void *owner);
+void nearcache_unref(struct conn *conn);
+
+#endif
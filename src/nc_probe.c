@@ -0,0 +1,32 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <nc_core.h>
+
+#ifdef NC_HAVE_USDT
+
+/*
+ * Probe semaphores, in the .probes section where tracers look for them;
+ * a tracer raises the semaphore of a probe while attached to it
+ */
+#define DEFINE_ACTION(_name)                                                \
+    volatile unsigned short nutcracker_##_name##_semaphore                  \
+        __attribute__((section(".probes")));
+PROBE_CODEC( DEFINE_ACTION )
+#undef DEFINE_ACTION
+
+#endif
@@ -0,0 +1,114 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _NC_PROBE_H_
+#define _NC_PROBE_H_
+
+/*
+ * USDT static tracepoints of provider nutcracker, for bpftrace, perf or
+ * systemtap; list them with:
+ *
+ *   $ bpftrace -l 'usdt:/path/to/nutcracker:*'
+ *
+ * Every probe has a semaphore that the tracer raises while it is attached.
+ * The probe arguments are only computed when it is raised, so a probe no
+ * one listens to costs a load and a not taken branch. Without <sys/sdt.h>
+ * the probes compile to nothing.
+ *
+ * Request ids are msg ids, connection ids are conn ids; strings are nul
+ * terminated. The arguments of each probe:
+ *
+ *   conn__open       conn id, sd, client?, peer address or server name
+ *   conn__close      conn id, sd, client?, errno, bytes received, bytes sent
+ *   req__recv__done  req id, client conn id, type, command, length
+ *   frag__create     req id, fragment req id, # fragments, type
+ *   req__forward     req id, type, cluster slot or -1, server, sd, length
+ *   req__send__done  req id, type, server, sd, length
+ *   rsp__recv__done  req id, type, server, sd, response length, error?
+ *   rsp__send__done  req id, type, command, response length, client conn id
+ *   coalesce         req id, type, # fragments, response length
+ *   servers__update  pool, # servers
+ *   slots__update    pool
+ */
+#define PROBE_CODEC(ACTION)                 \
+    ACTION( conn__open      )               \
+    ACTION( conn__close     )               \
+    ACTION( req__recv__done )               \
+    ACTION( frag__create    )               \
+    ACTION( req__forward    )               \
+    ACTION( req__send__done )               \
+    ACTION( rsp__recv__done )               \
+    ACTION( rsp__send__done )               \
+    ACTION( coalesce        )               \
+    ACTION( servers__update )               \
+    ACTION( slots__update   )               \
+
+#ifdef NC_HAVE_USDT
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define DEFINE_ACTION(_name) \
+    extern volatile unsigned short nutcracker_##_name##_semaphore;
+PROBE_CODEC( DEFINE_ACTION )
+#undef DEFINE_ACTION
+
+#define NC_PROBE_ENABLED(_name)                                             \
+    (__builtin_expect(nutcracker_##_name##_semaphore != 0, 0))
+
+#define NC_PROBE1(_name, _a1) do {                                          \
+    if (NC_PROBE_ENABLED(_name)) {                                          \
+        DTRACE_PROBE1(nutcracker, _name, _a1);                              \
+    }                                                                       \
+} while (0)
+
+#define NC_PROBE2(_name, _a1, _a2) do {                                     \
+    if (NC_PROBE_ENABLED(_name)) {                                          \
+        DTRACE_PROBE2(nutcracker, _name, _a1, _a2);                         \
+    }                                                                       \
+} while (0)
+
+#define NC_PROBE4(_name, _a1, _a2, _a3, _a4) do {                           \
+    if (NC_PROBE_ENABLED(_name)) {                                          \
+        DTRACE_PROBE4(nutcracker, _name, _a1, _a2, _a3, _a4);               \
+    }                                                                       \
+} while (0)
+
+#define NC_PROBE5(_name, _a1, _a2, _a3, _a4, _a5) do {                      \
+    if (NC_PROBE_ENABLED(_name)) {                                          \
+        DTRACE_PROBE5(nutcracker, _name, _a1, _a2, _a3, _a4, _a5);          \
+    }                                                                       \
+} while (0)
+
+#define NC_PROBE6(_name, _a1, _a2, _a3, _a4, _a5, _a6) do {                 \
+    if (NC_PROBE_ENABLED(_name)) {                                          \
+        DTRACE_PROBE6(nutcracker, _name, _a1, _a2, _a3, _a4, _a5, _a6);     \
+    }                                                                       \
+} while (0)
+
+#else
+
+#define NC_PROBE_ENABLED(_name) 0
+#define NC_PROBE1(_name, _a1)
+#define NC_PROBE2(_name, _a1, _a2)
+#define NC_PROBE4(_name, _a1, _a2, _a3, _a4)
+#define NC_PROBE5(_name, _a1, _a2, _a3, _a4, _a5)
+#define NC_PROBE6(_name, _a1, _a2, _a3, _a4, _a5, _a6)
+
+#endif
+
+#endif
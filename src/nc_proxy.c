@@ -22,6 +22,7 @@
 #include <nc_core.h>
 #include <nc_server.h>
 #include <nc_proxy.h>
+#include <nc_ipwhitelist.h>
 
 void
 proxy_ref(struct conn *conn, void *owner)
@@ -275,7 +276,7 @@ proxy_accept(struct context *ctx, struct conn *p)
     rstatus_t status;
     struct conn *c;
     int sd;
-    struct sockaddr addr;
+    struct sockaddr_storage addr;
     socklen_t len = sizeof(addr);
     struct server_pool *pool = p->owner;
 
@@ -284,7 +285,7 @@ proxy_accept(struct context *ctx, struct conn *p)
     ASSERT(p->recv_active && p->recv_ready);
 
     for (;;) {
-        sd = accept(p->sd, &addr, &len);
+        sd = accept(p->sd, (struct sockaddr *)&addr, &len);
         if (sd < 0) {
             if (errno == EINTR) {
                 log_debug(LOG_VERB, "accept on p %d not ready - eintr", p->sd);
@@ -339,8 +340,9 @@ proxy_accept(struct context *ctx, struct conn *p)
         return NC_OK;
     }
 
-    if (in_whitelist(((struct sockaddr_in*)&addr)->sin_addr) == 0) {
-        log_warn("Unauthorized access from %s", inet_ntoa(((struct sockaddr_in*)&addr)->sin_addr));
+    if (in_whitelist((struct sockaddr *)&addr) == 0) {
+        log_warn("Unauthorized access from %s",
+                 nc_unresolve_addr((struct sockaddr *)&addr, len));
         status = close(sd);
         if (status < 0) {
             log_error("close c %d failed, ignore: %s", sd, strerror(errno));
@@ -360,6 +362,19 @@ proxy_accept(struct context *ctx, struct conn *p)
     }
     c->sd = sd;
 
+    NC_PROBE4(conn__open, c->id, c->sd, 1,
+              nc_unresolve_addr((struct sockaddr *)&addr, len));
+
+    if (pool->ratelimit != NULL) {
+        ratelimit_attach(pool->ratelimit, c, (struct sockaddr *)&addr);
+    }
+
+    /* cache the client address, so slowlog never has to ask the kernel */
+    if (pool->slowlog) {
+        nc_snprintf(c->peer, sizeof(c->peer), "%s",
+                    nc_unresolve_addr((struct sockaddr *)&addr, len));
+    }
+
     stats_pool_incr(ctx, c->owner, client_connections);
 
     status = nc_set_nonblocking(c->sd);
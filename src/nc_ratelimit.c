@@ -0,0 +1,286 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <nc_core.h>
+#include <nc_server.h>
+#include <nc_hashkit.h>
+#include <nc_ratelimit.h>
+
+/* a full bucket, one second of tokens */
+static void
+ratelimit_fill(struct server_pool *pool, struct ratelimit_bucket *b,
+               int64_t now)
+{
+    b->refill = now;
+    b->req_tokens = (int64_t)pool->rate_requests * RATELIMIT_UNIT;
+    b->byte_tokens = (int64_t)pool->rate_bytes * RATELIMIT_UNIT;
+}
+
+struct ratelimit *
+ratelimit_create(struct server_pool *pool)
+{
+    struct ratelimit *rl;
+
+    rl = nc_zalloc(sizeof(*rl));
+    if (rl == NULL) {
+        return NULL;
+    }
+
+    rl->owner = pool;
+    TAILQ_INIT(&rl->paused);
+
+    rl->overflow.family = AF_UNSPEC;
+    ratelimit_fill(pool, &rl->overflow, nc_usec_now());
+
+    return rl;
+}
+
+void
+ratelimit_destroy(struct ratelimit *rl)
+{
+    nc_free(rl);
+}
+
+/* the source of a client address: masked ipv4 address, ipv6 /64 or family */
+static void
+ratelimit_key(struct server_pool *pool, struct sockaddr *addr, uint8_t *key,
+              int *family)
+{
+    struct sockaddr_in *sin;
+    struct sockaddr_in6 *sin6;
+    uint8_t *p;
+    uint32_t i, bits;
+
+    memset(key, 0, RATELIMIT_KEYLEN);
+    *family = addr->sa_family;
+
+    switch (addr->sa_family) {
+    case AF_INET:
+        sin = (struct sockaddr_in *)addr;
+        p = (uint8_t *)&sin->sin_addr;
+        break;
+
+    case AF_INET6:
+        sin6 = (struct sockaddr_in6 *)addr;
+        if (!IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr)) {
+            nc_memcpy(key, sin6->sin6_addr.s6_addr, 8);
+            return;
+        }
+        *family = AF_INET;
+        p = &sin6->sin6_addr.s6_addr[12];
+        break;
+
+    default:
+        /* unix socket clients are one source */
+        return;
+    }
+
+    for (i = 0, bits = pool->rate_prefix; i < 4 && bits > 0; i++) {
+        if (bits >= 8) {
+            key[i] = p[i];
+            bits -= 8;
+        } else {
+            key[i] = p[i] & (uint8_t)(0xff << (8 - bits));
+            bits = 0;
+        }
+    }
+}
+
+/* share the bucket of the source of addr with client connection conn */
+void
+ratelimit_attach(struct ratelimit *rl, struct conn *conn, struct sockaddr *addr)
+{
+    struct server_pool *pool = rl->owner;
+    struct ratelimit_bucket *b, *unused;
+    uint8_t key[RATELIMIT_KEYLEN];
+    uint32_t hash, i;
+    int family;
+
+    ASSERT(conn->client && !conn->proxy);
+    ASSERT(conn->rate == NULL);
+
+    ratelimit_key(pool, addr, key, &family);
+    hash = hash_fnv1a_32((char *)key, RATELIMIT_KEYLEN) ^ (uint32_t)family;
+
+    unused = NULL;
+    for (i = 0; i < RATELIMIT_NPROBE; i++) {
+        b = &rl->bucket[(hash + i) & (RATELIMIT_NBUCKET - 1)];
+
+        /* a source that reconnects finds its tokens as it left them */
+        if (b->family == family &&
+            memcmp(b->key, key, RATELIMIT_KEYLEN) == 0) {
+            break;
+        }
+
+        if (unused == NULL && b->nconn == 0) {
+            unused = b;
+        }
+    }
+
+    if (i == RATELIMIT_NPROBE) {
+        if (unused != NULL) {
+            b = unused;
+            nc_memcpy(b->key, key, RATELIMIT_KEYLEN);
+            b->family = family;
+            ratelimit_fill(pool, b, nc_loop_usec());
+        } else {
+            log_debug(LOG_INFO, "c %d from a source without bucket, shares "
+                      "the overflow bucket", conn->sd);
+            b = &rl->overflow;
+        }
+    }
+
+    b->nconn++;
+    conn->rate = b;
+}
+
+static void
+ratelimit_resume(struct context *ctx, struct server_pool *pool,
+                 struct conn *conn)
+{
+    ASSERT(conn->rate_paused);
+
+    TAILQ_REMOVE(&pool->ratelimit->paused, conn, rate_tqe);
+    conn->rate_paused = 0;
+    stats_pool_decr(ctx, pool, throttled_clients);
+}
+
+void
+ratelimit_detach(struct context *ctx, struct conn *conn)
+{
+    struct server_pool *pool = conn->owner;
+
+    if (conn->rate == NULL) {
+        return;
+    }
+
+    if (conn->rate_paused) {
+        ratelimit_resume(ctx, pool, conn);
+    }
+
+    ASSERT(conn->rate->nconn > 0);
+    conn->rate->nconn--;
+    conn->rate = NULL;
+}
+
+static void
+ratelimit_refill(struct server_pool *pool, struct ratelimit_bucket *b,
+                 int64_t now)
+{
+    int64_t elapsed;
+
+    elapsed = now - b->refill;
+    if (elapsed <= 0) {
+        return;
+    }
+    b->refill = now;
+
+    /* a usec earns rate / RATELIMIT_UNIT tokens, up to a second of them */
+    elapsed = MIN(elapsed, RATELIMIT_UNIT);
+    b->req_tokens = MIN(b->req_tokens + elapsed * pool->rate_requests,
+                        (int64_t)pool->rate_requests * RATELIMIT_UNIT);
+    b->byte_tokens = MIN(b->byte_tokens + elapsed * pool->rate_bytes,
+                         (int64_t)pool->rate_bytes * RATELIMIT_UNIT);
+}
+
+static bool
+ratelimit_empty(struct server_pool *pool, struct ratelimit_bucket *b)
+{
+    return (pool->rate_requests != 0 && b->req_tokens < 0) ||
+           (pool->rate_bytes != 0 && b->byte_tokens < 0);
+}
+
+/*
+ * Take the tokens of request msg received on client connection conn.
+ * Return false if the request must be rejected; a request over the limit
+ * that is not rejected pauses reads on conn instead.
+ */
+bool
+ratelimit_admit(struct context *ctx, struct conn *conn, struct msg *msg)
+{
+    struct server_pool *pool = conn->owner;
+    struct ratelimit_bucket *b = conn->rate;
+
+    ASSERT(conn->client && !conn->proxy);
+
+    if (b == NULL) {
+        return true;
+    }
+
+    ratelimit_refill(pool, b, nc_loop_usec());
+
+    if (pool->rate_reject && ratelimit_empty(pool, b)) {
+        stats_pool_incr(ctx, pool, throttled_requests);
+
+        log_debug(LOG_VERB, "reject req %"PRIu64" from c %d over the rate "
+                  "limit", msg->id, conn->sd);
+
+        return false;
+    }
+
+    b->req_tokens -= RATELIMIT_UNIT;
+    b->byte_tokens -= (int64_t)msg->mlen * RATELIMIT_UNIT;
+
+    if (pool->rate_reject || !ratelimit_empty(pool, b)) {
+        return true;
+    }
+
+    stats_pool_incr(ctx, pool, throttled_requests);
+
+    if (!conn->rate_paused) {
+        log_debug(LOG_VERB, "pause c %d over the rate limit after req "
+                  "%"PRIu64"", conn->sd, msg->id);
+
+        conn->rate_paused = 1;
+        TAILQ_INSERT_TAIL(&pool->ratelimit->paused, conn, rate_tqe);
+        stats_pool_incr(ctx, pool, throttled_clients);
+    }
+
+    return true;
+}
+
+/* read again from the paused client connections whose bucket refilled */
+void
+ratelimit_tick(struct server_pool *pool)
+{
+    struct context *ctx = pool->ctx;
+    struct ratelimit *rl = pool->ratelimit;
+    struct conn *conn, *nconn;
+    int64_t now;
+
+    if (rl == NULL) {
+        return;
+    }
+
+    now = nc_loop_usec();
+
+    for (conn = TAILQ_FIRST(&rl->paused); conn != NULL; conn = nconn) {
+        nconn = TAILQ_NEXT(conn, rate_tqe);
+
+        ratelimit_refill(pool, conn->rate, now);
+        if (ratelimit_empty(pool, conn->rate)) {
+            continue;
+        }
+
+        log_debug(LOG_VERB, "resume c %d under the rate limit", conn->sd);
+
+        ratelimit_resume(ctx, pool, conn);
+
+        /* edge triggered, the pending data gets no new event */
+        (void)core_core(conn, EVENT_READ);
+    }
+}
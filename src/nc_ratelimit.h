@@ -0,0 +1,71 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _NC_RATELIMIT_H_
+#define _NC_RATELIMIT_H_
+
+#include <nc_core.h>
+
+/*
+ * Token bucket rate limit of the requests a redis pool receives from each
+ * client source, in requests (rate_limit_requests) and request bytes
+ * (rate_limit_bytes) per second. A source is the client address masked to
+ * rate_limit_prefix bits for ipv4, or to its /64 for ipv6; all the
+ * connections of a source share one bucket, found when the connection is
+ * accepted and not per request. A bucket holds at most one second of
+ * tokens.
+ *
+ * Buckets live in a table of RATELIMIT_NBUCKET entries allocated with the
+ * pool, probed open addressing style at most RATELIMIT_NPROBE times; a
+ * bucket without connections is taken over by a new source, and sources
+ * that find no bucket at all share an overflow one. So the limiter never
+ * allocates, however many client connections there are.
+ *
+ * A request received when its bucket is empty is, with rate_limit_reject,
+ * answered with an error. Otherwise the request is forwarded, its tokens
+ * taken on credit, and the client connection stops reading until the
+ * bucket refills, which the pool tick checks.
+ */
+#define RATELIMIT_NBUCKET   65536           /* # buckets, power of 2 */
+#define RATELIMIT_NPROBE    8               /* # buckets probed for a source */
+#define RATELIMIT_KEYLEN    8               /* masked address bytes in key */
+#define RATELIMIT_UNIT      1000000LL       /* tokens per request or byte */
+
+struct ratelimit_bucket {
+    uint8_t  key[RATELIMIT_KEYLEN];         /* masked source address */
+    int      family;                        /* source address family */
+    uint32_t nconn;                         /* # client connections */
+    int64_t  refill;                        /* last refill in usec */
+    int64_t  req_tokens;                    /* request tokens, in 1/RATELIMIT_UNIT */
+    int64_t  byte_tokens;                   /* byte tokens, in 1/RATELIMIT_UNIT */
+};
+
+struct ratelimit {
+    struct server_pool      *owner;         /* owner pool */
+    struct conn_tqh         paused;         /* client connections paused */
+    struct ratelimit_bucket overflow;       /* bucket of sources not in table */
+    struct ratelimit_bucket bucket[RATELIMIT_NBUCKET]; /* buckets by source */
+};
+
+struct ratelimit *ratelimit_create(struct server_pool *pool);
+void ratelimit_destroy(struct ratelimit *rl);
+void ratelimit_attach(struct ratelimit *rl, struct conn *conn, struct sockaddr *addr);
+void ratelimit_detach(struct context *ctx, struct conn *conn);
+bool ratelimit_admit(struct context *ctx, struct conn *conn, struct msg *msg);
+void ratelimit_tick(struct server_pool *pool);
+
+#endif
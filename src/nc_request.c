@@ -115,6 +115,24 @@ req_put(struct msg *msg)
 
     msg_tmo_delete(msg);
 
+    if (msg->sf != NULL) {
+        singleflight_done(msg, NULL, msg->err);
+    }
+
+    if (msg->nbatch != 0) {
+        batch_fail(msg);
+    }
+
+    if (msg->nearcache) {
+        /* swallowed requests dropped their entry in client_close */
+        ASSERT(!msg->swallow);
+        nearcache_abort(msg->owner->owner, msg);
+    }
+
+    hedge_put(msg);
+
+    limit_release(msg, msg->error);
+
     msg_put(msg);
 }
 
@@ -450,6 +468,11 @@ req_recv_next(struct context *ctx, struct conn *conn, bool alloc)
         return NULL;
     }
 
+    /* over the rate limit, leave the rest in the socket until refilled */
+    if (alloc && conn->rate_paused) {
+        return NULL;
+    }
+
     msg = conn->rmsg;
     if (msg != NULL) {
         ASSERT(msg->request);
@@ -488,6 +511,35 @@ req_make_reply(struct context *ctx, struct conn *conn, struct msg *req)
     return NC_OK;
 }
 
+/* answer a request from the near cache, in order with the forwarded ones */
+static void
+req_nearcache_reply(struct context *ctx, struct conn *conn, struct msg *msg,
+                    struct nearcache_entry *e)
+{
+    rstatus_t status;
+    struct server_pool *pool = conn->owner;
+
+    stats_cmd_incr(ctx, pool, msg->type, requests);
+    stats_cmd_incr_by(ctx, pool, msg->type, request_bytes, msg->mlen);
+
+    status = req_make_reply(ctx, conn, msg);
+    if (status != NC_OK) {
+        conn->err = errno;
+        return;
+    }
+
+    status = nearcache_reply(e, msg->peer);
+    if (status != NC_OK) {
+        conn->err = errno;
+        return;
+    }
+
+    status = event_add_out(ctx->evb, conn);
+    if (status != NC_OK) {
+        conn->err = errno;
+    }
+}
+
 static bool
 req_filter(struct context *ctx, struct conn *conn, struct msg *msg)
 {
@@ -586,6 +638,18 @@ req_enqueue(struct context *ctx, struct conn *s_conn, struct conn *c_conn, struc
 {
     rstatus_t status;
 
+    if (c_conn != NULL && !msg->swallow) {
+        status = limit_admit(ctx, s_conn, msg);
+        if (status == NC_EAGAIN) {
+            /* waits for an in-flight slot of the server */
+            return NC_OK;
+        }
+        if (status != NC_OK) {
+            req_forward_error(ctx, c_conn, msg);
+            return status;
+        }
+    }
+
     /* enqueue the message (request) into server inq */
     if (TAILQ_EMPTY(&s_conn->imsg_q)) {
         status = event_add_out(ctx->evb, s_conn);
@@ -633,23 +697,49 @@ req_forward(struct context *ctx, struct conn *c_conn, struct msg *msg)
 
     pool = c_conn->owner;
 
+    stats_cmd_incr(ctx, pool, msg->type, requests);
+    stats_cmd_incr_by(ctx, pool, msg->type, request_bytes, msg->mlen);
+
     ASSERT(array_n(msg->keys) > 0);
     kpos = array_get(msg->keys, 0);
     key = kpos->start;
     keylen = (uint32_t)(kpos->end - kpos->start);
 
+    if (pool->hotkey != NULL) {
+        hotkey_update(pool->hotkey, key, keylen);
+    }
+
+    /* slow commands take the server connections of the slow lane */
+    msg->lane = pool->slow_cmd[msg->type] ? SERVER_LANE_SLOW :
+                SERVER_LANE_FAST;
+
     s_conn = msg->routing(ctx, pool, msg, key, keylen);
     if (s_conn == NULL) {
         req_forward_error(ctx, c_conn, msg);
         return;
     }
     ASSERT(!s_conn->client && !s_conn->proxy);
+    msg_phase_mark(msg, MSG_PHASE_ROUTED);
+
+    if (pool->nearcache != NULL) {
+        nearcache_write(pool->nearcache, msg);
+    }
 
     status = req_enqueue(ctx, s_conn, c_conn, msg);
     if (status != NC_OK) {
-        req_put(msg);
+        /* failed by req_enqueue */
         return;
     }
+    msg_phase_mark(msg, MSG_PHASE_ENQUEUED);
+
+    if (pool->singleflight != NULL) {
+        singleflight_write(pool->singleflight, msg);
+        singleflight_lead(pool->singleflight, msg);
+    }
+
+    NC_PROBE6(req__forward, msg->id, msg->type, (int)msg->slot - 1,
+              ((struct server *)s_conn->owner)->pname.data, s_conn->sd,
+              msg->mlen);
 
     req_forward_stats(ctx, s_conn->owner, msg);
 
@@ -667,6 +757,8 @@ req_recv_done(struct context *ctx, struct conn *conn, struct msg *msg,
     struct msg_tqh frag_msgq;
     struct msg *sub_msg;
     struct msg *tmsg; 			/* tmp next message */
+    struct server_pool *pool;
+    int timeout;
 
     ASSERT(conn->client && !conn->proxy);
     ASSERT(msg->request);
@@ -681,6 +773,37 @@ req_recv_done(struct context *ctx, struct conn *conn, struct msg *msg,
         return;
     }
 
+    if (stats_enabled) {
+        msg->recv_ts = nc_usec_now();
+    }
+
+    pool = conn->owner;
+    if (stats_enabled || pool->trace_sample_rate != 0) {
+        msg->phase_start = nc_loop_usec();
+    }
+
+    timeout = conn->deadline != 0 ? (int)conn->deadline : pool->timeout;
+    if (timeout > 0) {
+        msg->deadline = nc_loop_usec() + (int64_t)timeout * 1000LL;
+    }
+
+    if (pool->ratelimit != NULL && !ratelimit_admit(ctx, conn, msg)) {
+        if (!msg->noreply) {
+            conn->enqueue_outq(ctx, conn, msg);
+        }
+        errno = EDQUOT;
+        req_forward_error(ctx, conn, msg);
+        return;
+    }
+
+    if (pool->capture_sample_rate != 0 && --pool->capture_countdown == 0) {
+        pool->capture_countdown = pool->capture_sample_rate;
+        capture_request(pool, conn, msg);
+    }
+
+    NC_PROBE5(req__recv__done, msg->id, conn->id, msg->type,
+              msg_type_string(msg->type)->data, msg->mlen);
+
     if (msg->noforward) {
         status = req_make_reply(ctx, conn, msg);
         if (status != NC_OK) {
@@ -702,6 +825,20 @@ req_recv_done(struct context *ctx, struct conn *conn, struct msg *msg,
         return;
     }
 
+    if (pool->nearcache != NULL) {
+        struct nearcache_entry *e = nearcache_get(pool->nearcache, msg);
+
+        if (e != NULL) {
+            req_nearcache_reply(ctx, conn, msg, e);
+            return;
+        }
+    }
+
+    if (pool->singleflight != NULL &&
+        singleflight_join(ctx, pool->singleflight, conn, msg)) {
+        return;
+    }
+
     /* do fragment */
     TAILQ_INIT(&frag_msgq);
     status = msg->fragment(msg, REDIS_CLUSTER_SLOTS, &frag_msgq);
@@ -730,6 +867,10 @@ req_recv_done(struct context *ctx, struct conn *conn, struct msg *msg,
         tmsg = TAILQ_NEXT(sub_msg, m_tqe);
 
         TAILQ_REMOVE(&frag_msgq, sub_msg, m_tqe);
+        sub_msg->recv_ts = msg->recv_ts;
+        sub_msg->phase_start = msg->phase_start;
+        sub_msg->deadline = msg->deadline;
+        NC_PROBE4(frag__create, msg->id, sub_msg->id, msg->nfrag, msg->type);
         req_forward(ctx, conn, sub_msg);
     }
 
@@ -737,6 +878,56 @@ req_recv_done(struct context *ctx, struct conn *conn, struct msg *msg,
     return;
 }
 
+/*
+ * Fail request msg, past its deadline before it could be sent on server
+ * connection conn, with a timeout
+ */
+static void
+req_expire(struct context *ctx, struct conn *conn, struct msg *msg)
+{
+    struct conn *c_conn;
+    rstatus_t status;
+
+    ASSERT(!conn->client && !conn->proxy);
+    ASSERT(msg->request && !msg->done);
+
+    conn->dequeue_inq(ctx, conn, msg);
+    msg_tmo_delete(msg);
+    limit_release(msg, true);
+
+    stats_server_incr(ctx, conn->owner, expired_requests);
+
+    log_debug(LOG_INFO, "expire req %"PRIu64" len %"PRIu32" type %d on s %d, "
+              "%"PRId64" usec past its deadline", msg->id, msg->mlen,
+              msg->type, conn->sd, nc_loop_usec() - msg->deadline);
+
+    /* client went away */
+    if (msg->swallow || msg->noreply) {
+        req_put(msg);
+        return;
+    }
+
+    msg->done = 1;
+    msg->error = 1;
+    msg->err = ETIMEDOUT;
+
+    if (msg->sf != NULL) {
+        singleflight_done(msg, NULL, ETIMEDOUT);
+    }
+
+    if (msg->frag_owner != NULL) {
+        msg->frag_owner->nfrag_done++;
+    }
+
+    c_conn = msg->owner;
+    if (req_done(c_conn, TAILQ_FIRST(&c_conn->omsg_q))) {
+        status = event_add_out(ctx->evb, c_conn);
+        if (status != NC_OK) {
+            c_conn->err = errno;
+        }
+    }
+}
+
 struct msg *
 req_send_next(struct context *ctx, struct conn *conn)
 {
@@ -766,6 +957,39 @@ req_send_next(struct context *ctx, struct conn *conn)
         nmsg = TAILQ_NEXT(msg, s_tqe);
     }
 
+    /* drop requests that waited past their deadline, rather than send them */
+    while (nmsg != NULL && nmsg->deadline != 0 &&
+           nmsg->deadline <= nc_loop_usec()) {
+        msg = nmsg;
+        nmsg = TAILQ_NEXT(msg, s_tqe);
+        req_expire(ctx, conn, msg);
+    }
+
+    if (TAILQ_EMPTY(&conn->imsg_q)) {
+        /* all of them were dropped */
+        status = event_del_out(ctx->evb, conn);
+        if (status != NC_OK) {
+            conn->err = errno;
+        }
+
+        return NULL;
+    }
+
+    if (nmsg != NULL && batch_hold(conn, nmsg)) {
+        /* batch_rsp turns sends back on */
+        if (nmsg == TAILQ_FIRST(&conn->imsg_q)) {
+            status = event_del_out(ctx->evb, conn);
+            if (status != NC_OK) {
+                conn->err = errno;
+            }
+        }
+        nmsg = NULL;
+    }
+
+    if (nmsg != NULL) {
+        nmsg = batch_next(ctx, conn, nmsg);
+    }
+
     conn->smsg = nmsg;
 
     if (nmsg == NULL) {
@@ -801,15 +1025,24 @@ req_send_done(struct context *ctx, struct conn *conn, struct msg *msg)
     ASSERT(server!=NULL);
     sp = server->owner;
     ASSERT(sp!=NULL);
+
+    NC_PROBE5(req__send__done, msg->id, msg->type, server->pname.data,
+              conn->sd, msg->mlen);
+
     if (sp->slowlog) {
-        int64_t now = nc_msec_now();
+        int64_t now = nc_usec_now();
         if (now < 0) {
             log_debug(LOG_WARN, "slowlog access start time failed!");
             now = 0;
         }
         msg->slowlog_stime = now;
     }
-    
+
+    if (stats_enabled) {
+        msg->send_ts = nc_usec_now();
+    }
+    msg_phase_mark(msg, MSG_PHASE_SENT);
+
     /*
      * noreply request instructs the server not to send any response. So,
      * enqueue message (request) in server outq, if response is expected.
@@ -817,6 +1050,7 @@ req_send_done(struct context *ctx, struct conn *conn, struct msg *msg)
      */
     if (!msg->noreply) {
         conn->enqueue_outq(ctx, conn, msg);
+        hedge_arm(conn, msg);
     } else {
         req_put(msg);
     }
@@ -200,6 +200,12 @@ rsp_filter(struct context *ctx, struct conn *conn, struct msg *msg)
                   "%"PRIu64" on s %d", msg->id, msg->mlen, pmsg->id,
                   conn->sd);
 
+        if (pmsg->sf != NULL) {
+            singleflight_done(pmsg, msg, 0);
+        }
+
+        health_rsp(conn, pmsg, msg);
+
         rsp_put(msg);
         req_put(pmsg);
         return true;
@@ -211,23 +217,132 @@ rsp_filter(struct context *ctx, struct conn *conn, struct msg *msg)
 static void
 rsp_forward_stats(struct context *ctx, struct server *server, struct msg *msg, uint32_t msgsize)
 {
+    struct msg *pmsg;
+
     ASSERT(!msg->request);
 
+    pmsg = msg->peer;
+
     stats_server_incr(ctx, server, responses);
     stats_server_incr_by(ctx, server, response_bytes, msgsize);
+
+    stats_cmd_incr_by(ctx, server->owner, pmsg->type, response_bytes, msgsize);
+
+    switch (msg->type) {
+    case MSG_RSP_MC_ERROR:
+    case MSG_RSP_MC_CLIENT_ERROR:
+    case MSG_RSP_MC_SERVER_ERROR:
+    case MSG_RSP_REDIS_ERROR:
+        stats_cmd_incr(ctx, server->owner, pmsg->type, errors);
+        break;
+
+    default:
+        break;
+    }
+}
+
+static stats_pool_histo_field_t
+rsp_latency_class(struct msg *pmsg)
+{
+    if (pmsg->frag_id != 0) {
+        return STATS_POOL_HISTO_latency_multikey;
+    }
+
+    switch (pmsg->type) {
+    case MSG_REQ_MC_GET:
+    case MSG_REQ_MC_GETS:
+        return STATS_POOL_HISTO_latency_read;
+
+    case MSG_REQ_REDIS_EVAL:
+    case MSG_REQ_REDIS_EVALSHA:
+        return STATS_POOL_HISTO_latency_script;
+
+    default:
+        break;
+    }
+
+    if (pmsg->type > MSG_RSP_MC_SERVER_ERROR &&
+        pmsg->type < MSG_REQ_REDIS_WRITECMD_START) {
+        return STATS_POOL_HISTO_latency_read;
+    }
+
+    return STATS_POOL_HISTO_latency_write;
+}
+
+static stats_pool_histo_field_t
+rsp_size_class(struct msg *pmsg)
+{
+    switch (rsp_latency_class(pmsg)) {
+    case STATS_POOL_HISTO_latency_read:
+        return STATS_POOL_HISTO_rsp_size_read;
+
+    case STATS_POOL_HISTO_latency_multikey:
+        return STATS_POOL_HISTO_rsp_size_multikey;
+
+    case STATS_POOL_HISTO_latency_script:
+        return STATS_POOL_HISTO_rsp_size_script;
+
+    default:
+        return STATS_POOL_HISTO_rsp_size_write;
+    }
+}
+
+static void
+rsp_forward_size(struct context *ctx, struct server *server, struct msg *pmsg,
+                 uint32_t msgsize)
+{
+    struct server_pool *pool;
+
+    if (!stats_enabled) {
+        return;
+    }
+
+    pool = server->owner;
+
+    _stats_pool_record(ctx, pool, rsp_size_class(pmsg), msgsize);
+
+    if (pool->bigkey_threshold != 0 && msgsize >= pool->bigkey_threshold) {
+        stats_pool_bigkey(ctx, server, pmsg, msgsize);
+    }
+}
+
+static void
+rsp_forward_latency(struct context *ctx, struct server *server, struct msg *pmsg)
+{
+    struct server_pool *pool;
+    int64_t now, elapsed;
+
+    ASSERT(pmsg->request);
+
+    if (!stats_enabled || pmsg->recv_ts == 0) {
+        return;
+    }
+
+    pool = server->owner;
+    now = nc_usec_now();
+    elapsed = now - pmsg->recv_ts;
+
+    stats_pool_record(ctx, pool, latency, elapsed);
+    _stats_pool_record(ctx, pool, rsp_latency_class(pmsg), elapsed);
+
+    if (pool->slow_lane) {
+        if (pmsg->lane == SERVER_LANE_SLOW) {
+            stats_pool_record(ctx, pool, latency_slow_lane, elapsed);
+        } else {
+            stats_pool_record(ctx, pool, latency_fast_lane, elapsed);
+        }
+    }
+    stats_cmd_record(ctx, pool, pmsg->type, elapsed);
+
+    if (pmsg->send_ts != 0) {
+        stats_server_record(ctx, server, server_latency, now - pmsg->send_ts);
+    }
 }
 
 static void
 rsp_forward(struct context *ctx, struct conn *s_conn, struct msg *msg)
 {
-    rstatus_t status;
     struct msg *pmsg;
-    struct conn *c_conn;
-    uint32_t msgsize;
-    struct server_pool *sp;
-    struct server *server;
-
-    msgsize = msg->mlen;
 
     /* response from server implies that server is ok and heartbeating */
     server_ok(ctx, s_conn);
@@ -239,6 +354,17 @@ rsp_forward(struct context *ctx, struct conn *s_conn, struct msg *msg)
 
     s_conn->dequeue_outq(ctx, s_conn, pmsg);
 
+    /* the first response of a hedged read wins */
+    if (hedge_rsp(ctx, s_conn, pmsg, msg)) {
+        return;
+    }
+
+    /* a batch answers for the requests it carries */
+    if (pmsg->nbatch != 0) {
+        batch_rsp(ctx, s_conn, pmsg, msg);
+        return;
+    }
+
     /* establish msg <-> pmsg (response <-> request) link */
     pmsg->peer = msg;
     msg->peer = pmsg;
@@ -248,14 +374,60 @@ rsp_forward(struct context *ctx, struct conn *s_conn, struct msg *msg)
         return;
     }
 
+    rsp_complete(ctx, s_conn, pmsg, msg);
+}
+
+/*
+ * Complete request pmsg with its response msg, received on server
+ * connection s_conn, and schedule the response out to the client
+ */
+void
+rsp_complete(struct context *ctx, struct conn *s_conn, struct msg *pmsg,
+             struct msg *msg)
+{
+    rstatus_t status;
+    struct conn *c_conn;
+    uint32_t msgsize;
+    struct server_pool *sp;
+    struct server *server;
+
+    msgsize = msg->mlen;
+
+    pmsg->peer = msg;
+    msg->peer = pmsg;
+
     pmsg->done = 1;
 
+    msg_phase_set(pmsg, MSG_PHASE_RSP_FIRST, msg->phase_start);
+    msg_phase_mark(pmsg, MSG_PHASE_RSP_DONE);
+
     server = s_conn->owner;
     ASSERT(server!=NULL);
     sp = server->owner;
     ASSERT(sp!=NULL);
+
+    NC_PROBE6(rsp__recv__done, pmsg->id, pmsg->type, server->pname.data,
+              s_conn->sd, msgsize, msg->error);
+
+    rsp_forward_latency(ctx, server, pmsg);
+    rsp_forward_size(ctx, server, pmsg, msgsize);
+    server_pool_slot_response(sp, pmsg, msgsize);
+    limit_done(ctx, pmsg);
+
+    if (pmsg->nearcache && sp->nearcache != NULL) {
+        nearcache_fill(sp->nearcache, s_conn, pmsg, msg);
+    }
+
+    if (pmsg->sf != NULL) {
+        singleflight_done(pmsg, msg, 0);
+    }
+
+    if (pmsg->retried && msg->type != MSG_RSP_REDIS_ERROR) {
+        stats_pool_incr(ctx, sp, retries_recovered);
+    }
+
     if (sp->slowlog) {
-        int64_t now = nc_msec_now();
+        int64_t now = nc_usec_now();
         if (now < 0) {
             log_debug(LOG_WARN, "slowlog access end time failed!");
             now = 0;
@@ -347,6 +519,7 @@ rsp_send_next(struct context *ctx, struct conn *conn)
         msg->peer = pmsg;
         pmsg->peer = msg;
         stats_pool_incr(ctx, conn->owner, forward_error);
+        stats_cmd_incr(ctx, conn->owner, pmsg->type, errors);
     } else {
         msg = pmsg->peer;
     }
@@ -359,6 +532,56 @@ rsp_send_next(struct context *ctx, struct conn *conn)
     return msg;
 }
 
+/*
+ * Split the time of a forwarded request into the phases it went through:
+ * route (client side, until a server connection was picked), queue (in the
+ * server inq, including connect), server (on the wire and in the backend),
+ * read (receiving the response) and reply (waiting for sibling fragments
+ * and earlier responses, and writing to the client). One in every
+ * trace_sample_rate requests is also written to the log as a trace record.
+ */
+static void
+rsp_phase_record(struct context *ctx, struct server_pool *pool, struct msg *pmsg)
+{
+    int64_t ph[MSG_PHASE_SENTINEL];
+    uint32_t i;
+
+    if (pmsg->phase_mask != MSG_PHASE_ALL) {
+        return;
+    }
+
+    for (i = 0; i < MSG_PHASE_SENTINEL; i++) {
+        ph[i] = (int64_t)pmsg->phase[i];
+    }
+
+    if (stats_enabled) {
+        stats_pool_record(ctx, pool, phase_route, ph[MSG_PHASE_ROUTED]);
+        stats_pool_record(ctx, pool, phase_queue,
+                          ph[MSG_PHASE_SENT] - ph[MSG_PHASE_ROUTED]);
+        stats_pool_record(ctx, pool, phase_server,
+                          ph[MSG_PHASE_RSP_FIRST] - ph[MSG_PHASE_SENT]);
+        stats_pool_record(ctx, pool, phase_read,
+                          ph[MSG_PHASE_RSP_DONE] - ph[MSG_PHASE_RSP_FIRST]);
+        stats_pool_record(ctx, pool, phase_reply,
+                          ph[MSG_PHASE_REPLIED] - ph[MSG_PHASE_RSP_DONE]);
+    }
+
+    if (pool->trace_sample_rate == 0 || --pool->trace_countdown != 0) {
+        return;
+    }
+    pool->trace_countdown = pool->trace_sample_rate;
+
+    loga("trace pool=%.*s req=%"PRIu64" frag=%"PRIu64" type=%s "
+         "req_len=%"PRIu32" rsp_len=%"PRIu32" start=%"PRId64" "
+         "routed=%"PRId64" enqueued=%"PRId64" sent=%"PRId64" "
+         "rsp_first=%"PRId64" rsp_done=%"PRId64" replied=%"PRId64"",
+         pool->name.len, pool->name.data, pmsg->id, pmsg->frag_id,
+         msg_type_string(pmsg->type)->data, pmsg->mlen, pmsg->peer->mlen,
+         pmsg->phase_start, ph[MSG_PHASE_ROUTED], ph[MSG_PHASE_ENQUEUED],
+         ph[MSG_PHASE_SENT], ph[MSG_PHASE_RSP_FIRST],
+         ph[MSG_PHASE_RSP_DONE], ph[MSG_PHASE_REPLIED]);
+}
+
 void
 rsp_send_done(struct context *ctx, struct conn *conn, struct msg *msg)
 {
@@ -376,6 +599,12 @@ rsp_send_done(struct context *ctx, struct conn *conn, struct msg *msg)
     ASSERT(pmsg->peer == msg);
     ASSERT(pmsg->done && !pmsg->swallow);
 
+    msg_phase_mark(pmsg, MSG_PHASE_REPLIED);
+    rsp_phase_record(ctx, conn->owner, pmsg);
+
+    NC_PROBE5(rsp__send__done, pmsg->id, pmsg->type,
+              msg_type_string(pmsg->type)->data, msg->mlen, conn->id);
+
     /* dequeue request from client outq */
     conn->dequeue_outq(ctx, conn, pmsg);
 
@@ -389,29 +618,19 @@ check_out_slowlog(struct context *ctx, struct server_pool *sp, struct msg *msg)
 
     // max_cost_time 10min
     struct msg *pmsg; /* peer message (response) */
-    struct conn *c_conn;
     struct conn *s_conn;
     struct server *server;
-    int64_t cost_time;
-    int client_fd;
-    int server_fd;
-    char *c_host;
-    char *s_host;
-    static char client_host[NI_MAXHOST + NI_MAXSERV];
-    static char server_host[NI_MAXHOST + NI_MAXSERV];
-    struct string *req_type;
-    uint32_t req_len, rsp_len; 
-    struct keypos *kpos;
+    int64_t cost_usec, cost_time;
 
     ASSERT(sp->slowlog);
-    cost_time = msg->slowlog_etime - msg->slowlog_stime;
+    cost_usec = msg->slowlog_etime - msg->slowlog_stime;
+    cost_time = cost_usec / 1000;
 
     pmsg = msg->peer;
 
     ASSERT(msg->done == 1);
     ASSERT(msg->request && !pmsg->request);
 
-    c_conn = msg->owner;
     s_conn = pmsg->owner;
     if (s_conn) {
         server = s_conn->owner;
@@ -456,28 +675,11 @@ check_out_slowlog(struct context *ctx, struct server_pool *sp, struct msg *msg)
         }
     }
 
-    if (cost_time < sp-> slowlog_slower_than) {
+    if (cost_time < sp->slowlog_slower_than) {
         return;
     }
 
-    client_fd = c_conn == NULL ? 0 : c_conn->sd;
-    server_fd = s_conn == NULL ? 0 : s_conn->sd;
-
-    c_host = nc_unresolve_peer_desc(client_fd);
-    memcpy(client_host, c_host, NI_MAXHOST + NI_MAXSERV);
-    s_host = nc_unresolve_peer_desc(server_fd);
-    memcpy(server_host, s_host, NI_MAXHOST + NI_MAXSERV);
-
-    req_type = msg_type_string(msg->type);
-    req_len = msg->mlen;
-    rsp_len = pmsg->mlen;
-    kpos = array_get(msg->keys, 0);
-    if (kpos->end != NULL) {
-        *(kpos->end) = '\0';
-    }
-    log_slow("request_msg_id=%"PRIu64", client_address=%s, server_address=%s, cost_time=%"PRIu64"ms, fragment_id=%"PRIu64", request_type=%s, request_len=%"PRIu32", response_len=%"PRIu32", key='%s'",
-        msg->id, client_host, server_host, cost_time ,msg->frag_id, req_type->data, req_len, rsp_len, kpos->start);  
-
+    slowlog_record(sp, msg, cost_usec);
 }
 
 
@@ -161,6 +161,16 @@ ffi_server_new(struct server_pool *pool, char *name, char *id, char *ip, int por
     s->auto_ban_flag = false;
     s->lift_ban_time = 0LL;
 
+    s->tracker = NULL;
+
+    s->health_ts = 0LL;
+    s->health_id = 0;
+    s->health_rtt = 0LL;
+    s->health_failures = 0;
+    s->health_demoted = 0;
+
+    server_lane_init(s, pool);
+
     s->local_idc = 1;
 
     string_deinit(&address);
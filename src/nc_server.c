@@ -37,6 +37,7 @@ server_ref(struct conn *conn, void *owner)
     conn->addr = server->addr;
 
     server->ns_conn_q++;
+    server->lane[conn->lane].nconn++;
     TAILQ_INSERT_TAIL(&server->s_conn_q, conn, conn_tqe);
 
     conn->owner = owner;
@@ -58,6 +59,8 @@ server_unref(struct conn *conn)
 
     ASSERT(server->ns_conn_q != 0);
     server->ns_conn_q--;
+    ASSERT(server->lane[conn->lane].nconn != 0);
+    server->lane[conn->lane].nconn--;
     TAILQ_REMOVE(&server->s_conn_q, conn, conn_tqe);
 
     log_debug(LOG_VVERB, "unref conn %p owner %p from '%.*s'", conn, server,
@@ -115,6 +118,8 @@ server_each_set_owner(void *elem, void *data)
     struct server_pool *sp = data;
 
     s->owner = sp;
+    s->lane[SERVER_LANE_FAST].limit = sp->limit_max;
+    s->lane[SERVER_LANE_SLOW].limit = sp->slow_lane_limit;
 
     return NC_OK;
 }
@@ -177,30 +182,78 @@ server_deinit(struct array *server)
     array_deinit(server);
 }
 
+/* the lanes of server, with the in-flight limits of pool or none */
+void
+server_lane_init(struct server *server, struct server_pool *pool)
+{
+    struct server_lane *lane;
+    uint32_t i;
+
+    for (i = 0; i < SERVER_NLANE; i++) {
+        lane = &server->lane[i];
+
+        lane->nconn = 0;
+        lane->limit = 0;
+        lane->limit_acc = 0;
+        lane->limit_inflight = 0;
+        lane->limit_nwait = 0;
+        TAILQ_INIT(&lane->limit_wait);
+        lane->limit_cut = 0LL;
+    }
+
+    if (pool != NULL) {
+        server->lane[SERVER_LANE_FAST].limit = pool->limit_max;
+        server->lane[SERVER_LANE_SLOW].limit = pool->slow_lane_limit;
+    }
+}
+
 struct conn *
 server_conn(struct server *server)
+{
+    return server_lane_conn(server, SERVER_LANE_FAST);
+}
+
+struct conn *
+server_lane_conn(struct server *server, uint32_t lane)
 {
     struct server_pool *pool;
     struct conn *conn;
+    uint32_t nconn;
+
+    ASSERT(lane < SERVER_NLANE);
 
     pool = server->owner;
+    nconn = lane == SERVER_LANE_SLOW ? pool->slow_lane_connections :
+            pool->server_connections;
 
     /*
      * FIXME: handle multiple server connections per server and do load
      * balancing on it. Support multiple algorithms for
      * 'server_connections:' > 0 key
      */
-    if (server->ns_conn_q < pool->server_connections) {
-        return conn_get(server, false, pool->redis);
+    if (server->lane[lane].nconn < nconn) {
+        conn = conn_get(server, false, pool->redis);
+        if (conn != NULL && lane == SERVER_LANE_SLOW) {
+            /* referenced in the fast lane, where every connection starts */
+            server->lane[SERVER_LANE_FAST].nconn--;
+            conn->lane = SERVER_LANE_SLOW;
+            server->lane[SERVER_LANE_SLOW].nconn++;
+        }
+        return conn;
     }
 
-    ASSERT(server->ns_conn_q == pool->server_connections);
+    ASSERT(server->lane[lane].nconn == nconn);
 
     /*
-     * Pick a server connection from the head of the queue and insert
-     * it back into the tail of queue to maintain the lru order
+     * Pick the first server connection of the lane from the queue and
+     * insert it back into the tail of queue to maintain the lru order
      */
-    conn = TAILQ_FIRST(&server->s_conn_q);
+    TAILQ_FOREACH(conn, &server->s_conn_q, conn_tqe) {
+        if (conn->lane == lane) {
+            break;
+        }
+    }
+    ASSERT(conn != NULL);
     ASSERT(!conn->client && !conn->proxy);
 
     TAILQ_REMOVE(&server->s_conn_q, conn, conn_tqe);
@@ -349,6 +402,67 @@ server_close_stats(struct context *ctx, struct server *server, err_t err,
     }
 }
 
+/*
+ * Send read msg, that fails with the close of server connection conn, once
+ * more to another replica of its slot, if its timeout has not expired yet.
+ * Returns true if msg was dequeued from conn and sent again.
+ */
+static bool
+server_retry(struct context *ctx, struct conn *conn, struct msg *msg,
+             conn_msgq_t dequeue)
+{
+    struct server *server = conn->owner;
+    struct server_pool *pool = server->owner;
+    struct conn *s_conn;
+    struct mbuf *mbuf;
+    int64_t now;
+
+    if (!pool->retry_reads || !pool->rediscluster) {
+        return false;
+    }
+
+    /* single key reads of a client, sent once */
+    if (msg->owner == NULL || msg->retried || msg->swallow || msg->noreply ||
+        msg->frag_id != 0 || msg->hedge != NULL ||
+        msg->type <= MSG_RSP_MC_SERVER_ERROR ||
+        msg->type >= MSG_REQ_REDIS_WRITECMD_START) {
+        return false;
+    }
+
+    /* the request that timed out, or out of time */
+    if (pool->timeout > 0) {
+        now = nc_msec_now();
+        if (msg->tmo_rbe.data == NULL || now < 0 || msg->tmo_rbe.key <= now) {
+            return false;
+        }
+    }
+
+    s_conn = redis_replica_routing(ctx, pool, msg, server);
+    if (s_conn == NULL) {
+        return false;
+    }
+
+    /* the hedge clock points at conn; req_send_done starts it again */
+    hedge_put(msg);
+
+    dequeue(ctx, conn, msg);
+
+    for (mbuf = STAILQ_FIRST(&msg->mhdr); mbuf != NULL;
+         mbuf = STAILQ_NEXT(mbuf, next)) {
+        mbuf->pos = mbuf->start;
+    }
+    msg->retried = 1;
+
+    stats_pool_incr(ctx, pool, retries);
+
+    log_debug(LOG_INFO, "close s %d retry req %"PRIu64" len %"PRIu32" type %d "
+              "on s %d", conn->sd, msg->id, msg->mlen, msg->type, s_conn->sd);
+
+    (void)req_enqueue(ctx, s_conn, msg->owner, msg);
+
+    return true;
+}
+
 void
 server_close(struct context *ctx, struct conn *conn)
 {
@@ -373,8 +487,13 @@ server_close(struct context *ctx, struct conn *conn)
     for (msg = TAILQ_FIRST(&conn->imsg_q); msg != NULL; msg = nmsg) {
         nmsg = TAILQ_NEXT(msg, s_tqe);
 
+        if (server_retry(ctx, conn, msg, conn->dequeue_inq)) {
+            continue;
+        }
+
         /* dequeue the message (request) from server inq */
         conn->dequeue_inq(ctx, conn, msg);
+        limit_release(msg, true);
 
         /*
          * Don't send any error response, if
@@ -392,6 +511,10 @@ server_close(struct context *ctx, struct conn *conn)
             msg->error = 1;
             msg->err = conn->err;
 
+            if (msg->sf != NULL) {
+                singleflight_done(msg, NULL, conn->err);
+            }
+
             if (c_conn == NULL) {
                 req_put(msg);
                 continue;
@@ -418,8 +541,13 @@ server_close(struct context *ctx, struct conn *conn)
     for (msg = TAILQ_FIRST(&conn->omsg_q); msg != NULL; msg = nmsg) {
         nmsg = TAILQ_NEXT(msg, s_tqe);
 
+        if (server_retry(ctx, conn, msg, conn->dequeue_outq)) {
+            continue;
+        }
+
         /* dequeue the message (request) from server outq */
         conn->dequeue_outq(ctx, conn, msg);
+        limit_release(msg, true);
 
         if (msg->swallow) {
             log_debug(LOG_INFO, "close s %d swallow req %"PRIu64" len %"PRIu32
@@ -432,6 +560,10 @@ server_close(struct context *ctx, struct conn *conn)
             msg->error = 1;
             msg->err = conn->err;
 
+            if (msg->sf != NULL) {
+                singleflight_done(msg, NULL, conn->err);
+            }
+
             if (c_conn == NULL) {
                 req_put(msg);
                 continue;
@@ -533,6 +665,8 @@ server_connect(struct context *ctx, struct server *server, struct conn *conn)
 
     ASSERT(!conn->connecting && !conn->connected);
 
+    NC_PROBE4(conn__open, conn->id, conn->sd, 0, server->pname.data);
+
     status = connect(conn->sd, conn->addr, conn->addrlen);
     if (status != NC_OK) {
         if (errno == EINPROGRESS) {
@@ -744,7 +878,7 @@ server_pool_server(struct server_pool *pool, uint8_t *key, uint32_t keylen)
 
 struct conn *
 server_pool_conn(struct context *ctx, struct server_pool *pool, uint8_t *key,
-                 uint32_t keylen)
+                 uint32_t keylen, uint32_t lane)
 {
     rstatus_t status;
     struct server *server;
@@ -761,8 +895,8 @@ server_pool_conn(struct context *ctx, struct server_pool *pool, uint8_t *key,
         return NULL;
     }
 
-    /* pick a connection to a given server */
-    conn = server_conn(server);
+    /* pick a connection of the lane to a given server */
+    conn = server_lane_conn(server, lane);
     if (conn == NULL) {
         return NULL;
     }
@@ -776,6 +910,66 @@ server_pool_conn(struct context *ctx, struct server_pool *pool, uint8_t *key,
     return conn;
 }
 
+static bool
+server_pool_slot_write(struct msg *msg)
+{
+    return msg->type > MSG_REQ_REDIS_WRITECMD_START;
+}
+
+/*
+ * Count a request routed to a cluster slot. The slot is remembered in the
+ * request, so that the response bytes can be added to the same slot
+ */
+void
+server_pool_slot_request(struct server_pool *pool, struct msg *msg,
+                         uint32_t slot)
+{
+    struct slot_stat *ss;
+
+    ASSERT(pool->slot_stat != NULL && slot < REDIS_CLUSTER_SLOTS);
+
+    ss = &pool->slot_stat[slot];
+    msg->slot = slot + 1;
+
+    if (server_pool_slot_write(msg)) {
+        ss->writes++;
+        ss->write_bytes += msg->mlen;
+    } else {
+        ss->reads++;
+        ss->read_bytes += msg->mlen;
+    }
+}
+
+void
+server_pool_slot_response(struct server_pool *pool, struct msg *req,
+                          uint32_t len)
+{
+    struct slot_stat *ss;
+
+    if (pool->slot_stat == NULL || req->slot == 0) {
+        return;
+    }
+
+    ss = &pool->slot_stat[req->slot - 1];
+
+    if (server_pool_slot_write(req)) {
+        ss->write_bytes += len;
+    } else {
+        ss->read_bytes += len;
+    }
+}
+
+void
+server_pool_slot_reset(struct server_pool *pool)
+{
+    if (pool->slot_stat == NULL) {
+        return;
+    }
+
+    memset(pool->slot_stat, 0, REDIS_CLUSTER_SLOTS * sizeof(*pool->slot_stat));
+    pool->slot_stat_since = nc_usec_now();
+}
+
 static rstatus_t
 server_pool_each_preconnect(void *elem, void *data)
 {
@@ -816,6 +1010,8 @@ server_pool_each_disconnect(void *elem, void *data)
     rstatus_t status;
     struct server_pool *sp = elem;
 
+    nearcache_disconnect(sp);
+
     status = array_each(&sp->server, server_each_disconnect, NULL);
     if (status != NC_OK) {
         return status;
@@ -855,6 +1051,169 @@ server_pool_each_set_tick_callback(void *elem, void *data)
     return NC_OK;
 }
 
+static rstatus_t
+server_pool_each_slowlog_init(void *elem, void *data)
+{
+    struct server_pool *sp = elem;
+
+    if (!sp->slowlog) {
+        return NC_OK;
+    }
+
+    return slowlog_init(&sp->slowlog_ring, sp->slowlog_max_len);
+}
+
+static rstatus_t
+server_pool_each_hotkey_init(void *elem, void *data)
+{
+    struct server_pool *sp = elem;
+
+    if (sp->hotkey_max_len == 0) {
+        return NC_OK;
+    }
+
+    sp->hotkey = hotkey_create(sp->hotkey_max_len, sp->hotkey_sample_rate);
+    if (sp->hotkey == NULL) {
+        return NC_ENOMEM;
+    }
+
+    return NC_OK;
+}
+
+static rstatus_t
+server_pool_each_nearcache_init(void *elem, void *data)
+{
+    struct server_pool *sp = elem;
+
+    if (sp->nearcache_max_memory == 0) {
+        return NC_OK;
+    }
+
+    if (!sp->redis) {
+        log_warn("pool '%.*s' ignores nearcache_max_memory, it is not redis",
+                 sp->name.len, sp->name.data);
+        return NC_OK;
+    }
+
+    sp->nearcache = nearcache_create(sp);
+    if (sp->nearcache == NULL) {
+        return NC_ERROR;
+    }
+
+    return NC_OK;
+}
+
+static rstatus_t
+server_pool_each_singleflight_init(void *elem, void *data)
+{
+    struct server_pool *sp = elem;
+
+    if (string_empty(&sp->singleflight_commands)) {
+        return NC_OK;
+    }
+
+    if (!sp->redis) {
+        log_warn("pool '%.*s' ignores singleflight_commands, it is not redis",
+                 sp->name.len, sp->name.data);
+        return NC_OK;
+    }
+
+    sp->singleflight = singleflight_create(sp);
+    if (sp->singleflight == NULL) {
+        return NC_ERROR;
+    }
+
+    return NC_OK;
+}
+
+/* parse slow_lane_commands, separated by spaces or commas, into slow_cmd */
+static rstatus_t
+server_pool_each_lane_init(void *elem, void *data)
+{
+    struct server_pool *sp = elem;
+    uint8_t *p, *end, *name;
+    msg_type_t type;
+
+    if (string_empty(&sp->slow_lane_commands)) {
+        return NC_OK;
+    }
+
+    if (!sp->redis) {
+        log_warn("pool '%.*s' ignores slow_lane_commands, it is not redis",
+                 sp->name.len, sp->name.data);
+        return NC_OK;
+    }
+
+    p = sp->slow_lane_commands.data;
+    end = sp->slow_lane_commands.data + sp->slow_lane_commands.len;
+
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == ',')) {
+            p++;
+        }
+
+        for (name = p; p < end && *p != ' ' && *p != ','; p++) {
+            /* nothing */
+        }
+        if (p == name) {
+            break;
+        }
+
+        type = msg_type_redis(name, (uint32_t)(p - name));
+        if (type == MSG_UNKNOWN) {
+            log_error("pool '%.*s' has no command '%.*s' for the slow lane",
+                      sp->name.len, sp->name.data, (int)(p - name), name);
+            return NC_ERROR;
+        }
+
+        sp->slow_cmd[type] = 1;
+        sp->slow_lane = 1;
+    }
+
+    return NC_OK;
+}
+
+static rstatus_t
+server_pool_each_ratelimit_init(void *elem, void *data)
+{
+    struct server_pool *sp = elem;
+
+    if (sp->rate_requests == 0 && sp->rate_bytes == 0) {
+        return NC_OK;
+    }
+
+    sp->ratelimit = ratelimit_create(sp);
+    if (sp->ratelimit == NULL) {
+        return NC_ERROR;
+    }
+
+    return NC_OK;
+}
+
+static rstatus_t
+server_pool_each_slot_stat_init(void *elem, void *data)
+{
+    struct server_pool *sp = elem;
+
+    if (!sp->slot_stats) {
+        return NC_OK;
+    }
+
+    if (!sp->rediscluster) {
+        log_warn("pool '%.*s' ignores slot_stats, it is not a redis cluster",
+                 sp->name.len, sp->name.data);
+        return NC_OK;
+    }
+
+    sp->slot_stat = nc_zalloc(REDIS_CLUSTER_SLOTS * sizeof(*sp->slot_stat));
+    if (sp->slot_stat == NULL) {
+        return NC_ENOMEM;
+    }
+    sp->slot_stat_since = nc_usec_now();
+
+    return NC_OK;
+}
+
 static rstatus_t
 server_pool_each_calc_connections(void *elem, void *data)
 {
@@ -1002,6 +1361,55 @@ server_pool_init(struct array *server_pool, struct array *conf_pool,
         return status;
     }
 
+    /* allocate slowlog rings */
+    status = array_each(server_pool, server_pool_each_slowlog_init, NULL);
+    if (status != NC_OK) {
+        server_pool_deinit(server_pool);
+        return status;
+    }
+
+    /* allocate hot key sketches */
+    status = array_each(server_pool, server_pool_each_hotkey_init, NULL);
+    if (status != NC_OK) {
+        server_pool_deinit(server_pool);
+        return status;
+    }
+
+    /* allocate near caches */
+    status = array_each(server_pool, server_pool_each_nearcache_init, NULL);
+    if (status != NC_OK) {
+        server_pool_deinit(server_pool);
+        return status;
+    }
+
+    /* allocate single flight tables */
+    status = array_each(server_pool, server_pool_each_singleflight_init, NULL);
+    if (status != NC_OK) {
+        server_pool_deinit(server_pool);
+        return status;
+    }
+
+    /* classify the commands of the slow lane */
+    status = array_each(server_pool, server_pool_each_lane_init, NULL);
+    if (status != NC_OK) {
+        server_pool_deinit(server_pool);
+        return status;
+    }
+
+    /* allocate rate limit buckets */
+    status = array_each(server_pool, server_pool_each_ratelimit_init, NULL);
+    if (status != NC_OK) {
+        server_pool_deinit(server_pool);
+        return status;
+    }
+
+    /* allocate cluster slot counters */
+    status = array_each(server_pool, server_pool_each_slot_stat_init, NULL);
+    if (status != NC_OK) {
+        server_pool_deinit(server_pool);
+        return status;
+    }
+
     /* compute max server connections */
     ctx->max_nsconn = 0;
     status = array_each(server_pool, server_pool_each_calc_connections, ctx);
@@ -1049,6 +1457,33 @@ server_pool_deinit(struct array *server_pool)
 
         server_deinit(&sp->server);
 
+        slowlog_deinit(&sp->slowlog_ring);
+
+        if (sp->hotkey != NULL) {
+            hotkey_destroy(sp->hotkey);
+            sp->hotkey = NULL;
+        }
+
+        if (sp->slot_stat != NULL) {
+            nc_free(sp->slot_stat);
+            sp->slot_stat = NULL;
+        }
+
+        if (sp->nearcache != NULL) {
+            nearcache_destroy(sp->nearcache);
+            sp->nearcache = NULL;
+        }
+
+        if (sp->singleflight != NULL) {
+            singleflight_destroy(sp->singleflight);
+            sp->singleflight = NULL;
+        }
+
+        if (sp->ratelimit != NULL) {
+            ratelimit_destroy(sp->ratelimit);
+            sp->ratelimit = NULL;
+        }
+
         log_debug(LOG_DEBUG, "deinit pool %"PRIu32" '%.*s'", sp->idx,
                   sp->name.len, sp->name.data);
     }
@@ -1063,6 +1498,12 @@ server_pool_each_tick(void *elem, void *data)
 {
     struct server_pool *pool = elem;
 
+    slowlog_drain(pool);
+    hotkey_tick(pool->ctx, pool);
+    nearcache_tick(pool);
+    health_tick(pool);
+    limit_tick(pool);
+    ratelimit_tick(pool);
     pool->pool_tick(pool);
 
     /* always returns NC_OK */
@@ -1087,4 +1528,6 @@ server_conn_close(struct context *ctx, struct server *server)
         conn = TAILQ_FIRST(&server->s_conn_q);
         server_close(ctx, conn);
     }
+
+    limit_drain(ctx, server);
 }
@@ -65,6 +65,25 @@ typedef struct lua_State lua_State;
 typedef uint32_t (*hash_t)(const char *, size_t);
 typedef void (*pool_tick_t)(struct server_pool *);
 
+/*
+ * Requests to a server travel in one of two lanes, each with server
+ * connections and an in-flight limit of its own, so that the commands in
+ * slow_lane_commands never hold up the others on the same connection.
+ */
+#define SERVER_LANE_FAST    0           /* all but slow_lane_commands */
+#define SERVER_LANE_SLOW    1           /* slow_lane_commands */
+#define SERVER_NLANE        2
+
+struct server_lane {
+    uint32_t           nconn;         /* # server connections */
+    uint32_t           limit;         /* in-flight limit, adaptive in the fast lane */
+    uint32_t           limit_acc;     /* fast replies toward the next increase */
+    uint32_t           limit_inflight; /* # requests in flight */
+    uint32_t           limit_nwait;   /* # requests waiting for a slot */
+    struct msg_tqh     limit_wait;    /* requests waiting for a slot */
+    int64_t            limit_cut;     /* last decrease of limit in usec */
+};
+
 struct continuum {
     uint32_t index;  /* server index */
     uint32_t value;  /* hash value */
@@ -92,7 +111,17 @@ struct server {
     bool               auto_ban_flag; /* if disconnect, set true */
     int64_t            lift_ban_time; /* if set auto_ban_flag , lift banne time */
 
+    struct nearcache_tracker *tracker; /* near cache tracking or NULL */
+
+    int64_t            health_ts;     /* health check sent in usec or 0 */
+    uint64_t           health_id;     /* id of the health check in flight */
+    int64_t            health_rtt;    /* smoothed health check rtt in usec */
+    uint32_t           health_failures; /* # consecutive failed health checks */
+
+    struct server_lane lane[SERVER_NLANE]; /* fast and slow lane */
+
     unsigned           local_idc:1;   /* flag if backend server in local idc */
+    unsigned           health_demoted:1; /* demoted from reads by health checks? */
 };
 
 #define NC_MAXTAGNUM 10
@@ -103,6 +132,17 @@ struct replicaset {
     struct array tagged_servers[NC_MAXTAGNUM];
 };
 
+/*
+ * Traffic of one cluster slot since the last reset. Request counts are 32
+ * bit and wrap, bytes are request plus response bytes.
+ */
+struct slot_stat {
+    uint32_t reads;       /* # read requests */
+    uint32_t writes;      /* # write requests */
+    uint64_t read_bytes;  /* read request and response bytes */
+    uint64_t write_bytes; /* write request and response bytes */
+};
+
 #define REDIS_PROBE_BUF_SIZE 16384*10
 struct server_pool {
     uint32_t           idx;                  /* pool index */
@@ -145,6 +185,53 @@ struct server_pool {
 
     unsigned           slowlog;              /* slowlog? */
     int64_t            slowlog_slower_than;  /* slowlog time setting */
+    uint32_t           slowlog_max_len;      /* # slowlog ring entries */
+    unsigned           slowlog_log:1;        /* drain slowlog ring to log? */
+    struct slowlog     slowlog_ring;         /* recent slow requests */
+    uint32_t           trace_sample_rate;    /* trace 1 in N requests, 0 to disable */
+    uint32_t           trace_countdown;      /* # requests until the next trace */
+    uint32_t           capture_sample_rate;  /* capture 1 in N requests, 0 to disable */
+    uint32_t           capture_countdown;    /* # requests until the next capture */
+    uint32_t           hotkey_max_len;       /* # hot keys reported, 0 to disable */
+    uint32_t           hotkey_sample_rate;   /* sample 1 in N keys for hot keys */
+    struct hotkey      *hotkey;              /* hot key sketch */
+    unsigned           slot_stats:1;         /* per slot counters? (rediscluster) */
+    struct slot_stat   *slot_stat;           /* slot_stat[REDIS_CLUSTER_SLOTS] or NULL */
+    int64_t            slot_stat_since;      /* slot_stat last reset in usec */
+    uint32_t           bigkey_threshold;     /* big response in bytes, 0 to disable */
+    uint32_t           bigkey_max_len;       /* # big keys reported */
+    uint32_t           nearcache_max_memory; /* near cache bytes, 0 to disable */
+    int64_t            nearcache_ttl;        /* near cache entry lifetime in usec */
+    unsigned           nearcache_tracking:1; /* near cache invalidated by client tracking? */
+    struct string      nearcache_commands;   /* near cached commands (ref in conf_pool) */
+    struct nearcache   *nearcache;           /* near cache or NULL */
+    struct string      singleflight_commands; /* coalesced commands (ref in conf_pool) */
+    struct singleflight *singleflight;       /* in flight reads or NULL */
+    unsigned           batch_get:1;          /* send gets of a server as mget? */
+    unsigned           batch_get_strict:1;   /* send nil members of mget again? */
+    unsigned           batch_set:1;          /* send sets of a server as mset? */
+    uint32_t           batch_max;            /* max # requests per mget or mset */
+    uint32_t           hedge_after;          /* hedge reads after msec or 0 */
+    uint32_t           hedge_budget;         /* % of reads that may be hedged */
+    uint32_t           hedge_credit;         /* hedges earned, in 1/100 */
+    unsigned           retry_reads:1;        /* retry reads of failed servers? */
+    int64_t            health_interval;      /* health check interval in usec or 0 */
+    uint32_t           health_failures;      /* # failed checks that demote */
+    uint32_t           health_latency_factor; /* rtt over median that demotes */
+    int64_t            health_next;          /* next health check round in usec */
+    uint32_t           limit_max;            /* max in-flight requests per server or 0 */
+    int64_t            limit_latency;        /* reply latency that shrinks limit in usec */
+    uint32_t           limit_queue;          /* max requests waiting per server */
+    uint32_t           rate_requests;        /* requests per sec per source or 0 */
+    uint32_t           rate_bytes;           /* request bytes per sec per source or 0 */
+    uint32_t           rate_prefix;          /* ipv4 prefix length of a source */
+    unsigned           rate_reject:1;        /* reject, not pause, over the limit? */
+    struct ratelimit   *ratelimit;           /* source buckets or NULL */
+    struct string      slow_lane_commands;   /* slow lane commands (ref in conf_pool) */
+    uint32_t           slow_lane_connections; /* # slow lane connections per server */
+    uint32_t           slow_lane_limit;      /* max slow requests in flight per server or 0 */
+    unsigned           slow_lane:1;          /* slow lane in use? */
+    uint8_t            slow_cmd[MSG_SENTINEL]; /* slow lane request types */
 
     unsigned           redis:1;              /* redis? */
     unsigned           rediscluster:1;       /* rediscluster? */
@@ -182,14 +269,19 @@ int server_timeout(struct conn *conn);
 bool server_active(struct conn *conn);
 rstatus_t server_init(struct array *server, struct array *conf_server, struct server_pool *sp);
 void server_deinit(struct array *server);
+void server_lane_init(struct server *server, struct server_pool *pool);
 struct conn *server_conn(struct server *server);
+struct conn *server_lane_conn(struct server *server, uint32_t lane);
 rstatus_t server_connect(struct context *ctx, struct server *server, struct conn *conn);
 void server_close(struct context *ctx, struct conn *conn);
 void server_connected(struct context *ctx, struct conn *conn);
 void server_ok(struct context *ctx, struct conn *conn);
 
 uint32_t server_pool_idx(struct server_pool *pool, uint8_t *key, uint32_t keylen);
-struct conn *server_pool_conn(struct context *ctx, struct server_pool *pool, uint8_t *key, uint32_t keylen);
+struct conn *server_pool_conn(struct context *ctx, struct server_pool *pool, uint8_t *key, uint32_t keylen, uint32_t lane);
+void server_pool_slot_request(struct server_pool *pool, struct msg *msg, uint32_t slot);
+void server_pool_slot_response(struct server_pool *pool, struct msg *req, uint32_t len);
+void server_pool_slot_reset(struct server_pool *pool);
 rstatus_t server_pool_run(struct server_pool *pool);
 rstatus_t server_pool_preconnect(struct context *ctx);
 void server_pool_disconnect(struct context *ctx);
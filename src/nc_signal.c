@@ -104,8 +104,9 @@ signal_handler(int signo)
         break;
 
     case SIGHUP:
-        actionstr = ", reopening log file";
+        actionstr = ", reopening log and capture file";
         action = log_reopen;
+        capture_reopen();
         break;
 
     case SIGINT:
@@ -0,0 +1,342 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <nc_core.h>
+#include <nc_server.h>
+#include <nc_hashkit.h>
+#include <nc_singleflight.h>
+
+struct singleflight *
+singleflight_create(struct server_pool *pool)
+{
+    struct singleflight *sf;
+    uint32_t ncmd;
+    rstatus_t status;
+
+    sf = nc_zalloc(sizeof(*sf));
+    if (sf == NULL) {
+        return NULL;
+    }
+
+    sf->owner = pool;
+
+    status = nearcache_commands(pool, &pool->singleflight_commands, sf->cmd,
+                                &ncmd);
+    if (status != NC_OK) {
+        nc_free(sf);
+        return NULL;
+    }
+
+    return sf;
+}
+
+void
+singleflight_destroy(struct singleflight *sf)
+{
+    struct msg *msg, *nmsg;
+    uint32_t i;
+
+    /* requests still in flight at exit forget the table and their waiters */
+    for (i = 0; i < SINGLEFLIGHT_NSLOT; i++) {
+        for (msg = sf->table[i]; msg != NULL; msg = nmsg) {
+            nmsg = msg->sf_next;
+            msg->sf = NULL;
+            msg->sf_next = NULL;
+            msg->sf_waiter = NULL;
+        }
+    }
+
+    nc_free(sf);
+}
+
+/* the request from its only key to its end, if it fits in one mbuf */
+static rstatus_t
+singleflight_key(struct msg *msg, uint8_t **key, uint32_t *klen)
+{
+    struct mbuf *mbuf;
+    struct keypos *kpos;
+
+    if (msg->noreply || msg->frag_id != 0 || array_n(msg->keys) != 1) {
+        return NC_ERROR;
+    }
+
+    mbuf = STAILQ_FIRST(&msg->mhdr);
+    if (mbuf == NULL || mbuf != STAILQ_LAST(&msg->mhdr, mbuf, next)) {
+        return NC_ERROR;
+    }
+
+    kpos = array_get(msg->keys, 0);
+    if (kpos->start < mbuf->start || kpos->end > mbuf->last ||
+        kpos->start > kpos->end) {
+        return NC_ERROR;
+    }
+
+    *key = kpos->start;
+    *klen = (uint32_t)(mbuf->last - kpos->start);
+
+    return NC_OK;
+}
+
+/* hash of the key alone, so that a write finds the reads of its keys */
+static uint32_t
+singleflight_hash(struct keypos *kpos)
+{
+    return hash_fnv1a_32((char *)kpos->start,
+                         (size_t)(kpos->end - kpos->start));
+}
+
+static struct msg *
+singleflight_lookup(struct singleflight *sf, uint32_t hash, msg_type_t type,
+                    uint8_t *key, uint32_t klen)
+{
+    struct msg *msg;
+    uint8_t *mkey;
+    uint32_t mklen;
+
+    for (msg = sf->table[hash & (SINGLEFLIGHT_NSLOT - 1)]; msg != NULL;
+         msg = msg->sf_next) {
+        if (msg->sf_hash != hash || msg->type != type || msg->sf_stale) {
+            continue;
+        }
+
+        if (singleflight_key(msg, &mkey, &mklen) == NC_OK && mklen == klen &&
+            memcmp(mkey, key, klen) == 0) {
+            return msg;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Wait on an identical request in flight, if any, instead of forwarding
+ * msg. The request is queued on its client connection like a forwarded one.
+ */
+bool
+singleflight_join(struct context *ctx, struct singleflight *sf,
+                  struct conn *c_conn, struct msg *msg)
+{
+    struct server_pool *pool = sf->owner;
+    struct msg *leader;
+    uint8_t *key;
+    uint32_t klen, hash;
+
+    ASSERT(c_conn->client && !c_conn->proxy);
+    ASSERT(msg->request && msg->sf == NULL);
+
+    if (!sf->cmd[msg->type] || sf->nleader == 0) {
+        return false;
+    }
+
+    if (singleflight_key(msg, &key, &klen) != NC_OK) {
+        return false;
+    }
+
+    hash = singleflight_hash(array_get(msg->keys, 0));
+    leader = singleflight_lookup(sf, hash, msg->type, key, klen);
+    if (leader == NULL) {
+        return false;
+    }
+
+    c_conn->enqueue_outq(ctx, c_conn, msg);
+
+    msg->sf_next = leader->sf_waiter;
+    leader->sf_waiter = msg;
+
+    stats_cmd_incr(ctx, pool, msg->type, requests);
+    stats_cmd_incr_by(ctx, pool, msg->type, request_bytes, msg->mlen);
+    stats_pool_incr(ctx, pool, singleflight_coalesced);
+
+    log_debug(LOG_VERB, "req %"PRIu64" from c %d waits on req %"PRIu64"",
+              msg->id, c_conn->sd, leader->id);
+
+    return true;
+}
+
+/* let identical requests wait on msg, just forwarded to a server */
+void
+singleflight_lead(struct singleflight *sf, struct msg *msg)
+{
+    struct msg **bucket;
+    uint8_t *key;
+    uint32_t klen;
+
+    ASSERT(msg->request && msg->sf == NULL);
+
+    if (!sf->cmd[msg->type]) {
+        return;
+    }
+
+    if (singleflight_key(msg, &key, &klen) != NC_OK) {
+        return;
+    }
+
+    msg->sf = sf;
+    msg->sf_hash = singleflight_hash(array_get(msg->keys, 0));
+    msg->sf_waiter = NULL;
+
+    bucket = &sf->table[msg->sf_hash & (SINGLEFLIGHT_NSLOT - 1)];
+    msg->sf_next = *bucket;
+    *bucket = msg;
+    sf->nleader++;
+}
+
+/*
+ * Write msg, just forwarded to a server, may change its keys. The reads of
+ * them in flight stop taking waiters, so that a read received after msg,
+ * like one of the same client, is forwarded after it and sees the write.
+ */
+void
+singleflight_write(struct singleflight *sf, struct msg *msg)
+{
+    struct msg *leader;
+    struct keypos *kpos, *lkpos;
+    uint32_t i, hash;
+    size_t klen;
+
+    ASSERT(msg->request);
+
+    if (sf->nleader == 0 || msg->type <= MSG_REQ_REDIS_WRITECMD_START) {
+        return;
+    }
+
+    for (i = 0; i < array_n(msg->keys); i++) {
+        kpos = array_get(msg->keys, i);
+        klen = (size_t)(kpos->end - kpos->start);
+        hash = singleflight_hash(kpos);
+
+        for (leader = sf->table[hash & (SINGLEFLIGHT_NSLOT - 1)];
+             leader != NULL; leader = leader->sf_next) {
+            lkpos = array_get(leader->keys, 0);
+            if (leader->sf_hash != hash || leader->sf_stale ||
+                (size_t)(lkpos->end - lkpos->start) != klen ||
+                memcmp(lkpos->start, kpos->start, klen) != 0) {
+                continue;
+            }
+
+            leader->sf_stale = 1;
+
+            log_debug(LOG_VERB, "req %"PRIu64" overtakes req %"PRIu64"",
+                      msg->id, leader->id);
+        }
+    }
+}
+
+/* copy the response of the leader for a waiter */
+static rstatus_t
+singleflight_copy(struct msg *rsp, struct msg *src)
+{
+    struct mbuf *mbuf;
+    uint8_t *p;
+    size_t n, len;
+    rstatus_t status;
+
+    STAILQ_FOREACH(mbuf, &src->mhdr, next) {
+        for (p = mbuf->pos; p < mbuf->last; p += n) {
+            len = (size_t)(mbuf->last - p);
+            n = MIN(len, mbuf_data_size());
+            status = msg_append(rsp, p, n);
+            if (status != NC_OK) {
+                return status;
+            }
+        }
+    }
+
+    rsp->type = src->type;
+
+    return NC_OK;
+}
+
+static void
+singleflight_resolve(struct msg *msg, struct msg *src, err_t err)
+{
+    struct conn *c_conn;
+    struct context *ctx;
+    struct msg *rsp;
+    rstatus_t status;
+
+    ASSERT(msg->request && !msg->done && msg->peer == NULL);
+
+    /* client went away */
+    if (msg->swallow) {
+        req_put(msg);
+        return;
+    }
+
+    c_conn = msg->owner;
+    ctx = conn_to_ctx(c_conn);
+
+    msg->done = 1;
+
+    if (src != NULL) {
+        rsp = msg_get(c_conn, false, c_conn->redis);
+        if (rsp != NULL && singleflight_copy(rsp, src) == NC_OK) {
+            msg->peer = rsp;
+            rsp->peer = msg;
+        } else {
+            if (rsp != NULL) {
+                rsp_put(rsp);
+            }
+            src = NULL;
+            err = ENOMEM;
+        }
+    }
+
+    if (src == NULL) {
+        msg->error = 1;
+        msg->err = err;
+    }
+
+    if (req_done(c_conn, TAILQ_FIRST(&c_conn->omsg_q))) {
+        status = event_add_out(ctx->evb, c_conn);
+        if (status != NC_OK) {
+            c_conn->err = errno;
+        }
+    }
+}
+
+/*
+ * Request msg stops leading. Its waiters get a copy of rsp or, when rsp is
+ * NULL, fail with err.
+ */
+void
+singleflight_done(struct msg *msg, struct msg *rsp, err_t err)
+{
+    struct singleflight *sf = msg->sf;
+    struct msg **pmsg, *waiter, *nwaiter;
+
+    ASSERT(sf != NULL);
+
+    for (pmsg = &sf->table[msg->sf_hash & (SINGLEFLIGHT_NSLOT - 1)];
+         *pmsg != msg; pmsg = &(*pmsg)->sf_next) {
+        ASSERT(*pmsg != NULL);
+    }
+    *pmsg = msg->sf_next;
+    sf->nleader--;
+
+    waiter = msg->sf_waiter;
+
+    msg->sf = NULL;
+    msg->sf_next = NULL;
+    msg->sf_waiter = NULL;
+
+    for (; waiter != NULL; waiter = nwaiter) {
+        nwaiter = waiter->sf_next;
+        waiter->sf_next = NULL;
+        singleflight_resolve(waiter, rsp, err);
+    }
+}
@@ -0,0 +1,55 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _NC_SINGLEFLIGHT_H_
+#define _NC_SINGLEFLIGHT_H_
+
+#include <nc_core.h>
+
+/*
+ * Single flight of identical reads of a redis pool. A request of one of the
+ * singleflight_commands that is forwarded to a server becomes the leader of
+ * its command and arguments, found in a table until its response arrives.
+ * An identical request received meanwhile is not forwarded; it waits, in
+ * order on its client connection, on the leader and gets a copy of the
+ * leader's response, or its error.
+ *
+ * A write forwarded for a key makes the leaders of that key stale: they
+ * take no more waiters, so that reads received after the write are not
+ * answered with a value from before it.
+ *
+ * Waiters hang off their leader through msg->sf_next. The leader resolves
+ * them when its response is forwarded or swallowed, when its server
+ * connection is closed and, at the latest, when it is put.
+ */
+#define SINGLEFLIGHT_NSLOT  4096            /* # table buckets, power of 2 */
+
+struct singleflight {
+    struct server_pool *owner;              /* owner pool */
+    uint8_t            cmd[MSG_SENTINEL];   /* shared request types */
+    uint32_t           nleader;             /* # leaders in table */
+    struct msg         *table[SINGLEFLIGHT_NSLOT]; /* leaders by request */
+};
+
+struct singleflight *singleflight_create(struct server_pool *pool);
+void singleflight_destroy(struct singleflight *sf);
+bool singleflight_join(struct context *ctx, struct singleflight *sf, struct conn *c_conn, struct msg *msg);
+void singleflight_lead(struct singleflight *sf, struct msg *msg);
+void singleflight_write(struct singleflight *sf, struct msg *msg);
+void singleflight_done(struct msg *msg, struct msg *rsp, err_t err);
+
+#endif
@@ -0,0 +1,211 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ctype.h>
+
+#include <nc_core.h>
+#include <nc_server.h>
+#include <nc_slowlog.h>
+
+rstatus_t
+slowlog_init(struct slowlog *sl, uint32_t nentry)
+{
+    ASSERT(nentry > 0);
+
+    sl->entry = nc_zalloc(nentry * sizeof(*sl->entry));
+    if (sl->entry == NULL) {
+        return NC_ENOMEM;
+    }
+    sl->nentry = nentry;
+    sl->id = 0;
+    sl->reset_id = 0;
+    sl->drained_id = 0;
+
+    return NC_OK;
+}
+
+void
+slowlog_deinit(struct slowlog *sl)
+{
+    if (sl->entry != NULL) {
+        nc_free(sl->entry);
+    }
+    sl->nentry = 0;
+}
+
+static void
+slowlog_copy_str(char *dst, size_t size, const char *src, size_t len)
+{
+    len = MIN(len, size - 1);
+    nc_memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+/*
+ * Record a slow request into the pool ring. Everything is copied from
+ * state that is already in memory: the client address is cached by
+ * proxy_accept and the server address comes from its configuration, so
+ * no getpeername / getnameinfo happens here. Only a bounded prefix of the
+ * first key is copied, the request buffer itself is never modified.
+ */
+void
+slowlog_record(struct server_pool *pool, struct msg *req, int64_t duration)
+{
+    struct slowlog *sl = &pool->slowlog_ring;
+    struct slowlog_entry *e;
+    struct msg *rsp;
+    struct conn *c_conn, *s_conn;
+    struct server *server;
+    struct keypos *kpos;
+
+    if (sl->entry == NULL) {
+        return;
+    }
+
+    rsp = req->peer;
+    c_conn = req->owner;
+    s_conn = rsp != NULL ? rsp->owner : NULL;
+
+    e = &sl->entry[sl->id % sl->nentry];
+    e->id = sl->id++;
+    e->msg_id = req->id;
+    e->frag_id = req->frag_id;
+    e->start = req->slowlog_stime;
+    e->duration = duration;
+    e->req_len = req->mlen;
+    e->rsp_len = rsp != NULL ? rsp->mlen : 0;
+    e->type = req->type;
+
+    if (req->keys != NULL && array_n(req->keys) != 0) {
+        kpos = array_get(req->keys, 0);
+        e->key_len = (uint32_t)(kpos->end - kpos->start);
+        nc_memcpy(e->key, kpos->start, MIN(e->key_len, SLOWLOG_KEY_LEN));
+    } else {
+        e->key_len = 0;
+    }
+
+    if (c_conn != NULL && c_conn->peer[0] != '\0') {
+        slowlog_copy_str(e->client, sizeof(e->client), c_conn->peer,
+                         nc_strlen(c_conn->peer));
+    } else {
+        slowlog_copy_str(e->client, sizeof(e->client), "unknown", 7);
+    }
+
+    server = s_conn != NULL ? s_conn->owner : NULL;
+    if (server != NULL) {
+        /* host:port, or the name given in conf, as in the stats */
+        slowlog_copy_str(e->server, sizeof(e->server),
+                         (char *)server->name.data, server->name.len);
+    } else {
+        slowlog_copy_str(e->server, sizeof(e->server), "unknown", 7);
+    }
+}
+
+uint32_t
+slowlog_len(struct slowlog *sl)
+{
+    uint64_t n = sl->id - sl->reset_id;
+
+    return (uint32_t)MIN(n, (uint64_t)sl->nentry);
+}
+
+/*
+ * Return the idx-th most recent entry, idx 0 being the newest one
+ */
+struct slowlog_entry *
+slowlog_get(struct slowlog *sl, uint32_t idx)
+{
+    if (idx >= slowlog_len(sl)) {
+        return NULL;
+    }
+
+    return &sl->entry[(sl->id - 1 - idx) % sl->nentry];
+}
+
+void
+slowlog_reset(struct slowlog *sl)
+{
+    sl->reset_id = sl->id;
+}
+
+/*
+ * Lower case command name for a request type, without the REQ_REDIS_ or
+ * REQ_MC_ prefix; e.g. "get" for MSG_REQ_REDIS_GET
+ */
+int
+slowlog_cmd_name(msg_type_t type, char *buf, int size)
+{
+    struct string *tstr = msg_type_string(type);
+    uint8_t *p, *end;
+    int n;
+
+    p = tstr->data;
+    end = tstr->data + tstr->len;
+
+    if (tstr->len > sizeof("REQ_REDIS_") - 1 &&
+        nc_strncmp(p, "REQ_REDIS_", sizeof("REQ_REDIS_") - 1) == 0) {
+        p += sizeof("REQ_REDIS_") - 1;
+    } else if (tstr->len > sizeof("REQ_MC_") - 1 &&
+               nc_strncmp(p, "REQ_MC_", sizeof("REQ_MC_") - 1) == 0) {
+        p += sizeof("REQ_MC_") - 1;
+    }
+
+    for (n = 0; p < end && n < size - 1; p++, n++) {
+        buf[n] = (char)tolower(*p);
+    }
+    buf[n] = '\0';
+
+    return n;
+}
+
+/*
+ * Write the entries recorded since the last call to the slow log. Called
+ * from the pool tick; the formatted lines go to the log buffer and are
+ * written out by the log thread. Entries that were overwritten before
+ * they could be drained are counted and reported once.
+ */
+void
+slowlog_drain(struct server_pool *pool)
+{
+    struct slowlog *sl = &pool->slowlog_ring;
+    struct slowlog_entry *e;
+    uint64_t first;
+
+    if (!pool->slowlog || !pool->slowlog_log || sl->entry == NULL) {
+        return;
+    }
+
+    first = sl->id > sl->nentry ? sl->id - sl->nentry : 0;
+    if (sl->drained_id < first) {
+        log_warn("slowlog of pool '%.*s' dropped %"PRIu64" entries, "
+                 "slowlog_max_len %"PRIu32" is too small", pool->name.len,
+                 pool->name.data, first - sl->drained_id, sl->nentry);
+        sl->drained_id = first;
+    }
+
+    for (; sl->drained_id < sl->id; sl->drained_id++) {
+        e = &sl->entry[sl->drained_id % sl->nentry];
+
+        log_slow("request_msg_id=%"PRIu64", client_address=%s, "
+                 "server_address=%s, cost_time=%"PRId64"ms, "
+                 "fragment_id=%"PRIu64", request_type=%s, "
+                 "request_len=%"PRIu32", response_len=%"PRIu32", key='%.*s'",
+                 e->msg_id, e->client, e->server, e->duration / 1000,
+                 e->frag_id, msg_type_string(e->type)->data, e->req_len,
+                 e->rsp_len, (int)MIN(e->key_len, SLOWLOG_KEY_LEN), e->key);
+    }
+}
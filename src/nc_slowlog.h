@@ -0,0 +1,64 @@
+/*
+ * twemproxy - A fast and lightweight proxy for memcached protocol.
+ * Copyright (C) 2011 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _NC_SLOWLOG_H_
+#define _NC_SLOWLOG_H_
+
+#include <nc_core.h>
+
+/*
+ * Per pool ring of the most recent slow requests. Entries are filled on
+ * the event loop by plain copies from the request, its connections and
+ * the server, so recording a slow request never makes a syscall. Ids are
+ * monotonic and the entry for id lives at entry[id % nentry]; the ring
+ * keeps the last nentry ids, older ones are overwritten.
+ */
+#define SLOWLOG_KEY_LEN     64
+
+struct slowlog_entry {
+    uint64_t   id;                         /* entry id */
+    uint64_t   msg_id;                     /* request id */
+    uint64_t   frag_id;                    /* request fragment id */
+    int64_t    start;                      /* request sent to server in usec */
+    int64_t    duration;                   /* time to response in usec */
+    uint32_t   req_len;                    /* request length */
+    uint32_t   rsp_len;                    /* response length */
+    msg_type_t type;                       /* request type */
+    uint32_t   key_len;                    /* length of the first key */
+    uint8_t    key[SLOWLOG_KEY_LEN];       /* first key prefix */
+    char       client[NC_ADDR_DESC_LEN];   /* client address */
+    char       server[NC_ADDR_DESC_LEN];   /* server address */
+};
+
+struct slowlog {
+    struct slowlog_entry *entry;           /* entry[] */
+    uint32_t             nentry;           /* # entry */
+    uint64_t             id;               /* next entry id */
+    uint64_t             reset_id;         /* first id after the last reset */
+    uint64_t             drained_id;       /* next id to drain to the log */
+};
+
+rstatus_t slowlog_init(struct slowlog *sl, uint32_t nentry);
+void slowlog_deinit(struct slowlog *sl);
+void slowlog_record(struct server_pool *pool, struct msg *req, int64_t duration);
+uint32_t slowlog_len(struct slowlog *sl);
+struct slowlog_entry *slowlog_get(struct slowlog *sl, uint32_t idx);
+void slowlog_reset(struct slowlog *sl);
+void slowlog_drain(struct server_pool *pool);
+int slowlog_cmd_name(msg_type_t type, char *buf, int size);
+
+#endif
@@ -17,10 +17,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <unistd.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 
 #include <nc_core.h>
@@ -31,6 +33,25 @@ struct stats_desc {
     char *desc; /* stats description */
 };
 
+#define STATS_PROM_MIN_SIZE     (16 * 1024)
+#define STATS_KEY_NAME_LEN      (MAX(HOTKEY_KEY_LEN, STATS_BIGKEY_KEY_LEN) * 6 + 3) /* escaped key + "..." */
+#define STATS_PROM_CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+#define STATS_HTTP_WAIT         100     /* in msec */
+#define STATS_HTTP_SEND_WAIT    5000    /* in msec */
+#define STATS_HTTP_TICK         5       /* in msec */
+#define STATS_HTTP_REQ_LEN      1024
+#define STATS_HTTP_HDR_LEN      256
+#define STATS_HTTP_TOP_LEN      1024
+#define STATS_LIST_RETRY        4
+
+typedef enum stats_http {
+    STATS_HTTP_WAITING,     /* nothing received yet */
+    STATS_HTTP_NONE,        /* legacy client, raw json dump */
+    STATS_HTTP_JSON,        /* GET / */
+    STATS_HTTP_METRICS,     /* GET /metrics */
+    STATS_HTTP_NOT_FOUND
+} stats_http_t;
+
 #define DEFINE_ACTION(_name, _type, _desc) { .type = _type, .name = string(#_name) },
 static struct stats_metric stats_pool_codec[] = {
     STATS_POOL_CODEC( DEFINE_ACTION )
@@ -51,6 +72,59 @@ static struct stats_desc stats_server_desc[] = {
 };
 #undef DEFINE_ACTION
 
+#define DEFINE_ACTION(_name, _desc) string(#_name),
+static struct string stats_pool_histo_names[] = {
+    STATS_POOL_HISTO_CODEC( DEFINE_ACTION )
+};
+
+static struct string stats_server_histo_names[] = {
+    STATS_SERVER_HISTO_CODEC( DEFINE_ACTION )
+};
+#undef DEFINE_ACTION
+
+#define DEFINE_ACTION(_name, _desc) { .name = #_name, .desc = _desc },
+static struct stats_desc stats_pool_histo_desc[] = {
+    STATS_POOL_HISTO_CODEC( DEFINE_ACTION )
+};
+
+static struct stats_desc stats_server_histo_desc[] = {
+    STATS_SERVER_HISTO_CODEC( DEFINE_ACTION )
+};
+#undef DEFINE_ACTION
+
+#define DEFINE_ACTION(_name, _type, _desc) string(#_name),
+static struct string stats_cmd_field_names[] = {
+    STATS_CMD_CODEC( DEFINE_ACTION )
+};
+#undef DEFINE_ACTION
+
+#define DEFINE_ACTION(_name, _type, _desc) { .name = #_name, .desc = _desc },
+static struct stats_desc stats_cmd_desc[] = {
+    STATS_CMD_CODEC( DEFINE_ACTION )
+};
+#undef DEFINE_ACTION
+
+/*
+ * Per-command stats names derived from msg_type_strings[] by dropping the
+ * "REQ_" prefix and lowercasing, e.g. REQ_REDIS_GET -> redis_get. Types
+ * that are not requests keep an empty name and are never reported.
+ */
+#define STATS_CMD_NAME_LEN  32
+#define STATS_BIGKEY_NFIELD 3   /* size, count, last */
+static struct string stats_cmd_names[MSG_SENTINEL];
+static uint8_t stats_cmd_name_data[MSG_SENTINEL][STATS_CMD_NAME_LEN];
+
+/* percentiles reported for every histogram */
+static struct {
+    char   *suffix;
+    double q;
+} stats_histo_quantiles[] = {
+    { "p50",  0.5 },
+    { "p90",  0.9 },
+    { "p99",  0.99 },
+    { "p999", 0.999 },
+};
+
 static
 rstatus_t stats_pool_copy_recover(struct context *ctx, struct stats_pool *stp_src, struct hash_table **sit);
 
@@ -72,6 +146,59 @@ stats_describe(void)
         log_stderr("  %-20s\"%s\"", stats_server_desc[i].name,
                    stats_server_desc[i].desc);
     }
+
+    log_stderr("");
+
+    log_stderr("pool histograms (_count, _p50, _p90, _p99, _p999, _max):");
+    for (i = 0; i < NELEMS(stats_pool_histo_desc); i++) {
+        log_stderr("  %-20s\"%s\"", stats_pool_histo_desc[i].name,
+                   stats_pool_histo_desc[i].desc);
+    }
+
+    log_stderr("");
+
+    log_stderr("server histograms (_count, _p50, _p90, _p99, _p999, _max):");
+    for (i = 0; i < NELEMS(stats_server_histo_desc); i++) {
+        log_stderr("  %-20s\"%s\"", stats_server_histo_desc[i].name,
+                   stats_server_histo_desc[i].desc);
+    }
+
+    log_stderr("");
+
+    log_stderr("pool command stats (<command>_<stat>, e.g. redis_get_requests; "
+               "plus <command>_latency histogram):");
+    for (i = 0; i < NELEMS(stats_cmd_desc); i++) {
+        log_stderr("  %-20s\"%s\"", stats_cmd_desc[i].name,
+                   stats_cmd_desc[i].desc);
+    }
+}
+
+static void
+stats_cmd_names_init(void)
+{
+    uint32_t type, i, prefix;
+
+    prefix = sizeof("REQ_") - 1;
+
+    for (type = 0; type < MSG_SENTINEL; type++) {
+        struct string *tstr = msg_type_string((msg_type_t)type);
+        struct string *name = &stats_cmd_names[type];
+        uint8_t *data = stats_cmd_name_data[type];
+
+        string_init(name);
+
+        if (tstr->len <= prefix || tstr->len - prefix >= STATS_CMD_NAME_LEN ||
+            nc_strncmp(tstr->data, "REQ_", prefix) != 0) {
+            continue;
+        }
+
+        for (i = prefix; i < tstr->len; i++) {
+            data[i - prefix] = (uint8_t)tolower(tstr->data[i]);
+        }
+
+        name->data = data;
+        name->len = tstr->len - prefix;
+    }
 }
 
 static void
@@ -95,21 +222,6 @@ stats_metric_init(struct stats_metric *stm)
     }
 }
 
-static void
-stats_metric_reset(struct array *stats_metric)
-{
-    uint32_t i, nmetric;
-
-    nmetric = array_n(stats_metric);
-    ASSERT(nmetric == STATS_POOL_NFIELD || nmetric == STATS_SERVER_NFIELD);
-
-    for (i = 0; i < nmetric; i++) {
-        struct stats_metric *stm = array_get(stats_metric, i);
-
-        stats_metric_init(stm);
-    }
-}
-
 static rstatus_t
 stats_pool_metric_init(struct array *stats_metric)
 {
@@ -166,6 +278,144 @@ stats_server_metric_init(struct stats_server *sts)
     return NC_OK;
 }
 
+static rstatus_t
+stats_histo_init(struct array *stats_histo, struct string *names, uint32_t nhisto)
+{
+    rstatus_t status;
+    uint32_t i;
+
+    status = array_init(stats_histo, nhisto, sizeof(struct stats_histo));
+    if (status != NC_OK) {
+        return status;
+    }
+
+    for (i = 0; i < nhisto; i++) {
+        struct stats_histo *sth = array_push(stats_histo);
+
+        if (sth == NULL) {
+            return NC_ENOMEM;
+        }
+
+        sth->name = names[i];
+        memset(&sth->histo, 0, sizeof(sth->histo));
+    }
+
+    return NC_OK;
+}
+
+static void
+stats_histo_deinit(struct array *stats_histo)
+{
+    uint32_t i, nhisto;
+
+    nhisto = array_n(stats_histo);
+    for (i = 0; i < nhisto; i++) {
+        array_pop(stats_histo);
+    }
+    array_deinit(stats_histo);
+}
+
+static rstatus_t
+stats_cmd_init(struct array *stats_cmd)
+{
+    rstatus_t status;
+    uint32_t i;
+
+    status = array_init(stats_cmd, MSG_SENTINEL, sizeof(struct stats_cmd));
+    if (status != NC_OK) {
+        return status;
+    }
+
+    for (i = 0; i < MSG_SENTINEL; i++) {
+        struct stats_cmd *stc = array_push(stats_cmd);
+
+        if (stc == NULL) {
+            return NC_ENOMEM;
+        }
+
+        stc->name = stats_cmd_names[i];
+        memset(stc->value, 0, sizeof(stc->value));
+        memset(&stc->histo, 0, sizeof(stc->histo));
+    }
+
+    return NC_OK;
+}
+
+static void
+stats_cmd_deinit(struct array *stats_cmd)
+{
+    uint32_t i, ncmd;
+
+    ncmd = array_n(stats_cmd);
+    for (i = 0; i < ncmd; i++) {
+        array_pop(stats_cmd);
+    }
+    array_deinit(stats_cmd);
+}
+
+/*
+ * Bounded lists (hot keys, big keys) are arrays with a fixed capacity,
+ * or null arrays when the feature is off for the pool
+ */
+static rstatus_t
+stats_list_init(struct array *list, uint32_t n, size_t size)
+{
+    array_null(list);
+
+    if (n == 0) {
+        return NC_OK;
+    }
+
+    return array_init(list, n, size);
+}
+
+static void
+stats_list_reset(struct array *list)
+{
+    while (array_n(list) != 0) {
+        array_pop(list);
+    }
+}
+
+static void
+stats_list_deinit(struct array *list)
+{
+    stats_list_reset(list);
+    array_deinit(list);
+}
+
+/*
+ * The hot key and big key lists of current (a) change in place, and
+ * rarely. Their sequence is odd while they do, so the stats thread only
+ * keeps a copy made while it stayed even and unchanged (a seqlock).
+ */
+static void
+stats_list_begin(uint64_t *gen)
+{
+    __atomic_store_n(gen, *gen + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void
+stats_list_end(uint64_t *gen)
+{
+    __atomic_store_n(gen, *gen + 1, __ATOMIC_RELEASE);
+}
+
+/* dst keeps the capacity it was created with, so this never reallocates */
+static void
+stats_list_set(struct array *dst, void *elem, uint32_t n)
+{
+    uint32_t i;
+
+    stats_list_reset(dst);
+
+    for (i = 0; i < n && array_n(dst) < dst->nalloc; i++) {
+        nc_memcpy(array_push(dst), (uint8_t *)elem + i * dst->size,
+                  dst->size);
+    }
+}
+
 static void
 stats_metric_deinit(struct array *metric)
 {
@@ -185,12 +435,19 @@ stats_server_init(struct stats_server *sts, struct server *s)
 
     sts->name = s->name;
     array_null(&sts->metric);
+    array_null(&sts->histo);
 
     status = stats_server_metric_init(sts);
     if (status != NC_OK) {
         return status;
     }
 
+    status = stats_histo_init(&sts->histo, stats_server_histo_names,
+                              STATS_SERVER_NHISTO);
+    if (status != NC_OK) {
+        return status;
+    }
+
     log_debug(LOG_VVVERB, "init stats server '%.*s' with %"PRIu32" metric",
               sts->name.len, sts->name.data, array_n(&sts->metric));
 
@@ -240,6 +497,7 @@ stats_server_unmap(struct array *stats_server)
     for (i = 0; i < nserver; i++) {
         struct stats_server *sts = array_pop(stats_server);
         stats_metric_deinit(&sts->metric);
+        stats_histo_deinit(&sts->histo);
     }
     array_deinit(stats_server);
 
@@ -253,16 +511,60 @@ stats_pool_init(struct stats_pool *stp, struct server_pool *sp)
 
     stp->name = sp->name;
     array_null(&stp->metric);
+    array_null(&stp->histo);
+    array_null(&stp->cmd);
+    array_null(&stp->hotkey);
+    array_null(&stp->bigkey);
     array_null(&stp->server);
+    stp->hotkey_gen = 0;
+    stp->bigkey_gen = 0;
 
     status = stats_pool_metric_init(&stp->metric);
     if (status != NC_OK) {
         return status;
     }
 
+    status = stats_histo_init(&stp->histo, stats_pool_histo_names,
+                              STATS_POOL_NHISTO);
+    if (status != NC_OK) {
+        stats_metric_deinit(&stp->metric);
+        return status;
+    }
+
+    status = stats_cmd_init(&stp->cmd);
+    if (status != NC_OK) {
+        stats_metric_deinit(&stp->metric);
+        stats_histo_deinit(&stp->histo);
+        return status;
+    }
+
+    status = stats_list_init(&stp->hotkey, sp->hotkey_max_len,
+                             sizeof(struct hotkey_stat));
+    if (status != NC_OK) {
+        stats_metric_deinit(&stp->metric);
+        stats_histo_deinit(&stp->histo);
+        stats_cmd_deinit(&stp->cmd);
+        return status;
+    }
+
+    status = stats_list_init(&stp->bigkey, sp->bigkey_threshold != 0 ?
+                             sp->bigkey_max_len : 0,
+                             sizeof(struct stats_bigkey));
+    if (status != NC_OK) {
+        stats_metric_deinit(&stp->metric);
+        stats_histo_deinit(&stp->histo);
+        stats_cmd_deinit(&stp->cmd);
+        stats_list_deinit(&stp->hotkey);
+        return status;
+    }
+
     status = stats_server_map(&stp->server, &sp->server);
     if (status != NC_OK) {
         stats_metric_deinit(&stp->metric);
+        stats_histo_deinit(&stp->histo);
+        stats_cmd_deinit(&stp->cmd);
+        stats_list_deinit(&stp->hotkey);
+        stats_list_deinit(&stp->bigkey);
         return status;
     }
 
@@ -273,27 +575,6 @@ stats_pool_init(struct stats_pool *stp, struct server_pool *sp)
     return NC_OK;
 }
 
-static void
-stats_pool_reset(struct array *stats_pool)
-{
-    uint32_t i, npool;
-
-    npool = array_n(stats_pool);
-
-    for (i = 0; i < npool; i++) {
-        struct stats_pool *stp = array_get(stats_pool, i);
-        uint32_t j, nserver;
-
-        stats_metric_reset(&stp->metric);
-
-        nserver = array_n(&stp->server);
-        for (j = 0; j < nserver; j++) {
-            struct stats_server *sts = array_get(&stp->server, j);
-            stats_metric_reset(&sts->metric);
-        }
-    }
-}
-
 static rstatus_t
 stats_pool_map(struct array *stats_pool, struct array *server_pool)
 {
@@ -336,6 +617,10 @@ stats_pool_unmap(struct array *stats_pool)
     for (i = 0; i < npool; i++) {
         struct stats_pool *stp = array_pop(stats_pool);
         stats_metric_deinit(&stp->metric);
+        stats_histo_deinit(&stp->histo);
+        stats_cmd_deinit(&stp->cmd);
+        stats_list_deinit(&stp->hotkey);
+        stats_list_deinit(&stp->bigkey);
         stats_server_unmap(&stp->server);
     }
     array_deinit(stats_pool);
@@ -350,6 +635,11 @@ stats_create_buf(struct stats *st)
     uint32_t key_value_extra = 8;   /* "key": "value", */
     uint32_t pool_extra = 8;        /* '"pool_name": { ' + ' }' */
     uint32_t server_extra = 8;      /* '"server_name": { ' + ' }' */
+    uint32_t histo_extra = 6;       /* '_p999' */
+    uint32_t cmd_extra = 16;        /* '_response_bytes' or '_latency' */
+    uint32_t hotkey_extra = 24;     /* '"hotkeys": { ' + ' }' + '...' */
+    uint32_t bigkey_extra = 64;     /* field names of a big key entry */
+    uint32_t histo_nkey = NELEMS(stats_histo_quantiles) + 2; /* + count, max */
     size_t size = 0;
     uint32_t i;
 
@@ -386,6 +676,18 @@ stats_create_buf(struct stats *st)
     size += int64_max_digits;
     size += key_value_extra;
 
+    size += st->log_nrecord_str.len;
+    size += int64_max_digits;
+    size += key_value_extra;
+
+    size += st->log_ndrop_str.len;
+    size += int64_max_digits;
+    size += key_value_extra;
+
+    size += st->log_backlog_str.len;
+    size += int64_max_digits;
+    size += key_value_extra;
+
     /* server pools */
     for (i = 0; i < array_n(&st->sum); i++) {
         struct stats_pool *stp = array_get(&st->sum, i);
@@ -402,6 +704,50 @@ stats_create_buf(struct stats *st)
             size += key_value_extra;
         }
 
+        for (j = 0; j < array_n(&stp->histo); j++) {
+            struct stats_histo *sth = array_get(&stp->histo, j);
+
+            size += histo_nkey * (sth->name.len + histo_extra +
+                                  int64_max_digits + key_value_extra);
+        }
+
+        for (j = 0; j < array_n(&stp->cmd); j++) {
+            struct stats_cmd *stc = array_get(&stp->cmd, j);
+
+            if (stc->name.len == 0) {
+                continue;
+            }
+
+            size += (STATS_CMD_NFIELD + histo_nkey) *
+                    (stc->name.len + cmd_extra + histo_extra +
+                     int64_max_digits + key_value_extra);
+        }
+
+        /* hot keys are escaped, a byte takes at most 6 bytes ('\u00ff') */
+        if (stp->hotkey.nalloc != 0) {
+            size += hotkey_extra;
+            size += stp->hotkey.nalloc * (STATS_KEY_NAME_LEN +
+                                          int64_max_digits + key_value_extra);
+        }
+
+        if (stp->bigkey.nalloc != 0) {
+            uint32_t server_name_len = sizeof("unknown");
+
+            for (j = 0; j < array_n(&stp->server); j++) {
+                struct stats_server *sts = array_get(&stp->server, j);
+
+                server_name_len = MAX(server_name_len, sts->name.len);
+            }
+
+            size += hotkey_extra;
+            size += stp->bigkey.nalloc * (STATS_KEY_NAME_LEN + pool_extra +
+                                          bigkey_extra + STATS_CMD_NAME_LEN +
+                                          server_name_len +
+                                          STATS_BIGKEY_NFIELD *
+                                          (int64_max_digits +
+                                           key_value_extra));
+        }
+
         /* servers per pool */
         for (j = 0; j < array_n(&stp->server); j++) {
             struct stats_server *sts = array_get(&stp->server, j);
@@ -417,6 +763,13 @@ stats_create_buf(struct stats *st)
                 size += int64_max_digits;
                 size += key_value_extra;
             }
+
+            for (k = 0; k < array_n(&sts->histo); k++) {
+                struct stats_histo *sth = array_get(&sts->histo, k);
+
+                size += histo_nkey * (sth->name.len + histo_extra +
+                                      int64_max_digits + key_value_extra);
+            }
         }
     }
 
@@ -446,6 +799,13 @@ stats_destroy_buf(struct stats *st)
         nc_free(st->buf.data);
         st->buf.size = 0;
     }
+
+    if (st->prom.size != 0) {
+        ASSERT(st->prom.data != NULL);
+        nc_free(st->prom.data);
+        st->prom.len = 0;
+        st->prom.size = 0;
+    }
 }
 
 static rstatus_t
@@ -494,12 +854,37 @@ stats_add_num(struct stats *st, struct string *key, int64_t val)
     return NC_OK;
 }
 
+static rstatus_t
+stats_add_key(struct stats *st, struct string *name, char *infix,
+              struct string *suffix, int64_t val)
+{
+    struct stats_buffer *buf;
+    uint8_t *pos;
+    size_t room;
+    int n;
+
+    buf = &st->buf;
+    pos = buf->data + buf->len;
+    room = buf->size - buf->len - 1;
+
+    n = nc_snprintf(pos, room, "\"%.*s_%s%.*s\":%"PRId64", ", name->len,
+                    name->data, infix, suffix->len, suffix->data, val);
+    if (n < 0 || n >= (int)room) {
+        return NC_ERROR;
+    }
+
+    buf->len += (size_t)n;
+
+    return NC_OK;
+}
+
 static rstatus_t
 stats_add_header(struct stats *st)
 {
     rstatus_t status;
     struct stats_buffer *buf;
     int64_t cur_ts, uptime;
+    uint64_t log_nrecord, log_ndrop, log_backlog;
 
     buf = &st->buf;
     buf->data[0] = '{';
@@ -543,6 +928,23 @@ stats_add_header(struct stats *st)
         return status;
     }
 
+    log_counters(&log_nrecord, &log_ndrop, &log_backlog);
+
+    status = stats_add_num(st, &st->log_nrecord_str, (int64_t)log_nrecord);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    status = stats_add_num(st, &st->log_ndrop_str, (int64_t)log_ndrop);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    status = stats_add_num(st, &st->log_backlog_str, (int64_t)log_backlog);
+    if (status != NC_OK) {
+        return status;
+    }
+
     return NC_OK;
 }
 
@@ -644,164 +1046,1464 @@ stats_copy_metric(struct stats *st, struct array *metric)
     return NC_OK;
 }
 
-static void
-stats_aggregate_metric(struct array *dst, struct array *src)
+static rstatus_t
+stats_copy_histo_keys(struct stats *st, struct string *name, char *infix,
+                      struct histo *h)
 {
+    rstatus_t status;
+    struct string suffix;
     uint32_t i;
 
-    for (i = 0; i < array_n(src); i++) {
-        struct stats_metric *stm1, *stm2;
-
-        stm1 = array_get(src, i);
-        stm2 = array_get(dst, i);
+    string_set_text(&suffix, "count");
+    status = stats_add_key(st, name, infix, &suffix, (int64_t)h->count);
+    if (status != NC_OK) {
+        return status;
+    }
 
-        ASSERT(stm1->type == stm2->type);
+    for (i = 0; i < NELEMS(stats_histo_quantiles); i++) {
+        string_set_raw(&suffix, stats_histo_quantiles[i].suffix);
+        status = stats_add_key(st, name, infix, &suffix,
+                               (int64_t)histo_percentile(h,
+                                   stats_histo_quantiles[i].q));
+        if (status != NC_OK) {
+            return status;
+        }
+    }
 
-        switch (stm1->type) {
-        case STATS_COUNTER:
-            stm2->value.counter += stm1->value.counter;
-            break;
+    string_set_text(&suffix, "max");
+    status = stats_add_key(st, name, infix, &suffix, (int64_t)h->max);
+    if (status != NC_OK) {
+        return status;
+    }
 
-        case STATS_GAUGE:
-            stm2->value.counter += stm1->value.counter;
-            break;
+    return NC_OK;
+}
+
+static rstatus_t
+stats_copy_histo(struct stats *st, struct array *stats_histo)
+{
+    rstatus_t status;
+    uint32_t i;
+
+    for (i = 0; i < array_n(stats_histo); i++) {
+        struct stats_histo *sth = array_get(stats_histo, i);
+
+        status = stats_copy_histo_keys(st, &sth->name, "", &sth->histo);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    return NC_OK;
+}
+
+/* only commands that were seen are reported to keep the output readable */
+static rstatus_t
+stats_copy_cmd(struct stats *st, struct array *stats_cmd)
+{
+    rstatus_t status;
+    uint32_t i, j;
+
+    for (i = 0; i < array_n(stats_cmd); i++) {
+        struct stats_cmd *stc = array_get(stats_cmd, i);
+
+        if (stc->name.len == 0 || (stc->value[STATS_CMD_requests] == 0 &&
+                                   stc->value[STATS_CMD_errors] == 0)) {
+            continue;
+        }
 
-        case STATS_TIMESTAMP:
-            if (stm1->value.timestamp) {
-                stm2->value.timestamp = stm1->value.timestamp;
+        for (j = 0; j < STATS_CMD_NFIELD; j++) {
+            status = stats_add_key(st, &stc->name, "",
+                                   &stats_cmd_field_names[j], stc->value[j]);
+            if (status != NC_OK) {
+                return status;
             }
-            break;
+        }
 
-        default:
-            NOT_REACHED();
+        status = stats_copy_histo_keys(st, &stc->name, "latency_",
+                                       &stc->histo);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    return NC_OK;
+}
+
+/*
+ * Escape a key prefix for a json string or an openmetrics label value, and
+ * mark keys of which only a prefix of max bytes was kept with '...'
+ */
+static uint32_t
+stats_key_name(uint8_t *dst, uint8_t *key, uint32_t key_len, uint32_t max,
+               bool json)
+{
+    static const char hex[] = "0123456789abcdef";
+    uint8_t *p = dst;
+    uint32_t i, len;
+
+    len = MIN(key_len, max);
+
+    for (i = 0; i < len; i++) {
+        uint8_t ch = key[i];
+
+        if (!json || (ch >= 0x20 && ch < 0x7f && ch != '"' && ch != '\\')) {
+            *p++ = ch;
+        } else if (ch == '"' || ch == '\\') {
+            *p++ = '\\';
+            *p++ = ch;
+        } else {
+            *p++ = '\\';
+            *p++ = 'u';
+            *p++ = '0';
+            *p++ = '0';
+            *p++ = (uint8_t)hex[ch >> 4];
+            *p++ = (uint8_t)hex[ch & 0xf];
+        }
+    }
+
+    if (key_len > max) {
+        nc_memcpy(p, "...", 3);
+        p += 3;
+    }
+
+    return (uint32_t)(p - dst);
+}
+
+/* hot keys of the last window with their request rate, busiest first */
+static rstatus_t
+stats_copy_hotkey(struct stats *st, struct array *stats_hotkey)
+{
+    rstatus_t status;
+    struct string name;
+    uint8_t buf[STATS_KEY_NAME_LEN];
+    uint32_t i;
+
+    if (array_n(stats_hotkey) == 0) {
+        return NC_OK;
+    }
+
+    string_set_text(&name, "hotkeys");
+    status = stats_begin_nesting(st, &name);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    for (i = 0; i < array_n(stats_hotkey); i++) {
+        struct hotkey_stat *hs = array_get(stats_hotkey, i);
+
+        name.data = buf;
+        name.len = stats_key_name(buf, hs->key, hs->key_len, HOTKEY_KEY_LEN,
+                                  true);
+
+        status = stats_add_num(st, &name, (int64_t)hs->rate);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    return stats_end_nesting(st);
+}
+
+static int
+stats_bigkey_cmp(const void *t1, const void *t2)
+{
+    const struct stats_bigkey *b1 = t1, *b2 = t2;
+
+    if (b1->size == b2->size) {
+        return 0;
+    }
+
+    return b1->size > b2->size ? -1 : 1;
+}
+
+static struct string *
+stats_bigkey_server(struct stats_pool *stp, struct stats_bigkey *bk)
+{
+    static struct string unknown = string("unknown");
+    struct stats_server *sts;
+
+    if (bk->server >= array_n(&stp->server)) {
+        return &unknown;
+    }
+
+    sts = array_get(&stp->server, bk->server);
+
+    return &sts->name;
+}
+
+/* largest responses by key, largest first */
+static rstatus_t
+stats_copy_bigkey(struct stats *st, struct stats_pool *stp)
+{
+    rstatus_t status;
+    struct string name, key;
+    uint8_t buf[STATS_KEY_NAME_LEN];
+    uint32_t i;
+
+    if (array_n(&stp->bigkey) == 0) {
+        return NC_OK;
+    }
+
+    array_sort(&stp->bigkey, stats_bigkey_cmp);
+
+    string_set_text(&name, "bigkeys");
+    status = stats_begin_nesting(st, &name);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    for (i = 0; i < array_n(&stp->bigkey); i++) {
+        struct stats_bigkey *bk = array_get(&stp->bigkey, i);
+
+        key.data = buf;
+        key.len = stats_key_name(buf, bk->key, bk->key_len,
+                                 STATS_BIGKEY_KEY_LEN, true);
+
+        status = stats_begin_nesting(st, &key);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        string_set_text(&name, "command");
+        status = stats_add_string(st, &name, &stats_cmd_names[bk->type]);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        string_set_text(&name, "server");
+        status = stats_add_string(st, &name, stats_bigkey_server(stp, bk));
+        if (status != NC_OK) {
+            return status;
+        }
+
+        string_set_text(&name, "size");
+        status = stats_add_num(st, &name, (int64_t)bk->size);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        string_set_text(&name, "count");
+        status = stats_add_num(st, &name, (int64_t)bk->count);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        string_set_text(&name, "last");
+        status = stats_add_num(st, &name, bk->last);
+        if (status != NC_OK) {
+            return status;
         }
+
+        status = stats_end_nesting(st);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    return stats_end_nesting(st);
+}
+
+/*
+ * Histograms only grow, so an unchanged count means an unchanged histogram
+ * and the bucket array does not need to be copied again
+ */
+static void
+stats_snapshot_histo(struct histo *dst, struct histo *src)
+{
+    if (dst->count != src->count) {
+        *dst = *src;
     }
 }
 
 static void
-stats_aggregate(struct stats *st)
+stats_snapshot_metric(struct array *dst, struct array *src)
 {
     uint32_t i;
 
-    if (st->aggregate == 0) {
-        log_debug(LOG_PVERB, "skip aggregate of shadow %p to sum %p as "
-                  "generator is slow", st->shadow.elem, st->sum.elem);
-        return;
+    for (i = 0; i < array_n(src); i++) {
+        struct stats_metric *stm1, *stm2;
+
+        stm1 = array_get(src, i);
+        stm2 = array_get(dst, i);
+
+        ASSERT(stm1->type == stm2->type);
+
+        stm2->value = stm1->value;
+    }
+}
+
+/* copy list src, when it changed, unless it keeps changing under us */
+static void
+stats_snapshot_list(struct array *dst, uint64_t *dst_gen, struct array *src,
+                    uint64_t *src_gen)
+{
+    uint64_t gen;
+    int i;
+
+    for (i = 0; i < STATS_LIST_RETRY; i++) {
+        gen = __atomic_load_n(src_gen, __ATOMIC_ACQUIRE);
+        if (gen == *dst_gen) {
+            return;
+        }
+        if ((gen & 1) != 0) {
+            continue;
+        }
+
+        stats_list_set(dst, src->elem, array_n(src));
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(src_gen, __ATOMIC_RELAXED) == gen) {
+            *dst_gen = gen;
+            return;
+        }
     }
+}
 
-    log_debug(LOG_PVERB, "aggregate stats shadow %p to sum %p", st->shadow.elem,
-              st->sum.elem);
+static void
+stats_snapshot_pool(struct array *dst, struct array *src)
+{
+    uint32_t i;
 
-    for (i = 0; i < array_n(&st->shadow); i++) {
+    for (i = 0; i < array_n(src); i++) {
         struct stats_pool *stp1, *stp2;
         uint32_t j;
 
-        stp1 = array_get(&st->shadow, i);
-        stp2 = array_get(&st->sum, i);
-        stats_aggregate_metric(&stp2->metric, &stp1->metric);
+        stp1 = array_get(src, i);
+        stp2 = array_get(dst, i);
+
+        stats_snapshot_metric(&stp2->metric, &stp1->metric);
+
+        for (j = 0; j < array_n(&stp1->histo); j++) {
+            struct stats_histo *sth1 = array_get(&stp1->histo, j);
+            struct stats_histo *sth2 = array_get(&stp2->histo, j);
+
+            stats_snapshot_histo(&sth2->histo, &sth1->histo);
+        }
+
+        for (j = 0; j < array_n(&stp1->cmd); j++) {
+            struct stats_cmd *stc1 = array_get(&stp1->cmd, j);
+            struct stats_cmd *stc2 = array_get(&stp2->cmd, j);
+
+            memcpy(stc2->value, stc1->value, sizeof(stc2->value));
+            stats_snapshot_histo(&stc2->histo, &stc1->histo);
+        }
+
+        stats_snapshot_list(&stp2->hotkey, &stp2->hotkey_gen, &stp1->hotkey,
+                            &stp1->hotkey_gen);
+        stats_snapshot_list(&stp2->bigkey, &stp2->bigkey_gen, &stp1->bigkey,
+                            &stp1->bigkey_gen);
 
         for (j = 0; j < array_n(&stp1->server); j++) {
             struct stats_server *sts1, *sts2;
+            uint32_t k;
 
             sts1 = array_get(&stp1->server, j);
             sts2 = array_get(&stp2->server, j);
-            stats_aggregate_metric(&sts2->metric, &sts1->metric);
+            stats_snapshot_metric(&sts2->metric, &sts1->metric);
+
+            for (k = 0; k < array_n(&sts1->histo); k++) {
+                struct stats_histo *sth1 = array_get(&sts1->histo, k);
+                struct stats_histo *sth2 = array_get(&sts2->histo, k);
+
+                stats_snapshot_histo(&sth2->histo, &sth1->histo);
+            }
+        }
+    }
+}
+
+/*
+ * Stats are recorded by the event loop with plain increments into current
+ * (a), which is never reset, and nothing else: no lock, no flag and no
+ * copy. Once per interval the stats thread reads current (a) as it is
+ * into sum (c). Counters are word sized and only grow, so each one it
+ * reads is a value the counter had; the hot key and big key lists, which
+ * are changed in place, are read under their sequence.
+ */
+static void
+stats_aggregate(struct stats *st)
+{
+    int64_t now;
+
+    now = nc_msec_now();
+    if (now >= 0 && st->interval > 0 &&
+        now - st->aggregate_ts < st->interval) {
+        return;
+    }
+    st->aggregate_ts = now;
+
+    log_debug(LOG_PVERB, "aggregate stats current %p to sum %p",
+              st->current.elem, st->sum.elem);
+
+    stats_snapshot_pool(&st->sum, &st->current);
+
+    st->sum_gen++;
+}
+
+static rstatus_t
+stats_make_rsp(struct stats *st)
+{
+    rstatus_t status;
+    uint32_t i;
+
+    status = stats_add_header(st);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    for (i = 0; i < array_n(&st->sum); i++) {
+        struct stats_pool *stp = array_get(&st->sum, i);
+        uint32_t j;
+
+        status = stats_begin_nesting(st, &stp->name);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        /* copy pool metric from sum(c) to buffer */
+        status = stats_copy_metric(st, &stp->metric);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        status = stats_copy_histo(st, &stp->histo);
+        if (status != NC_OK) {
+            return status;
         }
+
+        status = stats_copy_cmd(st, &stp->cmd);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        status = stats_copy_hotkey(st, &stp->hotkey);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        status = stats_copy_bigkey(st, stp);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        for (j = 0; j < array_n(&stp->server); j++) {
+            struct stats_server *sts = array_get(&stp->server, j);
+
+            status = stats_begin_nesting(st, &sts->name);
+            if (status != NC_OK) {
+                return status;
+            }
+
+            /* copy server metric from sum(c) to buffer */
+            status = stats_copy_metric(st, &sts->metric);
+            if (status != NC_OK) {
+                return status;
+            }
+
+            status = stats_copy_histo(st, &sts->histo);
+            if (status != NC_OK) {
+                return status;
+            }
+
+            status = stats_end_nesting(st);
+            if (status != NC_OK) {
+                return status;
+            }
+        }
+
+        status = stats_end_nesting(st);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    status = stats_add_footer(st);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    return NC_OK;
+}
+
+/*
+ * OpenMetrics exposition. Every metric family is rendered as a contiguous
+ * block with pool, server and command labels. The body only depends on
+ * sum (c), so it is rendered into the reusable prom buffer once per
+ * aggregation and served as is to every scrape in between.
+ */
+
+static rstatus_t
+stats_prom_grow(struct stats_buffer *buf, size_t need)
+{
+    uint8_t *data;
+    size_t size;
+
+    size = MAX(buf->size * 2, buf->len + need);
+    size = MAX(size, STATS_PROM_MIN_SIZE);
+    size = NC_ALIGN(size, NC_ALIGNMENT);
+
+    data = nc_realloc(buf->data, size);
+    if (data == NULL) {
+        log_error("grow prom stats buffer to %zu failed: %s", size,
+                  strerror(errno));
+        return NC_ENOMEM;
+    }
+    buf->data = data;
+    buf->size = size;
+
+    return NC_OK;
+}
+
+static rstatus_t
+stats_prom_add(struct stats *st, const char *fmt, ...)
+{
+    rstatus_t status;
+    struct stats_buffer *buf;
+    va_list args;
+    size_t room;
+    int n;
+
+    buf = &st->prom;
+
+    for (;;) {
+        room = buf->size - buf->len;
+        if (room > 0) {
+            va_start(args, fmt);
+            n = nc_vsnprintf(buf->data + buf->len, room, fmt, args);
+            va_end(args);
+            if (n < 0) {
+                return NC_ERROR;
+            }
+            if ((size_t)n < room) {
+                buf->len += (size_t)n;
+                return NC_OK;
+            }
+        } else {
+            n = 0;
+        }
+
+        status = stats_prom_grow(buf, (size_t)n + 1);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+}
+
+/* append a label value, escaping '\', '"' and newline */
+static rstatus_t
+stats_prom_add_label(struct stats *st, const char *key, struct string *val)
+{
+    rstatus_t status;
+    struct stats_buffer *buf;
+    uint32_t i;
+
+    buf = &st->prom;
+
+    status = stats_prom_add(st, "%s=\"", key);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    for (i = 0; i < val->len; i++) {
+        uint8_t ch = val->data[i];
+
+        if (buf->size - buf->len < 2) {
+            status = stats_prom_grow(buf, 2);
+            if (status != NC_OK) {
+                return status;
+            }
+        }
+
+        switch (ch) {
+        case '\\':
+        case '"':
+            buf->data[buf->len++] = '\\';
+            buf->data[buf->len++] = ch;
+            break;
+
+        case '\n':
+            buf->data[buf->len++] = '\\';
+            buf->data[buf->len++] = 'n';
+            break;
+
+        default:
+            buf->data[buf->len++] = ch;
+            break;
+        }
+    }
+
+    return stats_prom_add(st, "\"");
+}
+
+/* append '{pool="..",server="..",command=".."' without the closing brace */
+static rstatus_t
+stats_prom_add_labels(struct stats *st, struct stats_pool *stp,
+                      struct stats_server *sts, struct stats_cmd *stc)
+{
+    rstatus_t status;
+
+    status = stats_prom_add(st, "{");
+    if (status != NC_OK) {
+        return status;
+    }
+
+    status = stats_prom_add_label(st, "pool", &stp->name);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    if (sts != NULL) {
+        status = stats_prom_add(st, ",");
+        if (status != NC_OK) {
+            return status;
+        }
+
+        status = stats_prom_add_label(st, "server", &sts->name);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    if (stc != NULL) {
+        status = stats_prom_add(st, ",");
+        if (status != NC_OK) {
+            return status;
+        }
+
+        status = stats_prom_add_label(st, "command", &stc->name);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    return NC_OK;
+}
+
+/*
+ * Metric names are nutcracker_<scope>_<name>, unless the name already
+ * starts with the scope (e.g. server_eof)
+ */
+static const char *
+stats_prom_scope(const char *scope, struct string *name)
+{
+    size_t len = strlen(scope);
+
+    if (name->len > len && nc_strncmp(name->data, scope, len) == 0) {
+        return "";
+    }
+
+    return scope;
+}
+
+static rstatus_t
+stats_prom_add_family(struct stats *st, const char *scope, struct string *name,
+                      const char *type, const char *help)
+{
+    scope = stats_prom_scope(scope, name);
+
+    return stats_prom_add(st, "# TYPE nutcracker_%s%.*s %s\n"
+                          "# HELP nutcracker_%s%.*s %s\n",
+                          scope, name->len, name->data, type,
+                          scope, name->len, name->data, help);
+}
+
+static rstatus_t
+stats_prom_add_sample(struct stats *st, const char *scope, struct string *name,
+                      const char *suffix, struct stats_pool *stp,
+                      struct stats_server *sts, struct stats_cmd *stc,
+                      int64_t val)
+{
+    rstatus_t status;
+
+    scope = stats_prom_scope(scope, name);
+
+    status = stats_prom_add(st, "nutcracker_%s%.*s%s", scope, name->len,
+                            name->data, suffix);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    status = stats_prom_add_labels(st, stp, sts, stc);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    return stats_prom_add(st, "} %"PRId64"\n", val);
+}
+
+/*
+ * Histogram buckets are collapsed to power of two boundaries so that every
+ * histogram exposes the same small set of le labels
+ */
+static rstatus_t
+stats_prom_add_histo(struct stats *st, const char *scope, struct string *name,
+                     struct stats_pool *stp, struct stats_server *sts,
+                     struct stats_cmd *stc, struct histo *h)
+{
+    rstatus_t status;
+    uint64_t cum, le;
+    uint32_t i;
+
+    scope = stats_prom_scope(scope, name);
+
+    cum = 0;
+    for (i = 0; i < HISTO_NBUCKET; i++) {
+        cum += h->bucket[i];
+
+        le = histo_bucket_value(i);
+        if (le == 0 || ((le + 1) & le) != 0) {
+            continue;
+        }
+
+        status = stats_prom_add(st, "nutcracker_%s%.*s_bucket", scope,
+                                name->len, name->data);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        status = stats_prom_add_labels(st, stp, sts, stc);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        status = stats_prom_add(st, ",le=\"%"PRIu64".0\"} %"PRIu64"\n", le,
+                                cum);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    status = stats_prom_add(st, "nutcracker_%s%.*s_bucket", scope, name->len,
+                            name->data);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    status = stats_prom_add_labels(st, stp, sts, stc);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    status = stats_prom_add(st, ",le=\"+Inf\"} %"PRIu64"\n", h->count);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    status = stats_prom_add_sample(st, scope, name, "_count", stp, sts, stc,
+                                   (int64_t)h->count);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    return stats_prom_add_sample(st, scope, name, "_sum", stp, sts, stc,
+                                 (int64_t)h->sum);
+}
+
+static const char *
+stats_prom_type(stats_type_t type)
+{
+    return type == STATS_COUNTER ? "counter" : "gauge";
+}
+
+static const char *
+stats_prom_suffix(stats_type_t type)
+{
+    return type == STATS_COUNTER ? "_total" : "";
+}
+
+static bool
+stats_prom_cmd_seen(struct stats_cmd *stc)
+{
+    return stc->name.len != 0 && (stc->value[STATS_CMD_requests] != 0 ||
+                                  stc->value[STATS_CMD_errors] != 0);
+}
+
+static rstatus_t
+stats_prom_make_hotkey(struct stats *st)
+{
+    rstatus_t status;
+    uint32_t i, j;
+    struct string name, key;
+    uint8_t buf[STATS_KEY_NAME_LEN];
+
+    string_set_text(&name, "hotkey_rate");
+    status = stats_prom_add_family(st, "pool_", &name, "gauge",
+                                   "requests per sec of a hot key in the "
+                                   "last window");
+    if (status != NC_OK) {
+        return status;
+    }
+
+    for (i = 0; i < array_n(&st->sum); i++) {
+        struct stats_pool *stp = array_get(&st->sum, i);
+
+        for (j = 0; j < array_n(&stp->hotkey); j++) {
+            struct hotkey_stat *hs = array_get(&stp->hotkey, j);
+
+            status = stats_prom_add(st, "nutcracker_pool_hotkey_rate");
+            if (status != NC_OK) {
+                return status;
+            }
+
+            status = stats_prom_add_labels(st, stp, NULL, NULL);
+            if (status != NC_OK) {
+                return status;
+            }
+
+            key.data = buf;
+            key.len = stats_key_name(buf, hs->key, hs->key_len,
+                                     HOTKEY_KEY_LEN, false);
+
+            status = stats_prom_add(st, ",");
+            if (status != NC_OK) {
+                return status;
+            }
+
+            status = stats_prom_add_label(st, "key", &key);
+            if (status != NC_OK) {
+                return status;
+            }
+
+            status = stats_prom_add(st, "} %"PRIu64"\n", hs->rate);
+            if (status != NC_OK) {
+                return status;
+            }
+        }
+    }
+
+    return NC_OK;
+}
+
+static rstatus_t
+stats_prom_make_bigkey(struct stats *st)
+{
+    rstatus_t status;
+    uint32_t i, j;
+    struct string name, key;
+    uint8_t buf[STATS_KEY_NAME_LEN];
+
+    string_set_text(&name, "bigkey_bytes");
+    status = stats_prom_add_family(st, "pool_", &name, "gauge",
+                                   "largest response in bytes of a big key");
+    if (status != NC_OK) {
+        return status;
+    }
+
+    for (i = 0; i < array_n(&st->sum); i++) {
+        struct stats_pool *stp = array_get(&st->sum, i);
+
+        for (j = 0; j < array_n(&stp->bigkey); j++) {
+            struct stats_bigkey *bk = array_get(&stp->bigkey, j);
+
+            status = stats_prom_add(st, "nutcracker_pool_bigkey_bytes");
+            if (status != NC_OK) {
+                return status;
+            }
+
+            status = stats_prom_add_labels(st, stp, NULL, NULL);
+            if (status != NC_OK) {
+                return status;
+            }
+
+            status = stats_prom_add(st, ",");
+            if (status != NC_OK) {
+                return status;
+            }
+
+            status = stats_prom_add_label(st, "server",
+                                          stats_bigkey_server(stp, bk));
+            if (status != NC_OK) {
+                return status;
+            }
+
+            status = stats_prom_add(st, ",");
+            if (status != NC_OK) {
+                return status;
+            }
+
+            status = stats_prom_add_label(st, "command",
+                                          &stats_cmd_names[bk->type]);
+            if (status != NC_OK) {
+                return status;
+            }
+
+            key.data = buf;
+            key.len = stats_key_name(buf, bk->key, bk->key_len,
+                                     STATS_BIGKEY_KEY_LEN, false);
+
+            status = stats_prom_add(st, ",");
+            if (status != NC_OK) {
+                return status;
+            }
+
+            status = stats_prom_add_label(st, "key", &key);
+            if (status != NC_OK) {
+                return status;
+            }
+
+            status = stats_prom_add(st, "} %"PRIu64"\n", bk->size);
+            if (status != NC_OK) {
+                return status;
+            }
+        }
+    }
+
+    return NC_OK;
+}
+
+static rstatus_t
+stats_prom_make_pool(struct stats *st)
+{
+    rstatus_t status;
+    uint32_t i, j;
+    struct string name;
+
+    for (j = 0; j < STATS_POOL_NFIELD; j++) {
+        status = stats_prom_add_family(st, "pool_", &stats_pool_codec[j].name,
+                                       stats_prom_type(stats_pool_codec[j].type),
+                                       stats_pool_desc[j].desc);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        for (i = 0; i < array_n(&st->sum); i++) {
+            struct stats_pool *stp = array_get(&st->sum, i);
+            struct stats_metric *stm = array_get(&stp->metric, j);
+
+            status = stats_prom_add_sample(st, "pool_", &stm->name,
+                                           stats_prom_suffix(stm->type),
+                                           stp, NULL, NULL,
+                                           stm->value.counter);
+            if (status != NC_OK) {
+                return status;
+            }
+        }
+    }
+
+    for (j = 0; j < STATS_POOL_NHISTO; j++) {
+        status = stats_prom_add_family(st, "pool_", &stats_pool_histo_names[j],
+                                       "histogram",
+                                       stats_pool_histo_desc[j].desc);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        for (i = 0; i < array_n(&st->sum); i++) {
+            struct stats_pool *stp = array_get(&st->sum, i);
+            struct stats_histo *sth = array_get(&stp->histo, j);
+
+            status = stats_prom_add_histo(st, "pool_", &sth->name, stp, NULL,
+                                          NULL, &sth->histo);
+            if (status != NC_OK) {
+                return status;
+            }
+        }
+    }
+
+    for (j = 0; j < STATS_CMD_NFIELD; j++) {
+        status = stats_prom_add_family(st, "command_", &stats_cmd_field_names[j],
+                                       "counter", stats_cmd_desc[j].desc);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        for (i = 0; i < array_n(&st->sum); i++) {
+            struct stats_pool *stp = array_get(&st->sum, i);
+            uint32_t k;
+
+            for (k = 0; k < array_n(&stp->cmd); k++) {
+                struct stats_cmd *stc = array_get(&stp->cmd, k);
+
+                if (!stats_prom_cmd_seen(stc)) {
+                    continue;
+                }
+
+                status = stats_prom_add_sample(st, "command_",
+                                               &stats_cmd_field_names[j],
+                                               "_total", stp, NULL, stc,
+                                               stc->value[j]);
+                if (status != NC_OK) {
+                    return status;
+                }
+            }
+        }
+    }
+
+    string_set_text(&name, "latency");
+    status = stats_prom_add_family(st, "command_", &name, "histogram",
+                                   "command latency in usec");
+    if (status != NC_OK) {
+        return status;
+    }
+
+    for (i = 0; i < array_n(&st->sum); i++) {
+        struct stats_pool *stp = array_get(&st->sum, i);
+
+        for (j = 0; j < array_n(&stp->cmd); j++) {
+            struct stats_cmd *stc = array_get(&stp->cmd, j);
+
+            if (!stats_prom_cmd_seen(stc)) {
+                continue;
+            }
+
+            status = stats_prom_add_histo(st, "command_", &name, stp, NULL,
+                                          stc, &stc->histo);
+            if (status != NC_OK) {
+                return status;
+            }
+        }
+    }
+
+    status = stats_prom_make_hotkey(st);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    return stats_prom_make_bigkey(st);
+}
+
+static rstatus_t
+stats_prom_make_server(struct stats *st)
+{
+    rstatus_t status;
+    uint32_t i, j, k;
+
+    for (k = 0; k < STATS_SERVER_NFIELD; k++) {
+        status = stats_prom_add_family(st, "server_",
+                                       &stats_server_codec[k].name,
+                                       stats_prom_type(stats_server_codec[k].type),
+                                       stats_server_desc[k].desc);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        for (i = 0; i < array_n(&st->sum); i++) {
+            struct stats_pool *stp = array_get(&st->sum, i);
+
+            for (j = 0; j < array_n(&stp->server); j++) {
+                struct stats_server *sts = array_get(&stp->server, j);
+                struct stats_metric *stm = array_get(&sts->metric, k);
+
+                status = stats_prom_add_sample(st, "server_", &stm->name,
+                                               stats_prom_suffix(stm->type),
+                                               stp, sts, NULL,
+                                               stm->value.counter);
+                if (status != NC_OK) {
+                    return status;
+                }
+            }
+        }
+    }
+
+    for (k = 0; k < STATS_SERVER_NHISTO; k++) {
+        status = stats_prom_add_family(st, "server_",
+                                       &stats_server_histo_names[k],
+                                       "histogram",
+                                       stats_server_histo_desc[k].desc);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        for (i = 0; i < array_n(&st->sum); i++) {
+            struct stats_pool *stp = array_get(&st->sum, i);
+
+            for (j = 0; j < array_n(&stp->server); j++) {
+                struct stats_server *sts = array_get(&stp->server, j);
+                struct stats_histo *sth = array_get(&sts->histo, k);
+
+                status = stats_prom_add_histo(st, "server_", &sth->name, stp,
+                                              sts, NULL, &sth->histo);
+                if (status != NC_OK) {
+                    return status;
+                }
+            }
+        }
+    }
+
+    return NC_OK;
+}
+
+static rstatus_t
+stats_prom_make_rsp(struct stats *st)
+{
+    rstatus_t status;
+
+    if (st->prom_gen == st->sum_gen && st->prom.len != 0) {
+        log_debug(LOG_VERB, "reuse prom stats of %zu bytes", st->prom.len);
+        return NC_OK;
+    }
+
+    st->prom.len = 0;
+
+    status = stats_prom_make_pool(st);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    status = stats_prom_make_server(st);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    status = stats_prom_add(st, "# EOF\n");
+    if (status != NC_OK) {
+        return status;
+    }
+
+    st->prom_gen = st->sum_gen;
+
+    return NC_OK;
+}
+
+/*
+ * Read the request of an accepted stats connection, without waiting. HTTP
+ * clients send theirs right after connecting, while legacy clients just
+ * read the JSON dump and send nothing.
+ */
+static stats_http_t
+stats_http_request(int sd)
+{
+    char req[STATS_HTTP_REQ_LEN];
+    ssize_t n;
+
+    n = recv(sd, req, sizeof(req) - 1, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return STATS_HTTP_WAITING;
+    }
+
+    if (n < 4 || memcmp(req, "GET ", 4) != 0) {
+        return STATS_HTTP_NONE;
+    }
+    req[n] = '\0';
+
+    if (strncmp(req + 4, "/metrics", 8) == 0 &&
+        (req[12] == ' ' || req[12] == '?')) {
+        return STATS_HTTP_METRICS;
+    }
+
+    if (req[4] == '/' && (req[5] == ' ' || req[5] == '?')) {
+        return STATS_HTTP_JSON;
+    }
+
+    return STATS_HTTP_NOT_FOUND;
+}
+
+/*
+ * Write what the socket of hc takes now, without blocking, and keep a
+ * copy of the rest in hc for stats_http_flush.
+ */
+static rstatus_t
+stats_http_write(struct stats_http_conn *hc, struct iovec *iov, int iovcnt)
+{
+    ssize_t n;
+    size_t sent, left;
+    uint8_t *p;
+    int i;
+
+    for (;;) {
+        n = nc_writev(hc->sd, iov, iovcnt);
+        if (n >= 0) {
+            break;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            n = 0;
+            break;
+        }
+        return NC_ERROR;
+    }
+
+    sent = (size_t)n;
+    left = 0;
+    for (i = 0; i < iovcnt; i++) {
+        if (sent >= iov[i].iov_len) {
+            sent -= iov[i].iov_len;
+            iov[i].iov_len = 0;
+            continue;
+        }
+        iov[i].iov_base = (uint8_t *)iov[i].iov_base + sent;
+        iov[i].iov_len -= sent;
+        left += iov[i].iov_len;
+        sent = 0;
+    }
+
+    if (left == 0) {
+        return NC_OK;
+    }
+
+    hc->out = nc_alloc(left);
+    if (hc->out == NULL) {
+        return NC_ENOMEM;
+    }
+    hc->nout = left;
+    hc->pos = 0;
+    hc->since = nc_msec_now();
+
+    for (i = 0, p = hc->out; i < iovcnt; i++) {
+        nc_memcpy(p, iov[i].iov_base, iov[i].iov_len);
+        p += iov[i].iov_len;
+    }
+
+    return NC_EAGAIN;
+}
+
+/* write the output hc still holds, NC_EAGAIN while some is left */
+static rstatus_t
+stats_http_flush(struct stats_http_conn *hc)
+{
+    ssize_t n;
+
+    while (hc->pos < hc->nout) {
+        n = nc_write(hc->sd, hc->out + hc->pos, hc->nout - hc->pos);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return NC_EAGAIN;
+            }
+            return NC_ERROR;
+        }
+        hc->pos += (size_t)n;
+    }
+
+    return NC_OK;
+}
+
+static void
+stats_http_done(struct stats_http_conn *hc)
+{
+    if (hc->out != NULL) {
+        nc_free(hc->out);
+        hc->out = NULL;
     }
+    close(hc->sd);
+}
 
-    st->aggregate = 0;
+static rstatus_t
+stats_http_send(struct stats_http_conn *hc, const char *status_line,
+                const char *type, uint8_t *extra, size_t extra_len,
+                uint8_t *body, size_t len)
+{
+    char hdr[STATS_HTTP_HDR_LEN];
+    struct iovec iov[3];
+    int hlen;
+
+    hlen = nc_scnprintf(hdr, sizeof(hdr), "HTTP/1.0 %s\r\n"
+                        "Content-Type: %s\r\n"
+                        "Content-Length: %zu\r\n"
+                        "Connection: close\r\n\r\n", status_line, type,
+                        extra_len + len);
+
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = (size_t)hlen;
+    iov[1].iov_base = extra;
+    iov[1].iov_len = extra_len;
+    iov[2].iov_base = body;
+    iov[2].iov_len = len;
+
+    return stats_http_write(hc, iov, 3);
 }
 
 static rstatus_t
-stats_make_rsp(struct stats *st)
+stats_http_send_metrics(struct stats *st, struct stats_http_conn *hc)
 {
     rstatus_t status;
-    uint32_t i;
+    uint8_t top[STATS_HTTP_TOP_LEN];
+    uint64_t log_nrecord, log_ndrop, log_backlog;
+    int n;
 
-    status = stats_add_header(st);
+    status = stats_prom_make_rsp(st);
     if (status != NC_OK) {
         return status;
     }
 
-    for (i = 0; i < array_n(&st->sum); i++) {
-        struct stats_pool *stp = array_get(&st->sum, i);
-        uint32_t j;
+    /* process wide metrics change between aggregations, render them fresh */
+    log_counters(&log_nrecord, &log_ndrop, &log_backlog);
+    n = nc_scnprintf(top, sizeof(top),
+                     "# TYPE nutcracker_info gauge\n"
+                     "nutcracker_info{version=\"%.*s\",source=\"%.*s\"} 1\n"
+                     "# TYPE nutcracker_start_time_seconds gauge\n"
+                     "nutcracker_start_time_seconds %"PRId64"\n"
+                     "# TYPE nutcracker_connections counter\n"
+                     "nutcracker_connections_total %"PRIu64"\n"
+                     "# TYPE nutcracker_current_connections gauge\n"
+                     "nutcracker_current_connections %"PRIu32"\n"
+                     "# TYPE nutcracker_log_records counter\n"
+                     "nutcracker_log_records_total %"PRIu64"\n"
+                     "# TYPE nutcracker_log_dropped counter\n"
+                     "nutcracker_log_dropped_total %"PRIu64"\n"
+                     "# TYPE nutcracker_log_backlog_bytes gauge\n"
+                     "nutcracker_log_backlog_bytes %"PRIu64"\n",
+                     st->version.len, st->version.data,
+                     st->source.len, st->source.data, st->start_ts,
+                     conn_ntotal_conn(), conn_ncurr_conn(),
+                     log_nrecord, log_ndrop, log_backlog);
+
+    return stats_http_send(hc, "200 OK", STATS_PROM_CONTENT_TYPE, top,
+                           (size_t)n, st->prom.data, st->prom.len);
+}
 
-        status = stats_begin_nesting(st, &stp->name);
+/*
+ * Answer req on stats connection hc. NC_EAGAIN means the socket did not
+ * take the whole response and hc keeps the rest; otherwise hc is done.
+ */
+static rstatus_t
+stats_send_rsp(struct stats *st, struct stats_http_conn *hc, stats_http_t req)
+{
+    rstatus_t status;
+    struct iovec iov;
+
+    switch (req) {
+    case STATS_HTTP_METRICS:
+        status = stats_http_send_metrics(st, hc);
+        break;
+
+    case STATS_HTTP_NOT_FOUND:
+        status = stats_http_send(hc, "404 Not Found", "text/plain", NULL, 0,
+                                 (uint8_t *)"not found\n", 10);
+        break;
+
+    case STATS_HTTP_JSON:
+    case STATS_HTTP_NONE:
+        status = stats_make_rsp(st);
         if (status != NC_OK) {
-            return status;
+            break;
         }
 
-        /* copy pool metric from sum(c) to buffer */
-        status = stats_copy_metric(st, &stp->metric);
-        if (status != NC_OK) {
-            return status;
+        log_debug(LOG_VERB, "send stats on sd %d %d bytes", hc->sd,
+                  st->buf.len);
+
+        if (req == STATS_HTTP_JSON) {
+            status = stats_http_send(hc, "200 OK", "application/json", NULL,
+                                     0, st->buf.data, st->buf.len);
+            break;
         }
 
-        for (j = 0; j < array_n(&stp->server); j++) {
-            struct stats_server *sts = array_get(&stp->server, j);
+        iov.iov_base = st->buf.data;
+        iov.iov_len = st->buf.len;
+        status = stats_http_write(hc, &iov, 1);
+        break;
 
-            status = stats_begin_nesting(st, &sts->name);
-            if (status != NC_OK) {
-                return status;
-            }
+    default:
+        NOT_REACHED();
+        status = NC_ERROR;
+    }
 
-            /* copy server metric from sum(c) to buffer */
-            status = stats_copy_metric(st, &sts->metric);
-            if (status != NC_OK) {
-                return status;
-            }
+    if (status != NC_OK && status != NC_EAGAIN) {
+        log_error("send stats on sd %d failed: %s", hc->sd, strerror(errno));
+    }
 
-            status = stats_end_nesting(st);
-            if (status != NC_OK) {
-                return status;
+    return status;
+}
+
+/*
+ * Answer the stats connections that sent their request, and those that
+ * sent nothing for STATS_HTTP_WAIT, as legacy clients. Sockets are non
+ * blocking, so a slow reader keeps the rest of its response and gets
+ * more of it on each poll, for up to STATS_HTTP_SEND_WAIT. The stats
+ * loop comes back every STATS_HTTP_TICK while any connection is left.
+ */
+static void
+stats_http_poll(struct stats *st)
+{
+    struct stats_http_conn *hc;
+    stats_http_t req;
+    rstatus_t status;
+    int64_t now;
+    uint32_t i, n;
+
+    now = nc_msec_now();
+
+    for (i = 0, n = 0; i < st->nhttp; i++) {
+        hc = &st->http[i];
+
+        if (hc->out != NULL) {
+            status = stats_http_flush(hc);
+            if (status == NC_EAGAIN && now >= 0 &&
+                now - hc->since >= STATS_HTTP_SEND_WAIT) {
+                log_warn("send stats on sd %d timed out with %zu of %zu "
+                         "bytes left", hc->sd, hc->nout - hc->pos, hc->nout);
+                status = NC_ERROR;
+            }
+        } else {
+            req = stats_http_request(hc->sd);
+            if (req == STATS_HTTP_WAITING) {
+                if (now >= 0 && now - hc->since < STATS_HTTP_WAIT) {
+                    st->http[n++] = *hc;
+                    continue;
+                }
+                req = STATS_HTTP_NONE;
             }
+
+            status = stats_send_rsp(st, hc, req);
         }
 
-        status = stats_end_nesting(st);
-        if (status != NC_OK) {
-            return status;
+        if (status == NC_EAGAIN) {
+            st->http[n++] = *hc;
+            continue;
         }
-    }
 
-    status = stats_add_footer(st);
-    if (status != NC_OK) {
-        return status;
+        stats_http_done(hc);
     }
+    st->nhttp = n;
 
-    return NC_OK;
+    if (st->nhttp == 0) {
+        st->wait = st->interval;
+    } else if (st->interval < 0 || st->interval > STATS_HTTP_TICK) {
+        st->wait = STATS_HTTP_TICK;
+    }
 }
 
-static rstatus_t
-stats_send_rsp(struct stats *st)
+/* accept a stats connection, to answer once its request is in */
+static void
+stats_accept(struct stats *st)
 {
-    rstatus_t status;
-    ssize_t n;
+    struct stats_http_conn *hc, full;
     int sd;
 
-    status = stats_make_rsp(st);
-    if (status != NC_OK) {
-        return status;
-    }
-
     sd = accept(st->sd, NULL, NULL);
     if (sd < 0) {
         log_error("accept on m %d failed: %s", st->sd, strerror(errno));
-        return NC_ERROR;
+        return;
     }
 
-    log_debug(LOG_VERB, "send stats on sd %d %d bytes", sd, st->buf.len);
-
-    n = nc_sendn(sd, st->buf.data, st->buf.len);
-    if (n < 0) {
-        log_error("send stats on sd %d failed: %s", sd, strerror(errno));
+    if (nc_set_nonblocking(sd) < 0) {
+        log_error("set nonblock on s %d failed: %s", sd, strerror(errno));
         close(sd);
-        return NC_ERROR;
+        return;
     }
 
-    close(sd);
+    if (st->nhttp == STATS_HTTP_NCONN) {
+        /* no room to wait for it, answer what the socket takes now */
+        full.sd = sd;
+        full.out = NULL;
+        stats_send_rsp(st, &full, STATS_HTTP_NONE);
+        stats_http_done(&full);
+        return;
+    }
 
-    return NC_OK;
+    hc = &st->http[st->nhttp++];
+    hc->sd = sd;
+    hc->since = nc_msec_now();
+    hc->out = NULL;
+    hc->nout = 0;
+    hc->pos = 0;
+}
+
+/* close the stats connections left waiting */
+static void
+stats_http_close(struct stats *st)
+{
+    uint32_t i;
+
+    for (i = 0; i < st->nhttp; i++) {
+        stats_http_done(&st->http[i]);
+    }
+    st->nhttp = 0;
+    st->wait = st->interval;
 }
 
 static void
@@ -810,17 +2512,15 @@ stats_loop_callback(void *arg1, void *arg2)
     struct stats *st = arg1;
     int n = *((int *)arg2);
 
-    /* aggregate stats from shadow (b) -> sum (c) */
-    pthread_mutex_lock(&st->stats_mutex);
+    /* aggregate stats from current (a) -> sum (c) */
     stats_aggregate(st);
-    pthread_mutex_unlock(&st->stats_mutex);
 
-    if (n == 0) {
-        return;
+    if (n != 0) {
+        stats_accept(st);
     }
 
-    /* send aggregate stats sum (c) to collector */
-    stats_send_rsp(st);
+    /* send aggregate stats sum (c) to collectors */
+    stats_http_poll(st);
 }
 
 static void *
@@ -891,7 +2591,6 @@ stats_start_aggregator(struct stats *st)
         log_error("stats aggregator create failed: %s", strerror(status));
         return NC_ERROR;
     }
-    pthread_mutex_init(&st->stats_mutex, NULL);
 
     return NC_OK;
 }
@@ -917,6 +2616,7 @@ stats_stop_aggregator(struct stats *st)
         close(st->sd);
         return NC_ERROR;
     }
+    stats_http_close(st);
     close(st->sd);
     return NC_OK;
 }
@@ -943,12 +2643,19 @@ stats_create(uint16_t stats_port, char *stats_ip, int stats_interval,
     st->buf.data = NULL;
     st->buf.size = 0;
 
+    st->prom.len = 0;
+    st->prom.data = NULL;
+    st->prom.size = 0;
+    st->sum_gen = 0;
+    st->prom_gen = 0;
+
     array_null(&st->current);
-    array_null(&st->shadow);
     array_null(&st->sum);
 
     st->tid = (pthread_t) -1;
     st->sd = -1;
+    st->wait = stats_interval;
+    st->nhttp = 0;
 
     string_set_text(&st->service_str, "service");
     string_set_text(&st->service, "nutcracker");
@@ -965,17 +2672,17 @@ stats_create(uint16_t stats_port, char *stats_ip, int stats_interval,
     string_set_text(&st->ntotal_conn_str, "total_connections");
     string_set_text(&st->ncurr_conn_str, "curr_connections");
 
-    st->updated = 0;
-    st->aggregate = 0;
+    string_set_text(&st->log_nrecord_str, "log_records");
+    string_set_text(&st->log_ndrop_str, "log_dropped");
+    string_set_text(&st->log_backlog_str, "log_backlog_bytes");
 
-    /* map server pool to current (a), shadow (b) and sum (c) */
+    st->aggregate_ts = 0;
 
-    status = stats_pool_map(&st->current, server_pool);
-    if (status != NC_OK) {
-        goto error;
-    }
+    stats_cmd_names_init();
+
+    /* map server pool to current (a) and sum (c) */
 
-    status = stats_pool_map(&st->shadow, server_pool);
+    status = stats_pool_map(&st->current, server_pool);
     if (status != NC_OK) {
         goto error;
     }
@@ -1016,25 +2723,18 @@ stats_reset_and_recover(struct context *ctx, struct stats_pool *stp_src, struct
         return NC_ERROR;
     }
     stats_pool_unmap(&st->sum);
-    stats_pool_unmap(&st->shadow);
     stats_pool_unmap(&st->current);
     stats_destroy_buf(st);
 
-    st->updated = 0;
-    st->aggregate = 0;
+    st->aggregate_ts = 0;
 
-    /* map server pool to current (a), shadow (b) and sum (c) */
+    /* map server pool to current (a) and sum (c) */
 
     status = stats_pool_map(&st->current, server_pool);
     if (status != NC_OK) {
         return NC_ERROR;
     }
 
-    status = stats_pool_map(&st->shadow, server_pool);
-    if (status != NC_OK) {
-        return NC_ERROR;
-    }
-
     status = stats_pool_map(&st->sum, server_pool);
     if (status != NC_OK) {
         return NC_ERROR;
@@ -1049,6 +2749,7 @@ stats_reset_and_recover(struct context *ctx, struct stats_pool *stp_src, struct
     if (status != NC_OK) {
         return NC_ERROR;
     }
+    st->sum_gen++;
 
     status = stats_start_aggregator(st);
     if (status != NC_OK) {
@@ -1063,62 +2764,11 @@ stats_destroy(struct stats *st)
 {
     stats_stop_aggregator(st);
     stats_pool_unmap(&st->sum);
-    stats_pool_unmap(&st->shadow);
     stats_pool_unmap(&st->current);
     stats_destroy_buf(st);
     nc_free(st);
 }
 
-void
-stats_swap(struct stats *st)
-{
-    if (!stats_enabled) {
-        return;
-    }
-
-    if (st->aggregate == 1) {
-        log_debug(LOG_PVERB, "skip swap of current %p shadow %p as aggregator "
-                  "is busy", st->current.elem, st->shadow.elem);
-        return;
-    }
-
-    if (st->updated == 0) {
-        log_debug(LOG_PVERB, "skip swap of current %p shadow %p as there is "
-                  "nothing new", st->current.elem, st->shadow.elem);
-        return;
-    }
-
-    log_debug(LOG_PVERB, "swap stats current %p shadow %p", st->current.elem,
-              st->shadow.elem);
-
-    array_swap(&st->current, &st->shadow);
-
-    /*
-     * Reset current (a) stats before giving it back to generator to keep
-     * stats addition idempotent
-     */
-    stats_pool_reset(&st->current);
-    st->updated = 0;
-
-    st->aggregate = 1;
-}
-
-void
-stats_aggregate_force(struct stats *st)
-{
-    pthread_mutex_lock(&st->stats_mutex);
-    st->aggregate = 1;
-    stats_aggregate(st);
-
-    st->updated = 1;
-    stats_swap(st);
-    stats_aggregate(st);
-
-    stats_pool_reset(&st->shadow);
-    stats_pool_reset(&st->current);
-    pthread_mutex_unlock(&st->stats_mutex);
-}
-
 static struct stats_metric *
 stats_pool_to_metric(struct context *ctx, struct server_pool *pool,
                      stats_pool_field_t fidx)
@@ -1134,8 +2784,6 @@ stats_pool_to_metric(struct context *ctx, struct server_pool *pool,
     stp = array_get(&st->current, pidx);
     stm = array_get(&stp->metric, fidx);
 
-    st->updated = 1;
-
     log_debug(LOG_VVVERB, "metric '%.*s' in pool %"PRIu32"", stm->name.len,
               stm->name.data, pidx);
 
@@ -1235,8 +2883,6 @@ stats_server_to_metric(struct context *ctx, struct server *server,
     sts = array_get(&stp->server, sidx);
     stm = array_get(&sts->metric, fidx);
 
-    st->updated = 1;
-
     log_debug(LOG_VVVERB, "metric '%.*s' in pool %"PRIu32" server %"PRIu32"",
               stm->name.len, stm->name.data, pidx, sidx);
 
@@ -1318,6 +2964,189 @@ _stats_server_set_ts(struct context *ctx, struct server *server,
               stm->name.data, stm->value.timestamp);
 }
 
+void
+_stats_server_set(struct context *ctx, struct server *server,
+                  stats_server_field_t fidx, int64_t val)
+{
+    struct stats_metric *stm;
+
+    stm = stats_server_to_metric(ctx, server, fidx);
+
+    ASSERT(stm->type == STATS_GAUGE);
+    stm->value.counter = val;
+
+    log_debug(LOG_VVVERB, "set field '%.*s' to %"PRId64"", stm->name.len,
+              stm->name.data, stm->value.counter);
+}
+
+static struct histo *
+stats_pool_to_histo(struct context *ctx, struct server_pool *pool,
+                    stats_pool_histo_field_t hidx)
+{
+    struct stats *st;
+    struct stats_pool *stp;
+    struct stats_histo *sth;
+
+    st = ctx->stats;
+    stp = array_get(&st->current, pool->idx);
+    sth = array_get(&stp->histo, hidx);
+
+    return &sth->histo;
+}
+
+void
+_stats_pool_record(struct context *ctx, struct server_pool *pool,
+                   stats_pool_histo_field_t hidx, int64_t val)
+{
+    histo_record(stats_pool_to_histo(ctx, pool, hidx), val);
+}
+
+static struct histo *
+stats_server_to_histo(struct context *ctx, struct server *server,
+                      stats_server_histo_field_t hidx)
+{
+    struct stats *st;
+    struct stats_pool *stp;
+    struct stats_server *sts;
+    struct stats_histo *sth;
+
+    st = ctx->stats;
+    stp = array_get(&st->current, server->owner->idx);
+    sts = array_get(&stp->server, server->idx);
+    sth = array_get(&sts->histo, hidx);
+
+    return &sth->histo;
+}
+
+void
+_stats_server_record(struct context *ctx, struct server *server,
+                     stats_server_histo_field_t hidx, int64_t val)
+{
+    histo_record(stats_server_to_histo(ctx, server, hidx), val);
+}
+
+static struct stats_cmd *
+stats_pool_to_cmd(struct context *ctx, struct server_pool *pool, uint32_t type)
+{
+    struct stats *st;
+    struct stats_pool *stp;
+
+    ASSERT(type < MSG_SENTINEL);
+
+    st = ctx->stats;
+    stp = array_get(&st->current, pool->idx);
+
+    return array_get(&stp->cmd, type);
+}
+
+void
+_stats_cmd_incr_by(struct context *ctx, struct server_pool *pool,
+                   uint32_t type, stats_cmd_field_t fidx, int64_t val)
+{
+    stats_pool_to_cmd(ctx, pool, type)->value[fidx] += val;
+}
+
+void
+_stats_cmd_record(struct context *ctx, struct server_pool *pool,
+                  uint32_t type, int64_t val)
+{
+    histo_record(&stats_pool_to_cmd(ctx, pool, type)->histo, val);
+}
+
+void
+_stats_pool_hotkey(struct context *ctx, struct server_pool *pool,
+                   struct hotkey_stat *top, uint32_t ntop)
+{
+    struct stats *st;
+    struct stats_pool *stp;
+
+    st = ctx->stats;
+    stp = array_get(&st->current, pool->idx);
+
+    stats_list_begin(&stp->hotkey_gen);
+    stats_list_set(&stp->hotkey, top, ntop);
+    stats_list_end(&stp->hotkey_gen);
+}
+
+/*
+ * Remember a response over the pool bigkey_threshold. Entries are keyed by
+ * the first key of the request and keep the largest response seen for it;
+ * once the list is full, a new key takes the place of the smallest entry
+ * if its response is larger. Lists are short and such responses are rare,
+ * so a linear scan is enough.
+ */
+void
+_stats_pool_bigkey(struct context *ctx, struct server *server,
+                   struct msg *req, uint32_t size)
+{
+    struct stats *st;
+    struct stats_pool *stp;
+    struct stats_bigkey *bk, *min;
+    struct keypos *kpos;
+    uint8_t *key;
+    uint32_t i, keylen, prefix;
+
+    st = ctx->stats;
+    stp = array_get(&st->current, server->owner->idx);
+
+    if (stp->bigkey.nalloc == 0) {
+        return;
+    }
+
+    key = NULL;
+    keylen = 0;
+    if (req->keys != NULL && array_n(req->keys) != 0) {
+        kpos = array_get(req->keys, 0);
+        key = kpos->start;
+        keylen = (uint32_t)(kpos->end - kpos->start);
+    }
+    prefix = MIN(keylen, STATS_BIGKEY_KEY_LEN);
+
+    stats_list_begin(&stp->bigkey_gen);
+
+    bk = NULL;
+    min = NULL;
+    for (i = 0; i < array_n(&stp->bigkey); i++) {
+        struct stats_bigkey *e = array_get(&stp->bigkey, i);
+
+        if (e->key_len == keylen &&
+            (prefix == 0 || memcmp(e->key, key, prefix) == 0)) {
+            bk = e;
+            break;
+        }
+
+        if (min == NULL || e->size < min->size) {
+            min = e;
+        }
+    }
+
+    if (bk == NULL) {
+        if (array_n(&stp->bigkey) < stp->bigkey.nalloc) {
+            bk = array_push(&stp->bigkey);
+        } else if (size > min->size) {
+            bk = min;
+        } else {
+            stats_list_end(&stp->bigkey_gen);
+            return;
+        }
+
+        bk->size = 0;
+        bk->count = 0;
+        bk->key_len = keylen;
+        if (prefix != 0) {
+            nc_memcpy(bk->key, key, prefix);
+        }
+    }
+
+    bk->size = MAX(bk->size, size);
+    bk->count++;
+    bk->last = nc_loop_usec() / 1000000;
+    bk->type = req->type;
+    bk->server = server->idx;
+
+    stats_list_end(&stp->bigkey_gen);
+}
+
 static void
 stats_metric_copy(struct stats_metric *dst, struct stats_metric *src)
 {
@@ -1333,6 +3162,10 @@ stats_pool_copy_init(struct stats_pool *stp, struct server_pool *sp, struct hash
     string_init(&stp->name);
     string_duplicate(&stp->name, &sp->name);
     array_null(&stp->metric);
+    array_null(&stp->histo);
+    array_null(&stp->cmd);
+    array_null(&stp->hotkey);
+    array_null(&stp->bigkey);
     array_null(&stp->server);
 
     status = array_init(&stp->metric, STATS_POOL_NFIELD, sizeof(struct stats_metric));
@@ -1340,6 +3173,16 @@ stats_pool_copy_init(struct stats_pool *stp, struct server_pool *sp, struct hash
         return status;
     }
 
+    status = array_init(&stp->histo, STATS_POOL_NHISTO, sizeof(struct stats_histo));
+    if (status != NC_OK) {
+        return status;
+    }
+
+    status = array_init(&stp->cmd, MSG_SENTINEL, sizeof(struct stats_cmd));
+    if (status != NC_OK) {
+        return status;
+    }
+
     nserver = array_n(&sp->server) == 0 ? array_n(&stp->server):array_n(&sp->server);
     status = array_init(&stp->server, nserver, sizeof(struct stats_server));
     if (status != NC_OK) {
@@ -1362,6 +3205,10 @@ stats_pool_copy_deinit(struct stats_pool *stp, struct hash_table **sit)
     struct stats_server *sts;
 
     stats_metric_deinit(&stp->metric);
+    stats_histo_deinit(&stp->histo);
+    stats_cmd_deinit(&stp->cmd);
+    stats_list_deinit(&stp->hotkey);
+    stats_list_deinit(&stp->bigkey);
     string_deinit(&stp->name);
 
     nserver = array_n(&stp->server);
@@ -1370,6 +3217,7 @@ stats_pool_copy_deinit(struct stats_pool *stp, struct hash_table **sit)
         string_deinit(&sts->name);
 
         stats_metric_deinit(&sts->metric);
+        stats_histo_deinit(&sts->histo);
     }
     array_deinit(&stp->server);
 
@@ -1377,7 +3225,7 @@ stats_pool_copy_deinit(struct stats_pool *stp, struct hash_table **sit)
     (*sit) = NULL;
 }
 
-/* copy ctx->sum->pool[i] to stp */
+/* copy ctx->current->pool[i] to stp */
 rstatus_t
 stats_pool_copy(struct context *ctx, struct stats_pool *stp, struct hash_table **sit)
 {
@@ -1385,10 +3233,12 @@ stats_pool_copy(struct context *ctx, struct stats_pool *stp, struct hash_table *
     uint32_t i, j, k;
     uint64_t idx_data;
     struct stats *st =  ctx->stats;
-    struct array *sum = &st->sum;
+    struct array *sum = &st->current;
 
     struct stats_pool *istp;
     struct stats_metric *stm_src, *stm_dst;
+    struct stats_histo *sth_src, *sth_dst;
+    struct stats_cmd *stc_src, *stc_dst;
     struct stats_server *sts_src, *sts_dst;
     for (i = 0;i < array_n(sum); i++) {
         /* get pool from array sum */
@@ -1405,6 +3255,26 @@ stats_pool_copy(struct context *ctx, struct stats_pool *stp, struct hash_table *
 
                 stats_metric_copy(stm_dst, stm_src);
             }
+            /* copy the histo array */
+            for (j = 0;j < array_n(&istp->histo);j++) {
+                sth_src = array_get(&istp->histo, j);
+                sth_dst = array_push(&stp->histo);
+                if (sth_dst == NULL) {
+                    return NC_ENOMEM;
+                }
+
+                *sth_dst = *sth_src;
+            }
+            /* copy the cmd array */
+            for (j = 0;j < array_n(&istp->cmd);j++) {
+                stc_src = array_get(&istp->cmd, j);
+                stc_dst = array_push(&stp->cmd);
+                if (stc_dst == NULL) {
+                    return NC_ENOMEM;
+                }
+
+                *stc_dst = *stc_src;
+            }
             /* copy the server array */
             for (j = 0;j < array_n(&istp->server);j++) {
                 sts_src = array_get(&istp->server, j);
@@ -1429,6 +3299,11 @@ stats_pool_copy(struct context *ctx, struct stats_pool *stp, struct hash_table *
                 if (status != NC_OK) {
                     return status;
                 }
+                status = array_init(&sts_dst->histo, STATS_SERVER_NHISTO,
+                                    sizeof(struct stats_histo));
+                if (status != NC_OK) {
+                    return status;
+                }
                 string_init(&sts_dst->name);
                 string_duplicate(&sts_dst->name, &sts_src->name);
 
@@ -1444,21 +3319,34 @@ stats_pool_copy(struct context *ctx, struct stats_pool *stp, struct hash_table *
 
                     stats_metric_copy(stm_dst, stm_src);
                 }
+
+                for (k = 0;k < array_n(&sts_src->histo); k++) {
+                    sth_src = array_get(&sts_src->histo, k);
+                    sth_dst = array_push(&sts_dst->histo);
+                    if (sth_dst == NULL) {
+                        return NC_ENOMEM;
+                    }
+
+                    *sth_dst = *sth_src;
+                }
             }
         }
     }
     return NC_OK;
 }
 
+/* recover stp into ctx->current, the next snapshot carries it to sum */
 static rstatus_t
 stats_pool_copy_recover(struct context *ctx, struct stats_pool *stp_src, struct hash_table **sit)
 {
     uint32_t i, j, k;
     struct stats *st =  ctx->stats;
-    struct array *sum = &st->sum;
+    struct array *sum = &st->current;
 
     struct stats_pool *stp_dst;
     struct stats_metric *stm_src, *stm_dst;
+    struct stats_histo *sth_src, *sth_dst;
+    struct stats_cmd *stc_src, *stc_dst;
     struct stats_server *sts_src, *sts_dst;
     char *key;
     uint64_t sidx;
@@ -1474,6 +3362,21 @@ stats_pool_copy_recover(struct context *ctx, struct stats_pool *stp_src, struct
 
                 stats_metric_copy(stm_dst, stm_src);
             }
+            /* recover the histo array */
+            for (j = 0;j < array_n(&stp_src->histo);j++) {
+                sth_src = array_get(&stp_src->histo, j);
+                sth_dst = array_get(&stp_dst->histo, j);
+
+                sth_dst->histo = sth_src->histo;
+            }
+            /* recover the cmd array */
+            for (j = 0;j < array_n(&stp_src->cmd);j++) {
+                stc_src = array_get(&stp_src->cmd, j);
+                stc_dst = array_get(&stp_dst->cmd, j);
+
+                memcpy(stc_dst->value, stc_src->value, sizeof(stc_dst->value));
+                stc_dst->histo = stc_src->histo;
+            }
             /* recover the server array */
             for (j = 0;j < array_n(&stp_dst->server);j++) {
                 /* recover sts_src data to sts_dst */
@@ -1497,6 +3400,12 @@ stats_pool_copy_recover(struct context *ctx, struct stats_pool *stp_src, struct
                         stm_dst = array_get(&sts_dst->metric, k);
                         stats_metric_copy(stm_dst, stm_src);
                     }
+                    for (k = 0;k < array_n(&sts_src->histo); k++) {
+                        sth_src = array_get(&sts_src->histo, k);
+                        sth_dst = array_get(&sts_dst->histo, k);
+
+                        sth_dst->histo = sth_src->histo;
+                    }
                 }
             }
         }
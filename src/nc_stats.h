@@ -30,6 +30,28 @@
     /* forwarder behavior */                                                                                        \
     ACTION( forward_error,          STATS_COUNTER,      "# times we encountered a forwarding error")                \
     ACTION( fragments,              STATS_COUNTER,      "# fragments created from a multi-vector request")          \
+    /* near cache behavior */                                                                                       \
+    ACTION( nearcache_hits,         STATS_COUNTER,      "# requests served from the near cache")                    \
+    ACTION( nearcache_misses,       STATS_COUNTER,      "# cacheable requests forwarded to a server")               \
+    ACTION( nearcache_evictions,    STATS_COUNTER,      "# near cache entries evicted for space")                   \
+    ACTION( nearcache_rejects,      STATS_COUNTER,      "# near cache admissions refused by frequency")             \
+    ACTION( nearcache_invalidations,STATS_COUNTER,      "# near cache entries invalidated")                         \
+    ACTION( nearcache_entries,      STATS_GAUGE,        "# near cache entries")                                     \
+    ACTION( nearcache_bytes,        STATS_GAUGE,        "near cache memory in bytes")                               \
+    /* single flight behavior */                                                                                    \
+    ACTION( singleflight_coalesced, STATS_COUNTER,      "# requests answered with an identical request's response") \
+    /* batching behavior */                                                                                         \
+    ACTION( batches,                STATS_COUNTER,      "# mget and mset sent for batched requests")                \
+    ACTION( batched_requests,       STATS_COUNTER,      "# get and set requests sent in batches")                   \
+    /* hedging behavior */                                                                                          \
+    ACTION( hedged_requests,        STATS_COUNTER,      "# reads sent again to a second replica")                   \
+    ACTION( hedge_wins,             STATS_COUNTER,      "# hedged reads answered first by the second replica")      \
+    /* retry behavior */                                                                                            \
+    ACTION( retries,                STATS_COUNTER,      "# reads sent again after their server connection failed")  \
+    ACTION( retries_recovered,      STATS_COUNTER,      "# retried reads answered by another replica")              \
+    /* rate limit behavior */                                                                                       \
+    ACTION( throttled_requests,     STATS_COUNTER,      "# requests over the rate limit of their client source")    \
+    ACTION( throttled_clients,      STATS_GAUGE,        "# client connections paused over the rate limit")          \
     ACTION( servers_update_at,      STATS_TIMESTAMP,    "timestamp when servers updated")                           \
     ACTION( slots_update_at,        STATS_TIMESTAMP,    "timestamp when slots updated")                             \
     ACTION( total_requests,         STATS_COUNTER,      "# total requests received")                                \
@@ -45,21 +67,6 @@
     ACTION( xrequest_gt_100ms,      STATS_COUNTER,      "# cross region requests more than 100ms")                  \
     ACTION( xrequest_gt_200ms,      STATS_COUNTER,      "# cross region requests more than 200ms")                  \
     ACTION( xrequest_gt_500ms,      STATS_COUNTER,      "# cross region requests more than 500ms")                  \
-    /* Redis */                                                                                                     \
-    ACTION( redis_req_get,          STATS_COUNTER,      "# get requests")                                           \
-    ACTION( redis_req_set,          STATS_COUNTER,      "# set requests")                                           \
-    ACTION( redis_req_del,          STATS_COUNTER,      "# del requests")                                           \
-    ACTION( redis_req_incr_decr,    STATS_COUNTER,      "# incr and decr requests")                                 \
-    ACTION( redis_req_mget,         STATS_COUNTER,      "# mget requests")                                          \
-    ACTION( redis_req_mset,         STATS_COUNTER,      "# mset requests")                                          \
-    ACTION( redis_req_sort,         STATS_COUNTER,      "# sort requests")                                          \
-    ACTION( redis_req_lrem,         STATS_COUNTER,      "# lrem requests")                                          \
-    ACTION( redis_req_sunion,       STATS_COUNTER,      "# sunion requests")                                        \
-    ACTION( redis_req_lists,        STATS_COUNTER,      "# list related requests")                                  \
-    ACTION( redis_req_sets,         STATS_COUNTER,      "# sets related requests")                                  \
-    ACTION( redis_req_hashs,        STATS_COUNTER,      "# hash related requests")                                  \
-    ACTION( redis_req_sortedsets,   STATS_COUNTER,      "# zset related requests")                                  \
-    ACTION( redis_req_other,        STATS_COUNTER,      "# other requests")                                         \
 
 #define STATS_SERVER_CODEC(ACTION)                                                                                  \
     /* server behavior */                                                                                           \
@@ -77,6 +84,48 @@
     ACTION( in_queue_bytes,         STATS_GAUGE,        "current request bytes in incoming queue")                  \
     ACTION( out_queue,              STATS_GAUGE,        "# requests in outgoing queue")                             \
     ACTION( out_queue_bytes,        STATS_GAUGE,        "current request bytes in outgoing queue")                  \
+    ACTION( expired_requests,       STATS_COUNTER,      "# requests dropped unsent past their deadline")            \
+    /* health check behavior */                                                                                     \
+    ACTION( health_rtt,             STATS_GAUGE,        "smoothed health check round trip time in usec")            \
+    ACTION( health_failures,        STATS_GAUGE,        "# consecutive failed health checks")                       \
+    ACTION( health_demoted,         STATS_GAUGE,        "1 if demoted from read routing by health checks")          \
+    /* concurrency limit behavior */                                                                                \
+    ACTION( concurrency_limit,      STATS_GAUGE,        "adaptive limit of requests in flight")                     \
+    ACTION( concurrency_inflight,   STATS_GAUGE,        "# requests in flight")                                     \
+    ACTION( concurrency_waiting,    STATS_GAUGE,        "# requests waiting for an in-flight slot")                 \
+    ACTION( shed_requests,          STATS_COUNTER,      "# requests rejected over the limit")                       \
+
+#define STATS_POOL_HISTO_CODEC(ACTION)                                                                              \
+    ACTION( latency,                "request latency in usec")                                                      \
+    ACTION( latency_read,           "read request latency in usec")                                                 \
+    ACTION( latency_write,          "write request latency in usec")                                                \
+    ACTION( latency_multikey,       "multi-key request fragment latency in usec")                                   \
+    ACTION( latency_script,         "eval and evalsha latency in usec")                                             \
+    ACTION( latency_fast_lane,      "fast lane request latency in usec")                                            \
+    ACTION( latency_slow_lane,      "slow lane request latency in usec")                                            \
+    ACTION( phase_route,            "time from request received to routed in usec")                                 \
+    ACTION( phase_queue,            "time from routed to written to server in usec")                                \
+    ACTION( phase_server,           "time from written to server to first response byte in usec")                   \
+    ACTION( phase_read,             "time from first response byte to response parsed in usec")                     \
+    ACTION( phase_reply,            "time from response parsed to written to client in usec")                       \
+    ACTION( rsp_size_read,          "read response size in bytes")                                                 \
+    ACTION( rsp_size_write,         "write response size in bytes")                                                 \
+    ACTION( rsp_size_multikey,      "multi-key request fragment response size in bytes")                            \
+    ACTION( rsp_size_script,        "eval and evalsha response size in bytes")                                      \
+
+#define STATS_SERVER_HISTO_CODEC(ACTION)                                                                            \
+    ACTION( server_latency,         "server round trip latency in usec")                                            \
+
+/*
+ * Per command counters, kept for every request msg_type_t in a dense
+ * per-pool array indexed by type and reported as <command>_<field>,
+ * e.g. redis_get_requests. Every command also has a latency histogram.
+ */
+#define STATS_CMD_CODEC(ACTION)                                                                                     \
+    ACTION( requests,               STATS_COUNTER,      "# requests")                                               \
+    ACTION( errors,                 STATS_COUNTER,      "# error responses")                                        \
+    ACTION( request_bytes,          STATS_COUNTER,      "total request bytes")                                      \
+    ACTION( response_bytes,         STATS_COUNTER,      "total response bytes")                                     \
 
 #define STATS_ADDR      "0.0.0.0"
 #define STATS_PORT      22222
@@ -99,14 +148,55 @@ struct stats_metric {
     } value;
 };
 
+struct stats_histo {
+    struct string name;   /* name (ref) */
+    struct histo  histo;  /* histogram */
+};
+
+#define DEFINE_ACTION(_name, _type, _desc) STATS_CMD_##_name,
+typedef enum stats_cmd_field {
+    STATS_CMD_CODEC(DEFINE_ACTION)
+    STATS_CMD_NFIELD
+} stats_cmd_field_t;
+#undef DEFINE_ACTION
+
+struct stats_cmd {
+    struct string name;                     /* command name, empty for non request types */
+    int64_t       value[STATS_CMD_NFIELD];  /* counters for cmd codec */
+    struct histo  histo;                    /* latency histogram */
+};
+
+/*
+ * Largest response seen for a key, among the responses over the pool
+ * bigkey_threshold
+ */
+#define STATS_BIGKEY_KEY_LEN    64
+
+struct stats_bigkey {
+    uint64_t size;                      /* largest response in bytes */
+    uint64_t count;                     /* # responses over the threshold */
+    int64_t  last;                      /* last response, unix time in sec */
+    uint32_t type;                      /* request msg_type_t of the last response */
+    uint32_t server;                    /* server index of the last response */
+    uint32_t key_len;                   /* full key length */
+    uint8_t  key[STATS_BIGKEY_KEY_LEN]; /* key prefix */
+};
+
 struct stats_server {
     struct string name;   /* server name (ref) */
     struct array  metric; /* stats_metric[] for server codec */
+    struct array  histo;  /* stats_histo[] for server histo codec */
 };
 
 struct stats_pool {
     struct string name;   /* pool name (ref) */
     struct array  metric; /* stats_metric[] for pool codec */
+    struct array  histo;  /* stats_histo[] for pool histo codec */
+    struct array  cmd;    /* stats_cmd[] indexed by msg_type_t */
+    struct array  hotkey; /* hotkey_stat[] of the last hot key window */
+    uint64_t      hotkey_gen; /* hotkey sequence, odd while it changes */
+    struct array  bigkey; /* stats_bigkey[] of the largest responses */
+    uint64_t      bigkey_gen; /* bigkey sequence, odd while it changes */
     struct array  server; /* stats_server[] */
 };
 
@@ -116,6 +206,17 @@ struct stats_buffer {
     size_t   size;  /* buffer alloc size */
 };
 
+#define STATS_HTTP_NCONN        16          /* max # stats connections waiting */
+
+/* accepted stats connection, waiting for a request or to send the rest */
+struct stats_http_conn {
+    int                 sd;              /* socket descriptor */
+    int64_t             since;           /* accept or first send time in msec */
+    uint8_t             *out;            /* unsent response, or NULL */
+    size_t              nout;            /* # bytes in out */
+    size_t              pos;             /* # bytes of out sent */
+};
+
 struct stats {
     uint16_t            port;            /* stats monitoring port */
     int                 interval;        /* stats aggregation interval */
@@ -123,13 +224,19 @@ struct stats {
 
     int64_t             start_ts;        /* start timestamp of nutcracker */
     struct stats_buffer buf;             /* output buffer */
+    struct stats_buffer prom;            /* openmetrics output buffer */
+    uint64_t            sum_gen;         /* # times sum (c) changed */
+    uint64_t            prom_gen;        /* sum_gen prom was rendered at */
 
     struct array        current;         /* stats_pool[] (a) */
-    struct array        shadow;          /* stats_pool[] (b) */
-    struct array        sum;             /* stats_pool[] (c = a + b) */
+    struct array        sum;             /* stats_pool[] (c) */
+    int64_t             aggregate_ts;    /* last aggregation in msec */
 
     pthread_t           tid;             /* stats aggregator thread */
     int                 sd;              /* stats descriptor */
+    int                 wait;            /* stats loop wait in msec */
+    uint32_t            nhttp;           /* # connections waiting */
+    struct stats_http_conn http[STATS_HTTP_NCONN]; /* connections waiting */
 
     struct string       service_str;     /* service string */
     struct string       service;         /* service */
@@ -141,11 +248,9 @@ struct stats {
     struct string       timestamp_str;   /* timestamp string */
     struct string       ntotal_conn_str; /* total connections string */
     struct string       ncurr_conn_str;  /* curr connections string */
-
-    volatile int        aggregate;       /* shadow (b) aggregate? */
-    volatile int        updated;         /* current (a) updated? */
-
-    pthread_mutex_t     stats_mutex;
+    struct string       log_nrecord_str; /* log records string */
+    struct string       log_ndrop_str;   /* log dropped string */
+    struct string       log_backlog_str; /* log backlog string */
 };
 
 #define DEFINE_ACTION(_name, _type, _desc) STATS_POOL_##_name,
@@ -162,6 +267,20 @@ typedef enum stats_server_field {
 } stats_server_field_t;
 #undef DEFINE_ACTION
 
+#define DEFINE_ACTION(_name, _desc) STATS_POOL_HISTO_##_name,
+typedef enum stats_pool_histo_field {
+    STATS_POOL_HISTO_CODEC(DEFINE_ACTION)
+    STATS_POOL_NHISTO
+} stats_pool_histo_field_t;
+#undef DEFINE_ACTION
+
+#define DEFINE_ACTION(_name, _desc) STATS_SERVER_HISTO_##_name,
+typedef enum stats_server_histo_field {
+    STATS_SERVER_HISTO_CODEC(DEFINE_ACTION)
+    STATS_SERVER_NHISTO
+} stats_server_histo_field_t;
+#undef DEFINE_ACTION
+
 #if defined NC_STATS && NC_STATS == 1
 
 #define stats_pool_incr(_ctx, _pool, _name) do {                        \
@@ -204,6 +323,39 @@ typedef enum stats_server_field {
      _stats_server_set_ts(_ctx, _server, STATS_SERVER_##_name, _val);   \
 } while (0)
 
+#define stats_server_set(_ctx, _server, _name, _val) do {               \
+    _stats_server_set(_ctx, _server, STATS_SERVER_##_name, _val);       \
+} while (0)
+
+#define stats_pool_record(_ctx, _pool, _name, _val) do {                \
+    _stats_pool_record(_ctx, _pool, STATS_POOL_HISTO_##_name, _val);    \
+} while (0)
+
+#define stats_server_record(_ctx, _server, _name, _val) do {            \
+    _stats_server_record(_ctx, _server, STATS_SERVER_HISTO_##_name,     \
+                         _val);                                         \
+} while (0)
+
+#define stats_cmd_incr(_ctx, _pool, _type, _name) do {                  \
+    _stats_cmd_incr_by(_ctx, _pool, _type, STATS_CMD_##_name, 1);       \
+} while (0)
+
+#define stats_cmd_incr_by(_ctx, _pool, _type, _name, _val) do {         \
+    _stats_cmd_incr_by(_ctx, _pool, _type, STATS_CMD_##_name, _val);    \
+} while (0)
+
+#define stats_cmd_record(_ctx, _pool, _type, _val) do {                 \
+    _stats_cmd_record(_ctx, _pool, _type, _val);                        \
+} while (0)
+
+#define stats_pool_hotkey(_ctx, _pool, _top, _ntop) do {                \
+    _stats_pool_hotkey(_ctx, _pool, _top, _ntop);                       \
+} while (0)
+
+#define stats_pool_bigkey(_ctx, _server, _req, _size) do {              \
+    _stats_pool_bigkey(_ctx, _server, _req, _size);                     \
+} while (0)
+
 #else
 
 #define stats_pool_incr(_ctx, _pool, _name)
@@ -222,6 +374,22 @@ typedef enum stats_server_field {
 
 #define stats_server_decr_by(_ctx, _server, _name, _val)
 
+#define stats_server_set(_ctx, _server, _name, _val)
+
+#define stats_pool_record(_ctx, _pool, _name, _val)
+
+#define stats_server_record(_ctx, _server, _name, _val)
+
+#define stats_cmd_incr(_ctx, _pool, _type, _name)
+
+#define stats_cmd_incr_by(_ctx, _pool, _type, _name, _val)
+
+#define stats_cmd_record(_ctx, _pool, _type, _val)
+
+#define stats_pool_hotkey(_ctx, _pool, _top, _ntop)
+
+#define stats_pool_bigkey(_ctx, _server, _req, _size)
+
 #endif
 
 #define stats_enabled   NC_STATS
@@ -239,13 +407,20 @@ void _stats_server_decr(struct context *ctx, struct server *server, stats_server
 void _stats_server_incr_by(struct context *ctx, struct server *server, stats_server_field_t fidx, int64_t val);
 void _stats_server_decr_by(struct context *ctx, struct server *server, stats_server_field_t fidx, int64_t val);
 void _stats_server_set_ts(struct context *ctx, struct server *server, stats_server_field_t fidx, int64_t val);
+void _stats_server_set(struct context *ctx, struct server *server, stats_server_field_t fidx, int64_t val);
+
+void _stats_pool_record(struct context *ctx, struct server_pool *pool, stats_pool_histo_field_t hidx, int64_t val);
+void _stats_server_record(struct context *ctx, struct server *server, stats_server_histo_field_t hidx, int64_t val);
+
+void _stats_cmd_incr_by(struct context *ctx, struct server_pool *pool, uint32_t type, stats_cmd_field_t fidx, int64_t val);
+void _stats_cmd_record(struct context *ctx, struct server_pool *pool, uint32_t type, int64_t val);
+
+void _stats_pool_hotkey(struct context *ctx, struct server_pool *pool, struct hotkey_stat *top, uint32_t ntop);
+void _stats_pool_bigkey(struct context *ctx, struct server *server, struct msg *req, uint32_t size);
 
 struct stats *stats_create(uint16_t stats_port, char *stats_ip, int stats_interval, char *source, struct array *server_pool);
 rstatus_t stats_reset_and_recover(struct context *ctx, struct stats_pool *stp_src, struct hash_table **sit);
 void stats_destroy(struct stats *stats);
-void stats_swap(struct stats *stats);
-
-void stats_aggregate_force(struct stats *stats);
 
 rstatus_t stats_pool_copy_init(struct stats_pool *stp, struct server_pool *sp, struct hash_table **sit);
 rstatus_t stats_pool_copy(struct context *ctx, struct stats_pool *stp, struct hash_table **sit);
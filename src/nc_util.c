@@ -236,6 +236,10 @@ nc_valid_port(int n)
     return true;
 }
 
+#ifdef NC_BENCH
+uint64_t nc_nalloc;     /* # malloc and realloc calls, for nc_bench */
+#endif
+
 void *
 _nc_alloc(size_t size, const char *name, int line)
 {
@@ -243,6 +247,10 @@ _nc_alloc(size_t size, const char *name, int line)
 
     ASSERT(size != 0);
 
+#ifdef NC_BENCH
+    nc_nalloc++;
+#endif
+
     p = malloc(size);
     if (p == NULL) {
         log_error("malloc(%zu) failed @ %s:%d", size, name, line);
@@ -279,6 +287,10 @@ _nc_realloc(void *ptr, size_t size, const char *name, int line)
 
     ASSERT(size != 0);
 
+#ifdef NC_BENCH
+    nc_nalloc++;
+#endif
+
     p = realloc(ptr, size);
     if (p == NULL) {
         log_error("realloc(%zu) failed @ %s:%d", size, name, line);
@@ -446,6 +458,8 @@ _nc_recvn(int sd, void *vptr, size_t n)
     return (ssize_t)(n - nleft);
 }
 
+static int64_t nc_loop_now;    /* event loop clock in usec */
+
 /*
  * Return the current time in microseconds since Epoch
  */
@@ -476,6 +490,29 @@ nc_msec_now(void)
     return nc_usec_now() / 1000LL;
 }
 
+/*
+ * Event loop clock; read once when the event backend returns a batch of
+ * events and shared by every handler dispatched from that batch. Cheap
+ * enough to stamp several points of every request, but only as precise as
+ * one loop iteration.
+ */
+void
+nc_loop_clock_update(void)
+{
+    int64_t now;
+
+    now = nc_usec_now();
+    if (now > 0) {
+        nc_loop_now = now;
+    }
+}
+
+int64_t
+nc_loop_usec(void)
+{
+    return nc_loop_now;
+}
+
 static int
 nc_resolve_inet(struct string *name, int port, struct sockinfo *si)
 {
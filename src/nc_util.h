@@ -40,6 +40,7 @@
 #define NC_INET_ADDRSTRLEN  MAX(NC_INET4_ADDRSTRLEN, NC_INET6_ADDRSTRLEN)
 #define NC_UNIX_ADDRSTRLEN  \
     (sizeof(struct sockaddr_un) - offsetof(struct sockaddr_un, sun_path))
+#define NC_ADDR_DESC_LEN    (NC_INET_ADDRSTRLEN + sizeof(":65535"))
 
 #define NC_MAXHOSTNAMELEN   256
 
@@ -122,6 +123,10 @@ void *_nc_calloc(size_t nmemb, size_t size, const char *name, int line);
 void *_nc_realloc(void *ptr, size_t size, const char *name, int line);
 void _nc_free(void *ptr, const char *name, int line);
 
+#ifdef NC_BENCH
+extern uint64_t nc_nalloc;
+#endif
+
 /*
  * Wrappers to send or receive n byte message on a blocking
  * socket descriptor.
@@ -192,6 +197,8 @@ int _scnprintf(char *buf, size_t size, const char *fmt, ...);
 int _vscnprintf(char *buf, size_t size, const char *fmt, va_list args);
 int64_t nc_usec_now(void);
 int64_t nc_msec_now(void);
+void nc_loop_clock_update(void);
+int64_t nc_loop_usec(void);
 
 /*
  * Address resolution for internet (ipv4 and ipv6) and unix domain
@@ -1526,7 +1526,7 @@ memcache_routing(struct context *ctx, struct server_pool *pool,
 {
     struct conn *s_conn;
 
-    s_conn = server_pool_conn(ctx, pool, key, keylen);
+    s_conn = server_pool_conn(ctx, pool, key, keylen, msg->lane);
 
     return s_conn;
 }
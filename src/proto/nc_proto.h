@@ -157,10 +157,12 @@ void redis_post_coalesce(struct msg *r);
 void redis_msg_size_check(struct msg *m, uint32_t limit);
 rstatus_t redis_add_auth_packet(struct context *ctx, struct conn *c_conn, struct conn *s_conn);
 rstatus_t redis_fragment(struct msg *r, uint32_t ncontinuum, struct msg_tqh *frag_msgq);
+rstatus_t redis_copy_bulk(struct msg *dst, struct msg *src);
 rstatus_t redis_reply(struct context *ctx, struct msg *r);
 void redis_post_connect(struct context *ctx, struct conn *conn, struct server *server);
 void redis_swallow_msg(struct conn *conn, struct msg *pmsg, struct msg *msg);
 struct conn *redis_routing(struct context *ctx, struct server_pool *pool, struct msg *msg, uint8_t *key, uint32_t keylen);
+struct conn *redis_replica_routing(struct context *ctx, struct server_pool *pool, struct msg *msg, struct server *exclude);
 rstatus_t redis_pre_req_forward(struct context *ctx, struct conn *conn, struct msg *msg);
 rstatus_t redis_pre_rsp_forward(struct context *ctx, struct conn *conn, struct msg *msg);
 void redis_pool_tick(struct server_pool *pool);
@@ -29,11 +29,22 @@
 
 #define NODES_INVALID "-ERR invalid server pool number for nodes command. try nodes 0\r\n"
 #define SLOTS_INVALID "-ERR invalid server pool number for slots command. try slots 0\r\n"
+#define SLOWLOG_INVALID "-ERR Unknown SLOWLOG subcommand or wrong number of arguments. Try GET, LEN, RESET\r\n"
+#define SLOWLOG_INVALID_COUNT "-ERR value is not an integer or out of range\r\n"
+#define HOTKEYS_DISABLED "-ERR hot key detection is disabled for this pool, set hotkey_max_len\r\n"
+#define SLOTSTATS_INVALID "-ERR Unknown SLOTSTATS subcommand or wrong number of arguments. Try GET, RESET\r\n"
+#define SLOTSTATS_DISABLED "-ERR slot stats are disabled for this pool, set slot_stats on a redis cluster pool\r\n"
+#define DEADLINE_INVALID "-ERR DEADLINE takes the request deadline in msec, or 0 for the pool timeout\r\n"
 
 #define AUTH_INVALID_PASSWORD "-ERR invalid password\r\n"
 #define AUTH_REQUIRE_PASSWORD "-NOAUTH Authentication required\r\n"
 #define AUTH_NO_PASSWORD "-ERR Client sent AUTH, but no password is set\r\n"
 
+#define SLOWLOG_DEFAULT_GET 10     /* # entries returned by SLOWLOG GET */
+#define SLOWLOG_REPLY_LEN   512    /* max length of one SLOWLOG GET entry */
+#define HOTKEYS_REPLY_LEN   256    /* max length of one HOTKEYS entry */
+#define SLOTSTATS_REPLY_LEN 128    /* max length of one SLOTSTATS GET entry */
+
 #define REDIS_UPDATE_TICKS (1000/NC_TICK_INTERVAL) /* 1s */
 #define REDIS_UPDATE_SERVER_PERIOD 60
 #define REDIS_CLUSTER_NODES_MESSAGE "*3\r\n$7\r\ncluster\r\n$5\r\nnodes\r\n$5\r\nextra\r\n"
@@ -56,6 +67,7 @@ redis_argz(struct msg *r)
     case MSG_REQ_REDIS_QUIT:
     case MSG_REQ_REDIS_NODE:
     case MSG_REQ_REDIS_SLOT:
+    case MSG_REQ_REDIS_HOTKEYS:
         return true;
 
     default:
@@ -280,6 +292,9 @@ redis_argx(struct msg *r)
     switch (r->type) {
     case MSG_REQ_REDIS_MGET:
     case MSG_REQ_REDIS_DEL:
+    case MSG_REQ_REDIS_SLOWLOG:
+    case MSG_REQ_REDIS_SLOTSTATS:
+    case MSG_REQ_REDIS_DEADLINE:
         return true;
 
     default:
@@ -892,6 +907,18 @@ redis_parse_req(struct msg *r)
                     break;
                 }
 
+                if (str7icmp(m, 's', 'l', 'o', 'w', 'l', 'o', 'g')) {
+                    r->type = MSG_REQ_REDIS_SLOWLOG;
+                    r->noforward = 1;
+                    break;
+                }
+
+                if (str7icmp(m, 'h', 'o', 't', 'k', 'e', 'y', 's')) {
+                    r->type = MSG_REQ_REDIS_HOTKEYS;
+                    r->noforward = 1;
+                    break;
+                }
+
                 if (str7icmp(m, 'h', 'e', 'x', 'i', 's', 't', 's')) {
                     r->type = MSG_REQ_REDIS_HEXISTS;
                     break;
@@ -970,6 +997,12 @@ redis_parse_req(struct msg *r)
                     break;
                 }
 
+                if (str8icmp(m, 'd', 'e', 'a', 'd', 'l', 'i', 'n', 'e')) {
+                    r->type = MSG_REQ_REDIS_DEADLINE;
+                    r->noforward = 1;
+                    break;
+                }
+
                 break;
 
             case 9:
@@ -998,6 +1031,12 @@ redis_parse_req(struct msg *r)
                     break;
                 }
 
+                if (str9icmp(m, 's', 'l', 'o', 't', 's', 't', 'a', 't', 's')) {
+                    r->type = MSG_REQ_REDIS_SLOTSTATS;
+                    r->noforward = 1;
+                    break;
+                }
+
                 break;
 
             case 10:
@@ -2170,7 +2209,7 @@ redis_parse_rsp(struct msg *r)
  * if dst == NULL, we just eat the bulk
  *
  * */
-static rstatus_t
+rstatus_t
 redis_copy_bulk(struct msg *dst, struct msg *src)
 {
     struct mbuf *mbuf, *nbuf;
@@ -2609,6 +2648,268 @@ redis_reply_topo(struct server_pool *pool, struct msg *response)
     return msg_prepend_format(response, "*%d\r\n", count);
 }
 
+/*
+ * Append one slowlog entry in the shape of a redis SLOWLOG GET entry:
+ * id, unix time, duration in usec, [command, key], client address, and
+ * then the proxy specific server address, request and response length.
+ * Keys longer than SLOWLOG_KEY_LEN are truncated the way redis truncates
+ * long arguments.
+ */
+static rstatus_t
+redis_reply_slowlog_entry(struct msg *response, struct slowlog_entry *e)
+{
+    char buf[SLOWLOG_REPLY_LEN];
+    char cmd[32];
+    char more[32];
+    int n, cmdlen, morelen;
+    uint32_t klen;
+
+    cmdlen = slowlog_cmd_name(e->type, cmd, sizeof(cmd));
+    klen = MIN(e->key_len, SLOWLOG_KEY_LEN);
+    morelen = 0;
+    if (e->key_len > SLOWLOG_KEY_LEN) {
+        morelen = nc_scnprintf(more, sizeof(more), "... (%"PRIu32" more bytes)",
+                               e->key_len - SLOWLOG_KEY_LEN);
+    }
+
+    n = nc_scnprintf(buf, sizeof(buf), "*8\r\n:%"PRIu64"\r\n:%"PRId64"\r\n"
+                     ":%"PRId64"\r\n*%d\r\n$%d\r\n%s\r\n", e->id,
+                     e->start / 1000000, e->duration, e->key_len ? 2 : 1,
+                     cmdlen, cmd);
+    if (e->key_len != 0) {
+        n += nc_scnprintf(buf + n, sizeof(buf) - (size_t)n, "$%d\r\n",
+                          (int)klen + morelen);
+        nc_memcpy(buf + n, e->key, klen);
+        n += (int)klen;
+        n += nc_scnprintf(buf + n, sizeof(buf) - (size_t)n, "%.*s\r\n",
+                          morelen, more);
+    }
+    n += nc_scnprintf(buf + n, sizeof(buf) - (size_t)n, "$%d\r\n%s\r\n$%d\r\n%s\r\n"
+                      ":%"PRIu32"\r\n:%"PRIu32"\r\n",
+                      (int)nc_strlen(e->client), e->client,
+                      (int)nc_strlen(e->server), e->server,
+                      e->req_len, e->rsp_len);
+
+    return msg_append(response, (uint8_t *)buf, (size_t)n);
+}
+
+/*
+ * SLOWLOG GET [count] | LEN | RESET, answered from the ring of the pool
+ * the client is connected to
+ */
+static rstatus_t
+redis_reply_slowlog(struct server_pool *pool, struct msg *r, struct msg *response)
+{
+    rstatus_t status;
+    struct slowlog *sl = &pool->slowlog_ring;
+    struct slowlog_entry *e;
+    struct keypos *kpos;
+    uint32_t nkey, klen, i, n;
+    char buf[32];
+    int count, len;
+
+    nkey = array_n(r->keys);
+    kpos = array_get(r->keys, 0);
+    klen = (uint32_t)(kpos->end - kpos->start);
+
+    if (nkey == 1 && klen == 3 && str3icmp(kpos->start, 'l', 'e', 'n')) {
+        len = nc_scnprintf(buf, sizeof(buf), ":%"PRIu32"\r\n", slowlog_len(sl));
+        return msg_append(response, (uint8_t *)buf, (size_t)len);
+    }
+
+    if (nkey == 1 && klen == 5 &&
+        str5icmp(kpos->start, 'r', 'e', 's', 'e', 't')) {
+        slowlog_reset(sl);
+        return msg_append(response, (uint8_t *)REPL_OK, nc_strlen(REPL_OK));
+    }
+
+    if (nkey > 2 || klen != 3 || !str3icmp(kpos->start, 'g', 'e', 't')) {
+        return msg_append(response, (uint8_t *)SLOWLOG_INVALID,
+                          nc_strlen(SLOWLOG_INVALID));
+    }
+
+    n = slowlog_len(sl);
+    if (nkey == 2) {
+        kpos = array_get(r->keys, 1);
+        klen = (uint32_t)(kpos->end - kpos->start);
+        count = nc_atoi(kpos->start, klen);
+        if (count < 0) {
+            return msg_append(response, (uint8_t *)SLOWLOG_INVALID_COUNT,
+                              nc_strlen(SLOWLOG_INVALID_COUNT));
+        }
+    } else {
+        count = SLOWLOG_DEFAULT_GET;
+    }
+    n = MIN(n, (uint32_t)count);
+
+    len = nc_scnprintf(buf, sizeof(buf), "*%"PRIu32"\r\n", n);
+    status = msg_append(response, (uint8_t *)buf, (size_t)len);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    for (i = 0; i < n; i++) {
+        e = slowlog_get(sl, i);
+        status = redis_reply_slowlog_entry(response, e);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    return NC_OK;
+}
+
+/*
+ * HOTKEYS, answered from the last closed window of the pool the client is
+ * connected to. Every entry is key, estimated count, its overestimation
+ * bound and the rate in requests per sec, busiest key first. Keys longer
+ * than HOTKEY_KEY_LEN are truncated like in SLOWLOG GET.
+ */
+static rstatus_t
+redis_reply_hotkeys(struct server_pool *pool, struct msg *response)
+{
+    rstatus_t status;
+    struct hotkey *hk = pool->hotkey;
+    uint32_t i, klen;
+    char buf[HOTKEYS_REPLY_LEN];
+    char more[32];
+    int n, morelen;
+
+    if (hk == NULL) {
+        return msg_append(response, (uint8_t *)HOTKEYS_DISABLED,
+                          nc_strlen(HOTKEYS_DISABLED));
+    }
+
+    n = nc_scnprintf(buf, sizeof(buf), "*%"PRIu32"\r\n", hk->ntop);
+    status = msg_append(response, (uint8_t *)buf, (size_t)n);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    for (i = 0; i < hk->ntop; i++) {
+        struct hotkey_stat *hs = &hk->top[i];
+
+        klen = MIN(hs->key_len, HOTKEY_KEY_LEN);
+        morelen = 0;
+        if (hs->key_len > HOTKEY_KEY_LEN) {
+            morelen = nc_scnprintf(more, sizeof(more),
+                                   "... (%"PRIu32" more bytes)",
+                                   hs->key_len - HOTKEY_KEY_LEN);
+        }
+
+        n = nc_scnprintf(buf, sizeof(buf), "*4\r\n$%d\r\n",
+                         (int)klen + morelen);
+        nc_memcpy(buf + n, hs->key, klen);
+        n += (int)klen;
+        n += nc_scnprintf(buf + n, sizeof(buf) - (size_t)n, "%.*s\r\n"
+                          ":%"PRIu64"\r\n:%"PRIu64"\r\n:%"PRIu64"\r\n",
+                          morelen, more, hs->count, hs->error, hs->rate);
+
+        status = msg_append(response, (uint8_t *)buf, (size_t)n);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    return NC_OK;
+}
+
+/*
+ * SLOTSTATS GET | RESET on the pool the client is connected to. GET is a
+ * sparse dump: the unix time of the last reset, then one [slot, reads,
+ * writes, read bytes, write bytes] entry per slot that saw traffic, so an
+ * idle or partly used cluster costs a few entries rather than 16384
+ */
+static rstatus_t
+redis_reply_slotstats(struct server_pool *pool, struct msg *r,
+                      struct msg *response)
+{
+    rstatus_t status;
+    struct keypos *kpos;
+    uint32_t klen, i, n;
+    char buf[SLOTSTATS_REPLY_LEN];
+    int len;
+
+    if (pool->slot_stat == NULL) {
+        return msg_append(response, (uint8_t *)SLOTSTATS_DISABLED,
+                          nc_strlen(SLOTSTATS_DISABLED));
+    }
+
+    kpos = array_get(r->keys, 0);
+    klen = (uint32_t)(kpos->end - kpos->start);
+
+    if (array_n(r->keys) == 1 && klen == 5 &&
+        str5icmp(kpos->start, 'r', 'e', 's', 'e', 't')) {
+        server_pool_slot_reset(pool);
+        return msg_append(response, (uint8_t *)REPL_OK, nc_strlen(REPL_OK));
+    }
+
+    if (array_n(r->keys) != 1 || klen != 3 ||
+        !str3icmp(kpos->start, 'g', 'e', 't')) {
+        return msg_append(response, (uint8_t *)SLOTSTATS_INVALID,
+                          nc_strlen(SLOTSTATS_INVALID));
+    }
+
+    for (n = 0, i = 0; i < REDIS_CLUSTER_SLOTS; i++) {
+        if (pool->slot_stat[i].reads != 0 || pool->slot_stat[i].writes != 0) {
+            n++;
+        }
+    }
+
+    len = nc_scnprintf(buf, sizeof(buf), "*%"PRIu32"\r\n:%"PRId64"\r\n",
+                       n + 1, pool->slot_stat_since / 1000000);
+    status = msg_append(response, (uint8_t *)buf, (size_t)len);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    for (i = 0; i < REDIS_CLUSTER_SLOTS; i++) {
+        struct slot_stat *ss = &pool->slot_stat[i];
+
+        if (ss->reads == 0 && ss->writes == 0) {
+            continue;
+        }
+
+        len = nc_scnprintf(buf, sizeof(buf), "*5\r\n:%"PRIu32"\r\n"
+                           ":%"PRIu32"\r\n:%"PRIu32"\r\n:%"PRIu64"\r\n"
+                           ":%"PRIu64"\r\n", i, ss->reads, ss->writes,
+                           ss->read_bytes, ss->write_bytes);
+        status = msg_append(response, (uint8_t *)buf, (size_t)len);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    return NC_OK;
+}
+
+/*
+ * DEADLINE msec sets the deadline of the requests of the client connection,
+ * in place of the pool timeout: a request still unsent msec after it was
+ * received fails with a timeout instead. DEADLINE 0 goes back to the pool
+ * timeout
+ */
+static rstatus_t
+redis_reply_deadline(struct conn *c_conn, struct msg *r, struct msg *response)
+{
+    struct keypos *kpos;
+    uint32_t klen;
+    int msec;
+
+    kpos = array_get(r->keys, 0);
+    klen = (uint32_t)(kpos->end - kpos->start);
+    msec = nc_atoi(kpos->start, klen);
+
+    if (array_n(r->keys) != 1 || msec < 0) {
+        return msg_append(response, (uint8_t *)DEADLINE_INVALID,
+                          nc_strlen(DEADLINE_INVALID));
+    }
+
+    c_conn->deadline = (uint32_t)msec;
+
+    return msg_append(response, (uint8_t *)REPL_OK, nc_strlen(REPL_OK));
+}
+
 rstatus_t
 redis_reply(struct context *ctx, struct msg *r)
 {
@@ -2673,6 +2974,14 @@ redis_reply(struct context *ctx, struct msg *r)
             pool = array_get(&ctx->pool, pidx);
             return redis_reply_topo(pool, response);
         }
+    case MSG_REQ_REDIS_SLOWLOG:
+        return redis_reply_slowlog(c_conn->owner, r, response);
+    case MSG_REQ_REDIS_HOTKEYS:
+        return redis_reply_hotkeys(c_conn->owner, response);
+    case MSG_REQ_REDIS_SLOTSTATS:
+        return redis_reply_slotstats(c_conn->owner, r, response);
+    case MSG_REQ_REDIS_DEADLINE:
+        return redis_reply_deadline(c_conn, r, response);
 
     default:
         NOT_REACHED();
@@ -2751,6 +3060,9 @@ redis_post_coalesce(struct msg *r)
 
     ASSERT(!pr->request);
     ASSERT(r->request && (r->frag_owner == r));
+
+    NC_PROBE4(coalesce, r->id, r->type, r->nfrag, pr->mlen);
+
     if (r->error || r->ferror) {
         /* do nothing, if msg is in error */
         return;
@@ -2929,6 +3241,88 @@ redis_swallow_msg(struct conn *conn, struct msg *pmsg, struct msg *msg)
     }
 }
 
+/*
+ * Pick a random live replica of slot idx other than exclude, from the first
+ * tag tier that has one. Returns NULL if there is none.
+ */
+static struct server *
+redis_read_server(struct server_pool *pool, uint32_t idx, int64_t now,
+                  struct server *exclude)
+{
+    uint32_t i, n;
+    struct array *slaves;
+    struct array *live_slaves;
+    struct server **ps;
+    struct server *server = NULL;
+    struct server *live_server = NULL;
+    int count;
+    int index;
+
+    for (i = 0; i < NC_MAXTAGNUM; i++) {
+        slaves = &pool->slots[idx]->tagged_servers[i];
+        if (slaves == NULL) {
+            log_warn("no accessible tagged_servers found in slot %d", idx);
+            return NULL;
+        }
+
+        index = 0;
+        count = array_n(slaves);
+        if (count == 0) {
+            continue;
+        }
+
+        live_slaves = array_create(10, sizeof(struct server *));
+        if (live_slaves == NULL) {
+            log_warn("array_create failed!");
+            return NULL;
+        }
+
+        while (index < count) {
+            live_server = *(struct server**)array_get(slaves, index);
+            index++;
+            if (live_server == NULL) {
+                log_warn("get server failed from tagged_servers");
+                continue;
+            }
+
+            if (live_server == exclude || live_server->health_demoted) {
+                continue;
+            }
+
+            if (live_server->auto_ban_flag) {
+                if (live_server->lift_ban_time > now) {
+                    log_warn("'%.*s'(read) ever disconnected, don't cost ban period, skip this slave!", live_server->pname.len, live_server->pname.data);
+                    continue;
+                } else {
+                    log_warn("'%.*s'(read) ever disconnected, cost ban period, pick up it to live slaves!", live_server->pname.len, live_server->pname.data);
+                    live_server->auto_ban_flag = false;
+                    live_server->lift_ban_time = 0LL;
+                    ps = array_push(live_slaves);
+                    *ps = live_server;
+                }
+            } else {
+                live_server->auto_ban_flag = false;
+                live_server->lift_ban_time = 0LL;
+                ps = array_push(live_slaves);
+                *ps = live_server;
+            }
+        }
+
+        if (array_n(live_slaves) == 0) {
+            live_server = NULL;
+            array_destroy(live_slaves);
+            continue;
+        } 
+        n = random() % array_n(live_slaves);
+        server = *(struct server**)array_get(live_slaves, n);
+        live_slaves->nelem = 0;
+        array_destroy(live_slaves);
+        break;
+    }
+
+    return server;
+}
+
 struct conn *
 redis_routing(struct context *ctx, struct server_pool *pool, 
               struct msg *msg, uint8_t *key, uint32_t keylen)
@@ -2936,12 +3330,13 @@ redis_routing(struct context *ctx, struct server_pool *pool,
     struct conn *s_conn;
 
     if (pool->rediscluster) {
-        uint32_t i, idx;
+        uint32_t idx;
         rstatus_t status;
         struct server *server = NULL;
         int64_t now;
 
         idx = server_pool_hash(pool, key, keylen) % REDIS_CLUSTER_SLOTS;
+        msg->slot = idx + 1;
 
         if (pool->slots[idx] == NULL) {
             log_debug(LOG_WARN, "no accessible server found in slot %d for key '%.*s'", 
@@ -2973,69 +3368,8 @@ redis_routing(struct context *ctx, struct server_pool *pool,
         } else {
             uint32_t n;
             struct array *slaves;
-            struct array *live_slaves;
-            struct server **ps;
-            struct server *live_server = NULL;
-            int count;
-            int index;
-
-            for (i = 0; i < NC_MAXTAGNUM; i++) {
-                slaves = &pool->slots[idx]->tagged_servers[i];
-                if (slaves == NULL) {
-                    log_warn("no accessible tagged_servers found in slot %d", idx);
-                    return NULL;
-                }
 
-                index = 0;
-                count = array_n(slaves);
-                if (count == 0) {
-                    continue;
-                }
-
-                live_slaves = array_create(10, sizeof(struct server *));
-                if (live_slaves == NULL) {
-                    log_warn("array_create failed!");
-                    return NULL;
-                }
-
-                while (index < count) {
-                    live_server = *(struct server**)array_get(slaves, index);
-                    index++;
-                    if (live_server == NULL) {
-                        log_warn("get server failed from tagged_servers");
-                        continue;
-                    }
-
-                    if (live_server->auto_ban_flag) {
-                        if (live_server->lift_ban_time > now) {
-                            log_warn("'%.*s'(read) ever disconnected, don't cost ban period, skip this slave!", live_server->pname.len, live_server->pname.data);
-                            continue;
-                        } else {
-                            log_warn("'%.*s'(read) ever disconnected, cost ban period, pick up it to live slaves!", live_server->pname.len, live_server->pname.data);
-                            live_server->auto_ban_flag = false;
-                            live_server->lift_ban_time = 0LL;
-                            ps = array_push(live_slaves);
-                            *ps = live_server;
-                        }
-                    } else {
-                        live_server->auto_ban_flag = false;
-                        live_server->lift_ban_time = 0LL;
-                        ps = array_push(live_slaves);
-                        *ps = live_server;
-                    }
-                }
-
-                if (array_n(live_slaves) == 0) {
-                    live_server = NULL;
-                    array_destroy(live_slaves);
-                    continue;
-                } 
-                n = random() % array_n(live_slaves);
-                server = *(struct server**)array_get(live_slaves, n);
-                live_slaves->nelem = 0;
-                array_destroy(live_slaves);
-                break;
-            }
+            server = redis_read_server(pool, idx, now, NULL);
 
             if (server == NULL) {
                 log_warn("all slaves are banned, random one from local region!");
@@ -3056,8 +3390,8 @@ redis_routing(struct context *ctx, struct server_pool *pool,
         log_debug(LOG_VERB, "key '%.*s' maps to server '%.*s' in slot %d",
                  keylen, key, server->pname.len, server->pname.data, idx);
 
-        /* pick a connection to the given server */
-        s_conn = server_conn(server);
+        /* pick a connection of the lane to the given server */
+        s_conn = server_lane_conn(server, msg->lane);
         if (s_conn == NULL) {
             return NULL;
         }
@@ -3067,8 +3401,58 @@ redis_routing(struct context *ctx, struct server_pool *pool,
             server_close(ctx, s_conn);
             return NULL;
         }
+
+        /* only requests that go out count, as only those get a response */
+        if (pool->slot_stat != NULL) {
+            server_pool_slot_request(pool, msg, idx);
+        }
     } else {
-        s_conn = server_pool_conn(ctx, pool, key, keylen);
+        s_conn = server_pool_conn(ctx, pool, key, keylen, msg->lane);
+    }
+
+    return s_conn;
+}
+
+/*
+ * Route read msg, already sent to server exclude, to another replica of its
+ * slot in the same or a following tag tier, for a hedge or a retry. Returns
+ * NULL if the slot has no other live replica.
+ */
+struct conn *
+redis_replica_routing(struct context *ctx, struct server_pool *pool,
+                      struct msg *msg, struct server *exclude)
+{
+    rstatus_t status;
+    struct server *server;
+    struct conn *s_conn;
+    uint32_t idx;
+
+    if (!pool->rediscluster || msg->slot == 0) {
+        return NULL;
+    }
+
+    idx = msg->slot - 1;
+    if (pool->slots[idx] == NULL) {
+        return NULL;
+    }
+
+    server = redis_read_server(pool, idx, nc_msec_now(), exclude);
+    if (server == NULL) {
+        return NULL;
+    }
+
+    log_debug(LOG_VERB, "req %"PRIu64" in slot %d to other server '%.*s'",
+              msg->id, idx, server->pname.len, server->pname.data);
+
+    s_conn = server_lane_conn(server, msg->lane);
+    if (s_conn == NULL) {
+        return NULL;
+    }
+
+    status = server_connect(ctx, server, s_conn);
+    if (status != NC_OK) {
+        server_close(ctx, s_conn);
+        return NULL;
     }
 
     return s_conn;
@@ -3113,84 +3497,6 @@ redis_pre_req_forward(struct context *ctx, struct conn *conn, struct msg *msg)
 
     stats_pool_incr(ctx, pool, total_requests);
 
-    switch(msg->type) {
-    case MSG_REQ_REDIS_GET:
-         stats_pool_incr(ctx, pool, redis_req_get);
-         break;
-    case MSG_REQ_REDIS_SET:
-         stats_pool_incr(ctx, pool, redis_req_set);
-         break;
-    case MSG_REQ_REDIS_DEL:
-         stats_pool_incr(ctx, pool, redis_req_del);
-         break;
-    case MSG_REQ_REDIS_INCR:
-    case MSG_REQ_REDIS_DECR:
-         stats_pool_incr(ctx, pool, redis_req_incr_decr);
-         break;
-    case MSG_REQ_REDIS_MGET:
-         stats_pool_incr(ctx, pool, redis_req_mget);
-         break;
-    case MSG_REQ_REDIS_MSET:
-         stats_pool_incr(ctx, pool, redis_req_mset);
-         break;
-    case MSG_REQ_REDIS_SORT:
-         stats_pool_incr(ctx, pool, redis_req_sort);
-         break;
-    case MSG_REQ_REDIS_LREM:
-          stats_pool_incr(ctx, pool, redis_req_lrem);
-          /* do not break as this is a list operation as the following.
-           * We count twice the LREM because it is an intensive operation/
-           *  */
-    case MSG_REQ_REDIS_LRANGE:
-    case MSG_REQ_REDIS_LSET:
-    case MSG_REQ_REDIS_LTRIM:
-    case MSG_REQ_REDIS_LINDEX:
-    case MSG_REQ_REDIS_LPUSHX:
-         stats_pool_incr(ctx, pool, redis_req_lists);
-         break;
-    case MSG_REQ_REDIS_SUNION:
-         stats_pool_incr(ctx, pool, redis_req_sunion);
-         /* do not break as this is a set operation as the following.
-          * We count twice the SUNION because it is an intensive operation/
-          *  */
-    case MSG_REQ_REDIS_SETBIT:
-    case MSG_REQ_REDIS_SETEX:
-    case MSG_REQ_REDIS_SETRANGE:
-    case MSG_REQ_REDIS_SADD:
-    case MSG_REQ_REDIS_SDIFF:
-    case MSG_REQ_REDIS_SDIFFSTORE:
-    case MSG_REQ_REDIS_SINTER:
-    case MSG_REQ_REDIS_SINTERSTORE:
-    case MSG_REQ_REDIS_SREM:
-    case MSG_REQ_REDIS_SUNIONSTORE:
-    case MSG_REQ_REDIS_SSCAN:
-        stats_pool_incr(ctx, pool, redis_req_sets);
-        break;
-    case MSG_REQ_REDIS_ZADD:
-    case MSG_REQ_REDIS_ZINTERSTORE:
-    case MSG_REQ_REDIS_ZRANGE:
-    case MSG_REQ_REDIS_ZRANGEBYSCORE:
-    case MSG_REQ_REDIS_ZREM:
-    case MSG_REQ_REDIS_ZREVRANGE:
-    case MSG_REQ_REDIS_ZREVRANGEBYSCORE:
-    case MSG_REQ_REDIS_ZUNIONSTORE:
-    case MSG_REQ_REDIS_ZSCAN:
-    case MSG_REQ_REDIS_ZCOUNT:
-    case MSG_REQ_REDIS_ZINCRBY:
-    case MSG_REQ_REDIS_ZREMRANGEBYRANK:
-    case MSG_REQ_REDIS_ZREMRANGEBYSCORE:
-        stats_pool_incr(ctx, pool, redis_req_sortedsets);
-        break;
-    case MSG_REQ_REDIS_HINCRBY:
-    case MSG_REQ_REDIS_HINCRBYFLOAT:
-    case MSG_REQ_REDIS_HSET:
-    case MSG_REQ_REDIS_HSETNX:
-        stats_pool_incr(ctx, pool, redis_req_hashs);
-        break;
-    default:
-        stats_pool_incr(ctx, pool, redis_req_other);
-        break;
-    }
     return NC_OK;
 }
 
@@ -3223,6 +3529,7 @@ redis_pre_rsp_forward(struct context *ctx, struct conn * s_conn, struct msg *msg
             mbuf->pos = mbuf->start;
         }
         pmsg->peer = NULL;
+        pmsg->nobatch = 1;
 
         /* fetch server conn */
         len = (size_t)(msg->val_end - msg->val_start);
@@ -3234,7 +3541,7 @@ redis_pre_rsp_forward(struct context *ctx, struct conn * s_conn, struct msg *msg
             goto ferror;
         }
 
-        s_conn = server_conn(server);
+        s_conn = server_lane_conn(server, pmsg->lane);
         if (s_conn == NULL) goto ferror;
 
         status = server_connect(pool->ctx, server, s_conn);
@@ -3505,7 +3812,6 @@ redis_pool_tick(struct server_pool *pool)
         int64_t now;
 
         struct context *ctx = pool->ctx;
-        struct stats *st = ctx->stats;
         struct stats_pool stats_pool;
         struct hash_table *server_idx_table;
         uint8_t *hashkey;
@@ -3532,14 +3838,14 @@ redis_pool_tick(struct server_pool *pool)
                 *se = *s;
             }
         }
+        nearcache_servers_update(pool);
+
         n = array_n(&pool->server);
         while (n--) {
             s = array_get(&pool->server, n);
             server_conn_close(ctx, *s);
         }
 
-        stats_aggregate_force(st);
-
         status = stats_pool_copy_init(&stats_pool, pool, &server_idx_table);
         if (status != NC_OK) {
             log_warn("stats_pool_copy_init failed");
@@ -3597,6 +3903,8 @@ redis_pool_tick(struct server_pool *pool)
             stats_pool_set_ts(ctx, pool, servers_update_at, now);
         }
         pool->first_update = 1;
+
+        NC_PROBE2(servers__update, pool->name.data, array_n(&pool->server));
     }
 
     /* dont update slot when server has not been updated */
@@ -3613,5 +3921,7 @@ redis_pool_tick(struct server_pool *pool)
         debug_slots(pool, LOG_VERB);
 
         pool->ffi_slots_update = 0;
+
+        NC_PROBE1(slots__update, pool->name.data);
     }
 }